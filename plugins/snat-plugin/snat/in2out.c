@@ -57,7 +57,8 @@ _(UNSUPPORTED_PROTOCOL, "Unsupported protocol")         \
 _(IN2OUT_PACKETS, "Good in2out packets processed")      \
 _(OUT_OF_PORTS, "Out of ports")                         \
 _(BAD_OUTSIDE_FIB, "Outside VRF ID not found")          \
-_(BAD_ICMP_TYPE, "icmp type not echo-request")
+_(BAD_ICMP_TYPE, "icmp type not echo-request")         \
+_(HANDOFF_CONGESTED, "Owner thread frame queue full")
   
 typedef enum {
 #define _(sym,str) SNAT_IN2OUT_ERROR_##sym,
@@ -86,8 +87,11 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
                       snat_session_key_t * key0,
                       snat_session_t ** sessionp,
                       vlib_node_runtime_t * node,
-                      u32 next0)
+                      u32 next0,
+                      u32 cpu_index,
+                      f64 now)
 {
+  snat_main_per_thread_data_t * tsm = &sm->per_thread_data[cpu_index];
   snat_user_t *u;
   snat_user_key_t user_key;
   snat_session_t *s;
@@ -115,103 +119,109 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
   kv0.key = user_key.as_u64;
   
   /* Ever heard of the "user" = src ip4 address before? */
-  if (clib_bihash_search_8_8 (&sm->user_hash, &kv0, &value0))
+  if (clib_bihash_search_8_8 (&tsm->user_hash, &kv0, &value0))
     {
       /* no, make a new one */
-      pool_get (sm->users, u);
+      pool_get (tsm->users, u);
       memset (u, 0, sizeof (*u));
       u->addr = ip0->src_address;
+      u->fib_index = rx_fib_index0;
 
-      pool_get (sm->list_pool, per_user_list_head_elt);
+      pool_get (tsm->list_pool, per_user_list_head_elt);
 
       u->sessions_per_user_list_head_index = per_user_list_head_elt -
-        sm->list_pool;
+        tsm->list_pool;
 
-      clib_dlist_init (sm->list_pool, u->sessions_per_user_list_head_index);
+      clib_dlist_init (tsm->list_pool, u->sessions_per_user_list_head_index);
       
-      kv0.value = u - sm->users;
+      kv0.value = u - tsm->users;
       
       /* add user */
-      clib_bihash_add_del_8_8 (&sm->user_hash, &kv0, 1 /* is_add */);
+      clib_bihash_add_del_8_8 (&tsm->user_hash, &kv0, 1 /* is_add */);
     }
   else
     {
-      u = pool_elt_at_index (sm->users, value0.value);
+      u = pool_elt_at_index (tsm->users, value0.value);
     }
 
+  /* Deterministic allocation probes the out2in table with full keys */
+  key1.protocol = key0->protocol;
+  key1.fib_index = outside_fib_index;
+
   /* Over quota? Recycle the least recently used translation */
   if (u->nsessions >= sm->max_translations_per_user)
     {
       /* Remove the oldest translation */
       oldest_per_user_translation_list_index = 
         clib_dlist_remove_head 
-        (sm->list_pool, u->sessions_per_user_list_head_index);
+        (tsm->list_pool, u->sessions_per_user_list_head_index);
 
       ASSERT (oldest_per_user_translation_list_index != ~0);
 
       /* add it back to the end of the LRU list */
-      clib_dlist_addtail (sm->list_pool, u->sessions_per_user_list_head_index,
+      clib_dlist_addtail (tsm->list_pool, u->sessions_per_user_list_head_index,
                           oldest_per_user_translation_list_index);
 
       /* Get the list element */
       oldest_per_user_translation_list_elt = 
-        pool_elt_at_index (sm->list_pool, 
+        pool_elt_at_index (tsm->list_pool, 
                            oldest_per_user_translation_list_index);
       
       /* Get the session index from the list element */
       session_index = oldest_per_user_translation_list_elt->value;
 
       /* Get the session */
-      s = pool_elt_at_index (sm->sessions, session_index);
+      s = pool_elt_at_index (tsm->sessions, session_index);
 
       /* Remove in2out, out2in keys */
       kv0.key = s->in2out.as_u64;
-      if (clib_bihash_add_del_8_8 (&sm->in2out, &kv0, 0 /* is_add */))
+      if (clib_bihash_add_del_8_8 (&tsm->in2out, &kv0, 0 /* is_add */))
           clib_warning ("in2out key delete failed");
       kv0.key = s->out2in.as_u64;
-      if (clib_bihash_add_del_8_8 (&sm->out2in, &kv0, 0 /* is_add */))
+      if (clib_bihash_add_del_8_8 (&tsm->out2in, &kv0, 0 /* is_add */))
           clib_warning ("out2in key delete failed");
 
-      snat_free_outside_address_and_port 
-        (sm, &s->out2in, s->outside_address_index);
+      snat_log_session (sm, cpu_index, s, SNAT_IPFIX_NAT44_SESSION_DELETE);
+
+      snat_user_free_port (sm, cpu_index, u, &s->out2in,
+                           s->outside_address_index);
       s->outside_address_index = ~0;
 
-      if (snat_alloc_outside_address_and_port (sm, &key1, &address_index))
+      if (snat_user_alloc_port (sm, cpu_index, u, key0, &key1,
+                                &address_index))
         {
-          ASSERT(0);
-
           b0->error = node->errors[SNAT_IN2OUT_ERROR_OUT_OF_PORTS];
           return SNAT_IN2OUT_NEXT_DROP;
         }
       s->outside_address_index = address_index;
+      s->flags &= ~SNAT_SESSION_TCP_STATE;
     }
   else
     {
-      if (snat_alloc_outside_address_and_port (sm, &key1, &address_index))
+      if (snat_user_alloc_port (sm, cpu_index, u, key0, &key1,
+                                &address_index))
         {
-          ASSERT(0);
-
           b0->error = node->errors[SNAT_IN2OUT_ERROR_OUT_OF_PORTS];
           return SNAT_IN2OUT_NEXT_DROP;
         }
 
       /* Create a new session */
-      pool_get (sm->sessions, s);
+      pool_get (tsm->sessions, s);
       memset (s, 0, sizeof (*s));
       
       s->outside_address_index = address_index;
 
       /* Create list elts */
-      pool_get (sm->list_pool, per_user_translation_list_elt);
-      clib_dlist_init (sm->list_pool, per_user_translation_list_elt -
-                       sm->list_pool);
+      pool_get (tsm->list_pool, per_user_translation_list_elt);
+      clib_dlist_init (tsm->list_pool, per_user_translation_list_elt -
+                       tsm->list_pool);
       
-      per_user_translation_list_elt->value = s - sm->sessions;
-      s->per_user_index = per_user_translation_list_elt - sm->list_pool;
+      per_user_translation_list_elt->value = s - tsm->sessions;
+      s->per_user_index = per_user_translation_list_elt - tsm->list_pool;
       s->per_user_list_head_index = u->sessions_per_user_list_head_index;
       
-      clib_dlist_addtail (sm->list_pool, s->per_user_list_head_index,
-                          per_user_translation_list_elt - sm->list_pool);
+      clib_dlist_addtail (tsm->list_pool, s->per_user_list_head_index,
+                          per_user_translation_list_elt - tsm->list_pool);
       u->nsessions++;
     }
   
@@ -221,16 +231,19 @@ static u32 slow_path (snat_main_t *sm, vlib_buffer_t *b0,
   s->out2in.fib_index = outside_fib_index;
   *sessionp = s;
 
+  snat_session_timer_start (sm, tsm, s, now);
+  snat_log_session (sm, cpu_index, s, SNAT_IPFIX_NAT44_SESSION_CREATE);
+
   /* Add to translation hashes */
   kv0.key = s->in2out.as_u64;
-  kv0.value = s - sm->sessions;
-  if (clib_bihash_add_del_8_8 (&sm->in2out, &kv0, 1 /* is_add */))
+  kv0.value = s - tsm->sessions;
+  if (clib_bihash_add_del_8_8 (&tsm->in2out, &kv0, 1 /* is_add */))
       clib_warning ("in2out key add failed");
   
   kv0.key = s->out2in.as_u64;
-  kv0.value = s - sm->sessions;
+  kv0.value = s - tsm->sessions;
   
-  if (clib_bihash_add_del_8_8 (&sm->out2in, &kv0, 1 /* is_add */))
+  if (clib_bihash_add_del_8_8 (&tsm->out2in, &kv0, 1 /* is_add */))
       clib_warning ("out2in key add failed");
 
   return next0;
@@ -244,8 +257,10 @@ static inline u32 icmp_in2out_slow_path (snat_main_t *sm,
                                          u32 rx_fib_index0,
                                          vlib_node_runtime_t * node,
                                          u32 next0,
-                                         f64 now)
+                                         f64 now,
+                                         u32 cpu_index)
 {
+  snat_main_per_thread_data_t * tsm = &sm->per_thread_data[cpu_index];
   snat_session_key_t key0;
   icmp_echo_header_t *echo0;
   clib_bihash_kv_8_8_t kv0, value0;
@@ -270,7 +285,7 @@ static inline u32 icmp_in2out_slow_path (snat_main_t *sm,
   
   kv0.key = key0.as_u64;
   
-  if (clib_bihash_search_8_8 (&sm->in2out, &kv0, &value0))
+  if (clib_bihash_search_8_8 (&tsm->in2out, &kv0, &value0))
     {
       ip4_address_t * first_int_addr;
 
@@ -289,13 +304,13 @@ static inline u32 icmp_in2out_slow_path (snat_main_t *sm,
         return next0;
       
       next0 = slow_path (sm, b0, ip0, rx_fib_index0, &key0,
-                         &s0, node, next0);
+                         &s0, node, next0, cpu_index, now);
       
       if (PREDICT_FALSE (next0 == SNAT_IN2OUT_NEXT_DROP))
         return next0;
     }
   else
-    s0 = pool_elt_at_index (sm->sessions, value0.value);
+    s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
   old_addr0 = ip0->src_address.as_u32;
   ip0->src_address = s0->out2in.addr;
@@ -321,8 +336,8 @@ static inline u32 icmp_in2out_slow_path (snat_main_t *sm,
   s0->last_heard = now;
   s0->total_pkts++;
   s0->total_bytes += vlib_buffer_length_in_chain (sm->vlib_main, b0);
-  clib_dlist_remove (sm->list_pool, s0->per_user_index);
-  clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+  clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+  clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                       s0->per_user_index);
 
   return next0;
@@ -340,6 +355,8 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
   snat_runtime_t * rt = (snat_runtime_t *)node->runtime_data;
   f64 now = vlib_time_now (vm);
   u32 stats_node_index;
+  u32 cpu_index = os_get_cpu_number ();
+  snat_main_per_thread_data_t * tsm = &sm->per_thread_data[cpu_index];
 
   stats_node_index = is_slow_path ? snat_in2out_slowpath_node.index :
     snat_in2out_node.index;
@@ -348,6 +365,17 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
   n_left_from = frame->n_vectors;
   next_index = node->cached_next_index;
 
+  /* Users are owned by workers; the slow path only sees owned packets */
+  if (!is_slow_path)
+    {
+      if (sm->num_workers)
+        n_left_from = snat_worker_handoff
+          (vm, node, from, n_left_from, 1 /* is_in2out */,
+           SNAT_IN2OUT_ERROR_HANDOFF_CONGESTED);
+      snat_maybe_expire_sessions (sm, tsm, cpu_index, now);
+      snat_ipfix_logging_maybe_flush (vm, cpu_index, now);
+    }
+
   while (n_left_from > 0)
     {
       u32 n_left_to_next;
@@ -436,7 +464,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 {
                   next0 = icmp_in2out_slow_path 
                     (sm, b0, ip0, icmp0, sw_if_index0, rx_fib_index0, 
-                     node, next0, now);
+                     node, next0, now, cpu_index);
                   goto trace00;
                 }
             }
@@ -456,7 +484,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
           
           kv0.key = key0.as_u64;
 
-          if (PREDICT_FALSE (clib_bihash_search_8_8 (&sm->in2out, &kv0, &value0) != 0))
+          if (PREDICT_FALSE (clib_bihash_search_8_8 (&tsm->in2out, &kv0, &value0) != 0))
             {
               if (is_slow_path)
                 {
@@ -477,7 +505,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                     goto trace00;
                   
                   next0 = slow_path (sm, b0, ip0, rx_fib_index0, &key0,
-                                     &s0, node, next0);
+                                     &s0, node, next0, cpu_index, now);
                   if (PREDICT_FALSE (next0 == SNAT_IN2OUT_NEXT_DROP))
                     goto trace00;
                 }
@@ -488,7 +516,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 }
             }
           else
-            s0 = pool_elt_at_index (sm->sessions, value0.value);
+            s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
           old_addr0 = ip0->src_address.as_u32;
           ip0->src_address = s0->out2in.addr;
@@ -515,6 +543,8 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                                      ip4_header_t /* cheat */,
                                      length /* changed member */);
               tcp0->checksum = ip_csum_fold(sum0);
+              snat_tcp_state_update (sm, tsm, s0, tcp0, now,
+                                     1 /* is_in2out */);
             }
           else
             {
@@ -527,8 +557,8 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
           s0->last_heard = now;
           s0->total_pkts++;
           s0->total_bytes += vlib_buffer_length_in_chain (vm, b0);
-          clib_dlist_remove (sm->list_pool, s0->per_user_index);
-          clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+          clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+          clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                               s0->per_user_index);
         trace00:
 
@@ -542,7 +572,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
               t->next_index = next0;
                   t->session_index = ~0;
               if (s0)
-                  t->session_index = s0 - sm->sessions;
+                  t->session_index = s0 - tsm->sessions;
             }
 
           pkts_processed += next0 != SNAT_IN2OUT_NEXT_DROP;
@@ -581,7 +611,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 {
                   next1 = icmp_in2out_slow_path 
                     (sm, b1, ip1, icmp1, sw_if_index1, rx_fib_index1, node, next1,
-                     now);
+                     now, cpu_index);
                   goto trace01;
                 }
             }
@@ -601,7 +631,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
           
           kv1.key = key1.as_u64;
 
-            if (PREDICT_FALSE(clib_bihash_search_8_8 (&sm->in2out, &kv1, &value1) != 0))
+            if (PREDICT_FALSE(clib_bihash_search_8_8 (&tsm->in2out, &kv1, &value1) != 0))
             {
               if (is_slow_path)
                 {
@@ -622,7 +652,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                     goto trace01;
                   
                   next1 = slow_path (sm, b1, ip1, rx_fib_index1, &key1,
-                                     &s1, node, next1);
+                                     &s1, node, next1, cpu_index, now);
                   if (PREDICT_FALSE (next1 == SNAT_IN2OUT_NEXT_DROP))
                     goto trace01;
                 }
@@ -633,7 +663,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 }
             }
           else
-            s1 = pool_elt_at_index (sm->sessions, value1.value);
+            s1 = pool_elt_at_index (tsm->sessions, value1.value);
 
           old_addr1 = ip1->src_address.as_u32;
           ip1->src_address = s1->out2in.addr;
@@ -660,6 +690,8 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                                      ip4_header_t /* cheat */,
                                      length /* changed member */);
               tcp1->checksum = ip_csum_fold(sum1);
+              snat_tcp_state_update (sm, tsm, s1, tcp1, now,
+                                     1 /* is_in2out */);
             }
           else
             {
@@ -672,8 +704,8 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
           s1->last_heard = now;
           s1->total_pkts++;
           s1->total_bytes += vlib_buffer_length_in_chain (vm, b1);
-          clib_dlist_remove (sm->list_pool, s1->per_user_index);
-          clib_dlist_addtail (sm->list_pool, s1->per_user_list_head_index,
+          clib_dlist_remove (tsm->list_pool, s1->per_user_index);
+          clib_dlist_addtail (tsm->list_pool, s1->per_user_list_head_index,
                               s1->per_user_index);
         trace01:
 
@@ -686,7 +718,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
               t->next_index = next1;
               t->session_index = ~0;
               if (s1)
-                t->session_index = s1 - sm->sessions;
+                t->session_index = s1 - tsm->sessions;
             }
 
           pkts_processed += next1 != SNAT_IN2OUT_NEXT_DROP;
@@ -762,7 +794,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 {
                   next0 = icmp_in2out_slow_path 
                     (sm, b0, ip0, icmp0, sw_if_index0, rx_fib_index0, node, next0,
-                     now);
+                     now, cpu_index);
                   goto trace0;
                 }
             }
@@ -782,7 +814,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
           
           kv0.key = key0.as_u64;
 
-          if (clib_bihash_search_8_8 (&sm->in2out, &kv0, &value0))
+          if (clib_bihash_search_8_8 (&tsm->in2out, &kv0, &value0))
             {
               if (is_slow_path)
                 {
@@ -803,7 +835,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                     goto trace0;
                   
                   next0 = slow_path (sm, b0, ip0, rx_fib_index0, &key0,
-                                     &s0, node, next0);
+                                     &s0, node, next0, cpu_index, now);
                   if (PREDICT_FALSE (next0 == SNAT_IN2OUT_NEXT_DROP))
                     goto trace0;
                 }
@@ -814,7 +846,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                 }
             }
           else
-            s0 = pool_elt_at_index (sm->sessions, value0.value);
+            s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
           old_addr0 = ip0->src_address.as_u32;
           ip0->src_address = s0->out2in.addr;
@@ -841,6 +873,8 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
                                      ip4_header_t /* cheat */,
                                      length /* changed member */);
               tcp0->checksum = ip_csum_fold(sum0);
+              snat_tcp_state_update (sm, tsm, s0, tcp0, now,
+                                     1 /* is_in2out */);
             }
           else
             {
@@ -853,8 +887,8 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
           s0->last_heard = now;
           s0->total_pkts++;
           s0->total_bytes += vlib_buffer_length_in_chain (vm, b0);
-          clib_dlist_remove (sm->list_pool, s0->per_user_index);
-          clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+          clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+          clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                               s0->per_user_index);
 
         trace0:
@@ -868,7 +902,7 @@ snat_in2out_node_fn_inline (vlib_main_t * vm,
               t->next_index = next0;
                   t->session_index = ~0;
               if (s0)
-                  t->session_index = s0 - sm->sessions;
+                  t->session_index = s0 - tsm->sessions;
             }
 
           pkts_processed += next0 != SNAT_IN2OUT_NEXT_DROP;
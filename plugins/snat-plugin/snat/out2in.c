@@ -51,7 +51,8 @@ vlib_node_registration_t snat_out2in_node;
 _(UNSUPPORTED_PROTOCOL, "Unsupported protocol")         \
 _(OUT2IN_PACKETS, "Good out2in packets processed")      \
 _(BAD_ICMP_TYPE, "icmp type not echo-reply")            \
-_(NO_TRANSLATION, "No translation")
+_(NO_TRANSLATION, "No translation")                     \
+_(HANDOFF_CONGESTED, "Owner thread frame queue full")
   
 typedef enum {
 #define _(sym,str) SNAT_OUT2IN_ERROR_##sym,
@@ -78,8 +79,10 @@ static inline u32 icmp_out2in_slow_path (snat_main_t *sm,
                                          u32 sw_if_index0,
                                          u32 rx_fib_index0,
                                          vlib_node_runtime_t * node,
-                                         u32 next0, f64 now)
+                                         u32 next0, f64 now,
+                                         u32 cpu_index)
 {
+  snat_main_per_thread_data_t * tsm = &sm->per_thread_data[cpu_index];
   snat_session_key_t key0;
   icmp_echo_header_t *echo0;
   clib_bihash_kv_8_8_t kv0, value0;
@@ -98,7 +101,7 @@ static inline u32 icmp_out2in_slow_path (snat_main_t *sm,
   
   kv0.key = key0.as_u64;
   
-  if (clib_bihash_search_8_8 (&sm->out2in, &kv0, &value0))
+  if (clib_bihash_search_8_8 (&tsm->out2in, &kv0, &value0))
     {
       ip4_address_t * first_int_addr;
 
@@ -120,7 +123,7 @@ static inline u32 icmp_out2in_slow_path (snat_main_t *sm,
       return SNAT_OUT2IN_NEXT_DROP;
     }
   else
-    s0 = pool_elt_at_index (sm->sessions, value0.value);
+    s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
   old_addr0 = ip0->dst_address.as_u32;
   ip0->dst_address = s0->in2out.addr;
@@ -146,8 +149,8 @@ static inline u32 icmp_out2in_slow_path (snat_main_t *sm,
   s0->last_heard = now;
   s0->total_pkts++;
   s0->total_bytes += vlib_buffer_length_in_chain (sm->vlib_main, b0);
-  clib_dlist_remove (sm->list_pool, s0->per_user_index);
-  clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+  clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+  clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                       s0->per_user_index);
 
   return next0;
@@ -165,11 +168,22 @@ snat_out2in_node_fn (vlib_main_t * vm,
   ip_lookup_main_t * lm = sm->ip4_lookup_main;
   ip_config_main_t * cm = &lm->rx_config_mains[VNET_UNICAST];
   f64 now = vlib_time_now (vm);
+  u32 cpu_index = os_get_cpu_number ();
+  snat_main_per_thread_data_t * tsm = &sm->per_thread_data[cpu_index];
 
   from = vlib_frame_vector_args (frame);
   n_left_from = frame->n_vectors;
   next_index = node->cached_next_index;
 
+  /* Steer return traffic to the thread owning its outside port */
+  if (sm->num_workers)
+    n_left_from = snat_worker_handoff (vm, node, from, n_left_from,
+                                       0 /* is_in2out */,
+                                       SNAT_OUT2IN_ERROR_HANDOFF_CONGESTED);
+
+  snat_maybe_expire_sessions (sm, tsm, cpu_index, now);
+  snat_ipfix_logging_maybe_flush (vm, cpu_index, now);
+
   while (n_left_from > 0)
     {
       u32 n_left_to_next;
@@ -252,7 +266,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
             {
               next0 = icmp_out2in_slow_path 
                 (sm, b0, ip0, icmp0, sw_if_index0, rx_fib_index0, node, 
-                 next0, now);
+                 next0, now, cpu_index);
               goto trace0;
             }
 
@@ -263,10 +277,10 @@ snat_out2in_node_fn (vlib_main_t * vm,
           
           kv0.key = key0.as_u64;
 
-          if (clib_bihash_search_8_8 (&sm->out2in, &kv0, &value0))
+          if (clib_bihash_search_8_8 (&tsm->out2in, &kv0, &value0))
             goto trace0;
           else
-            s0 = pool_elt_at_index (sm->sessions, value0.value);
+            s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
           old_addr0 = ip0->dst_address.as_u32;
           ip0->dst_address = s0->in2out.addr;
@@ -294,6 +308,8 @@ snat_out2in_node_fn (vlib_main_t * vm,
                                      ip4_header_t /* cheat */,
                                      length /* changed member */);
               tcp0->checksum = ip_csum_fold(sum0);
+              snat_tcp_state_update (sm, tsm, s0, tcp0, now,
+                                     0 /* is_in2out */);
             }
           else
             {
@@ -306,8 +322,8 @@ snat_out2in_node_fn (vlib_main_t * vm,
           s0->last_heard = now;
           s0->total_pkts++;
           s0->total_bytes += vlib_buffer_length_in_chain (vm, b0);
-          clib_dlist_remove (sm->list_pool, s0->per_user_index);
-          clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+          clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+          clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                               s0->per_user_index);
         trace0:
 
@@ -320,7 +336,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
               t->next_index = next0;
               t->session_index = ~0;
               if (s0)
-                  t->session_index = s0 - sm->sessions;
+                  t->session_index = s0 - tsm->sessions;
             }
 
           pkts_processed += next0 != SNAT_OUT2IN_NEXT_DROP;
@@ -354,7 +370,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
             {
               next1 = icmp_out2in_slow_path 
                 (sm, b1, ip1, icmp1, sw_if_index1, rx_fib_index1, node, 
-                 next1, now);
+                 next1, now, cpu_index);
               goto trace1;
             }
 
@@ -365,10 +381,10 @@ snat_out2in_node_fn (vlib_main_t * vm,
           
           kv1.key = key1.as_u64;
 
-          if (clib_bihash_search_8_8 (&sm->out2in, &kv1, &value1))
+          if (clib_bihash_search_8_8 (&tsm->out2in, &kv1, &value1))
             goto trace1;
           else
-            s1 = pool_elt_at_index (sm->sessions, value1.value);
+            s1 = pool_elt_at_index (tsm->sessions, value1.value);
 
           old_addr1 = ip1->dst_address.as_u32;
           ip1->dst_address = s1->in2out.addr;
@@ -396,6 +412,8 @@ snat_out2in_node_fn (vlib_main_t * vm,
                                      ip4_header_t /* cheat */,
                                      length /* changed member */);
               tcp1->checksum = ip_csum_fold(sum1);
+              snat_tcp_state_update (sm, tsm, s1, tcp1, now,
+                                     0 /* is_in2out */);
             }
           else
             {
@@ -408,8 +426,8 @@ snat_out2in_node_fn (vlib_main_t * vm,
           s1->last_heard = now;
           s1->total_pkts++;
           s1->total_bytes += vlib_buffer_length_in_chain (vm, b1);
-          clib_dlist_remove (sm->list_pool, s1->per_user_index);
-          clib_dlist_addtail (sm->list_pool, s1->per_user_list_head_index,
+          clib_dlist_remove (tsm->list_pool, s1->per_user_index);
+          clib_dlist_addtail (tsm->list_pool, s1->per_user_list_head_index,
                               s1->per_user_index);
         trace1:
 
@@ -422,7 +440,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
               t->next_index = next1;
               t->session_index = ~0;
               if (s1)
-                  t->session_index = s1 - sm->sessions;
+                  t->session_index = s1 - tsm->sessions;
             }
 
           pkts_processed += next0 != SNAT_OUT2IN_NEXT_DROP;
@@ -491,7 +509,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
             {
               next0 = icmp_out2in_slow_path 
                 (sm, b0, ip0, icmp0, sw_if_index0, rx_fib_index0, node, 
-                 next0, now);
+                 next0, now, cpu_index);
               goto trace00;
             }
 
@@ -502,10 +520,10 @@ snat_out2in_node_fn (vlib_main_t * vm,
           
           kv0.key = key0.as_u64;
 
-          if (clib_bihash_search_8_8 (&sm->out2in, &kv0, &value0))
+          if (clib_bihash_search_8_8 (&tsm->out2in, &kv0, &value0))
             goto trace00;
           else
-            s0 = pool_elt_at_index (sm->sessions, value0.value);
+            s0 = pool_elt_at_index (tsm->sessions, value0.value);
 
           old_addr0 = ip0->dst_address.as_u32;
           ip0->dst_address = s0->in2out.addr;
@@ -533,6 +551,8 @@ snat_out2in_node_fn (vlib_main_t * vm,
                                      ip4_header_t /* cheat */,
                                      length /* changed member */);
               tcp0->checksum = ip_csum_fold(sum0);
+              snat_tcp_state_update (sm, tsm, s0, tcp0, now,
+                                     0 /* is_in2out */);
             }
           else
             {
@@ -545,8 +565,8 @@ snat_out2in_node_fn (vlib_main_t * vm,
           s0->last_heard = now;
           s0->total_pkts++;
           s0->total_bytes += vlib_buffer_length_in_chain (vm, b0);
-          clib_dlist_remove (sm->list_pool, s0->per_user_index);
-          clib_dlist_addtail (sm->list_pool, s0->per_user_list_head_index,
+          clib_dlist_remove (tsm->list_pool, s0->per_user_index);
+          clib_dlist_addtail (tsm->list_pool, s0->per_user_list_head_index,
                               s0->per_user_index);
         trace00:
 
@@ -559,7 +579,7 @@ snat_out2in_node_fn (vlib_main_t * vm,
               t->next_index = next0;
               t->session_index = ~0;
               if (s0)
-                  t->session_index = s0 - sm->sessions;
+                  t->session_index = s0 - tsm->sessions;
             }
 
           pkts_processed += next0 != SNAT_OUT2IN_NEXT_DROP;
@@ -17,6 +17,7 @@
 
 #include <vnet/vnet.h>
 #include <vnet/plugin/plugin.h>
+#include <vnet/handoff.h>
 #include <vlibapi/api.h>
 #include <snat/snat.h>
 
@@ -174,11 +175,19 @@ bad_tx_sw_if_index:				\
 
 void snat_add_address (snat_main_t *sm, ip4_address_t *addr)
 {
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
   snat_address_t * ap;
 
+  /* Workers may be walking the address vector */
+  vlib_worker_thread_barrier_sync (sm->vlib_main);
+
   vec_add2 (sm->addresses, ap, 1);
   ap->addr = *addr;
+  /* Sized up front, so threads never reallocate it under each other */
+  clib_bitmap_alloc (ap->busy_port_bitmap, 65536);
+  vec_validate (ap->busy_ports_per_thread, tm->n_vlib_mains - 1);
 
+  vlib_worker_thread_barrier_release (sm->vlib_main);
 }
 
 static void increment_v4_address (ip4_address_t * a)
@@ -222,6 +231,19 @@ vl_api_snat_add_address_range_t_handler
   
   memcpy (&this_addr.as_u8, mp->first_ip_address, 4);
 
+  /* Deterministic mappings own their outside addresses */
+  for (i = 0; i < count; i++)
+    {
+      if (snat_det_map_by_out (sm, &this_addr))
+        {
+          rv = VNET_API_ERROR_VALUE_EXIST;
+          goto send_reply;
+        }
+      increment_v4_address (&this_addr);
+    }
+
+  memcpy (&this_addr.as_u8, mp->first_ip_address, 4);
+
   for (i = 0; i < count; i++)
     {
       snat_add_address (sm, &this_addr);
@@ -335,8 +357,16 @@ static clib_error_t * snat_init (vlib_main_t * vm)
   clib_error_t * error = 0;
   ip4_main_t * im = &ip4_main;
   ip_lookup_main_t * lm = &im->lookup_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  vlib_thread_registration_t * tr;
+  snat_main_per_thread_data_t * tsm;
+  vlib_node_t * dispatch;
+  uword * p;
   u8 * name;
 
+  if ((error = vlib_call_init_function (vm, threads_init)))
+    return error;
+
   name = format (0, "snat_%08x%c", api_version, 0);
 
   /* Ask for a correctly-sized block of API message decode slots */
@@ -349,6 +379,52 @@ static clib_error_t * snat_init (vlib_main_t * vm)
   sm->ip4_lookup_main = lm;
   sm->api_main = &api_main;
 
+  /* Translations are spread over the standard vnet worker threads */
+  p = hash_get_mem (tm->thread_registrations_by_name, "workers");
+  if (p)
+    {
+      tr = (vlib_thread_registration_t *) p[0];
+      if (tr && tr->count > 0)
+        {
+          sm->first_worker_index = tr->first_index;
+          sm->num_workers = tr->count;
+        }
+    }
+
+  /*
+   * Each thread gets an equal slice of the ports of every outside
+   * address. Keep the slices a whole number of bitmap words apart, so
+   * that threads never share a word of busy_port_bitmap.
+   */
+  sm->port_per_thread = (65536 - SNAT_FIRST_PORT) / clib_max (sm->num_workers, 1);
+  sm->port_per_thread &= ~(BITS (uword) - 1);
+  if (sm->port_per_thread == 0)
+    return clib_error_return (0, "%d workers leave no outside ports per "
+                              "worker", sm->num_workers);
+
+  vec_validate_aligned (sm->per_thread_data, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+  vec_foreach (tsm, sm->per_thread_data)
+    {
+      vec_validate (tsm->handoff_elts, tm->n_vlib_mains - 1);
+      vec_validate_init_empty (tsm->handoff_congested, tm->n_vlib_mains - 1,
+                               (vlib_frame_queue_t *) (~0));
+      /* Threads draw ports from their own random sequence */
+      tsm->random_seed = random_default_seed () + (tsm - sm->per_thread_data);
+    }
+
+  if (sm->num_workers)
+    {
+      dispatch = vlib_get_node_by_name (vm, (u8 *) "handoff-dispatch");
+      sm->in2out_handoff_next_index =
+        vlib_node_add_next (vm, dispatch->index, snat_in2out_node.index);
+      sm->out2in_handoff_next_index =
+        vlib_node_add_next (vm, dispatch->index, snat_out2in_node.index);
+    }
+
+  if ((error = snat_ipfix_logging_init (vm)))
+    return error;
+
   error = snat_plugin_api_hookup (vm);
   plugin_custom_dump_configure (sm);
   vec_free(name);
@@ -359,6 +435,7 @@ static clib_error_t * snat_init (vlib_main_t * vm)
 VLIB_INIT_FUNCTION (snat_init);
 
 void snat_free_outside_address_and_port (snat_main_t * sm, 
+                                         u32 cpu_index,
                                          snat_session_key_t * k, 
                                          u32 address_index)
 {
@@ -369,38 +446,47 @@ void snat_free_outside_address_and_port (snat_main_t * sm,
 
   a = sm->addresses + address_index;
 
-  ASSERT (clib_bitmap_get (a->busy_port_bitmap, port_host_byte_order) == 1);
+  ASSERT (clib_bitmap_get_no_check (a->busy_port_bitmap,
+                                    port_host_byte_order) == 1);
 
-  a->busy_port_bitmap = clib_bitmap_set (a->busy_port_bitmap, 
-                                         port_host_byte_order, 0);
-  a->busy_ports--;
+  clib_bitmap_set_no_check (a->busy_port_bitmap, port_host_byte_order, 0);
+  a->busy_ports_per_thread[cpu_index]--;
 }  
 
+/*
+ * Allocate an outside address and port for a new translation owned by
+ * cpu_index. Only ports from the thread's own slice are used, so that
+ * return traffic can be steered to the owning thread by port alone.
+ */
 int snat_alloc_outside_address_and_port (snat_main_t * sm, 
+                                         u32 cpu_index,
                                          snat_session_key_t * k,
                                          u32 * address_indexp)
 {
   int i;
   snat_address_t *a;
-  u32 portnum;
+  snat_main_per_thread_data_t * tsm = &sm->per_thread_data[cpu_index];
+  u32 portnum, first_port, offset;
+
+  offset = snat_thread_offset (sm, cpu_index);
+  if (PREDICT_FALSE (offset == ~0))
+    return 1;
+  first_port = SNAT_FIRST_PORT + offset * sm->port_per_thread;
 
   for (i = 0; i < vec_len (sm->addresses); i++)
     {
-      if (sm->addresses[i].busy_ports < (65535-1024))
-        {
-          a = sm->addresses + i;
+      a = sm->addresses + i;
 
+      if (a->busy_ports_per_thread[cpu_index] < sm->port_per_thread)
+        {
           while (1)
             {
-              portnum = random_u32 (&sm->random_seed);
-              portnum &= 0xFFFF;
-              if (portnum < 1024)
+              portnum = first_port 
+                + random_u32 (&tsm->random_seed) % sm->port_per_thread;
+              if (clib_bitmap_get_no_check (a->busy_port_bitmap, portnum))
                 continue;
-              if (clib_bitmap_get (a->busy_port_bitmap, portnum))
-                continue;
-              a->busy_port_bitmap = clib_bitmap_set (a->busy_port_bitmap,
-                                                     portnum, 1);
-              a->busy_ports++;
+              clib_bitmap_set_no_check (a->busy_port_bitmap, portnum, 1);
+              a->busy_ports_per_thread[cpu_index]++;
               /* Caller sets protocol and fib index */
               k->addr = a->addr;
               k->port = clib_host_to_net_u16(portnum);
@@ -413,6 +499,486 @@ int snat_alloc_outside_address_and_port (snat_main_t * sm,
   return 1;
 }
 
+static void
+snat_log_port_block (snat_main_t * sm, u32 cpu_index, snat_user_t * u,
+                     snat_port_block_t * pb, u8 nat_event)
+{
+  snat_address_t * a = vec_elt_at_index (sm->addresses, pb->address_index);
+
+  snat_ipfix_logging_port_block (cpu_index, nat_event, u->addr.as_u32,
+                                 a->addr.as_u32, pb->first_port,
+                                 pb->first_port + sm->port_block_size - 1,
+                                 u->fib_index);
+}
+
+/* Reserve a free port block of the thread's slice for a user */
+static int
+snat_alloc_port_block (snat_main_t * sm, u32 cpu_index, snat_user_t * u)
+{
+  snat_main_per_thread_data_t * tsm = &sm->per_thread_data[cpu_index];
+  snat_address_t * a;
+  snat_port_block_t * pb;
+  u32 i, j, n, n_blocks, first_port, port, offset;
+
+  offset = snat_thread_offset (sm, cpu_index);
+  if (PREDICT_FALSE (offset == ~0))
+    return 1;
+  n_blocks = sm->port_per_thread / sm->port_block_size;
+  first_port = SNAT_FIRST_PORT + offset * sm->port_per_thread;
+
+  for (i = 0; i < vec_len (sm->addresses); i++)
+    {
+      a = sm->addresses + i;
+
+      if (a->busy_ports_per_thread[cpu_index] 
+          >= n_blocks * sm->port_block_size)
+        continue;
+
+      /* Blocks are marked busy by their first port */
+      j = random_u32 (&tsm->random_seed) % n_blocks;
+      for (n = 0; n < n_blocks; n++)
+        {
+          port = first_port + j * sm->port_block_size;
+          if (!clib_bitmap_get_no_check (a->busy_port_bitmap, port))
+            {
+              clib_bitmap_set_no_check (a->busy_port_bitmap, port, 1);
+              a->busy_ports_per_thread[cpu_index] += sm->port_block_size;
+
+              vec_add2 (u->port_blocks, pb, 1);
+              pb->address_index = i;
+              pb->first_port = port;
+              pb->n_busy = 0;
+              clib_bitmap_alloc (pb->busy_bitmap, sm->port_block_size);
+              snat_log_port_block (sm, cpu_index, u, pb,
+                                   SNAT_IPFIX_NAT_PORT_BLOCK_ALLOC);
+              return 0;
+            }
+          if (++j == n_blocks)
+            j = 0;
+        }
+    }
+  return 1;
+}
+
+static void
+snat_free_port_block (snat_main_t * sm, u32 cpu_index, snat_user_t * u,
+                      snat_port_block_t * pb)
+{
+  snat_address_t * a = vec_elt_at_index (sm->addresses, pb->address_index);
+
+  snat_log_port_block (sm, cpu_index, u, pb, SNAT_IPFIX_NAT_PORT_BLOCK_FREE);
+
+  clib_bitmap_set_no_check (a->busy_port_bitmap, pb->first_port, 0);
+  a->busy_ports_per_thread[cpu_index] -= sm->port_block_size;
+  clib_bitmap_free (pb->busy_bitmap);
+}
+
+void snat_user_free_port_blocks (snat_main_t * sm, u32 cpu_index,
+                                 snat_user_t * u)
+{
+  snat_port_block_t * pb;
+
+  vec_foreach (pb, u->port_blocks)
+    snat_free_port_block (sm, cpu_index, u, pb);
+  vec_free (u->port_blocks);
+}
+
+/*
+ * Deterministic translation: the port is taken from the inside host's
+ * own range, keeping the inside port's position in the range when it
+ * is free. The caller sets the protocol and fib index of k, which are
+ * needed to probe the out2in table.
+ */
+static int
+snat_det_alloc_port (snat_main_t * sm, u32 cpu_index, snat_det_map_t * dm,
+                     snat_session_key_t * in, snat_session_key_t * k)
+{
+  snat_main_per_thread_data_t * tsm = &sm->per_thread_data[cpu_index];
+  clib_bihash_kv_8_8_t kv, value;
+  u16 first_port;
+  u32 i, offset;
+
+  snat_det_forward (dm, &in->addr, &k->addr, &first_port);
+
+  offset = clib_net_to_host_u16 (in->port) % dm->ports_per_host;
+  for (i = 0; i < dm->ports_per_host; i++)
+    {
+      k->port = clib_host_to_net_u16 (first_port + offset);
+      kv.key = k->as_u64;
+      if (clib_bihash_search_8_8 (&tsm->out2in, &kv, &value))
+        return 0;
+      if (++offset == dm->ports_per_host)
+        offset = 0;
+    }
+  return 1;
+}
+
+/*
+ * Allocate the outside address and port of a new session of user u,
+ * from a deterministic mapping, from the user's port blocks, or one
+ * port at a time. Deterministic sessions have no address index.
+ */
+int snat_user_alloc_port (snat_main_t * sm, u32 cpu_index, snat_user_t * u,
+                          snat_session_key_t * in, snat_session_key_t * k,
+                          u32 * address_indexp)
+{
+  snat_port_block_t * pb;
+  snat_det_map_t * dm;
+  u32 i;
+
+  if (PREDICT_FALSE (vec_len (sm->det_maps) != 0))
+    {
+      dm = snat_det_map_by_in (sm, &in->addr);
+      if (dm)
+        {
+          *address_indexp = ~0;
+          return snat_det_alloc_port (sm, cpu_index, dm, in, k);
+        }
+    }
+
+  if (sm->port_block_size == 0)
+    return snat_alloc_outside_address_and_port (sm, cpu_index, k,
+                                                address_indexp);
+
+  vec_foreach (pb, u->port_blocks)
+    if (pb->n_busy < sm->port_block_size)
+      goto found;
+
+  if (snat_alloc_port_block (sm, cpu_index, u))
+    return 1;
+  pb = vec_end (u->port_blocks) - 1;
+
+ found:
+  i = clib_bitmap_first_clear (pb->busy_bitmap);
+  clib_bitmap_set_no_check (pb->busy_bitmap, i, 1);
+  pb->n_busy++;
+
+  k->addr = sm->addresses[pb->address_index].addr;
+  k->port = clib_host_to_net_u16 (pb->first_port + i);
+  *address_indexp = pb->address_index;
+  return 0;
+}
+
+void snat_user_free_port (snat_main_t * sm, u32 cpu_index, snat_user_t * u,
+                          snat_session_key_t * k, u32 address_index)
+{
+  snat_port_block_t * pb;
+  u32 port;
+
+  /* Deterministic, nothing was allocated */
+  if (address_index == ~0)
+    return;
+
+  if (sm->port_block_size == 0)
+    {
+      snat_free_outside_address_and_port (sm, cpu_index, k, address_index);
+      return;
+    }
+
+  port = clib_net_to_host_u16 (k->port);
+
+  vec_foreach (pb, u->port_blocks)
+    {
+      if (pb->address_index != address_index
+          || port - pb->first_port >= sm->port_block_size)
+        continue;
+
+      ASSERT (clib_bitmap_get_no_check (pb->busy_bitmap, 
+                                        port - pb->first_port));
+      clib_bitmap_set_no_check (pb->busy_bitmap, port - pb->first_port, 0);
+      pb->n_busy--;
+
+      /* Give empty blocks back, but keep one for the user's next session */
+      if (pb->n_busy == 0 && vec_len (u->port_blocks) > 1)
+        {
+          snat_free_port_block (sm, cpu_index, u, pb);
+          vec_del1 (u->port_blocks, pb - u->port_blocks);
+        }
+      return;
+    }
+
+  clib_warning ("port %d not in any block of user %U", port,
+                format_ip4_address, &u->addr);
+}
+
+/* Remove an expired session, and its user with its last session */
+static void
+snat_delete_session (snat_main_t * sm, u32 cpu_index, snat_session_t * s)
+{
+  snat_main_per_thread_data_t * tsm = &sm->per_thread_data[cpu_index];
+  clib_bihash_kv_8_8_t kv, value, user_kv;
+  snat_user_key_t user_key;
+  snat_user_t * u;
+
+  user_key.addr = s->in2out.addr;
+  user_key.fib_index = s->in2out.fib_index;
+  user_kv.key = user_key.as_u64;
+
+  if (clib_bihash_search_8_8 (&tsm->user_hash, &user_kv, &value))
+    {
+      clib_warning ("user %U not found", format_ip4_address, &user_key.addr);
+      return;
+    }
+  u = pool_elt_at_index (tsm->users, value.value);
+
+  kv.key = s->in2out.as_u64;
+  if (clib_bihash_add_del_8_8 (&tsm->in2out, &kv, 0 /* is_add */))
+    clib_warning ("in2out key delete failed");
+  kv.key = s->out2in.as_u64;
+  if (clib_bihash_add_del_8_8 (&tsm->out2in, &kv, 0 /* is_add */))
+    clib_warning ("out2in key delete failed");
+
+  snat_log_session (sm, cpu_index, s, SNAT_IPFIX_NAT44_SESSION_DELETE);
+
+  snat_user_free_port (sm, cpu_index, u, &s->out2in, 
+                       s->outside_address_index);
+
+  clib_dlist_remove (tsm->list_pool, s->per_user_index);
+  pool_put_index (tsm->list_pool, s->per_user_index);
+
+  pool_put (tsm->sessions, s);
+
+  if (--u->nsessions)
+    return;
+
+  snat_user_free_port_blocks (sm, cpu_index, u);
+  pool_put_index (tsm->list_pool, u->sessions_per_user_list_head_index);
+  pool_put (tsm->users, u);
+  clib_bihash_add_del_8_8 (&tsm->user_hash, &user_kv, 0 /* is_add */);
+}
+
+/*
+ * Expire at most max_expired of the thread's idle sessions, leaving
+ * the rest for the next call. Traffic only updates last_heard, so a
+ * timer firing for a session still in use is simply re-armed. Wheel
+ * entries are never deleted; entries left behind by a recycled
+ * session are told apart by the session's expire time.
+ */
+void snat_expire_sessions (snat_main_t * sm, u32 cpu_index, f64 now,
+                           u32 max_expired)
+{
+  snat_main_per_thread_data_t * tsm = &sm->per_thread_data[cpu_index];
+  f64 slack, idle_until;
+  snat_session_t * s;
+  u32 session_index;
+
+  slack = (f64) (1ULL << tsm->wheel.log2_clocks_per_bin) * 1e-3;
+
+  if (vec_len (tsm->expired) == 0)
+    {
+      tsm->expired = timing_wheel_advance (&tsm->wheel, snat_wheel_time (now),
+                                           tsm->expired, 0);
+      tsm->last_expire_time = now;
+    }
+
+  while (max_expired-- && vec_len (tsm->expired))
+    {
+      session_index = vec_pop (tsm->expired);
+
+      if (pool_is_free_index (tsm->sessions, session_index))
+        continue;
+
+      s = pool_elt_at_index (tsm->sessions, session_index);
+      if (s->expire_time > now + slack || (s->flags & SNAT_SESSION_STATIC))
+        continue;
+
+      idle_until = s->last_heard + snat_session_timeout (sm, s);
+      if (idle_until > now)
+        {
+          s->expire_time = idle_until;
+          timing_wheel_insert (&tsm->wheel, snat_wheel_time (idle_until),
+                               session_index);
+          continue;
+        }
+
+      snat_delete_session (sm, cpu_index, s);
+    }
+}
+
+static vlib_node_registration_t snat_expire_input_node;
+
+/*
+ * Threads only expire their sessions while they receive snat traffic.
+ * This process catches the threads which went quiet with sessions
+ * or unsent IPFIX records still around. The main thread's are expired
+ * here; workers are asked to expire their own in snat-expire-input,
+ * so forwarding never stops for it.
+ */
+static uword
+snat_expire_walk_fn (vlib_main_t * vm, vlib_node_runtime_t * rt,
+                     vlib_frame_t * f)
+{
+  snat_main_t * sm = &snat_main;
+  snat_main_per_thread_data_t * tsm;
+  vlib_main_t * this_vm;
+  u32 i;
+
+  /* Workers are running by now; they poll for requests from here on */
+  if (vec_len (sm->per_thread_data) > 1)
+    {
+      vlib_worker_thread_barrier_sync (vm);
+      foreach_vlib_main (
+      ({
+        if (this_vlib_main->cpu_index)
+          vlib_node_set_state (this_vlib_main, snat_expire_input_node.index,
+                               VLIB_NODE_STATE_POLLING);
+      }));
+      vlib_worker_thread_barrier_release (vm);
+    }
+
+  while (1)
+    {
+      vlib_process_suspend (vm, 1.0);
+
+      vec_foreach_index (i, sm->per_thread_data)
+        {
+          tsm = vec_elt_at_index (sm->per_thread_data, i);
+          this_vm = i ? vlib_mains[i] : vm;
+
+          if ((pool_elts (tsm->sessions) == 0
+               && !snat_ipfix_logging_pending (i))
+              || vlib_time_now (this_vm) - tsm->last_expire_time < 2.0)
+            continue;
+
+          if (i)
+            {
+              tsm->expire_requested = 1;
+              continue;
+            }
+
+          snat_expire_sessions (sm, i, vlib_time_now (vm), ~0);
+          /* Send what the thread logged, including these deletes */
+          snat_ipfix_logging_flush (vm, i, vlib_time_now (vm), 1 /* force */);
+        }
+    }
+  return 0;
+}
+
+VLIB_REGISTER_NODE (snat_expire_walk_node, static) = {
+  .function = snat_expire_walk_fn,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "snat-expire-walk",
+};
+
+/*
+ * Expire a quiet worker's sessions on the worker, a batch per main
+ * loop pass, and flush its IPFIX records once done
+ */
+static uword
+snat_expire_input_fn (vlib_main_t * vm, vlib_node_runtime_t * rt,
+                      vlib_frame_t * f)
+{
+  snat_main_t * sm = &snat_main;
+  u32 cpu_index = os_get_cpu_number ();
+  snat_main_per_thread_data_t * tsm;
+  f64 now;
+
+  if (PREDICT_FALSE (cpu_index >= vec_len (sm->per_thread_data)))
+    return 0;
+
+  tsm = vec_elt_at_index (sm->per_thread_data, cpu_index);
+  if (PREDICT_TRUE (!tsm->expire_requested))
+    return 0;
+
+  now = vlib_time_now (vm);
+  snat_expire_sessions (sm, cpu_index, now, SNAT_EXPIRE_BATCH);
+  if (vec_len (tsm->expired))
+    return 0;
+
+  snat_ipfix_logging_flush (vm, cpu_index, now, 1 /* force */);
+  tsm->expire_requested = 0;
+  return 0;
+}
+
+VLIB_REGISTER_NODE (snat_expire_input_node, static) = {
+  .function = snat_expire_input_fn,
+  .type = VLIB_NODE_TYPE_INPUT,
+  .name = "snat-expire-input",
+  .state = VLIB_NODE_STATE_DISABLED,
+};
+
+/*
+ * Hand buffers owned by other threads off to them, and compact the
+ * ones owned by this thread at the front of the vector. Buffers for
+ * an owner whose frame queue is congested are dropped and counted as
+ * congested_error. Returns the number of buffers left for the caller
+ * to process.
+ */
+u32 snat_worker_handoff (vlib_main_t * vm, vlib_node_runtime_t * node,
+                         u32 * buffers, u32 n_buffers, int is_in2out,
+                         u32 congested_error)
+{
+  snat_main_t * sm = &snat_main;
+  u32 cpu_index = os_get_cpu_number ();
+  snat_main_per_thread_data_t * tsm = &sm->per_thread_data[cpu_index];
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  vlib_frame_queue_elt_t * hf;
+  u32 i, n_local = 0, owner0, bi0, handoff_next;
+  vlib_buffer_t * b0;
+  ip4_header_t * ip0;
+
+  handoff_next = is_in2out ? sm->in2out_handoff_next_index
+    : sm->out2in_handoff_next_index;
+
+  for (i = 0; i < n_buffers; i++)
+    {
+      bi0 = buffers[i];
+      b0 = vlib_get_buffer (vm, bi0);
+      ip0 = vlib_buffer_get_current (b0);
+
+      owner0 = is_in2out ? snat_in2out_owner (sm, ip0)
+        : snat_out2in_owner (sm, ip0);
+
+      /* Nothing to translate, let the current thread pass it on */
+      if (owner0 == ~0 || owner0 == cpu_index)
+        {
+          buffers[n_local++] = bi0;
+          continue;
+        }
+
+      /* Never wait for a busy owner, drop instead */
+      if (tsm->handoff_elts[owner0] == 0
+          && is_vlib_handoff_queue_congested (owner0,
+                                              tm->efd.queue_hi_thresh,
+                                              tsm->handoff_congested))
+        {
+          vec_add1 (tsm->handoff_drops, bi0);
+          continue;
+        }
+
+      vnet_buffer (b0)->handoff.next_index = handoff_next;
+
+      hf = dpdk_get_handoff_queue_elt (owner0, tsm->handoff_elts);
+      hf->buffer_index[hf->n_vectors++] = bi0;
+
+      if (hf->n_vectors == VLIB_FRAME_SIZE)
+        {
+          vlib_put_handoff_queue_elt (hf);
+          tsm->handoff_elts[owner0] = 0;
+        }
+    }
+
+  vec_foreach_index (i, tsm->handoff_elts)
+    {
+      if (tsm->handoff_elts[i])
+        {
+          vlib_put_handoff_queue_elt (tsm->handoff_elts[i]);
+          tsm->handoff_elts[i] = 0;
+        }
+      tsm->handoff_congested[i] = (vlib_frame_queue_t *) (~0);
+    }
+
+  if (PREDICT_FALSE (vec_len (tsm->handoff_drops) > 0))
+    {
+      vlib_node_increment_counter (vm, node->node_index, congested_error,
+                                   vec_len (tsm->handoff_drops));
+      vlib_buffer_free (vm, tsm->handoff_drops,
+                        vec_len (tsm->handoff_drops));
+      _vec_len (tsm->handoff_drops) = 0;
+    }
+
+  return n_local;
+}
 
 static clib_error_t *
 add_address_command_fn (vlib_main_t * vm,
@@ -445,6 +1011,16 @@ add_address_command_fn (vlib_main_t * vm,
                   format_ip4_address, &end_addr,
                   count);
   
+  /* Deterministic mappings own their outside addresses */
+  this_addr = start_addr;
+  for (i = 0; i < count; i++)
+    {
+      if (snat_det_map_by_out (sm, &this_addr))
+        return clib_error_return (0, "%U is in a deterministic mapping",
+                                  format_ip4_address, &this_addr);
+      increment_v4_address (&this_addr);
+    }
+
   this_addr = start_addr;
 
   for (i = 0; i < count; i++)
@@ -548,6 +1124,108 @@ VLIB_CLI_COMMAND (set_interface_snat_command, static) = {
   .short_help = "set interface snat in <intfc> out <intfc> [del]",
 };
 
+int snat_det_add_del_map (snat_main_t * sm, ip4_address_t * in_addr, 
+                          u8 in_plen, ip4_address_t * out_addr, u8 out_plen,
+                          int is_add)
+{
+  snat_det_map_t * dm;
+  snat_address_t * a;
+  u32 sharing_ratio;
+
+  if (in_plen > 32 || out_plen > 32)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  dm = snat_det_map_by_in (sm, in_addr);
+
+  if (!is_add)
+    {
+      if (!dm || dm->in_plen != in_plen)
+        return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+      vlib_worker_thread_barrier_sync (sm->vlib_main);
+      vec_del1 (sm->det_maps, dm - sm->det_maps);
+      vlib_worker_thread_barrier_release (sm->vlib_main);
+      return 0;
+    }
+
+  if (dm || snat_det_map_by_out (sm, out_addr))
+    return VNET_API_ERROR_VALUE_EXIST;
+
+  /* Outside addresses are either dynamic or deterministic, never both */
+  vec_foreach (a, sm->addresses)
+    if (snat_prefix_match (&a->addr, out_addr, out_plen))
+      return VNET_API_ERROR_INVALID_VALUE_2;
+
+  /* Every outside address is shared by the same number of hosts */
+  if (out_plen < in_plen)
+    return VNET_API_ERROR_INVALID_VALUE;
+  sharing_ratio = 1 << (out_plen - in_plen);
+  if (sharing_ratio > 65536 - SNAT_FIRST_PORT)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  vlib_worker_thread_barrier_sync (sm->vlib_main);
+  vec_add2 (sm->det_maps, dm, 1);
+  dm->in_addr.as_u32 = in_addr->as_u32 
+    & clib_host_to_net_u32 (in_plen ? ~0U << (32 - in_plen) : 0);
+  dm->in_plen = in_plen;
+  dm->out_addr.as_u32 = out_addr->as_u32 
+    & clib_host_to_net_u32 (out_plen ? ~0U << (32 - out_plen) : 0);
+  dm->out_plen = out_plen;
+  dm->sharing_ratio = sharing_ratio;
+  dm->ports_per_host = (65536 - SNAT_FIRST_PORT) / sharing_ratio;
+  vlib_worker_thread_barrier_release (sm->vlib_main);
+
+  return 0;
+}
+
+static clib_error_t *
+snat_det_map_command_fn (vlib_main_t * vm,
+                         unformat_input_t * input,
+                         vlib_cli_command_t * cmd)
+{
+  snat_main_t * sm = &snat_main;
+  ip4_address_t in_addr, out_addr;
+  u32 in_plen, out_plen;
+  int is_add = 1, rv;
+
+  if (!unformat (input, "in %U/%d out %U/%d", 
+                 unformat_ip4_address, &in_addr, &in_plen,
+                 unformat_ip4_address, &out_addr, &out_plen))
+    return clib_error_return (0, "unknown input `%U'",
+                              format_unformat_error, input);
+
+  if (unformat (input, "del"))
+    is_add = 0;
+
+  rv = snat_det_add_del_map (sm, &in_addr, in_plen, &out_addr, out_plen,
+                             is_add);
+  switch (rv)
+    {
+    case 0:
+      break;
+    case VNET_API_ERROR_NO_SUCH_ENTRY:
+      return clib_error_return (0, "no such mapping");
+    case VNET_API_ERROR_VALUE_EXIST:
+      return clib_error_return (0, "mapping overlaps an existing one");
+    case VNET_API_ERROR_INVALID_VALUE_2:
+      return clib_error_return (0, "out prefix overlaps the snat address "
+                                "pool");
+    default:
+      return clib_error_return (0, "out prefix must cover the in prefix "
+                                "with at most 64512 in hosts per out "
+                                "address");
+    }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (snat_det_map_command, static) = {
+  .path = "snat deterministic add",
+  .short_help = 
+  "snat deterministic add in <addr>/<plen> out <addr>/<plen> [del]",
+  .function = snat_det_map_command_fn,
+};
+
 static clib_error_t *
 snat_config (vlib_main_t * vm, unformat_input_t * input)
 {
@@ -557,7 +1235,13 @@ snat_config (vlib_main_t * vm, unformat_input_t * input)
   u32 user_buckets = 128;
   u32 user_memory_size = 64<<20;
   u32 max_translations_per_user = 100;
+  u32 udp_timeout = SNAT_UDP_TIMEOUT;
+  u32 tcp_established_timeout = SNAT_TCP_ESTABLISHED_TIMEOUT;
+  u32 tcp_transitory_timeout = SNAT_TCP_TRANSITORY_TIMEOUT;
+  u32 icmp_timeout = SNAT_ICMP_TIMEOUT;
+  u32 port_block_size = 0;
   u32 outside_vrf_id = 0;
+  snat_main_per_thread_data_t * tsm;
 
   while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
     {
@@ -573,6 +1257,18 @@ snat_config (vlib_main_t * vm, unformat_input_t * input)
       else if (unformat (input, "max translations per user %d",
                          &max_translations_per_user))
         ;
+      else if (unformat (input, "udp timeout %d", &udp_timeout))
+        ;
+      else if (unformat (input, "tcp established timeout %d",
+                         &tcp_established_timeout))
+        ;
+      else if (unformat (input, "tcp transitory timeout %d",
+                         &tcp_transitory_timeout))
+        ;
+      else if (unformat (input, "icmp timeout %d", &icmp_timeout))
+        ;
+      else if (unformat (input, "port block size %d", &port_block_size))
+        ;
       else if (unformat (input, "outside VRF id %d",
                          &outside_vrf_id))
         ;
@@ -587,16 +1283,36 @@ snat_config (vlib_main_t * vm, unformat_input_t * input)
   sm->user_buckets = user_buckets;
   sm->user_memory_size = user_memory_size;
   sm->max_translations_per_user = max_translations_per_user;
+  sm->udp_timeout = udp_timeout;
+  sm->tcp_established_timeout = tcp_established_timeout;
+  sm->tcp_transitory_timeout = tcp_transitory_timeout;
+  sm->icmp_timeout = icmp_timeout;
+
+  if (port_block_size > sm->port_per_thread || port_block_size > 0xffff)
+    return clib_error_return (0, "port block size %d larger than the %d "
+                              "ports of a thread", port_block_size,
+                              sm->port_per_thread);
+  sm->port_block_size = port_block_size;
   sm->outside_vrf_id = outside_vrf_id;
 
-  clib_bihash_init_8_8 (&sm->in2out, "in2out", translation_buckets,
-                        translation_memory_size);
+  /* Table sizes are per thread */
+  vec_foreach (tsm, sm->per_thread_data)
+    {
+      clib_bihash_init_8_8 (&tsm->in2out, "in2out", translation_buckets,
+                            translation_memory_size);
   
-  clib_bihash_init_8_8 (&sm->out2in, "out2in", translation_buckets,
-                        translation_memory_size);
+      clib_bihash_init_8_8 (&tsm->out2in, "out2in", translation_buckets,
+                            translation_memory_size);
+
+      clib_bihash_init_8_8 (&tsm->user_hash, "users", user_buckets,
+                            user_memory_size);
 
-  clib_bihash_init_8_8 (&sm->user_hash, "users", user_buckets,
-                        user_memory_size);
+      tsm->wheel.min_sched_time = 1.0;
+      tsm->wheel.max_sched_time = 1024.0;
+      timing_wheel_init (&tsm->wheel, snat_wheel_time (vlib_time_now (vm)),
+                         1e3 /* wheel ticks per second */);
+      tsm->last_expire_time = vlib_time_now (vm);
+    }
   return 0;
 }
 
@@ -628,7 +1344,11 @@ u8 * format_snat_session (u8 * s, va_list * args)
 
   s = format (s, "  i2o %U\n", format_snat_key, &sess->in2out);
   s = format (s, "    o2i %U\n", format_snat_key, &sess->out2in);
-  s = format (s, "       last heard %.2f\n", sess->last_heard);
+  s = format (s, "       last heard %.2f, expires %.2f\n",
+              sess->last_heard, sess->expire_time);
+  if (sess->in2out.protocol == SNAT_PROTOCOL_TCP)
+    s = format (s, "       tcp %s\n", snat_tcp_session_established (sess) 
+                ? "established" : "transitory");
   s = format (s, "       total pkts %d, total bytes %lld\n",
               sess->total_pkts, sess->total_bytes);
 
@@ -637,7 +1357,8 @@ u8 * format_snat_session (u8 * s, va_list * args)
 
 u8 * format_snat_user (u8 * s, va_list * args)
 {
-  snat_main_t * sm = va_arg (*args, snat_main_t *);
+  snat_main_per_thread_data_t * tsm = 
+    va_arg (*args, snat_main_per_thread_data_t *);
   snat_user_t * u = va_arg (*args, snat_user_t *);
   int verbose = va_arg (*args, int);
   dlist_elt_t * head, * elt;
@@ -652,20 +1373,20 @@ u8 * format_snat_user (u8 * s, va_list * args)
     return s;
 
   head_index = u->sessions_per_user_list_head_index;
-  head = pool_elt_at_index (sm->list_pool, head_index);
+  head = pool_elt_at_index (tsm->list_pool, head_index);
 
   elt_index = head->next;
-  elt = pool_elt_at_index (sm->list_pool, elt_index);
+  elt = pool_elt_at_index (tsm->list_pool, elt_index);
   session_index = elt->value;
 
   while (session_index != ~0)
     {
-      sess = pool_elt_at_index (sm->sessions, session_index);
+      sess = pool_elt_at_index (tsm->sessions, session_index);
 
-      s = format (s, "  %U\n", format_snat_session, sm, sess);
+      s = format (s, "  %U\n", format_snat_session, &snat_main, sess);
 
       elt_index = elt->next;
-      elt = pool_elt_at_index (sm->list_pool, elt_index);
+      elt = pool_elt_at_index (tsm->list_pool, elt_index);
       session_index = elt->value;
     }
 
@@ -679,31 +1400,64 @@ show_snat_command_fn (vlib_main_t * vm,
 {
   int verbose = 0;
   snat_main_t * sm = &snat_main;
+  snat_main_per_thread_data_t * tsm;
+  snat_det_map_t * dm;
   snat_user_t * u;
+  u32 n_users = 0, n_sessions = 0;
 
   if (unformat (input, "detail"))
     verbose = 1;
   else if (unformat (input, "verbose"))
     verbose = 2;
 
+  vec_foreach (tsm, sm->per_thread_data)
+    {
+      n_users += pool_elts (tsm->users);
+      n_sessions += pool_elts (tsm->sessions);
+    }
+
   vlib_cli_output (vm, "%d users, %d outside addresses, %d active sessions",
-                   pool_elts (sm->users),
-                   vec_len (sm->addresses),
-                   pool_elts (sm->sessions));
+                   n_users, vec_len (sm->addresses), n_sessions);
+
+  if (sm->num_workers)
+    vlib_cli_output (vm, "%d workers, %d outside ports per worker",
+                     sm->num_workers, sm->port_per_thread);
+
+  if (sm->port_block_size)
+    vlib_cli_output (vm, "port block size %d", sm->port_block_size);
+
+  vec_foreach (dm, sm->det_maps)
+    vlib_cli_output (vm, "deterministic %U/%d -> %U/%d, %d hosts per "
+                     "address, %d ports per host",
+                     format_ip4_address, &dm->in_addr, dm->in_plen,
+                     format_ip4_address, &dm->out_addr, dm->out_plen,
+                     dm->sharing_ratio, dm->ports_per_host);
+
+  vlib_cli_output (vm, "timeouts: udp %ds, tcp established %ds, "
+                   "tcp transitory %ds, icmp %ds", sm->udp_timeout,
+                   sm->tcp_established_timeout, sm->tcp_transitory_timeout,
+                   sm->icmp_timeout);
   
   if (verbose > 0)
     {
-      vlib_cli_output (vm, "%U", format_bihash_8_8, &sm->in2out,
-                       verbose - 1);
-      vlib_cli_output (vm, "%U", format_bihash_8_8, &sm->out2in,
-                       verbose - 1);
-      vlib_cli_output (vm, "%d list pool elements",
-                       pool_elts (sm->list_pool));
-
-      pool_foreach (u, sm->users,
-      ({
-        vlib_cli_output (vm, "%U", format_snat_user, sm, u, verbose - 1);
-      }));
+      vec_foreach (tsm, sm->per_thread_data)
+        {
+          if (pool_elts (tsm->users) == 0)
+            continue;
+
+          vlib_cli_output (vm, "thread %d:", tsm - sm->per_thread_data);
+          vlib_cli_output (vm, "%U", format_bihash_8_8, &tsm->in2out,
+                           verbose - 1);
+          vlib_cli_output (vm, "%U", format_bihash_8_8, &tsm->out2in,
+                           verbose - 1);
+          vlib_cli_output (vm, "%d list pool elements",
+                           pool_elts (tsm->list_pool));
+
+          pool_foreach (u, tsm->users,
+          ({
+            vlib_cli_output (vm, "%U", format_snat_user, tsm, u, verbose - 1);
+          }));
+        }
     }
 
   return 0;
@@ -25,8 +25,11 @@
 #include <vnet/api_errno.h>
 #include <vppinfra/bihash_8_8.h>
 #include <vppinfra/dlist.h>
+#include <vppinfra/timing_wheel.h>
 #include <vppinfra/error.h>
+#include <vlib/threads.h>
 #include <vlibapi/api.h>
+#include <snat/snat_ipfix_logging.h>
 
 /* Key */
 typedef struct {
@@ -85,22 +88,86 @@ typedef CLIB_PACKED(struct {
   /* Outside address */
   u32 outside_address_index;    /* 64-67 */
 
+  /* Time the session's expiry timer is armed for */
+  f64 expire_time;              /* 68-75 */
+
 }) snat_session_t;
 
 #define SNAT_SESSION_STATIC (1<<0)
 
+/* TCP connection state, from the flags seen in either direction */
+#define SNAT_SESSION_TCP_SYN_IN2OUT (1<<1)
+#define SNAT_SESSION_TCP_SYN_OUT2IN (1<<2)
+#define SNAT_SESSION_TCP_FIN_IN2OUT (1<<3)
+#define SNAT_SESSION_TCP_FIN_OUT2IN (1<<4)
+#define SNAT_SESSION_TCP_RST (1<<5)
+
+#define SNAT_SESSION_TCP_SYN \
+  (SNAT_SESSION_TCP_SYN_IN2OUT | SNAT_SESSION_TCP_SYN_OUT2IN)
+#define SNAT_SESSION_TCP_FIN \
+  (SNAT_SESSION_TCP_FIN_IN2OUT | SNAT_SESSION_TCP_FIN_OUT2IN)
+#define SNAT_SESSION_TCP_STATE \
+  (SNAT_SESSION_TCP_SYN | SNAT_SESSION_TCP_FIN | SNAT_SESSION_TCP_RST)
+
+/* Contiguous outside ports reserved for one user */
+typedef struct {
+  u32 address_index;
+  /* Host byte order */
+  u16 first_port;
+  u16 n_busy;
+  uword * busy_bitmap;
+} snat_port_block_t;
+
 typedef struct {
   ip4_address_t addr;
   u32 sessions_per_user_list_head_index;
   u32 nsessions;
+  u32 fib_index;
+  /* Port blocks held by the user, when port_block_size is set */
+  snat_port_block_t * port_blocks;
 } snat_user_t;
 
+/*
+ * Deterministic NAT: every inside host of in_addr/in_plen owns a fixed
+ * range of ports_per_host ports on one address of out_addr/out_plen.
+ * Either side of a translation can be computed from the other, so
+ * nothing needs to be allocated or logged per session.
+ */
+typedef struct {
+  ip4_address_t in_addr;
+  u8 in_plen;
+  ip4_address_t out_addr;
+  u8 out_plen;
+  /* Inside hosts sharing an outside address */
+  u32 sharing_ratio;
+  u16 ports_per_host;
+} snat_det_map_t;
+
+/* Outside ports below this value are never allocated */
+#define SNAT_FIRST_PORT 1024
+
+/* Default session timeouts in seconds, see RFC 4787, 5382 and 5508 */
+#define SNAT_UDP_TIMEOUT 300
+#define SNAT_TCP_ESTABLISHED_TIMEOUT 7440
+#define SNAT_TCP_TRANSITORY_TIMEOUT 240
+#define SNAT_ICMP_TIMEOUT 60
+
+/* Most sessions a thread expires per frame it processes */
+#define SNAT_EXPIRE_BATCH 256
+
 typedef struct {
   ip4_address_t addr;
-  u32 busy_ports;
+  /* Busy ports, counted per thread port range */
+  u32 * busy_ports_per_thread;
   uword * busy_port_bitmap;
 } snat_address_t;
 
+/*
+ * Translation state owned by one thread. Sessions of a given user
+ * always live on the same thread, and the outside ports that thread
+ * hands out come from its own slice of each outside address's port
+ * space, so no locking is needed on the data path.
+ */
 typedef struct {
   /* Main lookup tables */
   clib_bihash_8_8_t out2in;
@@ -115,15 +182,54 @@ typedef struct {
   /* Session pool */
   snat_session_t * sessions;
 
-  /* Vector of outside addresses */
-  snat_address_t * addresses;
-
   /* Pool of doubly-linked list elements */
   dlist_elt_t * list_pool;
 
+  /* Frames being handed off to other threads, by thread index */
+  vlib_frame_queue_elt_t ** handoff_elts;
+
+  /* Frame queues found congested this frame, ~0 when not checked */
+  vlib_frame_queue_t ** handoff_congested;
+
+  /* Buffers dropped because their owner's frame queue was full */
+  u32 * handoff_drops;
+
   /* Randomize port allocation order */
   u32 random_seed;
 
+  /* Session expiry, see snat_wheel_time */
+  timing_wheel_t wheel;
+  u32 * expired;
+  f64 last_expire_time;
+
+  /* Set by snat-expire-walk for a quiet worker, see snat-expire-input */
+  volatile u32 expire_requested;
+} snat_main_per_thread_data_t;
+
+typedef struct {
+  /* Per-thread translation state, indexed by thread index */
+  snat_main_per_thread_data_t * per_thread_data;
+
+  /* Vector of outside addresses */
+  snat_address_t * addresses;
+
+  /* Worker threads, 0 workers means everything runs on thread 0 */
+  u32 first_worker_index;
+  u32 num_workers;
+
+  /* Size of each thread's slice of an outside address's ports */
+  u32 port_per_thread;
+
+  /* Ports reserved per user at a time, 0 to allocate single ports */
+  u32 port_block_size;
+
+  /* Deterministic mappings */
+  snat_det_map_t * det_maps;
+
+  /* handoff-dispatch next indices leading back to the snat nodes */
+  u32 in2out_handoff_next_index;
+  u32 out2in_handoff_next_index;
+
   /* ip4 feature path indices */
   u32 rx_feature_in2out;
   u32 rx_feature_out2in;
@@ -134,6 +240,10 @@ typedef struct {
   u32 user_buckets;
   u32 user_memory_size;
   u32 max_translations_per_user;
+  u32 udp_timeout;
+  u32 tcp_established_timeout;
+  u32 tcp_transitory_timeout;
+  u32 icmp_timeout;
   u32 outside_vrf_id;
   u32 outside_fib_index;
 
@@ -154,12 +264,36 @@ extern vlib_node_registration_t snat_in2out_node;
 extern vlib_node_registration_t snat_out2in_node;
 
 void snat_free_outside_address_and_port (snat_main_t * sm, 
+                                         u32 cpu_index,
                                          snat_session_key_t * k, 
                                          u32 address_index);
 
 int snat_alloc_outside_address_and_port (snat_main_t * sm, 
+                                         u32 cpu_index,
                                          snat_session_key_t * k,
                                          u32 * address_indexp);
+
+int snat_user_alloc_port (snat_main_t * sm, u32 cpu_index, snat_user_t * u,
+                          snat_session_key_t * in, snat_session_key_t * k,
+                          u32 * address_indexp);
+
+void snat_user_free_port (snat_main_t * sm, u32 cpu_index, snat_user_t * u,
+                          snat_session_key_t * k, u32 address_index);
+
+void snat_user_free_port_blocks (snat_main_t * sm, u32 cpu_index,
+                                 snat_user_t * u);
+
+int snat_det_add_del_map (snat_main_t * sm, ip4_address_t * in_addr, 
+                          u8 in_plen, ip4_address_t * out_addr, u8 out_plen,
+                          int is_add);
+
+u32 snat_worker_handoff (vlib_main_t * vm, vlib_node_runtime_t * node,
+                         u32 * buffers, u32 n_buffers, int is_in2out,
+                         u32 congested_error);
+
+void snat_expire_sessions (snat_main_t * sm, u32 cpu_index, f64 now,
+                           u32 max_expired);
+
 format_function_t format_snat_user;
 
 typedef struct {
@@ -178,4 +312,295 @@ typedef struct {
   u16 sequence;
 } icmp_echo_header_t;
 
+/*
+ * The expiry wheels run in milliseconds of vlib time rather than in
+ * cpu clocks: wheel elements keep 32 bits of time relative to the
+ * wheel base, too few clocks for timeouts of minutes or hours.
+ */
+static inline u64
+snat_wheel_time (f64 t)
+{
+  return (u64) (t * 1e3);
+}
+
+/*
+ * A TCP session is established once SYNs went both ways, and until
+ * FINs went both ways or a RST was seen (RFC 5382). Connections being
+ * set up or torn down get the transitory timeout.
+ */
+static inline int
+snat_tcp_session_established (snat_session_t * s)
+{
+  if (s->flags & SNAT_SESSION_TCP_RST)
+    return 0;
+  if ((s->flags & SNAT_SESSION_TCP_FIN) == SNAT_SESSION_TCP_FIN)
+    return 0;
+  return (s->flags & SNAT_SESSION_TCP_SYN) == SNAT_SESSION_TCP_SYN;
+}
+
+/* Idle timeout of a session, in seconds */
+static inline u32
+snat_session_timeout (snat_main_t * sm, snat_session_t * s)
+{
+  switch (s->in2out.protocol)
+    {
+    case SNAT_PROTOCOL_ICMP:
+      return sm->icmp_timeout;
+    case SNAT_PROTOCOL_TCP:
+      return snat_tcp_session_established (s) ? sm->tcp_established_timeout
+        : sm->tcp_transitory_timeout;
+    default:
+      return sm->udp_timeout;
+    }
+}
+
+/* Arm the expiry timer of a new or recycled session */
+static inline void
+snat_session_timer_start (snat_main_t * sm,
+                          snat_main_per_thread_data_t * tsm,
+                          snat_session_t * s, f64 now)
+{
+  s->expire_time = now + snat_session_timeout (sm, s);
+  timing_wheel_insert (&tsm->wheel, snat_wheel_time (s->expire_time),
+                       s - tsm->sessions);
+}
+
+/*
+ * Log a session create or delete event. Sessions of deterministic
+ * mappings, and of users given whole port blocks, are covered by the
+ * mapping and block events instead.
+ */
+static inline void
+snat_log_session (snat_main_t * sm, u32 cpu_index, snat_session_t * s,
+                  u8 nat_event)
+{
+  if (PREDICT_TRUE (!snat_ipfix_logging_main.enabled)
+      || s->outside_address_index == ~0 || sm->port_block_size)
+    return;
+
+  snat_ipfix_logging_nat44_ses (cpu_index, nat_event,
+                                s->in2out.addr.as_u32, s->out2in.addr.as_u32,
+                                s->in2out.protocol, s->in2out.port,
+                                s->out2in.port, s->in2out.fib_index);
+}
+
+/*
+ * Track the TCP state of a session from the flags of a translated
+ * segment. Only SYN, FIN and RST matter, so most segments return
+ * right away. When the connection starts closing, its timer is
+ * brought forward to the transitory timeout; the timer armed for the
+ * established timeout is left to go stale.
+ */
+static inline void
+snat_tcp_state_update (snat_main_t * sm, snat_main_per_thread_data_t * tsm,
+                       snat_session_t * s, tcp_header_t * tcp, f64 now,
+                       int is_in2out)
+{
+  u32 flags = s->flags;
+  f64 expire_time;
+
+  if (PREDICT_TRUE (!(tcp->flags & 
+                      (TCP_FLAG_SYN | TCP_FLAG_FIN | TCP_FLAG_RST))))
+    return;
+
+  /* A new connection reusing the session starts over */
+  if ((tcp->flags & TCP_FLAG_SYN) 
+      && (flags & (SNAT_SESSION_TCP_FIN | SNAT_SESSION_TCP_RST)))
+    flags &= ~SNAT_SESSION_TCP_STATE;
+
+  if (tcp->flags & TCP_FLAG_SYN)
+    flags |= is_in2out ? SNAT_SESSION_TCP_SYN_IN2OUT 
+      : SNAT_SESSION_TCP_SYN_OUT2IN;
+  if (tcp->flags & TCP_FLAG_FIN)
+    flags |= is_in2out ? SNAT_SESSION_TCP_FIN_IN2OUT 
+      : SNAT_SESSION_TCP_FIN_OUT2IN;
+  if (tcp->flags & TCP_FLAG_RST)
+    flags |= SNAT_SESSION_TCP_RST;
+
+  if (flags == s->flags)
+    return;
+
+  s->flags = flags;
+
+  expire_time = now + snat_session_timeout (sm, s);
+  if (expire_time < s->expire_time)
+    {
+      s->expire_time = expire_time;
+      timing_wheel_insert (&tsm->wheel, snat_wheel_time (expire_time),
+                           s - tsm->sessions);
+    }
+}
+
+/* Expire sessions when the wheel is due or a batch is left over */
+static inline void
+snat_maybe_expire_sessions (snat_main_t * sm,
+                            snat_main_per_thread_data_t * tsm,
+                            u32 cpu_index, f64 now)
+{
+  if (PREDICT_FALSE (vec_len (tsm->expired) 
+                     || now - tsm->last_expire_time >= 1.0))
+    snat_expire_sessions (sm, cpu_index, now, SNAT_EXPIRE_BATCH);
+}
+
+/*
+ * Offset of a thread in the outside port partition, ~0 for a thread
+ * which owns no slice (the main thread when there are workers)
+ */
+static inline u32
+snat_thread_offset (snat_main_t * sm, u32 cpu_index)
+{
+  if (!sm->num_workers)
+    return 0;
+  if (PREDICT_FALSE (cpu_index < sm->first_worker_index
+                     || cpu_index - sm->first_worker_index
+                     >= sm->num_workers))
+    return ~0;
+  return cpu_index - sm->first_worker_index;
+}
+
+static inline int
+snat_prefix_match (ip4_address_t * a, ip4_address_t * prefix, u8 plen)
+{
+  u32 mask = plen ? ~0U << (32 - plen) : 0;
+
+  return ((clib_net_to_host_u32 (a->as_u32) 
+           ^ clib_net_to_host_u32 (prefix->as_u32)) & mask) == 0;
+}
+
+static inline snat_det_map_t *
+snat_det_map_by_in (snat_main_t * sm, ip4_address_t * in_addr)
+{
+  snat_det_map_t * dm;
+
+  vec_foreach (dm, sm->det_maps)
+    if (snat_prefix_match (in_addr, &dm->in_addr, dm->in_plen))
+      return dm;
+  return 0;
+}
+
+static inline snat_det_map_t *
+snat_det_map_by_out (snat_main_t * sm, ip4_address_t * out_addr)
+{
+  snat_det_map_t * dm;
+
+  vec_foreach (dm, sm->det_maps)
+    if (snat_prefix_match (out_addr, &dm->out_addr, dm->out_plen))
+      return dm;
+  return 0;
+}
+
+/* Outside address and first port of an inside host */
+static inline void
+snat_det_forward (snat_det_map_t * dm, ip4_address_t * in_addr,
+                  ip4_address_t * out_addr, u16 * first_port)
+{
+  u32 in_offset;
+
+  in_offset = clib_net_to_host_u32 (in_addr->as_u32) 
+    - clib_net_to_host_u32 (dm->in_addr.as_u32);
+
+  out_addr->as_u32 = clib_host_to_net_u32 
+    (clib_net_to_host_u32 (dm->out_addr.as_u32) 
+     + in_offset / dm->sharing_ratio);
+  *first_port = SNAT_FIRST_PORT 
+    + (in_offset % dm->sharing_ratio) * dm->ports_per_host;
+}
+
+/* Inside host owning an outside address and port, 0 if there is none */
+static inline int
+snat_det_reverse (snat_det_map_t * dm, ip4_address_t * out_addr, u16 port,
+                  ip4_address_t * in_addr)
+{
+  u32 out_offset, host;
+
+  if (port < SNAT_FIRST_PORT)
+    return 0;
+
+  host = (port - SNAT_FIRST_PORT) / dm->ports_per_host;
+  if (host >= dm->sharing_ratio)
+    return 0;
+
+  out_offset = clib_net_to_host_u32 (out_addr->as_u32) 
+    - clib_net_to_host_u32 (dm->out_addr.as_u32);
+
+  in_addr->as_u32 = clib_host_to_net_u32 
+    (clib_net_to_host_u32 (dm->in_addr.as_u32) 
+     + out_offset * dm->sharing_ratio + host);
+  return 1;
+}
+
+/* Thread owning the translations of an inside user */
+static inline u32
+snat_user_owner (snat_main_t * sm, ip4_address_t * addr)
+{
+  u32 hash;
+
+  if (sm->num_workers == 0)
+    return 0;
+
+  hash = addr->as_u32;
+  hash ^= (hash >> 16);
+  hash ^= (hash >> 8);
+
+  return sm->first_worker_index + hash % sm->num_workers;
+}
+
+static inline u32
+snat_in2out_owner (snat_main_t * sm, ip4_header_t * ip)
+{
+  return snat_user_owner (sm, &ip->src_address);
+}
+
+/*
+ * Thread owning the translation an outside packet belongs to, derived
+ * from the port range its destination port (or ICMP identifier) falls
+ * in. Returns ~0 when no thread can own it.
+ */
+static inline u32
+snat_out2in_owner (snat_main_t * sm, ip4_header_t * ip)
+{
+  udp_header_t * udp;
+  u32 port, offset;
+
+  if (sm->num_workers == 0)
+    return 0;
+
+  udp = ip4_next_header (ip);
+
+  switch (ip->protocol)
+    {
+    case IP_PROTOCOL_UDP:
+    case IP_PROTOCOL_TCP:
+      port = clib_net_to_host_u16 (udp->dst_port);
+      break;
+    case IP_PROTOCOL_ICMP:
+      port = clib_net_to_host_u16 
+        (((icmp_echo_header_t *)((icmp46_header_t *) udp + 1))->identifier);
+      break;
+    default:
+      return ~0;
+    }
+
+  if (port < SNAT_FIRST_PORT)
+    return ~0;
+
+  /* Deterministic translations belong to the inside host's thread */
+  if (PREDICT_FALSE (vec_len (sm->det_maps) != 0))
+    {
+      snat_det_map_t * dm;
+      ip4_address_t in_addr;
+
+      dm = snat_det_map_by_out (sm, &ip->dst_address);
+      if (dm)
+        return snat_det_reverse (dm, &ip->dst_address, port, &in_addr) 
+          ? snat_user_owner (sm, &in_addr) : ~0;
+    }
+
+  offset = (port - SNAT_FIRST_PORT) / sm->port_per_thread;
+  if (offset >= sm->num_workers)
+    return ~0;
+
+  return sm->first_worker_index + offset;
+}
+
 #endif /* __included_snat_h__ */
@@ -0,0 +1,551 @@
+/*
+ * snat_ipfix_logging.c - NAT44 event logging via IPFIX
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <vnet/vnet.h>
+#include <vlib/threads.h>
+#include <vnet/flow/flow_report.h>
+#include <snat/snat.h>
+#include <snat/snat_ipfix_logging.h>
+
+/*
+ * Each thread builds its own data packets from a copy of the ip4, udp
+ * and message headers of the template rewrite, so recording an event
+ * takes no lock. A packet is sent when the next record would exceed
+ * the collector path MTU, or when it has waited for
+ * SNAT_IPFIX_FLUSH_INTERVAL seconds.
+ */
+
+snat_ipfix_logging_main_t snat_ipfix_logging_main;
+
+#define foreach_snat_ipfix_nat44_session_field  \
+_(observationTimeMilliseconds, 8)               \
+_(natEvent, 1)                                  \
+_(sourceIPv4Address, 4)                         \
+_(postNATSourceIPv4Address, 4)                  \
+_(protocolIdentifier, 1)                        \
+_(sourceTransportPort, 2)                       \
+_(postNAPTSourceTransportPort, 2)               \
+_(ingressVRFID, 4)
+
+#define foreach_snat_ipfix_port_block_field     \
+_(observationTimeMilliseconds, 8)               \
+_(natEvent, 1)                                  \
+_(sourceIPv4Address, 4)                         \
+_(postNATSourceIPv4Address, 4)                  \
+_(portRangeStart, 2)                            \
+_(portRangeEnd, 2)                              \
+_(ingressVRFID, 4)
+
+#define _(id,length) + length
+#define SNAT_IPFIX_NAT44_SESSION_RECORD_SIZE \
+  (0 foreach_snat_ipfix_nat44_session_field)
+#define SNAT_IPFIX_PORT_BLOCK_RECORD_SIZE \
+  (0 foreach_snat_ipfix_port_block_field)
+
+static u32 snat_ipfix_record_size[SNAT_IPFIX_N_TEMPLATES] = {
+  [SNAT_IPFIX_NAT44_SESSION] = SNAT_IPFIX_NAT44_SESSION_RECORD_SIZE,
+  [SNAT_IPFIX_PORT_BLOCK] = SNAT_IPFIX_PORT_BLOCK_RECORD_SIZE,
+};
+#undef _
+
+static u16 snat_ipfix_template_id[SNAT_IPFIX_N_TEMPLATES] = {
+  [SNAT_IPFIX_NAT44_SESSION] = 256,
+  [SNAT_IPFIX_PORT_BLOCK] = 257,
+};
+
+static u8 snat_ipfix_ip_protocol[] = {
+  [SNAT_PROTOCOL_UDP] = IP_PROTOCOL_UDP,
+  [SNAT_PROTOCOL_TCP] = IP_PROTOCOL_TCP,
+  [SNAT_PROTOCOL_ICMP] = IP_PROTOCOL_ICMP,
+};
+
+static u8 * snat_template_rewrite (flow_report_main_t * frm,
+                                   flow_report_t * fr,
+                                   ip4_address_t * collector_address,
+                                   ip4_address_t * src_address,
+                                   u16 collector_port)
+{
+  snat_ipfix_logging_main_t * silm = &snat_ipfix_logging_main;
+  u32 template_index = pointer_to_uword (fr->opaque);
+  ip4_header_t * ip;
+  udp_header_t * udp;
+  ipfix_message_header_t * h;
+  ipfix_set_header_t * s;
+  ipfix_template_header_t * t;
+  ipfix_field_specifier_t * f;
+  ipfix_field_specifier_t * first_field;
+  u8 * rewrite = 0;
+  ip4_ipfix_template_packet_t * tp;
+  u8 data_header[SNAT_IPFIX_DATA_HEADER_SIZE];
+  u32 field_count = 0;
+
+#define _(id,length) field_count++;
+  if (template_index == SNAT_IPFIX_NAT44_SESSION)
+    {
+      foreach_snat_ipfix_nat44_session_field;
+    }
+  else
+    {
+      foreach_snat_ipfix_port_block_field;
+    }
+#undef _
+
+  /* allocate rewrite space */
+  vec_validate_aligned (rewrite,
+                        sizeof (ip4_ipfix_template_packet_t)
+                        + field_count * sizeof (ipfix_field_specifier_t) - 1,
+                        CLIB_CACHE_LINE_BYTES);
+
+  tp = (ip4_ipfix_template_packet_t *) rewrite;
+  ip = (ip4_header_t *) &tp->ip4;
+  udp = (udp_header_t *) (ip+1);
+  h = (ipfix_message_header_t *)(udp+1);
+  s = (ipfix_set_header_t *)(h+1);
+  t = (ipfix_template_header_t *)(s+1);
+  first_field = f = (ipfix_field_specifier_t *)(t+1);
+
+  ip->ip_version_and_header_length = 0x45;
+  ip->ttl = 254;
+  ip->protocol = IP_PROTOCOL_UDP;
+  ip->src_address.as_u32 = src_address->as_u32;
+  ip->dst_address.as_u32 = collector_address->as_u32;
+  udp->src_port = clib_host_to_net_u16 (fr->src_port);
+  udp->dst_port = clib_host_to_net_u16 (collector_port);
+
+  /* FIXUP: message header export_time */
+  /* FIXUP: message header sequence_number */
+  h->domain_id = clib_host_to_net_u32 (fr->domain_id);
+
+#define _(id,length)                                                    \
+  f->e_id_length = ipfix_e_id_length (0 /* enterprise */, id, length);  \
+  f++;
+  if (template_index == SNAT_IPFIX_NAT44_SESSION)
+    {
+      foreach_snat_ipfix_nat44_session_field;
+    }
+  else
+    {
+      foreach_snat_ipfix_port_block_field;
+    }
+#undef _
+
+  ASSERT (f - first_field);
+  /* Field count in this template */
+  t->id_count = ipfix_id_count (snat_ipfix_template_id[template_index],
+                                f - first_field);
+
+  /* set length in octets*/
+  s->set_id_length = ipfix_set_id_length (2 /* set_id */, (u8 *) f - (u8 *)s);
+
+  /* message length in octets */
+  h->version_length = version_length ((u8 *)f - (u8 *)h);
+
+  ip->length = clib_host_to_net_u16 ((u8 *)f - (u8 *)ip);
+  ip->checksum = ip4_header_checksum (ip);
+  udp->length = clib_host_to_net_u16 ((u8 *)f - (u8 *)udp);
+
+  /*
+   * Data packets start with the same ip4, udp and message headers,
+   * less the lengths which are set when a packet completes. Workers
+   * copy them while filling packets, so only change them with the
+   * workers stopped.
+   */
+  clib_memcpy (data_header, rewrite, SNAT_IPFIX_DATA_HEADER_SIZE);
+  ip = (ip4_header_t *) data_header;
+  udp = (udp_header_t *) (ip+1);
+  h = (ipfix_message_header_t *)(udp+1);
+  ip->length = ip->checksum = 0;
+  udp->length = 0;
+  h->version_length = 0;
+
+  if (!silm->data_header_valid
+      || memcmp (silm->data_header, data_header, sizeof (data_header)))
+    {
+      vlib_worker_thread_barrier_sync (frm->vlib_main);
+      clib_memcpy (silm->data_header, data_header, sizeof (data_header));
+      silm->data_header_valid = 1;
+      vlib_worker_thread_barrier_release (frm->vlib_main);
+    }
+
+  return rewrite;
+}
+
+static vlib_frame_t * snat_send_data (flow_report_main_t * frm,
+                                      flow_report_t * fr,
+                                      vlib_frame_t * f,
+                                      u32 * to_next,
+                                      u32 node_index)
+{
+  snat_ipfix_logging_main_t * silm = &snat_ipfix_logging_main;
+  vlib_main_t * vm = frm->vlib_main;
+
+  /* Data packets are sent by the threads which fill them */
+  snat_ipfix_logging_maybe_flush (vm, 0 /* cpu_index */, vlib_time_now (vm));
+
+  /* Templates carry the sequence number of the next data record */
+  fr->sequence_number = silm->sequence_number;
+
+  return f;
+}
+
+static inline vlib_main_t *
+snat_ipfix_vm (u32 cpu_index)
+{
+  return cpu_index ? vlib_mains[cpu_index] : vlib_get_main ();
+}
+
+static inline u64
+snat_ipfix_time_ms (flow_report_main_t * frm, f64 now)
+{
+  return (u64) ((((f64) frm->unix_time_0) + (now - frm->vlib_time_0)) * 1e3);
+}
+
+static void
+snat_ipfix_send (flow_report_main_t * frm, snat_ipfix_per_thread_t * pt,
+                 vlib_main_t * vm, u32 template_index, f64 now)
+{
+  snat_ipfix_logging_main_t * silm = &snat_ipfix_logging_main;
+  snat_ipfix_buffer_t * b = &pt->buffers[template_index];
+  vlib_buffer_t * b0;
+  ip4_header_t * ip;
+  udp_header_t * udp;
+  ipfix_message_header_t * h;
+  ipfix_set_header_t * s;
+  u32 sequence_number;
+
+  b0 = vlib_get_buffer (vm, b->bi);
+  ip = vlib_buffer_get_current (b0);
+  udp = (udp_header_t *) (ip+1);
+  h = (ipfix_message_header_t *)(udp+1);
+  s = (ipfix_set_header_t *)(h+1);
+
+  sequence_number = __sync_fetch_and_add (&silm->sequence_number,
+                                          b->n_records);
+
+  s->set_id_length =
+    ipfix_set_id_length (snat_ipfix_template_id[template_index],
+                         b->next_offset - ((u8 *)s - (u8 *)ip));
+  h->version_length = version_length (b->next_offset - ((u8 *)h - (u8 *)ip));
+  h->export_time = clib_host_to_net_u32
+    ((u32) (((f64)frm->unix_time_0) + (now - frm->vlib_time_0)));
+  h->sequence_number = clib_host_to_net_u32 (sequence_number);
+
+  ip->length = clib_host_to_net_u16 (b->next_offset);
+  ip->checksum = ip4_header_checksum (ip);
+  udp->length = clib_host_to_net_u16 (b->next_offset - sizeof (*ip));
+
+  b0->current_length = b->next_offset;
+  b0->flags |= VLIB_BUFFER_TOTAL_LENGTH_VALID;
+
+  vec_add1 (pt->ready, b->bi);
+  b->bi = ~0;
+}
+
+/* Returns where to write the next record, 0 if no buffer is available */
+static u8 *
+snat_ipfix_record_start (vlib_main_t * vm, u32 cpu_index,
+                         u32 template_index, f64 now)
+{
+  snat_ipfix_logging_main_t * silm = &snat_ipfix_logging_main;
+  flow_report_main_t * frm = &flow_report_main;
+  snat_ipfix_per_thread_t * pt;
+  snat_ipfix_buffer_t * b;
+  u32 record_size = snat_ipfix_record_size[template_index];
+  vlib_buffer_t * b0;
+  u32 bi0;
+  u8 * p;
+
+  pt = vec_elt_at_index (silm->per_thread, cpu_index);
+  b = &pt->buffers[template_index];
+
+  if (b->bi != ~0 && b->next_offset + record_size > frm->path_mtu)
+    snat_ipfix_send (frm, pt, vm, template_index, now);
+
+  if (b->bi == ~0)
+    {
+      if (vlib_buffer_alloc (vm, &bi0, 1) != 1)
+        return 0;
+
+      b0 = vlib_get_buffer (vm, bi0);
+      clib_memcpy (b0->data, silm->data_header, SNAT_IPFIX_DATA_HEADER_SIZE);
+      b0->current_data = 0;
+      vnet_buffer (b0)->sw_if_index[VLIB_RX] = 0;
+      vnet_buffer (b0)->sw_if_index[VLIB_TX] = frm->fib_index;
+
+      b->bi = bi0;
+      b->next_offset = SNAT_IPFIX_DATA_HEADER_SIZE
+        + sizeof (ipfix_set_header_t);
+      b->n_records = 0;
+      b->first_record_time = now;
+    }
+
+  b0 = vlib_get_buffer (vm, b->bi);
+  p = b0->data + b->next_offset;
+  b->next_offset += record_size;
+  b->n_records++;
+
+  return p;
+}
+
+static inline u8 *
+snat_ipfix_put_u64 (u8 * p, u64 v)
+{
+  v = clib_host_to_net_u64 (v);
+  clib_memcpy (p, &v, sizeof (v));
+  return p + sizeof (v);
+}
+
+/* Values already in network byte order */
+static inline u8 *
+snat_ipfix_put_u32 (u8 * p, u32 v)
+{
+  clib_memcpy (p, &v, sizeof (v));
+  return p + sizeof (v);
+}
+
+static inline u8 *
+snat_ipfix_put_u16 (u8 * p, u16 v)
+{
+  clib_memcpy (p, &v, sizeof (v));
+  return p + sizeof (v);
+}
+
+static inline u32
+snat_ipfix_vrf_id (u32 fib_index)
+{
+  ip4_main_t * im = &ip4_main;
+
+  return clib_host_to_net_u32 (vec_elt_at_index (im->fibs,
+                                                 fib_index)->table_id);
+}
+
+/**
+ * @brief Log a NAT44 session create or delete event
+ *
+ * Addresses and ports are in network byte order.
+ */
+void snat_ipfix_logging_nat44_ses (u32 cpu_index, u8 nat_event,
+                                   u32 src_ip, u32 nat_src_ip,
+                                   u8 snat_proto, u16 src_port,
+                                   u16 nat_src_port, u32 fib_index)
+{
+  snat_ipfix_logging_main_t * silm = &snat_ipfix_logging_main;
+  flow_report_main_t * frm = &flow_report_main;
+  vlib_main_t * vm;
+  f64 now;
+  u8 * p;
+
+  if (!silm->enabled || !silm->data_header_valid)
+    return;
+
+  vm = snat_ipfix_vm (cpu_index);
+  now = vlib_time_now (vm);
+
+  p = snat_ipfix_record_start (vm, cpu_index, SNAT_IPFIX_NAT44_SESSION, now);
+  if (PREDICT_FALSE (p == 0))
+    return;
+
+  p = snat_ipfix_put_u64 (p, snat_ipfix_time_ms (frm, now));
+  *p++ = nat_event;
+  p = snat_ipfix_put_u32 (p, src_ip);
+  p = snat_ipfix_put_u32 (p, nat_src_ip);
+  *p++ = snat_ipfix_ip_protocol[snat_proto];
+  p = snat_ipfix_put_u16 (p, src_port);
+  p = snat_ipfix_put_u16 (p, nat_src_port);
+  p = snat_ipfix_put_u32 (p, snat_ipfix_vrf_id (fib_index));
+}
+
+/**
+ * @brief Log a port block allocation or release
+ *
+ * Addresses are in network byte order, ports in host byte order.
+ */
+void snat_ipfix_logging_port_block (u32 cpu_index, u8 nat_event,
+                                    u32 src_ip, u32 nat_src_ip,
+                                    u16 start_port, u16 end_port,
+                                    u32 fib_index)
+{
+  snat_ipfix_logging_main_t * silm = &snat_ipfix_logging_main;
+  flow_report_main_t * frm = &flow_report_main;
+  vlib_main_t * vm;
+  f64 now;
+  u8 * p;
+
+  if (!silm->enabled || !silm->data_header_valid)
+    return;
+
+  vm = snat_ipfix_vm (cpu_index);
+  now = vlib_time_now (vm);
+
+  p = snat_ipfix_record_start (vm, cpu_index, SNAT_IPFIX_PORT_BLOCK, now);
+  if (PREDICT_FALSE (p == 0))
+    return;
+
+  p = snat_ipfix_put_u64 (p, snat_ipfix_time_ms (frm, now));
+  *p++ = nat_event;
+  p = snat_ipfix_put_u32 (p, src_ip);
+  p = snat_ipfix_put_u32 (p, nat_src_ip);
+  p = snat_ipfix_put_u16 (p, clib_host_to_net_u16 (start_port));
+  p = snat_ipfix_put_u16 (p, clib_host_to_net_u16 (end_port));
+  p = snat_ipfix_put_u32 (p, snat_ipfix_vrf_id (fib_index));
+}
+
+/**
+ * @brief Send the completed data packets of a thread
+ *
+ * Partially filled packets are completed first if they are old enough,
+ * or unconditionally if force is set. Must run on the thread owning
+ * cpu_index, or under the worker barrier.
+ */
+void snat_ipfix_logging_flush (vlib_main_t * vm, u32 cpu_index, f64 now,
+                               int force)
+{
+  snat_ipfix_logging_main_t * silm = &snat_ipfix_logging_main;
+  flow_report_main_t * frm = &flow_report_main;
+  snat_ipfix_per_thread_t * pt;
+  snat_ipfix_buffer_t * b;
+  vlib_frame_t * f;
+  u32 * to_next;
+  u32 i, n, n_left;
+
+  pt = vec_elt_at_index (silm->per_thread, cpu_index);
+
+  for (i = 0; i < SNAT_IPFIX_N_TEMPLATES; i++)
+    {
+      b = &pt->buffers[i];
+      if (b->bi != ~0
+          && (force || now - b->first_record_time >= SNAT_IPFIX_FLUSH_INTERVAL))
+        snat_ipfix_send (frm, pt, vm, i, now);
+    }
+
+  n_left = vec_len (pt->ready);
+  i = 0;
+
+  while (n_left > 0)
+    {
+      f = vlib_get_frame_to_node (vm, silm->ip4_lookup_node_index);
+      to_next = vlib_frame_vector_args (f);
+      n = clib_min (n_left, VLIB_FRAME_SIZE);
+      clib_memcpy (to_next, pt->ready + i, n * sizeof (u32));
+      f->n_vectors = n;
+      vlib_put_frame_to_node (vm, silm->ip4_lookup_node_index, f);
+      i += n;
+      n_left -= n;
+    }
+
+  _vec_len (pt->ready) = 0;
+}
+
+int snat_ipfix_logging_enable_disable (int enable, u32 domain_id,
+                                       u16 src_port)
+{
+  snat_ipfix_logging_main_t * silm = &snat_ipfix_logging_main;
+  flow_report_main_t * frm = &flow_report_main;
+  vnet_flow_report_add_del_args_t a;
+  u32 i;
+  int rv;
+
+  if (enable == silm->enabled)
+    return 0;
+
+  silm->domain_id = domain_id;
+  silm->src_port = src_port;
+
+  memset (&a, 0, sizeof (a));
+  a.rewrite_callback = snat_template_rewrite;
+  a.flow_data_callback = snat_send_data;
+  a.is_add = enable;
+  a.domain_id = domain_id;
+  a.src_port = src_port;
+
+  for (i = 0; i < SNAT_IPFIX_N_TEMPLATES; i++)
+    {
+      a.opaque = uword_to_pointer (i, void *);
+      rv = vnet_flow_report_add_del (frm, &a);
+      if (rv && enable)
+        return rv;
+    }
+
+  /*
+   * Partially filled packets left behind are sent by their thread, or
+   * by the snat-expire-walk process if the thread is quiet.
+   */
+  silm->enabled = enable;
+  if (!enable)
+    silm->data_header_valid = 0;
+
+  return 0;
+}
+
+clib_error_t * snat_ipfix_logging_init (vlib_main_t * vm)
+{
+  snat_ipfix_logging_main_t * silm = &snat_ipfix_logging_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  snat_ipfix_per_thread_t * pt;
+  u32 i;
+
+  silm->enabled = 0;
+  silm->ip4_lookup_node_index =
+    vlib_get_node_by_name (vm, (u8 *) "ip4-lookup")->index;
+
+  vec_validate_aligned (silm->per_thread, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+  vec_foreach (pt, silm->per_thread)
+    for (i = 0; i < SNAT_IPFIX_N_TEMPLATES; i++)
+      pt->buffers[i].bi = ~0;
+
+  return 0;
+}
+
+static clib_error_t *
+snat_ipfix_logging_enable_disable_command_fn (vlib_main_t * vm,
+                                              unformat_input_t * input,
+                                              vlib_cli_command_t * cmd)
+{
+  u32 domain_id = 0;
+  u32 src_port = UDP_DST_PORT_ipfix;
+  u8 enable = 1;
+  int rv;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "domain %d", &domain_id))
+        ;
+      else if (unformat (input, "src-port %d", &src_port))
+        ;
+      else if (unformat (input, "disable"))
+        enable = 0;
+      else
+        return clib_error_return (0, "unknown input '%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (src_port > 0xffff)
+    return clib_error_return (0, "invalid src-port %d", src_port);
+
+  rv = snat_ipfix_logging_enable_disable (enable, domain_id, (u16) src_port);
+  if (rv)
+    return clib_error_return (0, "ipfix logging enable failed, rv %d", rv);
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (snat_ipfix_logging_enable_disable_command, static) = {
+  .path = "snat ipfix logging",
+  .function = snat_ipfix_logging_enable_disable_command_fn,
+  .short_help = "snat ipfix logging [domain <domain-id>] "
+                "[src-port <port>] [disable]",
+};
@@ -0,0 +1,121 @@
+/*
+ * snat_ipfix_logging.h - NAT44 event logging via IPFIX
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __included_snat_ipfix_logging_h__
+#define __included_snat_ipfix_logging_h__
+
+#include <vnet/ip/ip.h>
+#include <vnet/flow/flow_report.h>
+
+/* natEvent values, from the IANA "NAT Event Type" registry */
+typedef enum {
+  SNAT_IPFIX_NAT44_SESSION_CREATE = 1,
+  SNAT_IPFIX_NAT44_SESSION_DELETE = 2,
+  SNAT_IPFIX_NAT_PORT_BLOCK_ALLOC = 14,
+  SNAT_IPFIX_NAT_PORT_BLOCK_FREE = 15,
+} snat_ipfix_nat_event_t;
+
+typedef enum {
+  SNAT_IPFIX_NAT44_SESSION = 0,
+  SNAT_IPFIX_PORT_BLOCK,
+  SNAT_IPFIX_N_TEMPLATES,
+} snat_ipfix_template_t;
+
+/* ip4, udp and ipfix message headers at the front of each data packet */
+#define SNAT_IPFIX_DATA_HEADER_SIZE                             \
+  (sizeof (ip4_header_t) + sizeof (udp_header_t)                \
+   + sizeof (ipfix_message_header_t))
+
+/* Seconds a partially filled data packet may wait before it is sent */
+#define SNAT_IPFIX_FLUSH_INTERVAL 1.0
+
+typedef struct {
+  /* Data packet being filled, ~0 if none */
+  u32 bi;
+  /* Offset of the next record */
+  u16 next_offset;
+  u16 n_records;
+  /* When the first record went in */
+  f64 first_record_time;
+} snat_ipfix_buffer_t;
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  snat_ipfix_buffer_t buffers[SNAT_IPFIX_N_TEMPLATES];
+  /* Completed data packets waiting to be sent */
+  u32 * ready;
+} snat_ipfix_per_thread_t;
+
+typedef struct {
+  u8 enabled;
+
+  /* Set once a collector is known and the data header is built */
+  u8 data_header_valid;
+  u8 data_header[SNAT_IPFIX_DATA_HEADER_SIZE];
+
+  /* Shared by all threads, records are numbered as packets complete */
+  volatile u32 sequence_number;
+
+  u32 domain_id;
+  u16 src_port;
+
+  /* Indexed by cpu_index */
+  snat_ipfix_per_thread_t * per_thread;
+
+  u32 ip4_lookup_node_index;
+} snat_ipfix_logging_main_t;
+
+extern snat_ipfix_logging_main_t snat_ipfix_logging_main;
+
+clib_error_t * snat_ipfix_logging_init (vlib_main_t * vm);
+int snat_ipfix_logging_enable_disable (int enable, u32 domain_id,
+                                       u16 src_port);
+void snat_ipfix_logging_nat44_ses (u32 cpu_index, u8 nat_event,
+                                   u32 src_ip, u32 nat_src_ip,
+                                   u8 snat_proto, u16 src_port,
+                                   u16 nat_src_port, u32 fib_index);
+void snat_ipfix_logging_port_block (u32 cpu_index, u8 nat_event,
+                                    u32 src_ip, u32 nat_src_ip,
+                                    u16 start_port, u16 end_port,
+                                    u32 fib_index);
+void snat_ipfix_logging_flush (vlib_main_t * vm, u32 cpu_index, f64 now,
+                               int force);
+
+static inline int
+snat_ipfix_logging_pending (u32 cpu_index)
+{
+  snat_ipfix_logging_main_t * silm = &snat_ipfix_logging_main;
+  snat_ipfix_per_thread_t * pt;
+
+  if (PREDICT_FALSE (cpu_index >= vec_len (silm->per_thread)))
+    return 0;
+
+  pt = vec_elt_at_index (silm->per_thread, cpu_index);
+
+  return (pt->buffers[SNAT_IPFIX_NAT44_SESSION].bi != ~0
+          || pt->buffers[SNAT_IPFIX_PORT_BLOCK].bi != ~0
+          || vec_len (pt->ready));
+}
+
+/* Called once per frame from the data path */
+static inline void
+snat_ipfix_logging_maybe_flush (vlib_main_t * vm, u32 cpu_index, f64 now)
+{
+  if (PREDICT_FALSE (snat_ipfix_logging_pending (cpu_index)))
+    snat_ipfix_logging_flush (vm, cpu_index, now, 0 /* force */);
+}
+
+#endif /* __included_snat_ipfix_logging_h__ */
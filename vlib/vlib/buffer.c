@@ -918,11 +918,13 @@ again:
       if (follow_buffer_next)
 	{
 	  n[0] = b0->next_buffer;
-	  free_next0 = free0 && (b0->flags & VLIB_BUFFER_NEXT_PRESENT) != 0;
+	  free_next0 = free0 && (b0->flags & VLIB_BUFFER_NEXT_PRESENT) != 0
+	    && vlib_buffer_put_ref (vm, b0->next_buffer);
 	  n += free_next0;
 
 	  n[0] = b1->next_buffer;
-	  free_next1 = free1 && (b1->flags & VLIB_BUFFER_NEXT_PRESENT) != 0;
+	  free_next1 = free1 && (b1->flags & VLIB_BUFFER_NEXT_PRESENT) != 0
+	    && vlib_buffer_put_ref (vm, b1->next_buffer);
 	  n += free_next1;
 	}
       else
@@ -1002,7 +1004,8 @@ again:
       if (follow_buffer_next)
 	{
 	  n[0] = b0->next_buffer;
-	  free_next0 = free0 && (b0->flags & VLIB_BUFFER_NEXT_PRESENT) != 0;
+	  free_next0 = free0 && (b0->flags & VLIB_BUFFER_NEXT_PRESENT) != 0
+	    && vlib_buffer_put_ref (vm, b0->next_buffer);
 	  n += free_next0;
 	}
       else
@@ -136,7 +136,11 @@ typedef struct
                       if VLIB_PACKET_IS_TRACED flag is set.
                    */
   u32 recycle_count; /**< Used by L2 path recycle code */
-  u32 opaque2[14];  /**< More opaque data, currently unused */
+  u32 n_add_refs; /**< Number of additional references to this buffer,
+                     held by clone headers chained in front of it.
+                     Zero for a buffer with a single owner.
+                  */
+  u32 opaque2[13];  /**< More opaque data, currently unused */
 
   /***** end of second cache line */
     CLIB_CACHE_LINE_ALIGN_MARK (cacheline2);
@@ -422,6 +422,24 @@ u32 vlib_buffer_add_data (vlib_main_t * vm,
 			  u32 free_list_index,
 			  u32 buffer_index, void *data, u32 n_data_bytes);
 
+/** \brief Check if a buffer is shared by clone headers
+
+    Shared buffers are the tail of several packets at once and must be
+    treated as read-only; see vlib_buffer_clone().
+
+    @param b - (vlib_buffer_t *) buffer
+    @return - (int) 1 if other packets hold references to the buffer
+*/
+always_inline int
+vlib_buffer_is_shared (vlib_buffer_t * b)
+{
+#if DPDK == 1
+  return rte_mbuf_refcnt_read (rte_mbuf_from_vlib_buffer (b)) > 1;
+#else
+  return b->n_add_refs != 0;
+#endif
+}
+
 /*
  * vlib_buffer_chain_* functions provide a way to create long buffers.
  * When DPDK is enabled, the 'hidden' DPDK header is taken care of transparently.
@@ -449,6 +467,7 @@ vlib_buffer_chain_buffer (vlib_main_t * vm,
 			  vlib_buffer_t * last, u32 next_bi)
 {
   vlib_buffer_t *next_buffer = vlib_get_buffer (vm, next_bi);
+  ASSERT (!vlib_buffer_is_shared (last));
   last->next_buffer = next_bi;
   last->flags |= VLIB_BUFFER_NEXT_PRESENT;
   next_buffer->current_length = 0;
@@ -477,6 +496,7 @@ always_inline void
 vlib_buffer_chain_increase_length (vlib_buffer_t * first,
 				   vlib_buffer_t * last, i32 len)
 {
+  ASSERT (!vlib_buffer_is_shared (last));
   last->current_length += len;
   if (first != last)
     first->total_length_not_including_first_buffer += len;
@@ -668,6 +688,195 @@ vlib_buffer_init_two_for_free_list (vlib_buffer_t * _dst0,
   ASSERT (dst1->b.total_length_not_including_first_buffer == 0);
 }
 
+/** \brief Drop one reference to a buffer shared by clone headers
+
+    @param vm - (vlib_main_t *) vlib main data structure pointer
+    @param bi - (u32) buffer index
+    @return - (int) 1 if that was the last reference and the buffer
+    must be freed, 0 if other clones still hold it
+*/
+always_inline int
+vlib_buffer_put_ref (vlib_main_t * vm, u32 bi)
+{
+  vlib_buffer_t *b = vlib_get_buffer (vm, bi);
+  u32 n_refs;
+
+  do
+    {
+      n_refs = b->n_add_refs;
+      if (PREDICT_TRUE (n_refs == 0))
+	return 1;
+    }
+  while (!__sync_bool_compare_and_swap (&b->n_add_refs, n_refs, n_refs - 1));
+
+  return 0;
+}
+
+always_inline void
+vlib_buffer_clone_header (vlib_buffer_t * d, vlib_buffer_t * s)
+{
+  d->current_data = s->current_data;
+  d->flags = s->flags & ~VLIB_BUFFER_RECYCLE;
+  d->trace_index = s->trace_index;
+  clib_memcpy (d->opaque, s->opaque, sizeof (s->opaque));
+}
+
+/** \brief Copy a packet into buffers of its own
+
+    The copy shares no data with the source, which is left as is.
+    A packet that fits in one buffer is copied into one buffer, so
+    this also turns a clone back into a single segment packet.
+
+    @param vm - (vlib_main_t *) vlib main data structure pointer
+    @param s - (vlib_buffer_t *) first buffer of the packet to copy
+    @return - (u32) buffer index of the copy, ~0 if buffers ran out
+*/
+always_inline u32
+vlib_buffer_copy (vlib_main_t * vm, vlib_buffer_t * s)
+{
+  vlib_buffer_t *d, *last;
+  u32 bi;
+
+  if (vlib_buffer_alloc (vm, &bi, 1) != 1)
+    return ~0;
+
+  d = last = vlib_get_buffer (vm, bi);
+  vlib_buffer_clone_header (d, s);
+  vlib_buffer_chain_init (d);
+
+  while (1)
+    {
+      if (vlib_buffer_chain_append_data_with_alloc
+	  (vm, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX, d, &last,
+	   vlib_buffer_get_current (s), s->current_length)
+	  != s->current_length)
+	{
+	  vlib_buffer_free (vm, &bi, 1);
+	  return ~0;
+	}
+      if (!(s->flags & VLIB_BUFFER_NEXT_PRESENT))
+	break;
+      s = vlib_get_buffer (vm, s->next_buffer);
+    }
+
+  return bi;
+}
+
+/** \brief Replicate a packet without copying its payload
+
+    Each clone gets a private header buffer holding the first
+    head_end_offset bytes of the packet, chained in front of the
+    (shared) remainder of the source. The shared part is freed once
+    the last clone is freed. Packets no longer than head_end_offset are
+    copied outright, and the source itself is returned as the first
+    clone.
+
+    The shared part must be treated as read-only by every node the
+    clones visit; rewrites must stay within the first head_end_offset
+    bytes. vlib_buffer_is_shared() tells whether a buffer is such a
+    part, and vlib_buffer_copy() gives a clone a private copy when a
+    node can't live with that, or its output can't send buffer chains.
+
+    @param vm - (vlib_main_t *) vlib main data structure pointer
+    @param src_buffer - (u32) buffer index of the packet to replicate,
+    consumed by this call
+    @param buffers - (u32 *) array receiving the clones
+    @param n_buffers - (u16) number of clones wanted
+    @param head_end_offset - (u16) bytes of private header per clone
+    @return - (u16) number of clones created, may be less than
+    n_buffers if buffers ran out, never zero
+*/
+always_inline u16
+vlib_buffer_clone (vlib_main_t * vm, u32 src_buffer, u32 * buffers,
+		   u16 n_buffers, u16 head_end_offset)
+{
+  vlib_buffer_t *s = vlib_get_buffer (vm, src_buffer);
+  u32 tail_length;
+  u16 n_cloned;
+  u16 i;
+
+  ASSERT (n_buffers);
+  ASSERT (s->n_add_refs == 0);
+  ASSERT (s->current_length > 0);
+
+  buffers[0] = src_buffer;
+  if (n_buffers == 1)
+    return 1;
+
+  /* Short packet: a full copy is cheaper than a two buffer chain */
+  if ((s->flags & VLIB_BUFFER_NEXT_PRESENT) == 0
+      && s->current_length <= head_end_offset)
+    {
+      n_cloned = 1 + vlib_buffer_alloc (vm, buffers + 1, n_buffers - 1);
+      for (i = 1; i < n_cloned; i++)
+	{
+	  vlib_buffer_t *d = vlib_get_buffer (vm, buffers[i]);
+	  vlib_buffer_clone_header (d, s);
+	  d->current_length = s->current_length;
+	  clib_memcpy (vlib_buffer_get_current (d),
+		       vlib_buffer_get_current (s), s->current_length);
+#if DPDK == 1
+	  struct rte_mbuf *mb = rte_mbuf_from_vlib_buffer (d);
+	  mb->data_off = VLIB_BUFFER_PRE_DATA_SIZE + d->current_data;
+	  mb->data_len = mb->pkt_len = d->current_length;
+#endif
+	}
+      return n_cloned;
+    }
+
+  /* The source keeps at least one byte so it stays a proper segment */
+  head_end_offset = clib_min (head_end_offset, s->current_length - 1);
+  tail_length = vlib_buffer_length_in_chain (vm, s) - head_end_offset;
+
+  n_cloned = vlib_buffer_alloc (vm, buffers, n_buffers);
+  if (PREDICT_FALSE (n_cloned < 2))
+    {
+      if (n_cloned)
+	vlib_buffer_free (vm, buffers, n_cloned);
+      buffers[0] = src_buffer;
+      return 1;
+    }
+
+  for (i = 0; i < n_cloned; i++)
+    {
+      vlib_buffer_t *d = vlib_get_buffer (vm, buffers[i]);
+      vlib_buffer_clone_header (d, s);
+      d->flags |= VLIB_BUFFER_NEXT_PRESENT | VLIB_BUFFER_TOTAL_LENGTH_VALID;
+      d->current_length = head_end_offset;
+      d->next_buffer = src_buffer;
+      d->total_length_not_including_first_buffer = tail_length;
+      clib_memcpy (vlib_buffer_get_current (d),
+		   vlib_buffer_get_current (s), head_end_offset);
+#if DPDK == 1
+      struct rte_mbuf *mb = rte_mbuf_from_vlib_buffer (d);
+      struct rte_mbuf *smb = rte_mbuf_from_vlib_buffer (s);
+      mb->data_off = VLIB_BUFFER_PRE_DATA_SIZE + d->current_data;
+      mb->data_len = d->current_length;
+      mb->pkt_len = d->current_length + tail_length;
+      mb->nb_segs = 1 + smb->nb_segs;
+      mb->next = smb;
+#endif
+    }
+
+  vlib_buffer_advance (s, head_end_offset);
+
+#if DPDK == 1
+  {
+    /* rte_pktmbuf_free walks the whole chain from each clone, so every
+       segment carries the extra references */
+    struct rte_mbuf *mb = rte_mbuf_from_vlib_buffer (s);
+    mb->data_off = VLIB_BUFFER_PRE_DATA_SIZE + s->current_data;
+    mb->data_len = s->current_length;
+    for (; mb; mb = mb->next)
+      rte_mbuf_refcnt_update (mb, n_cloned - 1);
+  }
+#else
+  s->n_add_refs = n_cloned - 1;
+#endif
+
+  return n_cloned;
+}
+
 #if CLIB_DEBUG > 0
 u32 *vlib_buffer_state_validation_lock;
 uword *vlib_buffer_state_validation_hash;
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * buffer_test.c: vlib_buffer_clone / vlib_buffer_copy tester
+ *
+ * Clones packets of various sizes, checks the clones see the whole
+ * packet, that the shared part carries one reference per extra clone,
+ * and that it goes back to the free list with the last clone only.
+ */
+
+#include <vlib/vlib.h>
+
+#define BUFFER_TEST(_cond, _comment, _args...)				\
+do {									\
+  if (!(_cond))								\
+    return clib_error_return (0, "FAIL line %d: " _comment,		\
+			      __LINE__, ##_args);			\
+} while (0)
+
+/* Packets longer than a buffer become chains */
+static int
+buffer_test_fill (vlib_main_t * vm, vlib_buffer_t * b, u32 n_bytes, u8 seed)
+{
+  static u8 *data;
+  vlib_buffer_t *last = b;
+  u32 i;
+
+  vec_validate (data, n_bytes);
+  for (i = 0; i < n_bytes; i++)
+    data[i] = seed + i;
+
+  vlib_buffer_chain_init (b);
+  return vlib_buffer_chain_append_data_with_alloc
+    (vm, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX, b, &last, data,
+     n_bytes) == n_bytes;
+}
+
+/* Contents of the whole chain match what buffer_test_fill wrote */
+static int
+buffer_test_contents_ok (vlib_main_t * vm, u32 bi, u32 n_bytes, u8 seed)
+{
+  static u8 *contents;
+  u32 i;
+
+  vec_validate (contents, n_bytes);
+  if (vlib_buffer_contents (vm, bi, contents) != n_bytes)
+    return 0;
+  for (i = 0; i < n_bytes; i++)
+    if (contents[i] != (u8) (seed + i))
+      return 0;
+  return 1;
+}
+
+static clib_error_t *
+buffer_test_clone (vlib_main_t * vm, u32 n_bytes, u16 n_clones,
+		   u16 head_size, int verbose)
+{
+  u32 src, *clones = 0;
+  vlib_buffer_t *s, *c;
+  u16 n, i;
+  u8 seed = n_bytes;
+
+  BUFFER_TEST (vlib_buffer_alloc (vm, &src, 1) == 1, "alloc");
+  s = vlib_get_buffer (vm, src);
+  BUFFER_TEST (buffer_test_fill (vm, s, n_bytes, seed), "fill");
+
+  vec_validate (clones, n_clones - 1);
+  n = vlib_buffer_clone (vm, src, clones, n_clones, head_size);
+  BUFFER_TEST (n == n_clones, "%d bytes: %d of %d clones", n_bytes, n,
+	       n_clones);
+
+  for (i = 0; i < n; i++)
+    {
+      c = vlib_get_buffer (vm, clones[i]);
+      BUFFER_TEST (buffer_test_contents_ok (vm, clones[i], n_bytes, seed),
+		   "%d bytes: clone %d contents", n_bytes, i);
+      BUFFER_TEST (vlib_buffer_length_in_chain (vm, c) == n_bytes,
+		   "%d bytes: clone %d length", n_bytes, i);
+    }
+
+  if (n_bytes <= head_size || n_clones == 1)
+    {
+      /* Full copies: nothing is shared and the source is a clone */
+      BUFFER_TEST (clones[0] == src, "%d bytes: source not first", n_bytes);
+      for (i = 0; i < n; i++)
+	{
+	  c = vlib_get_buffer (vm, clones[i]);
+	  BUFFER_TEST (n_clones == 1 || !(c->flags & VLIB_BUFFER_NEXT_PRESENT),
+		       "%d bytes: copy %d chained", n_bytes, i);
+	  BUFFER_TEST (!vlib_buffer_is_shared (c),
+		       "%d bytes: copy %d shared", n_bytes, i);
+	}
+      vlib_buffer_free (vm, clones, n);
+      vec_free (clones);
+      return 0;
+    }
+
+  /* Each clone is a private head in front of the shared source */
+  for (i = 0; i < n; i++)
+    {
+      c = vlib_get_buffer (vm, clones[i]);
+      BUFFER_TEST (clones[i] != src, "%d bytes: source is a head", n_bytes);
+      BUFFER_TEST ((c->flags & VLIB_BUFFER_NEXT_PRESENT)
+		   && c->next_buffer == src, "%d bytes: clone %d not chained",
+		   n_bytes, i);
+      BUFFER_TEST (c->current_length
+		   == clib_min (head_size,
+				vlib_buffer_free_list_buffer_size
+				(vm, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX) - 1),
+		   "%d bytes: clone %d head %d bytes", n_bytes, i,
+		   c->current_length);
+    }
+
+#if DPDK == 1
+  BUFFER_TEST (rte_mbuf_refcnt_read (rte_mbuf_from_vlib_buffer (s)) == n,
+	       "%d bytes: refcnt %d", n_bytes,
+	       rte_mbuf_refcnt_read (rte_mbuf_from_vlib_buffer (s)));
+#else
+  BUFFER_TEST (s->n_add_refs == n - 1, "%d bytes: %d refs", n_bytes,
+	       s->n_add_refs);
+#endif
+
+  /* A full copy of a clone shares nothing */
+  {
+    u32 copy = vlib_buffer_copy (vm, vlib_get_buffer (vm, clones[0]));
+    BUFFER_TEST (copy != ~0, "%d bytes: copy failed", n_bytes);
+    c = vlib_get_buffer (vm, copy);
+    BUFFER_TEST (buffer_test_contents_ok (vm, copy, n_bytes, seed),
+		 "%d bytes: copy contents", n_bytes);
+    BUFFER_TEST (!vlib_buffer_is_shared (c), "%d bytes: copy shared",
+		 n_bytes);
+    if (n_bytes <= vlib_buffer_free_list_buffer_size
+	(vm, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX) - c->current_data)
+      BUFFER_TEST (!(c->flags & VLIB_BUFFER_NEXT_PRESENT),
+		   "%d bytes: copy chained", n_bytes);
+    vlib_buffer_free_one (vm, copy);
+  }
+
+  /* The source stays until the last clone is freed */
+  for (i = 0; i < n - 1; i++)
+    {
+      BUFFER_TEST (vlib_buffer_is_shared (s),
+		   "%d bytes: unshared with %d clones left", n_bytes, n - i);
+      vlib_buffer_free_one (vm, clones[i]);
+      BUFFER_TEST (buffer_test_contents_ok (vm, clones[n - 1], n_bytes, seed),
+		   "%d bytes: last clone contents after %d frees", n_bytes,
+		   i + 1);
+    }
+  BUFFER_TEST (!vlib_buffer_is_shared (s), "%d bytes: still shared",
+	       n_bytes);
+#if CLIB_DEBUG > 0
+  BUFFER_TEST (vlib_buffer_is_known (vm, src) == VLIB_BUFFER_KNOWN_ALLOCATED,
+	       "%d bytes: source freed early", n_bytes);
+#endif
+
+  vlib_buffer_free_one (vm, clones[n - 1]);
+#if CLIB_DEBUG > 0
+  BUFFER_TEST (vlib_buffer_is_known (vm, src) == VLIB_BUFFER_KNOWN_FREE,
+	       "%d bytes: source not freed", n_bytes);
+#endif
+
+  if (verbose)
+    vlib_cli_output (vm, "%d bytes, %d clones, head %d: ok", n_bytes, n,
+		     head_size);
+
+  vec_free (clones);
+  return 0;
+}
+
+static clib_error_t *
+test_buffer_clone_command_fn (vlib_main_t * vm,
+			      unformat_input_t * input,
+			      vlib_cli_command_t * cmd)
+{
+  static u32 sizes[] = { 60, 255, 256, 257, 1000, 1500, 9000 };
+  static u16 counts[] = { 1, 2, 7 };
+  clib_error_t *error;
+  u32 head_size = 256;
+  int verbose = 0;
+  u32 i, j;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "head %d", &head_size))
+	;
+      else if (unformat (input, "verbose"))
+	verbose = 1;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  for (i = 0; i < ARRAY_LEN (sizes); i++)
+    for (j = 0; j < ARRAY_LEN (counts); j++)
+      if ((error = buffer_test_clone (vm, sizes[i], counts[j], head_size,
+				      verbose)))
+	return error;
+
+  vlib_cli_output (vm, "buffer clone test OK");
+  return 0;
+}
+
+/* *INDENT-OFF* */
+VLIB_CLI_COMMAND (test_buffer_clone_command, static) = {
+  .path = "test buffer clone",
+  .short_help = "test buffer clone [head <n>] [verbose]",
+  .function = test_buffer_clone_command_fn,
+};
+/* *INDENT-ON* */
+
+/*
+ * fd.io coding-style-patch-verification: ON
+ *
+ * Local Variables:
+ * eval: (c-set-style "gnu")
+ * End:
+ */
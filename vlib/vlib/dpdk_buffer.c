@@ -943,6 +943,8 @@ vlib_buffer_chain_validate (vlib_main_t * vm, vlib_buffer_t * b_first)
   mb_first = rte_mbuf_from_vlib_buffer (b_first);
 
   mb_first->pkt_len = mb_first->data_len = b_first->current_length;
+  mb_first->data_off = VLIB_BUFFER_PRE_DATA_SIZE + b_first->current_data;
+  mb_first->nb_segs = 1;
   while (b->flags & VLIB_BUFFER_NEXT_PRESENT)
     {
       b = vlib_get_buffer (vm, b->next_buffer);
@@ -952,8 +954,12 @@ vlib_buffer_chain_validate (vlib_main_t * vm, vlib_buffer_t * b_first)
       mb_first->pkt_len += b->current_length;
       mb_prev->next = mb;
       mb->data_len = b->current_length;
+      /* segments may have been advanced since they were received */
+      mb->data_off = VLIB_BUFFER_PRE_DATA_SIZE + b->current_data;
+      mb->nb_segs = 1;
       prev = b;
     }
+  rte_mbuf_from_vlib_buffer (prev)->next = 0;
 }
 
 clib_error_t *
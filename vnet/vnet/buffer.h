@@ -81,7 +81,8 @@ _(policer)                                      \
 _(output_features)				\
 _(map)						\
 _(map_t)					\
-_(ip_frag)
+_(ip_frag)					\
+_(ip_reass)
 
 /* 
  * vnet stack buffer opaque array overlay structure.
@@ -161,6 +162,8 @@ typedef struct {
       u16 bd_index;       // bridge-domain index
       u8  l2_len;         // ethernet header length
       u8  shg;            // split-horizon group
+      u64 dst_result;     // destination l2fib entry, from l2-learn
+      u8  dst_result_valid; // set if l2-learn filled in dst_result
     } l2;
 
     /* l2tpv3 softwire encap, only valid there */
@@ -287,6 +290,16 @@ typedef struct {
       u8 flags;          //See ip_frag.h
     } ip_frag;
 
+    /* IP Reassembly, see ip_reass.h */
+    struct {
+      u32 pad;              /* do not overlay w/ handoff.next_index */
+      u32 next_range_bi;    /* next fragment in offset order */
+      u16 range_first;      /* first payload byte of this fragment */
+      u16 range_last;       /* one past its last payload byte */
+      u16 data_offset;      /* header bytes to strip when chained */
+      u8 next_index;
+    } ip_reass;
+
     /* COP - configurable junk filter(s) */
     struct {
         /* Current configuration index. */
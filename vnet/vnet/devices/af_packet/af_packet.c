@@ -37,13 +37,19 @@
 #define AF_PACKET_TX_BLOCK_SIZE	 	(AF_PACKET_TX_FRAME_SIZE * \
 					 AF_PACKET_TX_FRAMES_PER_BLOCK)
 
-#define AF_PACKET_RX_FRAMES_PER_BLOCK	1024
-#define AF_PACKET_RX_FRAME_SIZE	 	(2048 * 5)
-#define AF_PACKET_RX_BLOCK_NR		1
+/* TPACKET_V3 packs packets into blocks, the frame size only sizes the ring */
+#define AF_PACKET_RX_BLOCK_SIZE		(1 << 18)
+#define AF_PACKET_RX_BLOCK_NR		64
+#define AF_PACKET_RX_FRAME_SIZE	 	2048
 #define AF_PACKET_RX_FRAME_NR		(AF_PACKET_RX_BLOCK_NR * \
-					 AF_PACKET_RX_FRAMES_PER_BLOCK)
-#define AF_PACKET_RX_BLOCK_SIZE		(AF_PACKET_RX_FRAME_SIZE * \
-					 AF_PACKET_RX_FRAMES_PER_BLOCK)
+					 (AF_PACKET_RX_BLOCK_SIZE / \
+					  AF_PACKET_RX_FRAME_SIZE))
+/* Kernel hands over a partly filled block after this many ms */
+#define AF_PACKET_RX_BLOCK_TIMEOUT_MS	1
+
+#ifndef PACKET_QDISC_BYPASS
+#define PACKET_QDISC_BYPASS		20
+#endif
 
 #if AF_PACKET_DEBUG_SOCKET == 1
 #define DBG_SOCK(args...) clib_warning(args);
@@ -54,8 +60,6 @@
 /*defined in net/if.h but clashes with dpdk headers */
 unsigned int if_nametoindex(const char *ifname);
 
-typedef struct tpacket_req tpacket_req_t;
-
 static u32
 af_packet_eth_flag_change (vnet_main_t * vnm, vnet_hw_interface_t * hi, u32 flags)
 {
@@ -78,25 +82,15 @@ static clib_error_t * af_packet_fd_read_ready (unix_file_t * uf)
 }
 
 static int
-create_packet_v2_sock(u8 * name, tpacket_req_t * rx_req, tpacket_req_t * tx_req,
-		      int *fd, u8 ** ring)
+create_packet_v3_rx_sock(uint host_if_index, struct tpacket_req3 * req,
+			 u16 fanout_id, int *fd, u8 ** ring)
 {
   int ret, err;
   struct sockaddr_ll sll;
-  uint host_if_index;
-  int ver = TPACKET_V2;
-  socklen_t req_sz = sizeof(struct tpacket_req);
-  u32 ring_sz = rx_req->tp_block_size * rx_req->tp_block_nr +
-		tx_req->tp_block_size * tx_req->tp_block_nr;
+  int ver = TPACKET_V3;
+  u32 ring_sz = req->tp_block_size * req->tp_block_nr;
 
-  host_if_index = if_nametoindex((const char *) name);
-
-  if (!host_if_index)
-    {
-      DBG_SOCK("Wrong host interface name");
-      ret = VNET_API_ERROR_INVALID_INTERFACE;
-      goto error;
-    }
+  *ring = MAP_FAILED;
 
   if ((*fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0)
     {
@@ -112,24 +106,100 @@ create_packet_v2_sock(u8 * name, tpacket_req_t * rx_req, tpacket_req_t * tx_req,
       goto error;
     }
 
+  if ((err = setsockopt(*fd, SOL_PACKET, PACKET_RX_RING, req, sizeof(*req))) < 0)
+    {
+      DBG_SOCK("Failed to set packet rx ring options");
+      ret = VNET_API_ERROR_SYSCALL_ERROR_1;
+      goto error;
+    }
+
+  *ring = mmap(NULL, ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, *fd, 0);
+  if (*ring == MAP_FAILED)
+    {
+      DBG_SOCK("mmap failure");
+      ret = VNET_API_ERROR_SYSCALL_ERROR_1;
+      goto error;
+    }
+
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family = PF_PACKET;
+  sll.sll_protocol = htons(ETH_P_ALL);
+  sll.sll_ifindex = host_if_index;
+
+  if ((err = bind(*fd, (struct sockaddr *) &sll, sizeof(sll))) < 0)
+    {
+      DBG_SOCK("Failed to bind rx packet socket (error %d)", err);
+      ret = VNET_API_ERROR_SYSCALL_ERROR_1;
+      goto error;
+    }
+
+  /* Spread flows over the queues, in the kernel */
+  if (fanout_id)
+    {
+      int fanout = fanout_id |
+	((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+
+      if ((err = setsockopt(*fd, SOL_PACKET, PACKET_FANOUT, &fanout,
+			    sizeof(fanout))) < 0)
+	{
+	  DBG_SOCK("Failed to join fanout group %d", fanout_id);
+	  ret = VNET_API_ERROR_SYSCALL_ERROR_1;
+	  goto error;
+	}
+    }
+
+  return 0;
+error:
+  if (*ring != MAP_FAILED)
+    munmap(*ring, ring_sz);
+  *ring = 0;
+  if (*fd >= 0)
+    close(*fd);
+  *fd = -1;
+  return ret;
+}
+
+static int
+create_packet_v2_tx_sock(uint host_if_index, struct tpacket_req * req,
+			 int *fd, u8 ** ring, u8 * is_qdisc_bypass)
+{
+  int ret, err;
+  struct sockaddr_ll sll;
+  int ver = TPACKET_V2;
   int opt = 1;
-  if ((err = setsockopt(*fd, SOL_PACKET, PACKET_LOSS, &opt, sizeof(opt))) < 0)
+  u32 ring_sz = req->tp_block_size * req->tp_block_nr;
+
+  *ring = MAP_FAILED;
+
+  /* Protocol 0: the socket receives nothing, the rx queues do that */
+  if ((*fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0)
     {
-      DBG_SOCK("Failed to set packet tx ring error handling option");
+      DBG_SOCK("Failed to create socket");
       ret = VNET_API_ERROR_SYSCALL_ERROR_1;
       goto error;
     }
 
-  if ((err = setsockopt(*fd, SOL_PACKET, PACKET_RX_RING, rx_req, req_sz)) < 0)
+  if ((err = setsockopt(*fd, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver))) < 0)
     {
-      DBG_SOCK("Failed to set packet rx ring options");
+      DBG_SOCK("Failed to set tx packet interface version");
       ret = VNET_API_ERROR_SYSCALL_ERROR_1;
       goto error;
     }
 
-  if ((err = setsockopt(*fd, SOL_PACKET, PACKET_TX_RING, tx_req, req_sz)) < 0)
+  if ((err = setsockopt(*fd, SOL_PACKET, PACKET_LOSS, &opt, sizeof(opt))) < 0)
     {
-      DBG_SOCK("Failed to set packet rx ring options");
+      DBG_SOCK("Failed to set packet tx ring error handling option");
+      ret = VNET_API_ERROR_SYSCALL_ERROR_1;
+      goto error;
+    }
+
+  /* Straight to the driver; not fatal on kernels without it */
+  *is_qdisc_bypass = setsockopt(*fd, SOL_PACKET, PACKET_QDISC_BYPASS,
+				&opt, sizeof(opt)) == 0;
+
+  if ((err = setsockopt(*fd, SOL_PACKET, PACKET_TX_RING, req, sizeof(*req))) < 0)
+    {
+      DBG_SOCK("Failed to set packet tx ring options");
       ret = VNET_API_ERROR_SYSCALL_ERROR_1;
       goto error;
     }
@@ -144,38 +214,96 @@ create_packet_v2_sock(u8 * name, tpacket_req_t * rx_req, tpacket_req_t * tx_req,
 
   memset(&sll, 0, sizeof(sll));
   sll.sll_family = PF_PACKET;
-  sll.sll_protocol = htons(ETH_P_ALL);
+  sll.sll_protocol = 0;
   sll.sll_ifindex = host_if_index;
 
   if ((err = bind(*fd, (struct sockaddr *) &sll, sizeof(sll))) < 0)
     {
-      DBG_SOCK("Failed to bind rx packet socket (error %d)", err);
+      DBG_SOCK("Failed to bind tx packet socket (error %d)", err);
       ret = VNET_API_ERROR_SYSCALL_ERROR_1;
       goto error;
     }
 
   return 0;
 error:
-  close(*fd);
+  if (*ring != MAP_FAILED)
+    munmap(*ring, ring_sz);
+  *ring = 0;
+  if (*fd >= 0)
+    close(*fd);
   *fd = -1;
   return ret;
 }
 
+static void
+af_packet_free_queues(af_packet_if_t * apif)
+{
+  af_packet_rx_queue_t * rxq;
+  af_packet_tx_queue_t * txq;
+
+  vec_foreach (rxq, apif->rx_queues)
+    {
+      if (rxq->unix_file_index != ~0)
+	unix_file_del(&unix_main, unix_main.file_pool + rxq->unix_file_index);
+      if (rxq->ring &&
+	  munmap(rxq->ring, rxq->req.tp_block_size * rxq->req.tp_block_nr))
+	clib_warning("Host interface %s could not free rx ring",
+		     apif->host_if_name);
+      if (rxq->fd >= 0)
+	close(rxq->fd);
+    }
+
+  vec_foreach (txq, apif->tx_queues)
+    {
+      if (txq->ring &&
+	  munmap(txq->ring, txq->req.tp_block_size * txq->req.tp_block_nr))
+	clib_warning("Host interface %s could not free tx ring",
+		     apif->host_if_name);
+      if (txq->fd >= 0)
+	close(txq->fd);
+      if (txq->lockp)
+	clib_mem_free((void *) txq->lockp);
+    }
+
+  vec_free(apif->rx_queues);
+  vec_free(apif->tx_queues);
+}
+
+static void
+af_packet_worker_thread_enable_disable (int is_enable)
+{
+  af_packet_main_t * apm = &af_packet_main;
+
+  /* with worker threads, the input cpus poll their rx queues */
+  foreach_vlib_main (
+  ({
+    u32 cpu = this_vlib_main->cpu_index;
+    if (cpu >= apm->input_cpu_first_index &&
+	cpu < apm->input_cpu_first_index + apm->input_cpu_count)
+      vlib_node_set_state(this_vlib_main, af_packet_input_node.index,
+			  is_enable ? VLIB_NODE_STATE_POLLING :
+			  VLIB_NODE_STATE_INTERRUPT);
+  }));
+}
+
 int
-af_packet_create_if(vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set, u32 *sw_if_index)
+af_packet_create_if(vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set,
+		    u32 n_queues, u32 *sw_if_index)
 {
   af_packet_main_t * apm = &af_packet_main;
-  int ret, fd = -1;
-  struct tpacket_req * rx_req = 0;
-  struct tpacket_req * tx_req = 0;
-  u8 * ring = 0;
+  vlib_thread_main_t * tm = vlib_get_thread_main();
+  int ret = 0;
   af_packet_if_t * apif = 0;
+  af_packet_rx_queue_t * rxq;
+  af_packet_tx_queue_t * txq;
   u8 hw_addr[6];
   clib_error_t * error;
   vnet_sw_interface_t * sw;
   vnet_main_t *vnm = vnet_get_main();
   uword * p;
   uword if_index;
+  uint host_if_index;
+  u32 q;
 
   p = mhash_get (&apm->if_index_by_host_if_name, host_if_name);
   if (p)
@@ -183,45 +311,94 @@ af_packet_create_if(vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set, u32 *
       return VNET_API_ERROR_SUBIF_ALREADY_EXISTS;
     }
 
-  vec_validate(rx_req, 0);
-  rx_req->tp_block_size = AF_PACKET_RX_BLOCK_SIZE;
-  rx_req->tp_frame_size = AF_PACKET_RX_FRAME_SIZE;
-  rx_req->tp_block_nr = AF_PACKET_RX_BLOCK_NR;
-  rx_req->tp_frame_nr = AF_PACKET_RX_FRAME_NR;
+  host_if_index = if_nametoindex((const char *) host_if_name);
 
-  vec_validate(tx_req, 0);
-  tx_req->tp_block_size = AF_PACKET_TX_BLOCK_SIZE;
-  tx_req->tp_frame_size = AF_PACKET_TX_FRAME_SIZE;
-  tx_req->tp_block_nr = AF_PACKET_TX_BLOCK_NR;
-  tx_req->tp_frame_nr = AF_PACKET_TX_FRAME_NR;
+  if (!host_if_index)
+    {
+      DBG_SOCK("Wrong host interface name");
+      vec_free(host_if_name);
+      return VNET_API_ERROR_INVALID_INTERFACE;
+    }
 
-  ret = create_packet_v2_sock(host_if_name, rx_req, tx_req, &fd, &ring);
+  if (n_queues == 0)
+    n_queues = 1;
 
-  if (ret != 0)
-    goto error;
+  /* Workers walk the pool */
+  vlib_worker_thread_barrier_sync (vm);
 
-  /* So far everything looks good, let's create interface */
   pool_get (apm->interfaces, apif);
+  memset (apif, 0, sizeof (*apif));
   if_index = apif - apm->interfaces;
 
-  apif->fd = fd;
-  apif->rx_ring = ring;
-  apif->tx_ring = ring + rx_req->tp_block_size * rx_req->tp_block_nr;
-  apif->rx_req = rx_req;
-  apif->tx_req = tx_req;
   apif->host_if_name = host_if_name;
   apif->per_interface_next_index = ~0;
-  apif->next_tx_frame = 0;
-  apif->next_rx_frame = 0;
-
-  {
-    unix_file_t template = {0};
-    template.read_function = af_packet_fd_read_ready;
-    template.file_descriptor = fd;
-    template.private_data = if_index;
-    template.flags = UNIX_FILE_EVENT_EDGE_TRIGGERED;
-    apif->unix_file_index = unix_file_add (&unix_main, &template);
-  }
+  apif->is_qdisc_bypass = 1;
+  if (n_queues > 1)
+    apif->fanout_id = ((getpid() << 4) + host_if_index) & 0xffff;
+  /* 0 means no fanout */
+  if (n_queues > 1 && apif->fanout_id == 0)
+    apif->fanout_id = 1;
+
+  vec_validate_aligned (apif->rx_queues, n_queues - 1, CLIB_CACHE_LINE_BYTES);
+  vec_validate_aligned (apif->tx_queues, n_queues - 1, CLIB_CACHE_LINE_BYTES);
+  vec_foreach (rxq, apif->rx_queues)
+    {
+      rxq->fd = -1;
+      rxq->unix_file_index = ~0;
+    }
+  vec_foreach (txq, apif->tx_queues)
+    txq->fd = -1;
+
+  for (q = 0; q < n_queues; q++)
+    {
+      u8 is_qdisc_bypass;
+
+      rxq = vec_elt_at_index (apif->rx_queues, q);
+      rxq->req.tp_block_size = AF_PACKET_RX_BLOCK_SIZE;
+      rxq->req.tp_block_nr = AF_PACKET_RX_BLOCK_NR;
+      rxq->req.tp_frame_size = AF_PACKET_RX_FRAME_SIZE;
+      rxq->req.tp_frame_nr = AF_PACKET_RX_FRAME_NR;
+      rxq->req.tp_retire_blk_tov = AF_PACKET_RX_BLOCK_TIMEOUT_MS;
+
+      ret = create_packet_v3_rx_sock(host_if_index, &rxq->req,
+				     apif->fanout_id, &rxq->fd, &rxq->ring);
+      if (ret != 0)
+	goto error;
+
+      rxq->cpu_index = apm->input_cpu_first_index +
+	(apm->next_input_cpu++ % apm->input_cpu_count);
+
+      /* Without workers the main thread is woken up by the socket */
+      if (tm->n_vlib_mains == 1)
+	{
+	  unix_file_t template = {0};
+	  template.read_function = af_packet_fd_read_ready;
+	  template.file_descriptor = rxq->fd;
+	  template.private_data = if_index;
+	  template.flags = UNIX_FILE_EVENT_EDGE_TRIGGERED;
+	  rxq->unix_file_index = unix_file_add (&unix_main, &template);
+	}
+
+      txq = vec_elt_at_index (apif->tx_queues, q);
+      txq->req.tp_block_size = AF_PACKET_TX_BLOCK_SIZE;
+      txq->req.tp_frame_size = AF_PACKET_TX_FRAME_SIZE;
+      txq->req.tp_block_nr = AF_PACKET_TX_BLOCK_NR;
+      txq->req.tp_frame_nr = AF_PACKET_TX_FRAME_NR;
+
+      ret = create_packet_v2_tx_sock(host_if_index, &txq->req, &txq->fd,
+				     &txq->ring, &is_qdisc_bypass);
+      if (ret != 0)
+	goto error;
+
+      apif->is_qdisc_bypass &= is_qdisc_bypass;
+
+      if (tm->n_vlib_mains > n_queues)
+	{
+	  txq->lockp = clib_mem_alloc_aligned (CLIB_CACHE_LINE_BYTES,
+					       CLIB_CACHE_LINE_BYTES);
+	  memset ((void *) txq->lockp, 0, CLIB_CACHE_LINE_BYTES);
+	}
+    }
 
   /*use configured or generate random MAC address */
   if (hw_addr_set)
@@ -244,8 +421,6 @@ af_packet_create_if(vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set, u32 *
 
   if (error)
     {
-      memset(apif, 0, sizeof(*apif));
-      pool_put(apm->interfaces, apif);
       clib_error_report (error);
       ret = VNET_API_ERROR_SYSCALL_ERROR_1;
       goto error;
@@ -260,12 +435,19 @@ af_packet_create_if(vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set, u32 *
   mhash_set_mem (&apm->if_index_by_host_if_name, host_if_name, &if_index, 0);
   if (sw_if_index)
     *sw_if_index = apif->sw_if_index;
+
+  if (tm->n_vlib_mains > 1 && pool_elts(apm->interfaces) == 1)
+    af_packet_worker_thread_enable_disable (1);
+
+  vlib_worker_thread_barrier_release (vm);
   return 0;
 
 error:
+  af_packet_free_queues(apif);
   vec_free(host_if_name);
-  vec_free(rx_req);
-  vec_free(tx_req);
+  memset(apif, 0, sizeof(*apif));
+  pool_put(apm->interfaces, apif);
+  vlib_worker_thread_barrier_release (vm);
   return ret;
 }
 
@@ -274,10 +456,10 @@ af_packet_delete_if(vlib_main_t *vm, u8 *host_if_name)
 {
   vnet_main_t *vnm = vnet_get_main();
   af_packet_main_t *apm = &af_packet_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main();
   af_packet_if_t *apif;
   uword *p;
   uword if_index;
-  u32 ring_sz;
 
   p = mhash_get(&apm->if_index_by_host_if_name, host_if_name);
   if (p == NULL) {
@@ -290,34 +472,25 @@ af_packet_delete_if(vlib_main_t *vm, u8 *host_if_name)
   /* bring down the interface */
   vnet_hw_interface_set_flags(vnm, apif->hw_if_index, 0);
 
+  vlib_worker_thread_barrier_sync (vm);
+
   /* clean up */
-  if (apif->unix_file_index != ~0) {
-    unix_file_del(&unix_main, unix_main.file_pool + apif->unix_file_index);
-    apif->unix_file_index = ~0;
-  }
-  ring_sz = apif->rx_req->tp_block_size * apif->rx_req->tp_block_nr +
-            apif->tx_req->tp_block_size * apif->tx_req->tp_block_nr;
-  if (munmap(apif->rx_ring, ring_sz))
-    clib_warning("Host interface %s could not free rx/tx ring", host_if_name);
-  apif->rx_ring = NULL;
-  apif->tx_ring = NULL;
-  close(apif->fd);
-  apif->fd = -1;
-
-  vec_free(apif->rx_req);
-  apif->rx_req = NULL;
-  vec_free(apif->tx_req);
-  apif->tx_req = NULL;
+  af_packet_free_queues(apif);
+
+  mhash_unset(&apm->if_index_by_host_if_name, host_if_name, &if_index);
 
   vec_free(apif->host_if_name);
   apif->host_if_name = NULL;
 
-  mhash_unset(&apm->if_index_by_host_if_name, host_if_name, &if_index);
-
   ethernet_delete_interface(vnm, apif->hw_if_index);
 
   pool_put(apm->interfaces, apif);
 
+  if (tm->n_vlib_mains > 1 && pool_elts(apm->interfaces) == 0)
+    af_packet_worker_thread_enable_disable (0);
+
+  vlib_worker_thread_barrier_release (vm);
+
   return 0;
 }
 
@@ -325,11 +498,30 @@ static clib_error_t *
 af_packet_init (vlib_main_t * vm)
 {
   af_packet_main_t * apm = &af_packet_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main();
+  vlib_thread_registration_t * tr;
+  uword * p;
 
   memset (apm, 0, sizeof (af_packet_main_t));
 
+  apm->input_cpu_first_index = 0;
+  apm->input_cpu_count = 1;
+
+  /* find out which cpus will be used for input */
+  p = hash_get_mem (tm->thread_registrations_by_name, "workers");
+  tr = p ? (vlib_thread_registration_t *) p[0] : 0;
+
+  if (tr && tr->count > 0)
+    {
+      apm->input_cpu_first_index = tr->first_index;
+      apm->input_cpu_count = tr->count;
+    }
+
   mhash_init_vec_string (&apm->if_index_by_host_if_name, sizeof (uword));
 
+  vec_validate_aligned (apm->rx_buffers, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+
   return 0;
 }
 
@@ -17,20 +17,51 @@
  *------------------------------------------------------------------
  */
 
+#include <linux/if_packet.h>
+
 typedef struct {
   CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
-  u8 * host_if_name;
   int fd;
-  struct tpacket_req * rx_req;
-  struct tpacket_req * tx_req;
-  u8 * rx_ring;
-  u8 * tx_ring;
+  u32 unix_file_index;
+
+  /* TPACKET_V3 block ring */
+  struct tpacket_req3 req;
+  u8 * ring;
+  u32 next_block;
+
+  /* Where to resume in a partly processed block */
+  u32 next_pkt_offset;
+  u32 n_pkts_left;
+
+  /* Thread polling this queue */
+  u32 cpu_index;
+} af_packet_rx_queue_t;
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+  /* Set when more threads than tx queues */
+  volatile u32 * lockp;
+  int fd;
+
+  /* TPACKET_V2 frame ring */
+  struct tpacket_req req;
+  u8 * ring;
+  u32 next_frame;
+} af_packet_tx_queue_t;
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+  u8 * host_if_name;
   u32 hw_if_index;
   u32 sw_if_index;
-  u32 unix_file_index;
 
-  u32 next_rx_frame;
-  u32 next_tx_frame;
+  /* rx queues share a PACKET_FANOUT group */
+  af_packet_rx_queue_t * rx_queues;
+  af_packet_tx_queue_t * tx_queues;
+  u16 fanout_id;
+
+  /* tx bypasses the host qdisc layer */
+  u8 is_qdisc_bypass;
 
   u32 per_interface_next_index;
   u8 is_admin_up;
@@ -43,16 +74,26 @@ typedef struct {
   /* bitmap of pending rx interfaces */
   uword * pending_input_bitmap;
 
-  /* rx buffer cache */
-  u32 * rx_buffers;
+  /* rx buffer cache, per thread */
+  u32 ** rx_buffers;
 
   /* hash of host interface names */
   mhash_t if_index_by_host_if_name;
+
+  /* first cpu index */
+  u32 input_cpu_first_index;
+
+  /* total cpu count */
+  u32 input_cpu_count;
+
+  /* round robin placement of rx queues on input cpus */
+  u32 next_input_cpu;
 } af_packet_main_t;
 
 af_packet_main_t af_packet_main;
 extern vnet_device_class_t af_packet_device_class;
 extern vlib_node_registration_t af_packet_input_node;
 
-int af_packet_create_if(vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set, u32 *sw_if_index);
+int af_packet_create_if(vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set,
+                        u32 n_queues, u32 *sw_if_index);
 int af_packet_delete_if(vlib_main_t * vm, u8 * host_if_name);
@@ -41,6 +41,7 @@ af_packet_create_command_fn (vlib_main_t * vm, unformat_input_t * input,
   u8 hwaddr [6];
   u8 * hw_addr_ptr = 0;
   u32 sw_if_index;
+  u32 n_queues = 1;
   int r;
 
   /* Get a line of input. */
@@ -53,6 +54,8 @@ af_packet_create_command_fn (vlib_main_t * vm, unformat_input_t * input,
 	;
       else if (unformat (line_input, "hw-addr %U", unformat_ethernet_address, hwaddr))
 	hw_addr_ptr = hwaddr;
+      else if (unformat (line_input, "queues %u", &n_queues))
+	;
       else
 	return clib_error_return (0, "unknown input `%U'", format_unformat_error, input);
     }
@@ -61,7 +64,8 @@ af_packet_create_command_fn (vlib_main_t * vm, unformat_input_t * input,
   if (host_if_name == NULL)
       return clib_error_return (0, "missing host interface name");
 
-  r = af_packet_create_if(vm, host_if_name, hw_addr_ptr, &sw_if_index);
+  r = af_packet_create_if(vm, host_if_name, hw_addr_ptr, n_queues,
+                          &sw_if_index);
 
   if (r == VNET_API_ERROR_SYSCALL_ERROR_1)
     return clib_error_return(0, "%s (errno %d)", strerror (errno), errno);
@@ -78,7 +82,8 @@ af_packet_create_command_fn (vlib_main_t * vm, unformat_input_t * input,
 
 VLIB_CLI_COMMAND (af_packet_create_command, static) = {
   .path = "create host-interface",
-  .short_help = "create host-interface name <interface name> [hw-addr <mac>]",
+  .short_help = "create host-interface name <interface name> [hw-addr <mac>] "
+                "[queues <n>]",
   .function = af_packet_create_command_fn,
 };
 
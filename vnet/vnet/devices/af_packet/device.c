@@ -58,7 +58,22 @@ static u8 * format_af_packet_device_name (u8 * s, va_list * args)
 
 static u8 * format_af_packet_device (u8 * s, va_list * args)
 {
+  u32 i = va_arg (*args, u32);
+  af_packet_main_t * apm = &af_packet_main;
+  af_packet_if_t * apif = pool_elt_at_index (apm->interfaces, i);
+  uword indent = format_get_indent (s);
+  af_packet_rx_queue_t * rxq;
+
   s = format (s, "Linux PACKET socket interface");
+  s = format (s, "\n%Urx TPACKET_V3, %d queues%s, tx TPACKET_V2%s",
+              format_white_space, indent + 2,
+              vec_len (apif->rx_queues),
+              apif->fanout_id ? " (fanout hash)" : "",
+              apif->is_qdisc_bypass ? " (qdisc bypass)" : "");
+  vec_foreach (rxq, apif->rx_queues)
+    s = format (s, "\n%Urx queue %d polled by cpu %d",
+                format_white_space, indent + 2,
+                rxq - apif->rx_queues, rxq->cpu_index);
   return s;
 }
 
@@ -79,15 +94,25 @@ af_packet_interface_tx (vlib_main_t * vm,
   u32 n_sent = 0;
   vnet_interface_output_runtime_t * rd = (void *) node->runtime_data;
   af_packet_if_t * apif = pool_elt_at_index (apm->interfaces, rd->dev_instance);
+  u32 queue_id = os_get_cpu_number() % vec_len (apif->tx_queues);
+  af_packet_tx_queue_t * txq = vec_elt_at_index (apif->tx_queues, queue_id);
   int block = 0;
-  u32 block_size = apif->tx_req->tp_block_size;
-  u32 frame_size = apif->tx_req->tp_frame_size;
-  u32 frame_num = apif->tx_req->tp_frame_nr;
-  u8 * block_start = apif->tx_ring + block * block_size;
-  u32 tx_frame = apif->next_tx_frame;
+  u32 block_size = txq->req.tp_block_size;
+  u32 frame_size = txq->req.tp_frame_size;
+  u32 frame_num = txq->req.tp_frame_nr;
+  u8 * block_start = txq->ring + block * block_size;
+  u32 tx_frame;
   struct tpacket2_hdr * tph;
   u32 frame_not_ready = 0;
 
+  if (PREDICT_FALSE(txq->lockp != 0))
+    {
+      while (__sync_lock_test_and_set (txq->lockp, 1))
+        ;
+    }
+
+  tx_frame = txq->next_frame;
+
   while(n_left > 0)
     {
       u32 len;
@@ -130,9 +155,9 @@ next:
 
   if (PREDICT_TRUE(n_sent))
     {
-      apif->next_tx_frame = tx_frame;
+      txq->next_frame = tx_frame;
 
-      if (PREDICT_FALSE(sendto(apif->fd, NULL, 0,
+      if (PREDICT_FALSE(sendto(txq->fd, NULL, 0,
                                MSG_DONTWAIT, NULL, 0) == -1))
         {
           /* Uh-oh, drop & move on, but count whether it was fatal or not.
@@ -147,6 +172,9 @@ next:
         }
     }
 
+  if (PREDICT_FALSE(txq->lockp != 0))
+    *txq->lockp = 0;
+
   if (PREDICT_FALSE(frame_not_ready))
     vlib_error_count (vm, node->node_index, AF_PACKET_TX_ERROR_FRAME_NOT_READY,
                       frame_not_ready);
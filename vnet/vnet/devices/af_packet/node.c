@@ -50,8 +50,8 @@ enum {
 typedef struct {
   u32 next_index;
   u32 hw_if_index;
-  int block;
-  struct tpacket2_hdr tph;
+  u32 queue_id;
+  struct tpacket3_hdr tph;
 } af_packet_input_trace_t;
 
 static u8 * format_af_packet_input_trace (u8 * s, va_list * args)
@@ -61,11 +61,11 @@ static u8 * format_af_packet_input_trace (u8 * s, va_list * args)
   af_packet_input_trace_t * t = va_arg (*args, af_packet_input_trace_t *);
   uword indent = format_get_indent (s);
 
-  s = format (s, "af_packet: hw_if_index %d next-index %d",
-	      t->hw_if_index, t->next_index);
+  s = format (s, "af_packet: hw_if_index %d queue %d next-index %d",
+	      t->hw_if_index, t->queue_id, t->next_index);
 
-  s = format (s, "\n%Utpacket2_hdr:\n%Ustatus 0x%x len %u snaplen %u mac %u net %u"
-	      "\n%Usec 0x%x nsec 0x%x vlan_tci %u"
+  s = format (s, "\n%Utpacket3_hdr:\n%Ustatus 0x%x len %u snaplen %u mac %u net %u"
+	      "\n%Usec 0x%x nsec 0x%x rxhash 0x%x vlan_tci %u"
 #ifdef TP_STATUS_VLAN_TPID_VALID
 	      " vlan_tpid %u"
 #endif
@@ -80,11 +80,12 @@ static u8 * format_af_packet_input_trace (u8 * s, va_list * args)
 	      format_white_space, indent + 4,
 	      t->tph.tp_sec,
 	      t->tph.tp_nsec,
-	      t->tph.tp_vlan_tci,
+	      t->tph.hv1.tp_rxhash,
+	      t->tph.hv1.tp_vlan_tci
 #ifdef TP_STATUS_VLAN_TPID_VALID
-	      t->tph.tp_vlan_tpid,
+	      , t->tph.hv1.tp_vlan_tpid
 #endif
-	      t->tph.tp_net);
+	      );
   return s;
 }
 
@@ -117,64 +118,106 @@ buffer_add_to_chain(vlib_main_t *vm, u32 bi, u32 first_bi, u32 prev_bi)
 #endif
 }
 
+/* Packets looped back from our own transmit, without qdisc bypass */
+always_inline int
+af_packet_is_outgoing (struct tpacket3_hdr * tph)
+{
+  struct sockaddr_ll * sll = (struct sockaddr_ll *)
+    ((u8 *) tph + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+  return sll->sll_pkttype == PACKET_OUTGOING;
+}
+
+/* Make sure at least n_min rx buffers are at hand, returns how many are */
+always_inline u32
+af_packet_rx_buffers_fill (vlib_main_t * vm, u32 ** rx_buffers, u32 n_min)
+{
+  u32 n_free_bufs = vec_len (*rx_buffers);
+  u32 n_alloc;
+
+  if (PREDICT_TRUE(n_free_bufs >= n_min))
+    return n_free_bufs;
+
+  n_alloc = clib_max (n_min - n_free_bufs, VLIB_FRAME_SIZE);
+  vec_validate (*rx_buffers, n_free_bufs + n_alloc - 1);
+  n_free_bufs += vlib_buffer_alloc (vm, *rx_buffers + n_free_bufs, n_alloc);
+  _vec_len (*rx_buffers) = n_free_bufs;
+  return n_free_bufs;
+}
+
 always_inline uword
-af_packet_device_input_fn  (vlib_main_t * vm, vlib_node_runtime_t * node,
-			    vlib_frame_t * frame, u32 device_idx)
+af_packet_queue_input_fn  (vlib_main_t * vm, vlib_node_runtime_t * node,
+			   af_packet_if_t * apif, u32 queue_id)
 {
   af_packet_main_t * apm = &af_packet_main;
-  af_packet_if_t * apif = pool_elt_at_index(apm->interfaces, device_idx);
-  struct tpacket2_hdr *tph;
+  af_packet_rx_queue_t * rxq = vec_elt_at_index (apif->rx_queues, queue_id);
+  u32 cpu_index = os_get_cpu_number();
+  struct tpacket_block_desc * bd;
+  struct tpacket3_hdr *tph;
   u32 next_index = AF_PACKET_INPUT_NEXT_ETHERNET_INPUT;
-  u32 block = 0;
-  u32 rx_frame;
   u32 n_free_bufs;
   u32 n_rx_packets = 0;
   u32 n_rx_bytes = 0;
   u32 * to_next = 0;
-  u32 block_size = apif->rx_req->tp_block_size;
-  u32 frame_size = apif->rx_req->tp_frame_size;
-  u32 frame_num = apif->rx_req->tp_frame_nr;
-  u8 * block_start = apif->rx_ring + block * block_size;
+  u32 block_size = rxq->req.tp_block_size;
+  u32 block_nr = rxq->req.tp_block_nr;
   uword n_trace = vlib_get_trace_count (vm, node);
   u32 n_buffer_bytes = vlib_buffer_free_list_buffer_size (vm,
     VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX);
-  u32 min_bufs = apif->rx_req->tp_frame_size / n_buffer_bytes;
+  u32 * rx_buffers = apm->rx_buffers[cpu_index];
+  int out_of_buffers = 0;
 
   if (apif->per_interface_next_index != ~0)
       next_index = apif->per_interface_next_index;
 
-  n_free_bufs = vec_len (apm->rx_buffers);
-  if (PREDICT_FALSE(n_free_bufs < VLIB_FRAME_SIZE))
-    {
-      vec_validate(apm->rx_buffers, VLIB_FRAME_SIZE + n_free_bufs - 1);
-      n_free_bufs += vlib_buffer_alloc(vm, &apm->rx_buffers[n_free_bufs], VLIB_FRAME_SIZE);
-      _vec_len (apm->rx_buffers) = n_free_bufs;
-    }
+  n_free_bufs = af_packet_rx_buffers_fill (vm, &rx_buffers, VLIB_FRAME_SIZE);
 
-  rx_frame = apif->next_rx_frame;
-  tph = (struct tpacket2_hdr *) (block_start + rx_frame * frame_size);
-  while ((tph->tp_status & TP_STATUS_USER) && (n_free_bufs > min_bufs))
+  bd = (struct tpacket_block_desc *) (rxq->ring + rxq->next_block * block_size);
+
+  /* Kernel retires whole blocks; each is handed back once consumed */
+  while ((bd->hdr.bh1.block_status & TP_STATUS_USER) && !out_of_buffers)
     {
-      vlib_buffer_t * b0, * first_b0 = 0;
-      u32 next0 = next_index;
+      if (rxq->next_pkt_offset == 0)
+	{
+	  rxq->next_pkt_offset = bd->hdr.bh1.offset_to_first_pkt;
+	  rxq->n_pkts_left = bd->hdr.bh1.num_pkts;
+	}
+      tph = (struct tpacket3_hdr *) ((u8 *) bd + rxq->next_pkt_offset);
 
       u32 n_left_to_next;
       vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
-      while ((tph->tp_status & TP_STATUS_USER) && (n_free_bufs > min_bufs) &&
-	     n_left_to_next)
+      while (rxq->n_pkts_left && n_left_to_next)
 	{
+	  vlib_buffer_t * b0, * first_b0 = 0;
+	  u32 next0 = next_index;
 	  u32 data_len = tph->tp_snaplen;
 	  u32 offset = 0;
 	  u32 bi0 = 0, first_bi0 = 0, prev_bi0;
+	  u32 n_bufs;
+
+	  if (PREDICT_FALSE(af_packet_is_outgoing (tph)))
+	    goto next_packet;
+
+	  /* TPACKET_V3 packets may be as large as a block, e.g. with GRO.
+	     Without buffers for all of it, resume here on the next call. */
+	  n_bufs = (data_len + n_buffer_bytes - 1) / n_buffer_bytes;
+	  if (PREDICT_FALSE(n_free_bufs < n_bufs))
+	    {
+	      n_free_bufs = af_packet_rx_buffers_fill (vm, &rx_buffers, n_bufs);
+	      if (n_free_bufs < n_bufs)
+		{
+		  out_of_buffers = 1;
+		  break;
+		}
+	    }
 
 	  while (data_len)
 	    {
 	      /* grab free buffer */
-	      u32 last_empty_buffer = vec_len (apm->rx_buffers) - 1;
+	      u32 last_empty_buffer = vec_len (rx_buffers) - 1;
 	      prev_bi0 = bi0;
-	      bi0 = apm->rx_buffers[last_empty_buffer];
+	      bi0 = rx_buffers[last_empty_buffer];
 	      b0 = vlib_get_buffer (vm, bi0);
-	      _vec_len (apm->rx_buffers) = last_empty_buffer;
+	      _vec_len (rx_buffers) = last_empty_buffer;
 	      n_free_bufs--;
 
 	      /* copy data */
@@ -221,27 +264,39 @@ af_packet_device_input_fn  (vlib_main_t * vm, vlib_node_runtime_t * node,
 	      tr = vlib_add_trace (vm, node, first_b0, sizeof (*tr));
 	      tr->next_index = next0;
 	      tr->hw_if_index = apif->hw_if_index;
-	      clib_memcpy(&tr->tph, tph, sizeof(struct tpacket2_hdr));
+	      tr->queue_id = queue_id;
+	      clib_memcpy(&tr->tph, tph, sizeof(struct tpacket3_hdr));
 	    }
 	  /* enque and take next packet */
 	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index, to_next,
 					   n_left_to_next, first_bi0, next0);
 
-	   /* next packet */
-	  tph->tp_status = TP_STATUS_KERNEL;
-	  rx_frame = (rx_frame + 1) % frame_num;
-	  tph = (struct tpacket2_hdr *) (block_start + rx_frame * frame_size);
+	next_packet:
+	  rxq->n_pkts_left--;
+	  rxq->next_pkt_offset += tph->tp_next_offset;
+	  tph = (struct tpacket3_hdr *) ((u8 *) bd + rxq->next_pkt_offset);
 	}
 
       vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+
+      /* whole block consumed, give it back */
+      if (rxq->n_pkts_left == 0)
+	{
+	  rxq->next_pkt_offset = 0;
+	  CLIB_MEMORY_BARRIER();
+	  bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	  rxq->next_block = (rxq->next_block + 1) % block_nr;
+	  bd = (struct tpacket_block_desc *)
+	    (rxq->ring + rxq->next_block * block_size);
+	}
     }
 
-  apif->next_rx_frame = rx_frame;
+  apm->rx_buffers[cpu_index] = rx_buffers;
 
   vlib_increment_combined_counter
     (vnet_get_main()->interface_main.combined_sw_if_counters
      + VNET_INTERFACE_COUNTER_RX,
-     os_get_cpu_number(),
+     cpu_index,
      apif->hw_if_index,
      n_rx_packets, n_rx_bytes);
 
@@ -254,13 +309,33 @@ af_packet_input_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
 {
   int i;
   u32 n_rx_packets = 0;
-
+  u32 cpu_index = os_get_cpu_number();
   af_packet_main_t * apm = &af_packet_main;
+  af_packet_if_t * apif;
+  af_packet_rx_queue_t * rxq;
+
+  /* Interrupt mode, main thread only: every queue of a woken interface */
+  if (node->state == VLIB_NODE_STATE_INTERRUPT)
+    {
+      clib_bitmap_foreach (i, apm->pending_input_bitmap,
+	({
+	  clib_bitmap_set (apm->pending_input_bitmap, i, 0);
+	  apif = pool_elt_at_index (apm->interfaces, i);
+	  vec_foreach (rxq, apif->rx_queues)
+	    n_rx_packets += af_packet_queue_input_fn
+	      (vm, node, apif, rxq - apif->rx_queues);
+	}));
+      return n_rx_packets;
+    }
 
-  clib_bitmap_foreach (i, apm->pending_input_bitmap,
+  /* Polling on workers: the queues placed on this thread */
+  pool_foreach (apif, apm->interfaces,
     ({
-      clib_bitmap_set (apm->pending_input_bitmap, i, 0);
-      n_rx_packets += af_packet_device_input_fn(vm, node, frame, i);
+      if (apif->is_admin_up)
+	vec_foreach (rxq, apif->rx_queues)
+	  if (rxq->cpu_index == cpu_index)
+	    n_rx_packets += af_packet_queue_input_fn
+	      (vm, node, apif, rxq - apif->rx_queues);
     }));
 
   return n_rx_packets;
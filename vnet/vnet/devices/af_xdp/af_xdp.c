@@ -0,0 +1,736 @@
+/*
+ *------------------------------------------------------------------
+ * af_xdp.c - linux kernel AF_XDP socket interface
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *------------------------------------------------------------------
+ */
+
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <vlib/vlib.h>
+#include <vlib/unix/unix.h>
+#include <vnet/ip/ip.h>
+#include <vnet/ethernet/ethernet.h>
+
+#include <vnet/devices/af_xdp/af_xdp.h>
+
+#define AF_XDP_DEBUG_SOCKET		0
+
+#ifndef AF_XDP
+#define AF_XDP				44
+#endif
+
+#ifndef SOL_XDP
+#define SOL_XDP				283
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL		69
+#endif
+
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET		70
+#endif
+
+/* How long a wakeup syscall may spin in the driver, in usec */
+#define AF_XDP_BUSY_POLL_USEC		20
+
+#if AF_XDP_DEBUG_SOCKET == 1
+#define DBG_SOCK(args...) clib_warning(args);
+#else
+#define DBG_SOCK(args...)
+#endif
+
+/*defined in net/if.h but clashes with dpdk headers */
+unsigned int if_nametoindex(const char *ifname);
+
+static u32
+af_xdp_eth_flag_change (vnet_main_t * vnm, vnet_hw_interface_t * hi, u32 flags)
+{
+  /* nothing for now */
+  return 0;
+}
+
+static clib_error_t * af_xdp_fd_read_ready (unix_file_t * uf)
+{
+  vlib_main_t * vm = vlib_get_main();
+  af_xdp_main_t * axm = &af_xdp_main;
+  u32 idx = uf->private_data;
+
+  axm->pending_input_bitmap = clib_bitmap_set (axm->pending_input_bitmap, idx, 1);
+
+  /* Schedule the rx node */
+  vlib_node_set_interrupt_pending (vm, af_xdp_input_node.index);
+
+  return 0;
+}
+
+static int
+af_xdp_bpf (int cmd, union bpf_attr * attr)
+{
+  return syscall (__NR_bpf, cmd, attr, sizeof (*attr));
+}
+
+/*
+ * bpf_redirect_map (&xsks_map, ctx->rx_queue_index, XDP_PASS): queues
+ * without a socket in the map still reach the host stack.
+ */
+static int
+af_xdp_load_program (int map_fd)
+{
+  struct bpf_insn insns[] = {
+    /* r2 = ctx->rx_queue_index */
+    { .code = BPF_LDX | BPF_W | BPF_MEM, .dst_reg = BPF_REG_2,
+      .src_reg = BPF_REG_1,
+      .off = STRUCT_OFFSET_OF (struct xdp_md, rx_queue_index) },
+    /* r1 = xsks_map */
+    { .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1,
+      .src_reg = BPF_PSEUDO_MAP_FD, .imm = map_fd },
+    { 0 },
+    /* r3 = XDP_PASS */
+    { .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3,
+      .imm = XDP_PASS },
+    { .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+    { .code = BPF_JMP | BPF_EXIT },
+  };
+  union bpf_attr attr;
+
+  memset (&attr, 0, sizeof (attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = pointer_to_uword (insns);
+  attr.insn_cnt = ARRAY_LEN (insns);
+  attr.license = pointer_to_uword ("Apache-2.0");
+
+  return af_xdp_bpf (BPF_PROG_LOAD, &attr);
+}
+
+/* RTM_SETLINK with IFLA_XDP; prog_fd -1 detaches */
+static int
+af_xdp_set_link_xdp_fd (u32 host_if_index, int prog_fd, u32 flags)
+{
+  struct {
+    struct nlmsghdr nh;
+    struct ifinfomsg ifi;
+    u8 attrs[64];
+  } req;
+  struct nlattr * nest, * nla;
+  struct sockaddr_nl sa;
+  struct nlmsghdr * nh;
+  struct nlmsgerr * err;
+  u8 reply[1024];
+  int fd, n, rv = -1;
+
+  if ((fd = socket (AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0)
+    return -1;
+
+  memset (&req, 0, sizeof (req));
+  req.nh.nlmsg_len = NLMSG_LENGTH (sizeof (struct ifinfomsg));
+  req.nh.nlmsg_type = RTM_SETLINK;
+  req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  req.nh.nlmsg_seq = 1;
+  req.ifi.ifi_family = AF_UNSPEC;
+  req.ifi.ifi_index = host_if_index;
+
+  nest = (struct nlattr *) ((u8 *) &req + NLMSG_ALIGN (req.nh.nlmsg_len));
+  nest->nla_type = NLA_F_NESTED | IFLA_XDP;
+  nest->nla_len = NLA_HDRLEN;
+
+  nla = (struct nlattr *) ((u8 *) nest + nest->nla_len);
+  nla->nla_type = IFLA_XDP_FD;
+  nla->nla_len = NLA_HDRLEN + sizeof (prog_fd);
+  clib_memcpy ((u8 *) nla + NLA_HDRLEN, &prog_fd, sizeof (prog_fd));
+  nest->nla_len += NLA_ALIGN (nla->nla_len);
+
+  nla = (struct nlattr *) ((u8 *) nest + nest->nla_len);
+  nla->nla_type = IFLA_XDP_FLAGS;
+  nla->nla_len = NLA_HDRLEN + sizeof (flags);
+  clib_memcpy ((u8 *) nla + NLA_HDRLEN, &flags, sizeof (flags));
+  nest->nla_len += NLA_ALIGN (nla->nla_len);
+
+  req.nh.nlmsg_len += NLA_ALIGN (nest->nla_len);
+
+  memset (&sa, 0, sizeof (sa));
+  sa.nl_family = AF_NETLINK;
+
+  if (sendto (fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr *) &sa,
+	      sizeof (sa)) < 0)
+    goto done;
+
+  n = recv (fd, reply, sizeof (reply), 0);
+  nh = (struct nlmsghdr *) reply;
+  if (n < (int) NLMSG_LENGTH (sizeof (*err)) || nh->nlmsg_type != NLMSG_ERROR)
+    goto done;
+
+  err = NLMSG_DATA (nh);
+  if (err->error)
+    {
+      errno = -err->error;
+      goto done;
+    }
+  rv = 0;
+
+done:
+  close (fd);
+  return rv;
+}
+
+static int
+af_xdp_map_ring (int fd, af_xdp_ring_t * r, struct xdp_ring_offset * off,
+		 u64 pgoff, u32 desc_size)
+{
+  u8 * map;
+
+  r->map_size = off->desc + AF_XDP_RING_SIZE * desc_size;
+  map = mmap (NULL, r->map_size, PROT_READ | PROT_WRITE,
+	      MAP_SHARED | MAP_POPULATE, fd, pgoff);
+  if (map == MAP_FAILED)
+    return -1;
+
+  r->map = map;
+  r->producer = (u32 *) (map + off->producer);
+  r->consumer = (u32 *) (map + off->consumer);
+  r->flags = (u32 *) (map + off->flags);
+  r->desc = map + off->desc;
+  r->mask = AF_XDP_RING_SIZE - 1;
+  r->cached_prod = *r->producer;
+  r->cached_cons = *r->consumer;
+  return 0;
+}
+
+static void
+af_xdp_unmap_ring (af_xdp_ring_t * r)
+{
+  if (r->map)
+    munmap (r->map, r->map_size);
+  r->map = 0;
+}
+
+static int
+af_xdp_create_queue (af_xdp_if_t * axif, u32 queue_id, int is_busy_poll)
+{
+  af_xdp_queue_t * q = vec_elt_at_index (axif->queues, queue_id);
+  struct xdp_mmap_offsets off;
+  struct sockaddr_xdp sxdp;
+  socklen_t optlen = sizeof (off);
+  int ring_size = AF_XDP_RING_SIZE;
+  union bpf_attr attr;
+  int err, opt;
+
+  if ((q->fd = socket (AF_XDP, SOCK_RAW, 0)) < 0)
+    {
+      DBG_SOCK("Failed to create socket");
+      return VNET_API_ERROR_SYSCALL_ERROR_1;
+    }
+
+  /* The first socket registers the UMEM, the others share it */
+  if (queue_id == 0)
+    {
+      struct xdp_umem_reg mr;
+
+      memset (&mr, 0, sizeof (mr));
+      mr.addr = axif->umem_start;
+      mr.len = axif->umem_size;
+      mr.chunk_size = AF_XDP_FRAME_SIZE;
+      mr.flags = XDP_UMEM_UNALIGNED_CHUNK_FLAG;
+
+      if ((err = setsockopt(q->fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr))) < 0)
+	{
+	  DBG_SOCK("Failed to register UMEM");
+	  return VNET_API_ERROR_SYSCALL_ERROR_1;
+	}
+    }
+
+  /* Every socket has its own fill and completion rings */
+  if (setsockopt(q->fd, SOL_XDP, XDP_UMEM_FILL_RING,
+		 &ring_size, sizeof(ring_size)) < 0 ||
+      setsockopt(q->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+		 &ring_size, sizeof(ring_size)) < 0 ||
+      setsockopt(q->fd, SOL_XDP, XDP_RX_RING,
+		 &ring_size, sizeof(ring_size)) < 0 ||
+      setsockopt(q->fd, SOL_XDP, XDP_TX_RING,
+		 &ring_size, sizeof(ring_size)) < 0)
+    {
+      DBG_SOCK("Failed to set ring sizes");
+      return VNET_API_ERROR_SYSCALL_ERROR_1;
+    }
+
+  if ((err = getsockopt(q->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen)) < 0)
+    {
+      DBG_SOCK("Failed to get ring offsets");
+      return VNET_API_ERROR_SYSCALL_ERROR_1;
+    }
+
+  if (af_xdp_map_ring (q->fd, &q->rx, &off.rx, XDP_PGOFF_RX_RING,
+		       sizeof (struct xdp_desc)) ||
+      af_xdp_map_ring (q->fd, &q->tx, &off.tx, XDP_PGOFF_TX_RING,
+		       sizeof (struct xdp_desc)) ||
+      af_xdp_map_ring (q->fd, &q->fill, &off.fr, XDP_UMEM_PGOFF_FILL_RING,
+		       sizeof (u64)) ||
+      af_xdp_map_ring (q->fd, &q->completion, &off.cr,
+		       XDP_UMEM_PGOFF_COMPLETION_RING, sizeof (u64)))
+    {
+      DBG_SOCK("mmap failure");
+      return VNET_API_ERROR_SYSCALL_ERROR_1;
+    }
+
+  /* Wakeups run the driver in the polling thread; older kernels ignore it */
+  if (is_busy_poll)
+    {
+      opt = 1;
+      setsockopt(q->fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &opt, sizeof(opt));
+      opt = AF_XDP_BUSY_POLL_USEC;
+      setsockopt(q->fd, SOL_SOCKET, SO_BUSY_POLL, &opt, sizeof(opt));
+      opt = VLIB_FRAME_SIZE;
+      setsockopt(q->fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &opt, sizeof(opt));
+    }
+
+  memset (&sxdp, 0, sizeof (sxdp));
+  sxdp.sxdp_family = AF_XDP;
+  sxdp.sxdp_ifindex = axif->host_if_index;
+  sxdp.sxdp_queue_id = queue_id;
+
+  if (queue_id == 0)
+    {
+      sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP |
+	(axif->is_zerocopy ? XDP_ZEROCOPY : XDP_COPY);
+      err = bind(q->fd, (struct sockaddr *) &sxdp, sizeof(sxdp));
+
+      /* Not every driver does zero-copy, copy mode still skips the skb */
+      if (err < 0 && axif->is_zerocopy)
+	{
+	  axif->is_zerocopy = 0;
+	  sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+	  err = bind(q->fd, (struct sockaddr *) &sxdp, sizeof(sxdp));
+	}
+    }
+  else
+    {
+      /* Mode and wakeup flags come with the shared UMEM */
+      sxdp.sxdp_flags = XDP_SHARED_UMEM;
+      sxdp.sxdp_shared_umem_fd = axif->queues[0].fd;
+      err = bind(q->fd, (struct sockaddr *) &sxdp, sizeof(sxdp));
+    }
+
+  if (err < 0)
+    {
+      DBG_SOCK("Failed to bind queue %d (error %d)", queue_id, err);
+      return VNET_API_ERROR_SYSCALL_ERROR_1;
+    }
+
+  /* Steer the queue's packets to the socket */
+  memset (&attr, 0, sizeof (attr));
+  attr.map_fd = axif->xsks_map_fd;
+  attr.key = pointer_to_uword (&queue_id);
+  attr.value = pointer_to_uword (&q->fd);
+  attr.flags = BPF_ANY;
+
+  if (af_xdp_bpf (BPF_MAP_UPDATE_ELEM, &attr) < 0)
+    {
+      DBG_SOCK("Failed to add queue %d to the xsks map", queue_id);
+      return VNET_API_ERROR_SYSCALL_ERROR_2;
+    }
+
+  return 0;
+}
+
+/*
+ * Buffers the kernel has not returned: fill entries it never took, rx and
+ * completions we never read, tx descriptors it never sent. Called once
+ * the program is detached.
+ */
+static void
+af_xdp_free_ring_buffers (vlib_main_t * vm, af_xdp_if_t * axif,
+			  af_xdp_queue_t * q)
+{
+  struct xdp_desc * descs;
+  u64 * addrs;
+  u32 * bis = 0;
+  u32 i;
+
+  if (q->fill.map)
+    for (i = *q->fill.consumer, addrs = q->fill.desc;
+	 i != q->fill.cached_prod; i++)
+      vec_add1 (bis, vlib_get_buffer_index
+		(vm, af_xdp_rx_buffer (axif, addrs[i & q->fill.mask])));
+
+  if (q->rx.map)
+    for (i = q->rx.cached_cons, descs = q->rx.desc;
+	 i != *q->rx.producer; i++)
+      vec_add1 (bis, vlib_get_buffer_index
+		(vm, af_xdp_rx_buffer (axif, descs[i & q->rx.mask].addr)));
+
+  if (q->tx.map)
+    for (i = *q->tx.consumer, descs = q->tx.desc;
+	 i != q->tx.cached_prod; i++)
+      vec_add1 (bis, vlib_get_buffer_index
+		(vm, af_xdp_tx_buffer (axif, descs[i & q->tx.mask].addr)));
+
+  if (q->completion.map)
+    for (i = q->completion.cached_cons, addrs = q->completion.desc;
+	 i != *q->completion.producer; i++)
+      vec_add1 (bis, vlib_get_buffer_index
+		(vm, af_xdp_tx_buffer (axif, addrs[i & q->completion.mask])));
+
+  if (vec_len (bis))
+    vlib_buffer_free (vm, bis, vec_len (bis));
+  vec_free (bis);
+}
+
+static void
+af_xdp_free_queues (vlib_main_t * vm, af_xdp_if_t * axif)
+{
+  af_xdp_queue_t * q;
+
+  /* Nothing new arrives once the program is gone */
+  if (axif->xdp_flags &&
+      af_xdp_set_link_xdp_fd (axif->host_if_index, -1, axif->xdp_flags) < 0)
+    clib_warning("Host interface %s could not detach XDP program",
+		 axif->host_if_name);
+  axif->xdp_flags = 0;
+
+  vec_foreach (q, axif->queues)
+    {
+      if (q->unix_file_index != ~0)
+	unix_file_del(&unix_main, unix_main.file_pool + q->unix_file_index);
+      af_xdp_free_ring_buffers (vm, axif, q);
+      af_xdp_unmap_ring (&q->rx);
+      af_xdp_unmap_ring (&q->tx);
+      af_xdp_unmap_ring (&q->fill);
+      af_xdp_unmap_ring (&q->completion);
+      if (q->lockp)
+	clib_mem_free((void *) q->lockp);
+    }
+
+  /* Sharing sockets first, the UMEM owner last */
+  vec_foreach_backwards (q, axif->queues)
+    if (q->fd >= 0)
+      close(q->fd);
+
+  if (axif->prog_fd >= 0)
+    close(axif->prog_fd);
+  if (axif->xsks_map_fd >= 0)
+    close(axif->xsks_map_fd);
+
+  vec_free(axif->queues);
+}
+
+static void
+af_xdp_worker_thread_enable_disable (int is_enable)
+{
+  af_xdp_main_t * axm = &af_xdp_main;
+
+  /* with worker threads, the input cpus poll their queues */
+  foreach_vlib_main (
+  ({
+    u32 cpu = this_vlib_main->cpu_index;
+    if (cpu >= axm->input_cpu_first_index &&
+	cpu < axm->input_cpu_first_index + axm->input_cpu_count)
+      vlib_node_set_state(this_vlib_main, af_xdp_input_node.index,
+			  is_enable ? VLIB_NODE_STATE_POLLING :
+			  VLIB_NODE_STATE_INTERRUPT);
+  }));
+}
+
+int
+af_xdp_create_if(vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set,
+		 u32 n_queues, int is_copy, u32 *sw_if_index)
+{
+  af_xdp_main_t * axm = &af_xdp_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main();
+  vlib_physmem_main_t * vpm = &vm->physmem_main;
+  uword page_size = clib_mem_get_page_size ();
+  uword umem_start, umem_end;
+  int ret = 0;
+  af_xdp_if_t * axif = 0;
+  af_xdp_queue_t * q;
+  u8 hw_addr[6];
+  clib_error_t * error;
+  vnet_sw_interface_t * sw;
+  vnet_main_t *vnm = vnet_get_main();
+  union bpf_attr attr;
+  struct rlimit rl;
+  uword * p;
+  uword if_index;
+  uint host_if_index;
+  u32 i;
+
+  p = mhash_get (&axm->if_index_by_host_if_name, host_if_name);
+  if (p)
+    return VNET_API_ERROR_SUBIF_ALREADY_EXISTS;
+
+  host_if_index = if_nametoindex((const char *) host_if_name);
+
+  if (!host_if_index)
+    {
+      DBG_SOCK("Wrong host interface name");
+      return VNET_API_ERROR_INVALID_INTERFACE;
+    }
+
+  if (n_queues == 0)
+    n_queues = 1;
+
+  /* The map and the UMEM are locked memory; older kernels count it here */
+  rl.rlim_cur = rl.rlim_max = RLIM_INFINITY;
+  setrlimit (RLIMIT_MEMLOCK, &rl);
+
+  /* Workers walk the pool */
+  vlib_worker_thread_barrier_sync (vm);
+
+  pool_get_aligned (axm->interfaces, axif, CLIB_CACHE_LINE_BYTES);
+  memset (axif, 0, sizeof (*axif));
+  if_index = axif - axm->interfaces;
+
+  axif->host_if_name = vec_dup (host_if_name);
+  axif->host_if_index = host_if_index;
+  axif->per_interface_next_index = ~0;
+  axif->xsks_map_fd = -1;
+  axif->prog_fd = -1;
+
+  /* Zero-copy DMA needs physically contiguous chunks */
+  axif->is_zerocopy = !is_copy && !vpm->is_fake;
+
+#if DPDK > 0
+  /*
+   * The physmem span covers every socket's mbuf pool and the holes
+   * between them; the kernel pins the UMEM, so only the pool this
+   * thread allocates from goes in.
+   */
+  {
+    struct rte_mempool * rmp =
+      vm->buffer_main->pktmbuf_pools[rte_socket_id ()];
+    umem_start = pointer_to_uword (rmp);
+    umem_end = rmp->elt_va_end;
+  }
+#else
+  /* One mapping of the whole region */
+  umem_start = vpm->virtual.start;
+  umem_end = vpm->virtual.end;
+#endif
+  axif->umem_start = umem_start & ~(page_size - 1);
+  axif->umem_size = round_pow2 (umem_end, page_size) - axif->umem_start;
+
+  vec_validate_aligned (axif->queues, n_queues - 1, CLIB_CACHE_LINE_BYTES);
+  vec_foreach (q, axif->queues)
+    {
+      q->fd = -1;
+      q->unix_file_index = ~0;
+    }
+
+  memset (&attr, 0, sizeof (attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof (u32);
+  attr.value_size = sizeof (int);
+  attr.max_entries = n_queues;
+
+  if ((axif->xsks_map_fd = af_xdp_bpf (BPF_MAP_CREATE, &attr)) < 0 ||
+      (axif->prog_fd = af_xdp_load_program (axif->xsks_map_fd)) < 0)
+    {
+      DBG_SOCK("Failed to create the XDP program");
+      ret = VNET_API_ERROR_SYSCALL_ERROR_2;
+      goto error;
+    }
+
+  /*
+   * Native mode first; generic mode works everywhere but copies. Until
+   * a queue's socket is in the map, its packets still go to the stack.
+   */
+  axif->xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST | XDP_FLAGS_DRV_MODE;
+  if (is_copy || af_xdp_set_link_xdp_fd (host_if_index, axif->prog_fd,
+					 axif->xdp_flags) < 0)
+    {
+      axif->xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST | XDP_FLAGS_SKB_MODE;
+      axif->is_zerocopy = 0;
+      if (af_xdp_set_link_xdp_fd (host_if_index, axif->prog_fd,
+				  axif->xdp_flags) < 0)
+	{
+	  DBG_SOCK("Failed to attach the XDP program");
+	  axif->xdp_flags = 0;
+	  ret = VNET_API_ERROR_SYSCALL_ERROR_3;
+	  goto error;
+	}
+    }
+
+  for (i = 0; i < n_queues; i++)
+    {
+      ret = af_xdp_create_queue (axif, i, tm->n_vlib_mains > 1);
+      if (ret != 0)
+	goto error;
+
+      q = vec_elt_at_index (axif->queues, i);
+      q->cpu_index = axm->input_cpu_first_index +
+	(axm->next_input_cpu++ % axm->input_cpu_count);
+
+      /* The kernel needs chunks before it can deliver anything */
+      af_xdp_refill (vm, axif, q);
+
+      /* Without workers the main thread is woken up by the socket */
+      if (tm->n_vlib_mains == 1)
+	{
+	  unix_file_t template = {0};
+	  template.read_function = af_xdp_fd_read_ready;
+	  template.file_descriptor = q->fd;
+	  template.private_data = if_index;
+	  template.flags = UNIX_FILE_EVENT_EDGE_TRIGGERED;
+	  q->unix_file_index = unix_file_add (&unix_main, &template);
+	}
+
+      /*
+       * Threads may outnumber the queues on tx, and the thread polling a
+       * queue is not the one sending on it, yet both reap its completions
+       */
+      if (tm->n_vlib_mains > 1)
+	{
+	  q->lockp = clib_mem_alloc_aligned (CLIB_CACHE_LINE_BYTES,
+					     CLIB_CACHE_LINE_BYTES);
+	  memset ((void *) q->lockp, 0, CLIB_CACHE_LINE_BYTES);
+	}
+    }
+
+  /*use configured or generate random MAC address */
+  if (hw_addr_set)
+    clib_memcpy(hw_addr, hw_addr_set, 6);
+  else
+    {
+      f64 now = vlib_time_now(vm);
+      u32 rnd;
+      rnd = (u32) (now * 1e6);
+      rnd = random_u32 (&rnd);
+
+      clib_memcpy (hw_addr+2, &rnd, sizeof(rnd));
+      hw_addr[0] = 2;
+      hw_addr[1] = 0xfe;
+    }
+
+  error = ethernet_register_interface(vnm, af_xdp_device_class.index,
+				      if_index, hw_addr, &axif->hw_if_index,
+				      af_xdp_eth_flag_change);
+
+  if (error)
+    {
+      clib_error_report (error);
+      ret = VNET_API_ERROR_SYSCALL_ERROR_1;
+      goto error;
+    }
+
+  sw = vnet_get_hw_sw_interface (vnm, axif->hw_if_index);
+  axif->sw_if_index = sw->sw_if_index;
+
+  vnet_hw_interface_set_flags (vnm, axif->hw_if_index,
+			       VNET_HW_INTERFACE_FLAG_LINK_UP);
+
+  mhash_set_mem (&axm->if_index_by_host_if_name, axif->host_if_name,
+		 &if_index, 0);
+  if (sw_if_index)
+    *sw_if_index = axif->sw_if_index;
+
+  if (tm->n_vlib_mains > 1 && pool_elts(axm->interfaces) == 1)
+    af_xdp_worker_thread_enable_disable (1);
+
+  vlib_worker_thread_barrier_release (vm);
+  return 0;
+
+error:
+  af_xdp_free_queues(vm, axif);
+  vec_free(axif->host_if_name);
+  memset(axif, 0, sizeof(*axif));
+  pool_put(axm->interfaces, axif);
+  vlib_worker_thread_barrier_release (vm);
+  return ret;
+}
+
+int
+af_xdp_delete_if(vlib_main_t *vm, u8 *host_if_name)
+{
+  vnet_main_t *vnm = vnet_get_main();
+  af_xdp_main_t *axm = &af_xdp_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main();
+  af_xdp_if_t *axif;
+  uword *p;
+  uword if_index;
+
+  p = mhash_get(&axm->if_index_by_host_if_name, host_if_name);
+  if (p == NULL) {
+    clib_warning("Host interface %s does not exist", host_if_name);
+    return VNET_API_ERROR_INVALID_INTERFACE;
+  }
+  axif = pool_elt_at_index(axm->interfaces, p[0]);
+  if_index = axif - axm->interfaces;
+
+  /* bring down the interface */
+  vnet_hw_interface_set_flags(vnm, axif->hw_if_index, 0);
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  /* clean up */
+  af_xdp_free_queues(vm, axif);
+
+  mhash_unset(&axm->if_index_by_host_if_name, axif->host_if_name, &if_index);
+
+  vec_free(axif->host_if_name);
+  axif->host_if_name = NULL;
+
+  ethernet_delete_interface(vnm, axif->hw_if_index);
+
+  pool_put(axm->interfaces, axif);
+
+  if (tm->n_vlib_mains > 1 && pool_elts(axm->interfaces) == 0)
+    af_xdp_worker_thread_enable_disable (0);
+
+  vlib_worker_thread_barrier_release (vm);
+
+  return 0;
+}
+
+static clib_error_t *
+af_xdp_init (vlib_main_t * vm)
+{
+  af_xdp_main_t * axm = &af_xdp_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main();
+  vlib_thread_registration_t * tr;
+  uword * p;
+
+  memset (axm, 0, sizeof (af_xdp_main_t));
+
+  axm->input_cpu_first_index = 0;
+  axm->input_cpu_count = 1;
+
+  /* find out which cpus will be used for input */
+  p = hash_get_mem (tm->thread_registrations_by_name, "workers");
+  tr = p ? (vlib_thread_registration_t *) p[0] : 0;
+
+  if (tr && tr->count > 0)
+    {
+      axm->input_cpu_first_index = tr->first_index;
+      axm->input_cpu_count = tr->count;
+    }
+
+  mhash_init_vec_string (&axm->if_index_by_host_if_name, sizeof (uword));
+
+  vec_validate_aligned (axm->buffers, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+
+  /* Before the workers fork the free lists */
+  axm->free_list_index =
+    vlib_buffer_get_or_create_free_list (vm, AF_XDP_FRAME_SIZE, "af-xdp");
+
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (af_xdp_init);
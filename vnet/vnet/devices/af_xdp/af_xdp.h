@@ -0,0 +1,260 @@
+/*
+ *------------------------------------------------------------------
+ * af_xdp.h - linux kernel AF_XDP socket interface header file
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *------------------------------------------------------------------
+ */
+
+#include <linux/if_xdp.h>
+
+/*
+ * The UMEM is the vlib physmem region, registered with unaligned chunks.
+ * A fill ring entry is the offset of a vlib buffer's data; the kernel
+ * writes the packet into it and hands back the same offset, with the
+ * packet's offset in the chunk in the top bits. Tx descriptors point at
+ * the buffer itself the same way. No copy on rx, and none on tx for
+ * single-segment buffers.
+ */
+#define AF_XDP_FRAME_SIZE	2048
+#define AF_XDP_RING_SIZE	1024
+
+typedef struct {
+  volatile u32 * producer;
+  volatile u32 * consumer;
+  volatile u32 * flags;
+  void * desc;
+  u32 mask;
+
+  /* Our end of the ring, published in batches */
+  u32 cached_prod;
+  u32 cached_cons;
+
+  void * map;
+  uword map_size;
+} af_xdp_ring_t;
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+  int fd;
+  u32 unix_file_index;
+
+  /* rx side: fill ring in, rx ring out */
+  af_xdp_ring_t rx;
+  af_xdp_ring_t fill;
+
+  /* Thread polling this queue */
+  u32 cpu_index;
+
+  CLIB_CACHE_LINE_ALIGN_MARK(cacheline1);
+  /* Set with workers, serializes tx and completion reaping */
+  volatile u32 * lockp;
+
+  /* tx side: tx ring in, completion ring out */
+  af_xdp_ring_t tx;
+  af_xdp_ring_t completion;
+} af_xdp_queue_t;
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+  u8 * host_if_name;
+  u32 host_if_index;
+  u32 hw_if_index;
+  u32 sw_if_index;
+
+  /* One socket per kernel queue, all sharing queue 0's UMEM */
+  af_xdp_queue_t * queues;
+
+  /* Registered UMEM, page aligned cover of the buffer memory */
+  uword umem_start;
+  uword umem_size;
+
+  /* XSKMAP and the program redirecting into it */
+  int xsks_map_fd;
+  int prog_fd;
+  u32 xdp_flags;
+
+  u8 is_zerocopy;
+
+  u32 per_interface_next_index;
+  u8 is_admin_up;
+} af_xdp_if_t;
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+  af_xdp_if_t * interfaces;
+
+  /* bitmap of pending rx interfaces */
+  uword * pending_input_bitmap;
+
+  /* Buffers large enough for a whole frame */
+  u32 free_list_index;
+
+  /* Scratch vectors of buffer indices, per thread */
+  u32 ** buffers;
+
+  /* hash of host interface names */
+  mhash_t if_index_by_host_if_name;
+
+  /* first cpu index */
+  u32 input_cpu_first_index;
+
+  /* total cpu count */
+  u32 input_cpu_count;
+
+  /* round robin placement of queues on input cpus */
+  u32 next_input_cpu;
+} af_xdp_main_t;
+
+af_xdp_main_t af_xdp_main;
+extern vnet_device_class_t af_xdp_device_class;
+extern vlib_node_registration_t af_xdp_input_node;
+
+/* Entries the producer may still add */
+always_inline u32
+af_xdp_ring_n_free (af_xdp_ring_t * r)
+{
+  return r->mask + 1 - (r->cached_prod - *r->consumer);
+}
+
+/* Entries ready for the consumer; reads after this see their contents */
+always_inline u32
+af_xdp_ring_n_ready (af_xdp_ring_t * r)
+{
+  u32 n = *r->producer - r->cached_cons;
+  CLIB_MEMORY_BARRIER();
+  return n;
+}
+
+always_inline void
+af_xdp_ring_produce (af_xdp_ring_t * r)
+{
+  CLIB_MEMORY_BARRIER();
+  *r->producer = r->cached_prod;
+}
+
+always_inline void
+af_xdp_ring_consume (af_xdp_ring_t * r)
+{
+  CLIB_MEMORY_BARRIER();
+  *r->consumer = r->cached_cons;
+}
+
+always_inline int
+af_xdp_ring_needs_wakeup (af_xdp_ring_t * r)
+{
+  return (*r->flags & XDP_RING_NEED_WAKEUP) != 0;
+}
+
+always_inline int
+af_xdp_is_umem (af_xdp_if_t * axif, void * p, u32 len)
+{
+  uword a = pointer_to_uword (p);
+  return a >= axif->umem_start && a + len <= axif->umem_start + axif->umem_size;
+}
+
+always_inline u64
+af_xdp_umem_addr (af_xdp_if_t * axif, void * p)
+{
+  return pointer_to_uword (p) - axif->umem_start;
+}
+
+/* rx chunks start at the buffer's data */
+always_inline vlib_buffer_t *
+af_xdp_rx_buffer (af_xdp_if_t * axif, u64 addr)
+{
+  return uword_to_pointer (axif->umem_start +
+			   (addr & XSK_UNALIGNED_BUF_ADDR_MASK) -
+			   STRUCT_OFFSET_OF (vlib_buffer_t, data),
+			   vlib_buffer_t *);
+}
+
+/* tx descriptors point at the buffer header, current_data may be < 0 */
+always_inline vlib_buffer_t *
+af_xdp_tx_buffer (af_xdp_if_t * axif, u64 addr)
+{
+  return uword_to_pointer (axif->umem_start +
+			   (addr & XSK_UNALIGNED_BUF_ADDR_MASK),
+			   vlib_buffer_t *);
+}
+
+/* Top up the fill ring with fresh buffers, in one batch */
+always_inline void
+af_xdp_refill (vlib_main_t * vm, af_xdp_if_t * axif, af_xdp_queue_t * q)
+{
+  af_xdp_main_t * axm = &af_xdp_main;
+  u32 cpu_index = os_get_cpu_number();
+  u32 n_free = af_xdp_ring_n_free (&q->fill);
+  u64 * addrs = q->fill.desc;
+  u32 n_alloc, n_foreign = 0, i;
+  u32 * bis;
+
+  if (n_free < VLIB_FRAME_SIZE / 4)
+    return;
+
+  vec_validate (axm->buffers[cpu_index], n_free - 1);
+  bis = axm->buffers[cpu_index];
+
+  n_alloc = vlib_buffer_alloc_from_free_list (vm, bis, n_free,
+                                              axm->free_list_index);
+  for (i = 0; i < n_alloc; i++)
+    {
+      vlib_buffer_t * b = vlib_get_buffer (vm, bis[i]);
+
+      /* Another socket's pool: the kernel can't write there */
+      if (PREDICT_FALSE(!af_xdp_is_umem (axif, b->data, AF_XDP_FRAME_SIZE)))
+        {
+          bis[n_foreign++] = bis[i];
+          continue;
+        }
+      addrs[q->fill.cached_prod++ & q->fill.mask] =
+        af_xdp_umem_addr (axif, b->data);
+    }
+
+  if (n_alloc > n_foreign)
+    af_xdp_ring_produce (&q->fill);
+  if (PREDICT_FALSE(n_foreign))
+    vlib_buffer_free (vm, bis, n_foreign);
+}
+
+/* Buffers the kernel is done sending go back to their free lists */
+always_inline void
+af_xdp_reap_completions (vlib_main_t * vm, af_xdp_if_t * axif,
+                         af_xdp_queue_t * q)
+{
+  af_xdp_main_t * axm = &af_xdp_main;
+  u32 cpu_index = os_get_cpu_number();
+  u64 * addrs = q->completion.desc;
+  u32 n_done = af_xdp_ring_n_ready (&q->completion);
+  u32 * bis;
+  u32 i;
+
+  if (n_done == 0)
+    return;
+
+  vec_validate (axm->buffers[cpu_index], n_done - 1);
+  bis = axm->buffers[cpu_index];
+
+  for (i = 0; i < n_done; i++)
+    bis[i] = vlib_get_buffer_index
+      (vm, af_xdp_tx_buffer
+       (axif, addrs[q->completion.cached_cons++ & q->completion.mask]));
+
+  af_xdp_ring_consume (&q->completion);
+  vlib_buffer_free (vm, bis, n_done);
+}
+
+int af_xdp_create_if(vlib_main_t * vm, u8 * host_if_name, u8 * hw_addr_set,
+                     u32 n_queues, int is_copy, u32 *sw_if_index);
+int af_xdp_delete_if(vlib_main_t * vm, u8 * host_if_name);
@@ -0,0 +1,388 @@
+/*
+ *------------------------------------------------------------------
+ * device.c - linux kernel AF_XDP socket interface device class
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *------------------------------------------------------------------
+ */
+
+#include <sys/socket.h>
+#include <linux/if_link.h>
+
+#include <vlib/vlib.h>
+#include <vlib/unix/unix.h>
+#include <vnet/ip/ip.h>
+#include <vnet/ethernet/ethernet.h>
+
+#include <vnet/devices/af_xdp/af_xdp.h>
+
+#ifndef SOL_XDP
+#define SOL_XDP				283
+#endif
+
+/* Copy mode sends a small batch per syscall and says EAGAIN for the rest */
+#define AF_XDP_TX_MAX_KICKS		(VLIB_FRAME_SIZE / 16)
+
+#define foreach_af_xdp_tx_func_error               \
+_(RING_FULL,       "tx ring full")                 \
+_(TOO_BIG,         "packet larger than a frame")   \
+_(NO_BUFFERS,      "no buffers to linearize")      \
+_(WAKEUP_FATAL,    "tx wakeup fatal failure")
+
+typedef enum {
+#define _(f,s) AF_XDP_TX_ERROR_##f,
+  foreach_af_xdp_tx_func_error
+#undef _
+  AF_XDP_TX_N_ERROR,
+} af_xdp_tx_func_error_t;
+
+static char * af_xdp_tx_func_error_strings[] = {
+#define _(n,s) s,
+    foreach_af_xdp_tx_func_error
+#undef _
+};
+
+
+static u8 * format_af_xdp_device_name (u8 * s, va_list * args)
+{
+  u32 i = va_arg (*args, u32);
+  af_xdp_main_t * axm = &af_xdp_main;
+  af_xdp_if_t * axif = pool_elt_at_index (axm->interfaces, i);
+
+  s = format (s, "xdp-%s", axif->host_if_name);
+  return s;
+}
+
+static u8 * format_af_xdp_device (u8 * s, va_list * args)
+{
+  u32 i = va_arg (*args, u32);
+  af_xdp_main_t * axm = &af_xdp_main;
+  af_xdp_if_t * axif = pool_elt_at_index (axm->interfaces, i);
+  uword indent = format_get_indent (s);
+  af_xdp_queue_t * q;
+
+  s = format (s, "Linux AF_XDP socket interface");
+  s = format (s, "\n%U%d queues, %s XDP, %s",
+              format_white_space, indent + 2,
+              vec_len (axif->queues),
+              (axif->xdp_flags & XDP_FLAGS_DRV_MODE) ? "native" : "generic",
+              axif->is_zerocopy ? "zero-copy" : "copy mode");
+  vec_foreach (q, axif->queues)
+    {
+      struct xdp_statistics st;
+      socklen_t len = sizeof (st);
+
+      s = format (s, "\n%Uqueue %d polled by cpu %d",
+                  format_white_space, indent + 2,
+                  q - axif->queues, q->cpu_index);
+
+      memset (&st, 0, sizeof (st));
+      if (getsockopt (q->fd, SOL_XDP, XDP_STATISTICS, &st, &len) == 0)
+        s = format (s, "\n%Urx dropped %llu rx ring full %llu "
+                    "fill ring empty %llu invalid rx %llu tx %llu",
+                    format_white_space, indent + 4,
+                    st.rx_dropped, st.rx_ring_full,
+                    st.rx_fill_ring_empty_descs,
+                    st.rx_invalid_descs, st.tx_invalid_descs);
+    }
+  return s;
+}
+
+typedef struct {
+  u32 buffer_index;
+  u32 hw_if_index;
+  u32 queue_id;
+  u8 is_linearized;
+  struct xdp_desc desc;
+  /* Copy of the buffer; packet data stored in pre_data. */
+  vlib_buffer_t buffer;
+} af_xdp_tx_trace_t;
+
+static u8 * format_af_xdp_tx_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  af_xdp_tx_trace_t * t = va_arg (*args, af_xdp_tx_trace_t *);
+  uword indent = format_get_indent (s);
+
+  s = format (s, "af_xdp: hw_if_index %d queue %d buffer 0x%x%s",
+              t->hw_if_index, t->queue_id, t->buffer_index,
+              t->is_linearized ? " (copied)" : "");
+  s = format (s, "\n%Uxdp_desc: addr 0x%llx offset %u len %u",
+              format_white_space, indent + 2,
+              t->desc.addr & XSK_UNALIGNED_BUF_ADDR_MASK,
+              (u32) (t->desc.addr >> XSK_UNALIGNED_BUF_OFFSET_SHIFT),
+              t->desc.len);
+  s = format (s, "\n%Ubuffer: %U", format_white_space, indent + 2,
+              format_vlib_buffer, &t->buffer);
+  s = format (s, "\n%U%U", format_white_space, indent + 2,
+              format_ethernet_header_with_length, t->buffer.pre_data,
+              sizeof (t->buffer.pre_data));
+  return s;
+}
+
+static void
+af_xdp_tx_trace (vlib_main_t * vm, vlib_node_runtime_t * node,
+                 af_xdp_if_t * axif, u32 queue_id, u32 bi, vlib_buffer_t * b,
+                 vlib_buffer_t * sent, struct xdp_desc * d)
+{
+  af_xdp_tx_trace_t * t;
+
+  t = vlib_add_trace (vm, node, b, sizeof (t[0]));
+  t->buffer_index = bi;
+  t->hw_if_index = axif->hw_if_index;
+  t->queue_id = queue_id;
+  t->is_linearized = sent != b;
+  t->desc = d[0];
+  clib_memcpy (&t->buffer, sent, sizeof (sent[0]) - sizeof (sent->pre_data));
+  clib_memcpy (t->buffer.pre_data, vlib_buffer_get_current (sent),
+               clib_min (sizeof (t->buffer.pre_data), sent->current_length));
+}
+
+/* Chained, or not in the UMEM: copy into one frame sized buffer */
+static u32
+af_xdp_linearize (vlib_main_t * vm, vlib_buffer_t * b)
+{
+  af_xdp_main_t * axm = &af_xdp_main;
+  vlib_buffer_t * nb;
+  u32 nbi, len = 0;
+
+  if (vlib_buffer_alloc_from_free_list (vm, &nbi, 1,
+                                        axm->free_list_index) != 1)
+    return ~0;
+
+  nb = vlib_get_buffer (vm, nbi);
+  nb->current_data = 0;
+  nb->flags = 0;
+
+  while (1)
+    {
+      clib_memcpy (nb->data + len, vlib_buffer_get_current (b),
+                   b->current_length);
+      len += b->current_length;
+      if (!(b->flags & VLIB_BUFFER_NEXT_PRESENT))
+        break;
+      b = vlib_get_buffer (vm, b->next_buffer);
+    }
+
+  nb->current_length = len;
+  return nbi;
+}
+
+static_always_inline void
+af_xdp_tx_kick (vlib_main_t * vm, vlib_node_runtime_t * node,
+                af_xdp_queue_t * q)
+{
+  u32 n_kicks = 0;
+
+  while (af_xdp_ring_needs_wakeup (&q->tx) &&
+         *q->tx.consumer != q->tx.cached_prod &&
+         n_kicks++ < AF_XDP_TX_MAX_KICKS)
+    {
+      if (sendto (q->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) >= 0)
+        break;
+      if (errno == EAGAIN || errno == EBUSY)
+        continue;
+      /* Out of skbs, or the link went down: try again next frame */
+      if (errno != ENOBUFS && errno != ENETDOWN)
+        vlib_error_count (vm, node->node_index,
+                          AF_XDP_TX_ERROR_WAKEUP_FATAL, 1);
+      break;
+    }
+}
+
+static uword
+af_xdp_interface_tx (vlib_main_t * vm,
+                     vlib_node_runtime_t * node,
+                     vlib_frame_t * frame)
+{
+  af_xdp_main_t * axm = &af_xdp_main;
+  u32 * buffers = vlib_frame_args (frame);
+  u32 n_left = frame->n_vectors;
+  vnet_interface_output_runtime_t * rd = (void *) node->runtime_data;
+  af_xdp_if_t * axif = pool_elt_at_index (axm->interfaces, rd->dev_instance);
+  u32 cpu_index = os_get_cpu_number();
+  u32 queue_id = cpu_index % vec_len (axif->queues);
+  af_xdp_queue_t * q = vec_elt_at_index (axif->queues, queue_id);
+  struct xdp_desc * descs = q->tx.desc;
+  u32 n_free_slots, n_sent = 0;
+  u32 n_too_big = 0, n_no_buffers = 0, n_ring_full = 0;
+  u32 * drops, n_drops = 0;
+
+  if (PREDICT_FALSE(q->lockp != 0))
+    {
+      while (__sync_lock_test_and_set (q->lockp, 1))
+        ;
+    }
+
+  af_xdp_reap_completions (vm, axif, q);
+
+  /* Sent buffers belong to the kernel until completion, only drops are freed */
+  vec_validate (axm->buffers[cpu_index], n_left - 1);
+  drops = axm->buffers[cpu_index];
+
+  n_free_slots = af_xdp_ring_n_free (&q->tx);
+
+  while (n_left > 0 && n_sent < n_free_slots)
+    {
+      u32 bi0 = buffers[0];
+      vlib_buffer_t * b0 = vlib_get_buffer (vm, bi0);
+      vlib_buffer_t * ob0 = b0;
+      u8 * data0 = vlib_buffer_get_current (b0);
+      struct xdp_desc * d;
+      u32 nbi0;
+
+      buffers++;
+      n_left--;
+
+      if (PREDICT_FALSE((b0->flags & VLIB_BUFFER_NEXT_PRESENT) ||
+                        !af_xdp_is_umem (axif, b0, data0 + b0->current_length
+                                         - (u8 *) b0)))
+        {
+          drops[n_drops++] = bi0;
+          if (vlib_buffer_length_in_chain (vm, b0) > AF_XDP_FRAME_SIZE)
+            {
+              n_too_big++;
+              continue;
+            }
+          nbi0 = af_xdp_linearize (vm, b0);
+          if (nbi0 == ~0)
+            {
+              n_no_buffers++;
+              continue;
+            }
+          b0 = vlib_get_buffer (vm, nbi0);
+          data0 = vlib_buffer_get_current (b0);
+        }
+      else if (PREDICT_FALSE(b0->current_length > AF_XDP_FRAME_SIZE))
+        {
+          drops[n_drops++] = bi0;
+          n_too_big++;
+          continue;
+        }
+
+      d = descs + (q->tx.cached_prod++ & q->tx.mask);
+      d->addr = af_xdp_umem_addr (axif, b0) |
+        ((u64) (data0 - (u8 *) b0) << XSK_UNALIGNED_BUF_OFFSET_SHIFT);
+      d->len = b0->current_length;
+      d->options = 0;
+      n_sent++;
+
+      if (PREDICT_FALSE(ob0->flags & VLIB_BUFFER_IS_TRACED))
+        af_xdp_tx_trace (vm, node, axif, queue_id, bi0, ob0, b0, d);
+    }
+
+  if (PREDICT_TRUE(n_sent))
+    {
+      af_xdp_ring_produce (&q->tx);
+      af_xdp_tx_kick (vm, node, q);
+    }
+
+  if (PREDICT_FALSE(q->lockp != 0))
+    *q->lockp = 0;
+
+  if (PREDICT_FALSE(n_left))
+    {
+      n_ring_full = n_left;
+      clib_memcpy (drops + n_drops, buffers, n_left * sizeof (u32));
+      n_drops += n_left;
+      vlib_error_count (vm, node->node_index, AF_XDP_TX_ERROR_RING_FULL,
+                        n_ring_full);
+    }
+
+  if (PREDICT_FALSE(n_too_big))
+    vlib_error_count (vm, node->node_index, AF_XDP_TX_ERROR_TOO_BIG,
+                      n_too_big);
+
+  if (PREDICT_FALSE(n_no_buffers))
+    vlib_error_count (vm, node->node_index, AF_XDP_TX_ERROR_NO_BUFFERS,
+                      n_no_buffers);
+
+  if (n_drops)
+    vlib_buffer_free (vm, drops, n_drops);
+
+  return frame->n_vectors;
+}
+
+static void
+af_xdp_set_interface_next_node (vnet_main_t *vnm, u32 hw_if_index,
+                                u32 node_index)
+{
+  af_xdp_main_t * axm = &af_xdp_main;
+  vnet_hw_interface_t *hw = vnet_get_hw_interface (vnm, hw_if_index);
+  af_xdp_if_t * axif = pool_elt_at_index (axm->interfaces, hw->dev_instance);
+
+  /* Shut off redirection */
+  if (node_index == ~0)
+    {
+      axif->per_interface_next_index = node_index;
+      return;
+    }
+
+  axif->per_interface_next_index =
+    vlib_node_add_next (vlib_get_main(), af_xdp_input_node.index, node_index);
+}
+
+static void af_xdp_clear_hw_interface_counters (u32 instance)
+{
+  /* Nothing for now */
+}
+
+static clib_error_t *
+af_xdp_interface_admin_up_down (vnet_main_t * vnm, u32 hw_if_index, u32 flags)
+{
+  af_xdp_main_t * axm = &af_xdp_main;
+  vnet_hw_interface_t *hw = vnet_get_hw_interface (vnm, hw_if_index);
+  af_xdp_if_t * axif = pool_elt_at_index (axm->interfaces, hw->dev_instance);
+  u32 hw_flags;
+
+  axif->is_admin_up = (flags & VNET_SW_INTERFACE_FLAG_ADMIN_UP) != 0;
+
+  if (axif->is_admin_up)
+    hw_flags = VNET_HW_INTERFACE_FLAG_LINK_UP;
+  else
+    hw_flags = 0;
+
+  vnet_hw_interface_set_flags(vnm, hw_if_index, hw_flags);
+
+  return 0;
+}
+
+static clib_error_t *
+af_xdp_subif_add_del_function (vnet_main_t * vnm,
+                               u32 hw_if_index,
+                               struct vnet_sw_interface_t * st,
+                               int is_add)
+{
+  /* Nothing for now */
+  return 0;
+}
+
+VNET_DEVICE_CLASS (af_xdp_device_class) = {
+  .name = "af-xdp",
+  .tx_function = af_xdp_interface_tx,
+  .format_device_name = format_af_xdp_device_name,
+  .format_device = format_af_xdp_device,
+  .format_tx_trace = format_af_xdp_tx_trace,
+  .tx_function_n_errors = AF_XDP_TX_N_ERROR,
+  .tx_function_error_strings = af_xdp_tx_func_error_strings,
+  .rx_redirect_to_node = af_xdp_set_interface_next_node,
+  .clear_counters = af_xdp_clear_hw_interface_counters,
+  .admin_up_down_function = af_xdp_interface_admin_up_down,
+  .subif_add_del_function = af_xdp_subif_add_del_function,
+  .no_flatten_output_chains = 1,
+};
+
+VLIB_DEVICE_TX_FUNCTION_MULTIARCH (af_xdp_device_class,
+                                   af_xdp_interface_tx)
@@ -0,0 +1,262 @@
+/*
+ *------------------------------------------------------------------
+ * node.c - linux kernel AF_XDP socket interface input node
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *------------------------------------------------------------------
+ */
+
+#include <sys/socket.h>
+
+#include <vlib/vlib.h>
+#include <vlib/unix/unix.h>
+#include <vnet/ip/ip.h>
+#include <vnet/ethernet/ethernet.h>
+
+#include <vnet/devices/af_xdp/af_xdp.h>
+
+#define foreach_af_xdp_input_error
+
+typedef enum {
+#define _(f,s) AF_XDP_INPUT_ERROR_##f,
+  foreach_af_xdp_input_error
+#undef _
+  AF_XDP_INPUT_N_ERROR,
+} af_xdp_input_error_t;
+
+static char * af_xdp_input_error_strings[] = {
+#define _(n,s) s,
+    foreach_af_xdp_input_error
+#undef _
+};
+
+enum {
+  AF_XDP_INPUT_NEXT_DROP,
+  AF_XDP_INPUT_NEXT_ETHERNET_INPUT,
+  AF_XDP_INPUT_N_NEXT,
+};
+
+typedef struct {
+  u32 next_index;
+  u32 hw_if_index;
+  u32 queue_id;
+  struct xdp_desc desc;
+} af_xdp_input_trace_t;
+
+static u8 * format_af_xdp_input_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  af_xdp_input_trace_t * t = va_arg (*args, af_xdp_input_trace_t *);
+  uword indent = format_get_indent (s);
+
+  s = format (s, "af_xdp: hw_if_index %d queue %d next-index %d",
+	      t->hw_if_index, t->queue_id, t->next_index);
+  s = format (s, "\n%Uxdp_desc: addr 0x%llx offset %u len %u",
+	      format_white_space, indent + 2,
+	      t->desc.addr & XSK_UNALIGNED_BUF_ADDR_MASK,
+	      (u32) (t->desc.addr >> XSK_UNALIGNED_BUF_OFFSET_SHIFT),
+	      t->desc.len);
+  return s;
+}
+
+always_inline uword
+af_xdp_queue_input_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+		       af_xdp_if_t * axif, u32 queue_id)
+{
+  af_xdp_queue_t * q = vec_elt_at_index (axif->queues, queue_id);
+  u32 cpu_index = os_get_cpu_number();
+  u32 next_index = AF_XDP_INPUT_NEXT_ETHERNET_INPUT;
+  struct xdp_desc * descs = q->rx.desc;
+  u32 n_rx_packets, n_left;
+  u32 n_rx_bytes = 0;
+  u32 n_left_to_next, * to_next;
+  uword n_trace = vlib_get_trace_count (vm, node);
+
+  if (axif->per_interface_next_index != ~0)
+      next_index = axif->per_interface_next_index;
+
+  /*
+   * Sent buffers come back on the completion ring; an interface that
+   * only receives would otherwise hold them until its next tx. The
+   * ring has a single consumer, so skip it while a tx thread holds
+   * the queue, that one reaps.
+   */
+  if (q->lockp == 0 || !__sync_lock_test_and_set (q->lockp, 1))
+    {
+      af_xdp_reap_completions (vm, axif, q);
+      if (q->lockp != 0)
+	*q->lockp = 0;
+    }
+
+  af_xdp_refill (vm, axif, q);
+
+  n_rx_packets = af_xdp_ring_n_ready (&q->rx);
+
+  if (n_rx_packets == 0)
+    {
+      /* Busy poll the driver, or restart it after the fill ring ran dry */
+      if (af_xdp_ring_needs_wakeup (&q->fill))
+	recvfrom (q->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+      return 0;
+    }
+
+  if (n_rx_packets > VLIB_FRAME_SIZE)
+    n_rx_packets = VLIB_FRAME_SIZE;
+  n_left = n_rx_packets;
+
+  while (n_left)
+    {
+      vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+
+      while (n_left && n_left_to_next)
+	{
+	  struct xdp_desc * d = descs + (q->rx.cached_cons++ & q->rx.mask);
+	  vlib_buffer_t * b0;
+	  u32 next0 = next_index;
+	  u32 bi0;
+
+	  if (n_left > 2)
+	    {
+	      struct xdp_desc * pd =
+		descs + ((q->rx.cached_cons + 1) & q->rx.mask);
+	      vlib_prefetch_buffer_header
+		(af_xdp_rx_buffer (axif, pd->addr), STORE);
+	    }
+
+	  /* The packet is already in the buffer, just describe it */
+	  b0 = af_xdp_rx_buffer (axif, d->addr);
+	  bi0 = vlib_get_buffer_index (vm, b0);
+
+	  b0->current_data = d->addr >> XSK_UNALIGNED_BUF_OFFSET_SHIFT;
+	  b0->current_length = d->len;
+	  b0->total_length_not_including_first_buffer = 0;
+	  b0->flags = VLIB_BUFFER_TOTAL_LENGTH_VALID;
+#if DPDK > 0
+	  struct rte_mbuf * mb = rte_mbuf_from_vlib_buffer(b0);
+	  mb->data_off = RTE_PKTMBUF_HEADROOM + b0->current_data;
+	  rte_pktmbuf_data_len (mb) = b0->current_length;
+	  rte_pktmbuf_pkt_len (mb) = b0->current_length;
+#endif
+	  vnet_buffer(b0)->sw_if_index[VLIB_RX] = axif->sw_if_index;
+	  vnet_buffer(b0)->sw_if_index[VLIB_TX] = (u32)~0;
+
+	  n_rx_bytes += d->len;
+	  to_next[0] = bi0;
+	  to_next += 1;
+	  n_left_to_next--;
+	  n_left--;
+
+	  /* trace */
+	  VLIB_BUFFER_TRACE_TRAJECTORY_INIT(b0);
+	  if (PREDICT_FALSE(n_trace > 0))
+	    {
+	      af_xdp_input_trace_t *tr;
+	      vlib_trace_buffer (vm, node, next0, b0, /* follow_chain */ 0);
+	      vlib_set_trace_count (vm, node, --n_trace);
+	      tr = vlib_add_trace (vm, node, b0, sizeof (*tr));
+	      tr->next_index = next0;
+	      tr->hw_if_index = axif->hw_if_index;
+	      tr->queue_id = queue_id;
+	      clib_memcpy(&tr->desc, d, sizeof(struct xdp_desc));
+	    }
+
+	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index, to_next,
+					   n_left_to_next, bi0, next0);
+	}
+
+      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+    }
+
+  /* One consumer update for the whole batch */
+  af_xdp_ring_consume (&q->rx);
+
+  vlib_increment_combined_counter
+    (vnet_get_main()->interface_main.combined_sw_if_counters
+     + VNET_INTERFACE_COUNTER_RX,
+     cpu_index,
+     axif->hw_if_index,
+     n_rx_packets, n_rx_bytes);
+
+  return n_rx_packets;
+}
+
+static uword
+af_xdp_input_fn (vlib_main_t * vm, vlib_node_runtime_t * node,
+		 vlib_frame_t * frame)
+{
+  int i;
+  u32 n_rx_packets = 0;
+  u32 cpu_index = os_get_cpu_number();
+  af_xdp_main_t * axm = &af_xdp_main;
+  af_xdp_if_t * axif;
+  af_xdp_queue_t * q;
+  int is_more = 0;
+
+  /* Interrupt mode, main thread only: every queue of a woken interface */
+  if (node->state == VLIB_NODE_STATE_INTERRUPT)
+    {
+      clib_bitmap_foreach (i, axm->pending_input_bitmap,
+	({
+	  clib_bitmap_set (axm->pending_input_bitmap, i, 0);
+	  axif = pool_elt_at_index (axm->interfaces, i);
+	  vec_foreach (q, axif->queues)
+	    {
+	      n_rx_packets += af_xdp_queue_input_fn
+		(vm, node, axif, q - axif->queues);
+
+	      /* Edge triggered: what did not fit raises no new event */
+	      if (af_xdp_ring_n_ready (&q->rx))
+		{
+		  clib_bitmap_set (axm->pending_input_bitmap, i, 1);
+		  is_more = 1;
+		}
+	    }
+	}));
+
+      if (is_more)
+	vlib_node_set_interrupt_pending (vm, node->node_index);
+      return n_rx_packets;
+    }
+
+  /* Polling on workers: the queues placed on this thread */
+  pool_foreach (axif, axm->interfaces,
+    ({
+      if (axif->is_admin_up)
+	vec_foreach (q, axif->queues)
+	  if (q->cpu_index == cpu_index)
+	    n_rx_packets += af_xdp_queue_input_fn
+	      (vm, node, axif, q - axif->queues);
+    }));
+
+  return n_rx_packets;
+}
+
+VLIB_REGISTER_NODE (af_xdp_input_node) = {
+  .function = af_xdp_input_fn,
+  .name = "af-xdp-input",
+  .format_trace = format_af_xdp_input_trace,
+  .type = VLIB_NODE_TYPE_INPUT,
+  .state = VLIB_NODE_STATE_INTERRUPT,
+  .n_errors = AF_XDP_INPUT_N_ERROR,
+  .error_strings = af_xdp_input_error_strings,
+
+  .n_next_nodes = AF_XDP_INPUT_N_NEXT,
+  .next_nodes = {
+    [AF_XDP_INPUT_NEXT_DROP] = "error-drop",
+    [AF_XDP_INPUT_NEXT_ETHERNET_INPUT] = "ethernet-input",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (af_xdp_input_node, af_xdp_input_fn)
@@ -261,6 +261,10 @@ typedef struct {
 
   /* total input packet counter */
   u64 aggregate_rx_packets;
+
+  /* rx packets to capture that skip ethernet-input, by whether
+     current_data is past the ethernet header */
+  u32 * capture_buffers[2];
 } dpdk_worker_t;
 
 typedef struct {
@@ -641,6 +641,9 @@ dpdk_lib_init (dpdk_main_t * dm)
       xd->vlib_sw_if_index = sw->sw_if_index;
       hi = vnet_get_hw_interface (dm->vnet_main, xd->vlib_hw_if_index);
 
+      if (xd->tx_conf.txq_flags & ETH_TXQ_FLAGS_NOMULTSEGS)
+        hi->flags |= VNET_HW_INTERFACE_FLAG_NO_MULTI_SEG;
+
       /*
        * DAW-FIXME: The Cisco VIC firmware does not provide an api for a
        *            driver to dynamically change the mtu.  If/when the 
@@ -23,6 +23,7 @@
 #include <vnet/classify/vnet_classify.h>
 #include <vnet/mpls-gre/packet.h>
 #include <vnet/handoff.h>
+#include <vnet/unix/pcap_capture.h>
 
 #include "dpdk_priv.h"
 
@@ -185,6 +186,37 @@ void dpdk_rx_trace (dpdk_main_t * dm,
     }
 }
 
+/*
+ * Packets for ip4/ip6/mpls-input, drops and handoffs that don't go on
+ * to ethernet-input are captured here, ethernet header included. Their
+ * frames are not dispatched yet, so step back over the header and
+ * forward again once they are in the ring.
+ */
+static void
+dpdk_rx_capture (vlib_main_t * vm, dpdk_worker_t * dw)
+{
+  u32 * l3 = dw->capture_buffers[1];
+  u32 i;
+
+  if (vec_len (dw->capture_buffers[0]))
+    pcap_capture_buffers (vm, dw->capture_buffers[0],
+                          vec_len (dw->capture_buffers[0]), PCAP_CAPTURE_RX);
+
+  if (vec_len (l3))
+    {
+      for (i = 0; i < vec_len (l3); i++)
+        vlib_buffer_advance (vlib_get_buffer (vm, l3[i]),
+                             -(word) sizeof (ethernet_header_t));
+      pcap_capture_buffers (vm, l3, vec_len (l3), PCAP_CAPTURE_RX);
+      for (i = 0; i < vec_len (l3); i++)
+        vlib_buffer_advance (vlib_get_buffer (vm, l3[i]),
+                             sizeof (ethernet_header_t));
+    }
+
+  vec_reset_length (dw->capture_buffers[0]);
+  vec_reset_length (dw->capture_buffers[1]);
+}
+
 /*
  * dpdk_efd_update_counters()
  * Update EFD (early-fast-discard) counters
@@ -295,6 +327,8 @@ static inline u32 dpdk_device_input ( dpdk_main_t * dm,
   vlib_buffer_free_list_t * fl;
   u8 efd_discard_burst = 0;
   u32 buffer_flags_template;
+  dpdk_worker_t * dw = vec_elt_at_index(dm->workers, cpu_index);
+  u32 capture_rx = pcap_capture_main.flags & PCAP_CAPTURE_RX;
   
   if (xd->admin_up == 0)
     return 0;
@@ -510,6 +544,13 @@ static inline u32 dpdk_device_input ( dpdk_main_t * dm,
            */
           VLIB_BUFFER_TRACE_TRAJECTORY_INIT(b0);
 
+          if (PREDICT_FALSE (capture_rx)
+              && next0 != DPDK_RX_NEXT_ETHERNET_INPUT
+              && !((b0->flags & BUFFER_HANDOFF_NEXT_VALID)
+                   && vnet_buffer(b0)->handoff.next_index ==
+                   HANDOFF_DISPATCH_NEXT_ETHERNET_INPUT))
+            vec_add1 (dw->capture_buffers[l3_offset0 != 0], bi0);
+
           vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
                                            to_next, n_left_to_next,
                                            bi0, next0);
@@ -535,7 +576,9 @@ static inline u32 dpdk_device_input ( dpdk_main_t * dm,
      xd->vlib_sw_if_index,
      mb_index, n_rx_bytes);
 
-  dpdk_worker_t * dw = vec_elt_at_index(dm->workers, cpu_index);
+  if (PREDICT_FALSE (capture_rx))
+    dpdk_rx_capture (vm, dw);
+
   dw->aggregate_rx_packets += mb_index;
 
   return mb_index;
@@ -28,7 +28,8 @@
 
 #define foreach_netmap_tx_func_error	       \
 _(NO_FREE_SLOTS, "no free tx slots")           \
-_(PENDING_MSGS, "pending msgs in tx ring")
+_(PENDING_MSGS, "pending msgs in tx ring")    \
+_(TOO_BIG, "packet larger than a netmap buffer")
 
 typedef enum {
 #define _(f,s) NETMAP_TX_ERROR_##f,
@@ -98,10 +99,11 @@ netmap_interface_tx (vlib_main_t * vm,
   netmap_main_t * nm = &netmap_main;
   u32 * buffers = vlib_frame_args (frame);
   u32 n_left = frame->n_vectors;
-  f64 const time_constant = 1e3;
+  u32 n_too_big = 0;
   vnet_interface_output_runtime_t * rd = (void *) node->runtime_data;
   netmap_if_t * nif = pool_elt_at_index (nm->interfaces, rd->dev_instance);
   int cur_ring;
+  u32 n_total_free = 0;
 
   if (PREDICT_FALSE(nif->lockp != 0))
     {
@@ -109,26 +111,24 @@ netmap_interface_tx (vlib_main_t * vm,
         ;
     }
 
+  /*
+   * Reclaim completed slots only if the rings can't take the whole
+   * vector as they are, so a vector normally costs a single sync.
+   */
+  for (cur_ring = nif->first_tx_ring; cur_ring <= nif->last_tx_ring; cur_ring++)
+    n_total_free += nm_ring_space (NETMAP_TXRING(nif->nifp, cur_ring));
+
+  if (n_total_free < n_left)
+    ioctl(nif->fd, NIOCTXSYNC, NULL);
+
   cur_ring = nif->first_tx_ring;
 
   while(n_left && cur_ring <= nif->last_tx_ring)
     {
       struct netmap_ring * ring = NETMAP_TXRING(nif->nifp, cur_ring);
-      int n_free_slots = nm_ring_space(ring);
+      u32 n_free_slots = nm_ring_space(ring);
       uint cur = ring->cur;
 
-      if (nm_tx_pending(ring))
-        {
-         ioctl(nif->fd, NIOCTXSYNC, NULL);
-         clib_cpu_time_wait(time_constant);
-
-         if (nm_tx_pending(ring) && !n_free_slots)
-           {
-             cur_ring++;
-             continue;
-           }
-        }
-
       while (n_left && n_free_slots)
 	{
 	  vlib_buffer_t * b0 = 0;
@@ -136,9 +136,21 @@ netmap_interface_tx (vlib_main_t * vm,
 	  u32 len;
 	  u32 offset = 0;
 	  buffers++;
+	  n_left--;
+
+	  if (n_left)
+	    vlib_prefetch_buffer_with_index (vm, buffers[0], LOAD);
 
           struct netmap_slot * slot = &ring->slot[cur];
 
+	  b0 = vlib_get_buffer (vm, bi);
+	  if (PREDICT_FALSE (vlib_buffer_length_in_chain (vm, b0)
+			     > ring->nr_buf_size))
+	    {
+	      n_too_big++;
+	      continue;
+	    }
+
 	  do
 	    {
 	      b0 = vlib_get_buffer (vm, bi);
@@ -148,18 +160,19 @@ netmap_interface_tx (vlib_main_t * vm,
 		      vlib_buffer_get_current(b0), len);
 	      offset += len;
 	    }
-          while ((bi = b0->next_buffer));
+          while ((bi = (b0->flags & VLIB_BUFFER_NEXT_PRESENT) ?
+		  b0->next_buffer : 0));
 
 	  slot->len = offset;
-	  cur = (cur + 1) % ring->num_slots;
+	  cur = nm_ring_next (ring, cur);
 	  n_free_slots--;
-          n_left--;
 	}
       CLIB_MEMORY_BARRIER();
       ring->head = ring->cur = cur;
+      cur_ring++;
     }
 
-  if (n_left < frame->n_vectors)
+  if (n_left + n_too_big < frame->n_vectors)
       ioctl(nif->fd, NIOCTXSYNC, NULL);
 
   if (PREDICT_FALSE(nif->lockp != 0))
@@ -169,6 +182,9 @@ netmap_interface_tx (vlib_main_t * vm,
     vlib_error_count (vm, node->node_index,
     (n_left == frame->n_vectors ? NETMAP_TX_ERROR_PENDING_MSGS : NETMAP_TX_ERROR_NO_FREE_SLOTS), n_left);
 
+  if (n_too_big)
+    vlib_error_count (vm, node->node_index, NETMAP_TX_ERROR_TOO_BIG, n_too_big);
+
   vlib_buffer_free (vm, vlib_frame_args (frame), frame->n_vectors);
   return frame->n_vectors;
 }
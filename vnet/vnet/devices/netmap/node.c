@@ -154,8 +154,8 @@ netmap_device_input_fn  (vlib_main_t * vm, vlib_node_runtime_t * node,
 	      vlib_buffer_t * b0, * first_b0 = 0;
 	      u32 offset = 0;
 	      u32 bi0 = 0, first_bi0 = 0, prev_bi0;
-	      u32 next_slot_index = (cur_slot_index + 1) % ring->num_slots;
-	      u32 next2_slot_index = (cur_slot_index + 2) % ring->num_slots;
+	      u32 next_slot_index = nm_ring_next (ring, cur_slot_index);
+	      u32 next2_slot_index = nm_ring_next (ring, next_slot_index);
 	      struct netmap_slot * slot = &ring->slot[cur_slot_index];
 	      u32 data_len = slot->len;
 
@@ -238,7 +238,12 @@ netmap_device_input_fn  (vlib_main_t * vm, vlib_node_runtime_t * node,
        cur_ring++;
     }
 
-  if (n_rx_packets)
+  /*
+   * One sync per vector both hands the consumed slots back and picks up
+   * new ones for the next call. When polling nobody else refreshes the
+   * rings, in interrupt mode the kernel's poll handler does.
+   */
+  if (n_rx_packets || node->state == VLIB_NODE_STATE_POLLING)
     ioctl(nif->fd, NIOCRXSYNC, NULL);
 
   vlib_increment_combined_counter
@@ -60,18 +60,16 @@ typedef enum {
   SSVM_ETH_INPUT_N_NEXT,
 } ssvm_eth_input_next_t;
 
+/* Receiver side of one queue: copy up to a frame out, give chunks back */
 static inline uword 
-ssvm_eth_device_input (ssvm_eth_main_t * em,
+ssvm_eth_device_input (vlib_main_t * vm,
+                       ssvm_eth_main_t * em,
                        ssvm_private_t * intfc,
+                       ssvm_eth_queue_t * queue,
                        vlib_node_runtime_t * node)
 {
   ssvm_shared_header_t * sh = intfc->sh;
-  vlib_main_t * vm = em->vlib_main;
-  unix_shared_memory_queue_t * q;
   ssvm_eth_queue_elt_t * elt, * elts;
-  u32 elt_index;
-  u32 my_pid = intfc->my_pid;
-  int rx_queue_index;
   u32 n_to_alloc = VLIB_FRAME_SIZE * 2;
   u32 n_allocated, n_present_in_cache;
 #if DPDK > 0
@@ -82,68 +80,52 @@ ssvm_eth_device_input (ssvm_eth_main_t * em,
   vlib_buffer_free_list_t * fl;
   u32 n_left_to_next, * to_next;
   u32 next0;
-  u32 n_buffers;
-  u32 n_available;
+  u32 n_buffers, n_packets, n_dropped = 0;
   u32 bi0, saved_bi0;
   vlib_buffer_t * b0, * prev;
-  u32 saved_cache_size = 0;
   ethernet_header_t * eh0;
   u16 type0;
   u32 n_rx_bytes = 0, l3_offset0;
   u32 cpu_index = os_get_cpu_number();
-  u32 trace_cnt __attribute__((unused)) = vlib_get_trace_count (vm, node);
-  volatile u32 * lock;
-  u32 * elt_indices;
+  u32 * heads, * chunks;
+  u32 i;
   uword n_trace = vlib_get_trace_count (vm, node);
 
-  /* Either side down? buh-bye... */
-  if (pointer_to_uword(sh->opaque [MASTER_ADMIN_STATE_INDEX]) == 0 ||
-      pointer_to_uword(sh->opaque [SLAVE_ADMIN_STATE_INDEX]) == 0)
-    return 0;
-
-  if (intfc->i_am_master)
-    q = (unix_shared_memory_queue_t *)(sh->opaque [TO_MASTER_Q_INDEX]);
-  else
-    q = (unix_shared_memory_queue_t *)(sh->opaque [TO_SLAVE_Q_INDEX]);
+  n_packets = ssvm_eth_ring_n_elts (queue->packets);
 
   /* Nothing to do? */
-  if (q->cursize == 0)
+  if (n_packets == 0)
     return 0;
 
-  fl = vlib_buffer_get_free_list (vm, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX);
+  if (n_packets > VLIB_FRAME_SIZE)
+    n_packets = VLIB_FRAME_SIZE;
 
-  vec_reset_length (intfc->rx_queue);
-  
-  lock = (u32 *) q;
-  while (__sync_lock_test_and_set (lock, 1))
-    ;
-  while (q->cursize > 0)
-    {
-      unix_shared_memory_queue_sub_raw (q, (u8 *)&elt_index);
-      ASSERT(elt_index < 2048);
-      vec_add1 (intfc->rx_queue, elt_index);
-    }
-  CLIB_MEMORY_BARRIER();
-  *lock = 0;
+  vec_validate (em->packet_cache[cpu_index], n_packets - 1);
+  heads = em->packet_cache[cpu_index];
+  chunks = em->chunk_cache[cpu_index];
+  vec_reset_length (chunks);
 
-  n_present_in_cache = vec_len (em->buffer_cache);
+  n_packets = ssvm_eth_ring_dequeue (queue->packets, heads, n_packets);
 
-  if (vec_len (em->buffer_cache) < vec_len (intfc->rx_queue) * 2)
+  fl = vlib_buffer_get_free_list (vm, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX);
+
+  n_present_in_cache = vec_len (em->buffer_cache[cpu_index]);
+
+  if (n_present_in_cache < n_packets * 2)
     {
-      vec_validate (em->buffer_cache, 
-                    n_to_alloc + vec_len (em->buffer_cache) - 1);
+      vec_validate (em->buffer_cache[cpu_index], 
+                    n_to_alloc + n_present_in_cache - 1);
       n_allocated = 
-        vlib_buffer_alloc (vm, &em->buffer_cache [n_present_in_cache], 
+        vlib_buffer_alloc (vm, &em->buffer_cache[cpu_index][n_present_in_cache], 
                            n_to_alloc);
       
       n_present_in_cache += n_allocated;
-      _vec_len (em->buffer_cache) = n_present_in_cache;
     }
 
   elts = (ssvm_eth_queue_elt_t *) (sh->opaque [CHUNK_POOL_INDEX]);
 
-  n_buffers = vec_len (intfc->rx_queue);
-  rx_queue_index = 0;
+  n_buffers = n_packets;
+  i = 0;
 
   while (n_buffers > 0)
     {
@@ -151,15 +133,12 @@ ssvm_eth_device_input (ssvm_eth_main_t * em,
       
       while (n_buffers > 0 && n_left_to_next > 0)
         {
-          elt = elts + intfc->rx_queue[rx_queue_index];
+          elt = elts + heads[i];
           
-          saved_cache_size = n_present_in_cache;
-          if (PREDICT_FALSE(saved_cache_size == 0))
-	    {
-	      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
-	      goto out;
-	    }
-          saved_bi0 = bi0 = em->buffer_cache [--n_present_in_cache];
+          if (PREDICT_FALSE(n_present_in_cache == 0))
+            break;
+
+          saved_bi0 = bi0 = em->buffer_cache[cpu_index][--n_present_in_cache];
           b0 = vlib_get_buffer (vm, bi0);
           prev = 0;
 
@@ -174,28 +153,48 @@ ssvm_eth_device_input (ssvm_eth_main_t * em,
               
               clib_memcpy (b0->data + b0->current_data, elt->data, 
                       b0->current_length);
+              vec_add1 (chunks, elt - elts);
 
               if (PREDICT_FALSE(prev != 0))
+                {
                   prev->next_buffer = bi0;
+                  prev->flags |= VLIB_BUFFER_NEXT_PRESENT;
+                }
 
               if (PREDICT_FALSE(elt->flags & SSVM_BUFFER_NEXT_PRESENT))
                 {
                   prev = b0;
+                  elt = elts + elt->next_index;
                   if (PREDICT_FALSE(n_present_in_cache == 0))
-		    {
-		      vlib_put_next_frame (vm, node, next_index, 
-					   n_left_to_next);
-		      goto out;
-		    }
-                  bi0 = em->buffer_cache [--n_present_in_cache];
+                    {
+                      /* keep the chunks coming, the packet is lost */
+                      prev->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+                      vlib_buffer_free (vm, &saved_bi0, 1);
+                      saved_bi0 = ~0;
+                      while (1)
+                        {
+                          vec_add1 (chunks, elt - elts);
+                          if (!(elt->flags & SSVM_BUFFER_NEXT_PRESENT))
+                            break;
+                          elt = elts + elt->next_index;
+                        }
+                      break;
+                    }
+                  bi0 = em->buffer_cache[cpu_index][--n_present_in_cache];
                   b0 = vlib_get_buffer (vm, bi0);
                 }
               else
                 break;
             }
-          
-          saved_cache_size = n_present_in_cache;
 
+          if (PREDICT_FALSE(saved_bi0 == ~0))
+            {
+              n_dropped++;
+              n_buffers--;
+              i++;
+              continue;
+            }
+          
           to_next[0] = saved_bi0;
           to_next++;
           n_left_to_next--;
@@ -224,7 +223,7 @@ ssvm_eth_device_input (ssvm_eth_main_t * em,
 
           b0->current_data += l3_offset0;
           b0->current_length -= l3_offset0;
-          b0->flags = VLIB_BUFFER_TOTAL_LENGTH_VALID;
+          b0->flags |= VLIB_BUFFER_TOTAL_LENGTH_VALID;
 
           vnet_buffer(b0)->sw_if_index[VLIB_RX] = intfc->vlib_hw_if_index;
           vnet_buffer(b0)->sw_if_index[VLIB_TX] = (u32)~0;
@@ -252,45 +251,48 @@ ssvm_eth_device_input (ssvm_eth_main_t * em,
 
           vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
                                            to_next, n_left_to_next,
-                                           bi0, next0);
+                                           saved_bi0, next0);
           n_buffers--;
-          rx_queue_index++;
+          i++;
         }
 
       vlib_put_next_frame (vm, node, next_index, n_left_to_next);
-    }
-  
- out:
-  if (em->buffer_cache)
-    _vec_len (em->buffer_cache) = saved_cache_size;
-  else
-    ASSERT (saved_cache_size == 0);
-
-  ssvm_lock (sh, my_pid, 2);
-
-  ASSERT(vec_len(intfc->rx_queue) > 0);
 
-  n_available = (u32)pointer_to_uword(sh->opaque[CHUNK_POOL_NFREE]);
-  elt_indices = (u32 *)(sh->opaque[CHUNK_POOL_FREELIST_INDEX]);
+      if (PREDICT_FALSE(n_present_in_cache == 0))
+        break;
+    }
 
-  clib_memcpy (&elt_indices[n_available], intfc->rx_queue, 
-          vec_len (intfc->rx_queue) * sizeof (u32));
+  /* Out of vlib buffers: drop the rest, their chunks still go back */
+  for (; i < n_packets; i++)
+    {
+      elt = elts + heads[i];
+      while (1)
+        {
+          vec_add1 (chunks, elt - elts);
+          if (!(elt->flags & SSVM_BUFFER_NEXT_PRESENT))
+            break;
+          elt = elts + elt->next_index;
+        }
+      n_dropped++;
+    }
 
-  n_available += vec_len (intfc->rx_queue);
-  sh->opaque[CHUNK_POOL_NFREE] = uword_to_pointer(n_available, void* );
+  _vec_len (em->buffer_cache[cpu_index]) = n_present_in_cache;
 
-  ssvm_unlock (sh);
+  /* The free ring holds all of the queue's chunks, they always fit */
+  ssvm_eth_ring_enqueue (queue->free, chunks, vec_len (chunks));
+  em->chunk_cache[cpu_index] = chunks;
 
-  vlib_error_count (vm, node->node_index, SSVM_ETH_INPUT_ERROR_NO_BUFFERS,
-		    n_buffers);
+  if (n_dropped)
+    vlib_error_count (vm, node->node_index, SSVM_ETH_INPUT_ERROR_NO_BUFFERS,
+                      n_dropped);
 
   vlib_increment_combined_counter 
     (vnet_get_main()->interface_main.combined_sw_if_counters
      + VNET_INTERFACE_COUNTER_RX, cpu_index, 
      intfc->vlib_hw_if_index,
-     rx_queue_index, n_rx_bytes);
+     n_packets - n_dropped, n_rx_bytes);
 
-  return rx_queue_index;
+  return n_packets - n_dropped;
 }
                                            
 static uword
@@ -300,11 +302,31 @@ ssvm_eth_input_node_fn (vlib_main_t * vm,
 {
   ssvm_eth_main_t * em = &ssvm_eth_main;
   ssvm_private_t * intfc;
+  ssvm_shared_header_t * sh;
+  ssvm_eth_queue_t * queues;
   uword n_rx_packets = 0;
+  u32 cpu_index = os_get_cpu_number();
+  u32 q;
 
   vec_foreach (intfc, em->intfcs)
     {
-      n_rx_packets += ssvm_eth_device_input (em, intfc, node);
+      sh = intfc->sh;
+
+      /* Either side down? buh-bye... */
+      if (pointer_to_uword(sh->opaque [MASTER_ADMIN_STATE_INDEX]) == 0 ||
+          pointer_to_uword(sh->opaque [SLAVE_ADMIN_STATE_INDEX]) == 0)
+        continue;
+
+      if (intfc->i_am_master)
+        queues = (ssvm_eth_queue_t *)(sh->opaque [TO_MASTER_Q_INDEX]);
+      else
+        queues = (ssvm_eth_queue_t *)(sh->opaque [TO_SLAVE_Q_INDEX]);
+
+      /* each ring has a single consumer: its input thread */
+      for (q = 0; q < vec_len (queues); q++)
+        if (em->input_cpu_first_index + q % em->input_cpu_count == cpu_index)
+          n_rx_packets += ssvm_eth_device_input (vm, em, intfc, queues + q,
+                                                 node);
     }
 
   return n_rx_packets;
@@ -32,17 +32,57 @@ static u32 ssvm_eth_flag_change (vnet_main_t * vnm,
                                  vnet_hw_interface_t * hi,
                                  u32 flags);
 
+static ssvm_eth_ring_t *
+ssvm_eth_ring_alloc (u32 size)
+{
+  ssvm_eth_ring_t * r;
+
+  r = clib_mem_alloc_aligned (sizeof (*r) + size * sizeof (r->elts[0]),
+                              CLIB_CACHE_LINE_BYTES);
+  memset (r, 0, sizeof (*r));
+  r->mask = size - 1;
+  return r;
+}
+
+/* Called with the segment heap pushed */
+static ssvm_eth_queue_t *
+ssvm_eth_queues_alloc (ssvm_eth_main_t * em, u32 n_queues,
+                       u32 chunks_per_queue, u32 * next_chunk)
+{
+  ssvm_eth_queue_t * queues = 0, * queue;
+  /* the free ring must hold every chunk, queue-elts caps packets in flight */
+  u32 free_size = 1 << max_log2 (chunks_per_queue);
+  u32 packets_size = 1 << max_log2 (clib_min (em->queue_elts,
+                                              chunks_per_queue));
+  u32 i;
+
+  vec_validate_aligned (queues, n_queues - 1, CLIB_CACHE_LINE_BYTES);
+
+  vec_foreach (queue, queues)
+    {
+      queue->packets = ssvm_eth_ring_alloc (packets_size);
+      queue->free = ssvm_eth_ring_alloc (free_size);
+      queue->sender_lock = 0;
+
+      /* the sender starts out owning its share of the chunks */
+      for (i = 0; i < chunks_per_queue; i++)
+        queue->free->elts[i] = (*next_chunk)++;
+      queue->free->head = chunks_per_queue;
+    }
+
+  return queues;
+}
+
 int ssvm_eth_create (ssvm_eth_main_t * em, u8 * name, int is_master)
 {
   ssvm_private_t * intfc;
   void * oldheap;
   clib_error_t * e;
-  unix_shared_memory_queue_t * q;
   ssvm_shared_header_t * sh;
   ssvm_eth_queue_elt_t * elts;
-  u32 * elt_indices;
+  u32 chunks_per_queue, next_chunk;
   u8 enet_addr[6];
-  int i, rv;
+  int rv;
 
   vec_add2 (em->intfcs, intfc, 1);
 
@@ -60,6 +100,11 @@ int ssvm_eth_create (ssvm_eth_main_t * em, u8 * name, int is_master)
 
   intfc->requested_va = em->next_base_va;
   em->next_base_va += em->segment_size;
+  /* Each queue of each direction gets an equal share of the chunks */
+  chunks_per_queue = em->nbuffers / (2 * em->n_queues);
+  if (chunks_per_queue == 0)
+    return VNET_API_ERROR_INVALID_VALUE;
+
   rv = ssvm_master_init (intfc, intfc - em->intfcs /* master index */);
 
   if (rv < 0)
@@ -70,32 +115,19 @@ int ssvm_eth_create (ssvm_eth_main_t * em, u8 * name, int is_master)
   sh = intfc->sh;
   oldheap = ssvm_push_heap (sh);
 
-  q = unix_shared_memory_queue_init (em->queue_elts, sizeof (u32),
-                                     0 /* consumer pid not interesting */,
-                                     0 /* signal not sent */);
-  sh->opaque [TO_MASTER_Q_INDEX] = (void *)q;
-  q = unix_shared_memory_queue_init (em->queue_elts, sizeof (u32),
-                                     0 /* consumer pid not interesting */,
-                                     0 /* signal not sent */);
-  sh->opaque [TO_SLAVE_Q_INDEX] = (void *)q;
-  
   /* 
    * Preallocate the requested number of buffer chunks
-   * There must be a better way to do this, etc.
    * Add some slop to avoid pool reallocation, which will not go well
    */
   elts = 0;
-  elt_indices = 0;
-
   vec_validate_aligned (elts, em->nbuffers - 1, CLIB_CACHE_LINE_BYTES);
-  vec_validate_aligned (elt_indices, em->nbuffers - 1, CLIB_CACHE_LINE_BYTES);
-  
-  for (i = 0; i < em->nbuffers; i++)
-    elt_indices[i] = i;
-
   sh->opaque [CHUNK_POOL_INDEX] = (void *) elts;
-  sh->opaque [CHUNK_POOL_FREELIST_INDEX] = (void *) elt_indices;
-  sh->opaque [CHUNK_POOL_NFREE] = (void *)(uword) em->nbuffers;
+
+  next_chunk = 0;
+  sh->opaque [TO_MASTER_Q_INDEX] = (void *)
+    ssvm_eth_queues_alloc (em, em->n_queues, chunks_per_queue, &next_chunk);
+  sh->opaque [TO_SLAVE_Q_INDEX] = (void *)
+    ssvm_eth_queues_alloc (em, em->n_queues, chunks_per_queue, &next_chunk);
   
   ssvm_pop_heap (oldheap);
 
@@ -151,6 +183,8 @@ ssvm_config (vlib_main_t * vm, unformat_input_t * input)
         ;
       else if (unformat (input, "queue-elts %lld", &em->queue_elts))
         ;
+      else if (unformat (input, "queues %d", &em->n_queues))
+        ;
       else if (unformat (input, "slave"))
         is_master = 0;
       else if (unformat (input, "%s", &name))
@@ -163,6 +197,9 @@ ssvm_config (vlib_main_t * vm, unformat_input_t * input)
   if (vec_len (em->names) == 0)
       return 0;
 
+  if (em->n_queues == 0)
+    return clib_error_return (0, "queues must be at least 1");
+
   for (i = 0; i < vec_len (em->names); i++)
     {
       rv = ssvm_eth_create (em, em->names[i], is_master);
@@ -182,6 +219,9 @@ VLIB_CONFIG_FUNCTION (ssvm_config, "ssvm_eth");
 static clib_error_t * ssvm_eth_init (vlib_main_t * vm)
 {
   ssvm_eth_main_t * em = &ssvm_eth_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main();
+  vlib_thread_registration_t * tr;
+  uword * p;
 
   if (((sizeof(ssvm_eth_queue_elt_t) / CLIB_CACHE_LINE_BYTES) 
        * CLIB_CACHE_LINE_BYTES) != sizeof(ssvm_eth_queue_elt_t))
@@ -202,6 +242,27 @@ static clib_error_t * ssvm_eth_init (vlib_main_t * vm)
   em->segment_size = 8<<20;
   em->nbuffers = 1024;
   em->queue_elts = 512;
+  em->n_queues = 1;
+
+  /* find out which cpus will be used for input */
+  em->input_cpu_first_index = 0;
+  em->input_cpu_count = 1;
+
+  p = hash_get_mem (tm->thread_registrations_by_name, "workers");
+  tr = p ? (vlib_thread_registration_t *) p[0] : 0;
+
+  if (tr && tr->count > 0)
+    {
+      em->input_cpu_first_index = tr->first_index;
+      em->input_cpu_count = tr->count;
+    }
+
+  vec_validate_aligned (em->buffer_cache, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+  vec_validate_aligned (em->chunk_cache, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+  vec_validate_aligned (em->packet_cache, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
   return 0;
 }
 
@@ -243,99 +304,85 @@ ssvm_eth_interface_tx (vlib_main_t * vm,
   vnet_interface_output_runtime_t * rd = (void *) node->runtime_data;
   ssvm_private_t * intfc = vec_elt_at_index (em->intfcs, rd->dev_instance);
   ssvm_shared_header_t * sh = intfc->sh;
-  unix_shared_memory_queue_t * q;
+  ssvm_eth_queue_t * queues, * queue;
   u32 * from;
   u32 n_left;
   ssvm_eth_queue_elt_t * elts, * elt, * prev_elt;
-  u32 my_pid = intfc->my_pid;
   vlib_buffer_t * b0;
-  u32 bi0;
-  u32 size_this_buffer;
-  u32 chunks_this_buffer;
   u8 i_am_master = intfc->i_am_master;
-  u32 elt_index;
-  int is_ring_full, interface_down;
-  int i;
-  volatile u32 *queue_lock;
-  u32 n_to_alloc = VLIB_FRAME_SIZE;
-  u32 n_allocated, n_present_in_cache, n_available;
-  u32 * elt_indices;
+  u32 cpu_index = os_get_cpu_number();
+  u32 n_free_chunks, n_free_slots, n_chunks, n_packets;
+  u32 * chunks, * heads;
+  u32 i, c;
+  int is_locked = 0;
   
-  if (i_am_master)
-    q = (unix_shared_memory_queue_t *)sh->opaque [TO_SLAVE_Q_INDEX];
-  else
-    q = (unix_shared_memory_queue_t *)sh->opaque [TO_MASTER_Q_INDEX];
-
-  queue_lock = (u32 *) q;
-
   from = vlib_frame_vector_args (f);
   n_left = f->n_vectors;
-  is_ring_full = 0;
-  interface_down = 0;
-
-  n_present_in_cache = vec_len (em->chunk_cache);
+  n_packets = 0;
 
   /* admin / link up/down check */
   if (sh->opaque [MASTER_ADMIN_STATE_INDEX] == 0 ||
       sh->opaque [SLAVE_ADMIN_STATE_INDEX] == 0)
     {
-      interface_down = 1;
+      vlib_error_count (vm, node->node_index, SSVM_ETH_TX_ERROR_ADMIN_DOWN,
+                        n_left);
       goto out;
     }
 
-  ssvm_lock (sh, my_pid, 1);
+  if (i_am_master)
+    queues = (ssvm_eth_queue_t *) sh->opaque [TO_SLAVE_Q_INDEX];
+  else
+    queues = (ssvm_eth_queue_t *) sh->opaque [TO_MASTER_Q_INDEX];
 
-  elts = (ssvm_eth_queue_elt_t *) (sh->opaque [CHUNK_POOL_INDEX]);
-  elt_indices = (u32 *) (sh->opaque [CHUNK_POOL_FREELIST_INDEX]);
-  n_available = (u32) pointer_to_uword(sh->opaque [CHUNK_POOL_NFREE]);
+  queue = vec_elt_at_index (queues, cpu_index % vec_len (queues));
 
-  if (n_present_in_cache < n_left*2)
+  /* Rings are single producer, threads may outnumber the queues */
+  if (PREDICT_FALSE (vlib_get_thread_main()->n_vlib_mains > vec_len (queues)))
     {
-      vec_validate (em->chunk_cache, 
-                    n_to_alloc + n_present_in_cache - 1);
-
-      n_allocated = n_to_alloc < n_available ? n_to_alloc : n_available;
-
-      if (PREDICT_TRUE(n_allocated > 0))
-	{
-	  clib_memcpy (&em->chunk_cache[n_present_in_cache],
-		  &elt_indices[n_available - n_allocated],
-		  sizeof(u32) * n_allocated);
-	}
-
-      n_present_in_cache += n_allocated;
-      n_available -= n_allocated;
-      sh->opaque [CHUNK_POOL_NFREE] = uword_to_pointer(n_available, void*);
-      _vec_len (em->chunk_cache) = n_present_in_cache;
+      while (__sync_lock_test_and_set (&queue->sender_lock, 1))
+        ;
+      is_locked = 1;
     }
 
-  ssvm_unlock (sh);
+  elts = (ssvm_eth_queue_elt_t *) (sh->opaque [CHUNK_POOL_INDEX]);
+
+  /* Take whole packets only, a chunk per buffer in the chain */
+  n_free_chunks = ssvm_eth_ring_n_elts (queue->free);
+  n_free_slots = queue->packets->mask + 1
+    - ssvm_eth_ring_n_elts (queue->packets);
+  n_chunks = 0;
 
-  while (n_left)
+  while (n_packets < n_left && n_packets < n_free_slots)
     {
-      bi0 = from[0];
-      b0 = vlib_get_buffer (vm, bi0);
-      
-      size_this_buffer = vlib_buffer_length_in_chain (vm, b0);
-      chunks_this_buffer = (size_this_buffer + (SSVM_BUFFER_SIZE - 1))
-        / SSVM_BUFFER_SIZE;
-
-      /* If we're not going to be able to enqueue the buffer, tail drop. */
-      if (q->cursize >= q->maxsize)
+      b0 = vlib_get_buffer (vm, from[n_packets]);
+      c = 1;
+      while (b0->flags & VLIB_BUFFER_NEXT_PRESENT)
         {
-          is_ring_full = 1;
-          break;
+          b0 = vlib_get_buffer (vm, b0->next_buffer);
+          c++;
         }
+      if (n_chunks + c > n_free_chunks)
+        break;
+      n_chunks += c;
+      n_packets++;
+    }
+
+  vec_validate (em->chunk_cache[cpu_index], n_chunks);
+  vec_validate (em->packet_cache[cpu_index], n_packets);
+  chunks = em->chunk_cache[cpu_index];
+  heads = em->packet_cache[cpu_index];
+
+  n_chunks = ssvm_eth_ring_dequeue (queue->free, chunks, n_chunks);
 
+  for (i = 0, c = 0; i < n_packets; i++)
+    {
+      b0 = vlib_get_buffer (vm, from[i]);
       prev_elt = 0;
-      elt_index = ~0;
-      for (i = 0; i < chunks_this_buffer; i++)
-        {
-          if (PREDICT_FALSE (n_present_in_cache == 0))
-            goto out;
+      heads[i] = chunks[c];
 
-          elt_index = em->chunk_cache[--n_present_in_cache];
-          elt = elts + elt_index;
+      while (1)
+        {
+          elt = elts + chunks[c++];
 
           elt->type = SSVM_PACKET_TYPE;
           elt->flags = 0;
@@ -345,52 +392,41 @@ ssvm_eth_interface_tx (vlib_main_t * vm,
           elt->current_data_hint = b0->current_data;
           elt->owner = !i_am_master;
           elt->tag = 1;
-	  
+
           clib_memcpy (elt->data, b0->data + b0->current_data, b0->current_length);
-          
+
           if (PREDICT_FALSE (prev_elt != 0))
             prev_elt->next_index = elt - elts;
-            
-          if (PREDICT_FALSE(i < (chunks_this_buffer-1)))
-            {
-              elt->flags = SSVM_BUFFER_NEXT_PRESENT;
-              ASSERT (b0->flags & VLIB_BUFFER_NEXT_PRESENT);
-              b0 = vlib_get_buffer (vm, b0->next_buffer);
-            }
+
+          if (PREDICT_TRUE (!(b0->flags & VLIB_BUFFER_NEXT_PRESENT)))
+            break;
+
+          elt->flags = SSVM_BUFFER_NEXT_PRESENT;
+          b0 = vlib_get_buffer (vm, b0->next_buffer);
           prev_elt = elt;
         }
+    }
 
-      while (__sync_lock_test_and_set (queue_lock, 1))
-          ;
-      
-      unix_shared_memory_queue_add_raw (q, (u8 *)&elt_index);
-      CLIB_MEMORY_BARRIER();
-      *queue_lock = 0;
+  ASSERT (c == n_chunks);
 
-      from++;
-      n_left--;
-    }
+  /* publish the whole batch with a single head update */
+  ssvm_eth_ring_enqueue (queue->packets, heads, n_packets);
 
- out:
-  if (PREDICT_FALSE(n_left))
+  if (is_locked)
     {
-      if (is_ring_full)
-        vlib_error_count (vm, node->node_index, SSVM_ETH_TX_ERROR_RING_FULL, 
-                          n_left);
-      else if (interface_down)
-        vlib_error_count (vm, node->node_index, SSVM_ETH_TX_ERROR_ADMIN_DOWN, 
-                          n_left);
-      else
-        vlib_error_count (vm, node->node_index, SSVM_ETH_TX_ERROR_NO_BUFFERS,
-                          n_left);
-
-      vlib_buffer_free (vm, from, n_left);
+      CLIB_MEMORY_BARRIER();
+      queue->sender_lock = 0;
     }
-  else
-      vlib_buffer_free (vm, vlib_frame_vector_args (f), f->n_vectors);
 
-  if (PREDICT_TRUE(vec_len(em->chunk_cache)))
-      _vec_len(em->chunk_cache) = n_present_in_cache;
+  if (PREDICT_FALSE (n_packets < n_left))
+    vlib_error_count (vm, node->node_index,
+                      n_packets == n_free_slots ?
+                      SSVM_ETH_TX_ERROR_RING_FULL :
+                      SSVM_ETH_TX_ERROR_NO_BUFFERS,
+                      n_left - n_packets);
+
+ out:
+  vlib_buffer_free (vm, vlib_frame_vector_args (f), f->n_vectors);
 
   return f->n_vectors;
 }
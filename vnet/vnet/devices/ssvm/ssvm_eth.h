@@ -27,7 +27,6 @@
 #include <vnet/ethernet/ethernet.h>
 #include <vnet/ip/ip.h>
 #include <vnet/pg/pg.h>
-#include <vlibmemory/unix_shared_memory_queue.h>
 
 #include <ssvm.h>
 
@@ -56,12 +55,92 @@ typedef struct {
   u8 pad2[CLIB_CACHE_LINE_BYTES - 16];
 } ssvm_eth_queue_elt_t;
 
+/*
+ * Single producer, single consumer ring of chunk indices. Head and tail
+ * live in their own cache lines, each written by one side only.
+ */
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  volatile u32 head;            /* written by the producer */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+  volatile u32 tail;            /* written by the consumer */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline2);
+  u32 mask;                     /* ring size - 1, size is a power of 2 */
+  u32 elts[0];
+} ssvm_eth_ring_t;
+
+/*
+ * One queue of one direction. The sender owns a fixed share of the
+ * chunk pool: it fills chunks and puts the packet heads on the packet
+ * ring, the receiver copies them out and hands every chunk back on the
+ * free ring. Neither ring ever needs the segment lock.
+ */
+typedef struct {
+  ssvm_eth_ring_t * packets;
+  ssvm_eth_ring_t * free;
+
+  /* Taken by sender threads sharing the queue, never by the receiver */
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+  volatile u32 sender_lock;
+} ssvm_eth_queue_t;
+
+always_inline u32
+ssvm_eth_ring_n_elts (ssvm_eth_ring_t * r)
+{
+  return r->head - r->tail;
+}
+
+/* Producer side: adds up to n_elts, publishes them at once */
+always_inline u32
+ssvm_eth_ring_enqueue (ssvm_eth_ring_t * r, u32 * elts, u32 n_elts)
+{
+  u32 head = r->head;
+  u32 n_free = r->mask + 1 - (head - r->tail);
+  u32 i;
+
+  if (n_elts > n_free)
+    n_elts = n_free;
+
+  for (i = 0; i < n_elts; i++)
+    r->elts[(head + i) & r->mask] = elts[i];
+
+  CLIB_MEMORY_BARRIER ();
+  r->head = head + n_elts;
+  return n_elts;
+}
+
+/* Consumer side: takes up to n_elts, releases the slots at once */
+always_inline u32
+ssvm_eth_ring_dequeue (ssvm_eth_ring_t * r, u32 * elts, u32 n_elts)
+{
+  u32 tail = r->tail;
+  u32 n_present = r->head - tail;
+  u32 i;
+
+  if (n_elts > n_present)
+    n_elts = n_present;
+
+  /* read the slots only after seeing the producer's head */
+  CLIB_MEMORY_BARRIER ();
+
+  for (i = 0; i < n_elts; i++)
+    elts[i] = r->elts[(tail + i) & r->mask];
+
+  CLIB_MEMORY_BARRIER ();
+  r->tail = tail + n_elts;
+  return n_elts;
+}
+
 typedef struct {
   /* vector of point-to-point connections */
   ssvm_private_t * intfcs;
 
-  u32 * buffer_cache;
-  u32 * chunk_cache;
+  /* per-cpu rx vlib buffer cache */
+  u32 ** buffer_cache;
+
+  /* per-cpu scratch vectors of chunk indices, and of packet heads */
+  u32 ** chunk_cache;
+  u32 ** packet_cache;
 
   /* Configurable parameters */
   /* base address for next placement */
@@ -69,10 +148,17 @@ typedef struct {
   u64 segment_size;
   u64 nbuffers;
   u64 queue_elts;
+  u32 n_queues;
 
   /* Segment names */
   u8 ** names;
 
+  /* first cpu index */
+  u32 input_cpu_first_index;
+
+  /* total cpu count */
+  u32 input_cpu_count;
+
   /* convenience */
   vlib_main_t * vlib_main;
   vnet_main_t * vnet_main;
@@ -81,48 +167,13 @@ typedef struct {
 
 ssvm_eth_main_t ssvm_eth_main;
 
+/* Queue vectors, in the shared heap, one per direction */
 typedef enum {
-  CHUNK_POOL_FREELIST_INDEX = 0,
-  CHUNK_POOL_INDEX, 
-  CHUNK_POOL_NFREE,
+  CHUNK_POOL_INDEX = 0,
   TO_MASTER_Q_INDEX,
   TO_SLAVE_Q_INDEX,
   MASTER_ADMIN_STATE_INDEX,
   SLAVE_ADMIN_STATE_INDEX,
 } ssvm_eth_opaque_index_t;
 
-/*
- * debug scaffolding.
- */
-static inline void ssvm_eth_validate_freelists (int need_lock)
-{
-#if CLIB_DEBUG > 0
-  ssvm_eth_main_t * em = &ssvm_eth_main;
-  ssvm_private_t * intfc;
-  ssvm_shared_header_t * sh;
-  u32 * elt_indices;
-  u32 n_available;
-  int i;
-
-  for (i = 0; i < vec_len (em->intfcs); i++)
-    {
-      intfc = em->intfcs + i;
-      sh = intfc->sh;
-      u32 my_pid = intfc->my_pid;
-  
-      if (need_lock)
-        ssvm_lock (sh, my_pid, 15);
-
-      elt_indices = (u32 *) (sh->opaque [CHUNK_POOL_FREELIST_INDEX]);
-      n_available = (u32) (uword) (sh->opaque [CHUNK_POOL_NFREE]);
-
-      for (i = 0; i < n_available; i++)
-	ASSERT (elt_indices[i] < 2048);
-
-      if (need_lock)
-        ssvm_unlock (sh);
-    }
-#endif
-}
-
 #endif /* __included_ssvm_eth_h__ */
@@ -208,6 +208,63 @@ static clib_error_t * vhost_user_callfd_read_ready (unix_file_t * uf)
   return 0;
 }
 
+/*
+ * Spreads the rings coming from the guests over the input threads, round
+ * robin unless pinned, and polls vhost-user-input only where needed.
+ * Rings are placed once the guest has given their address.
+ */
+static void vhost_user_rx_thread_placement(void)
+{
+  vhost_user_main_t * vum = &vhost_user_main;
+  dpdk_main_t * dm = &dpdk_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main();
+  vlib_main_t * vm = vlib_get_main();
+  vhost_user_intf_t * vui;
+  vhost_iface_and_queue_t * iq;
+  u32 cpu_index, qid, rr = 0;
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  for (cpu_index = 0; cpu_index < vec_len (vum->rx_queues_by_cpu); cpu_index++)
+    vec_reset_length (vum->rx_queues_by_cpu[cpu_index]);
+
+  vec_foreach (vui, vum->vhost_user_interfaces) {
+    for (qid = 0; vui->active && qid < vui->num_vrings / 2; qid++) {
+      vhost_user_vring_t * txvq = &vui->vrings[VHOST_VRING_IDX_TX(qid)];
+
+      txvq->cpu_index = ~0;
+      if (!txvq->desc)
+        continue;
+
+      if (txvq->pinned_worker_index != ~0)
+        cpu_index = dm->input_cpu_first_index +
+                    txvq->pinned_worker_index % dm->input_cpu_count;
+      else
+        cpu_index = dm->input_cpu_first_index + rr++ % dm->input_cpu_count;
+
+      txvq->cpu_index = cpu_index;
+      vec_add2 (vum->rx_queues_by_cpu[cpu_index], iq, 1);
+      iq->vhost_iface_index = vui - vum->vhost_user_interfaces;
+      iq->qid = qid;
+    }
+  }
+
+  /* workers not started yet inherit the main thread's state */
+  for (cpu_index = 0; cpu_index < tm->n_vlib_mains; cpu_index++) {
+    vlib_main_t * this_vm = vlib_mains ? vlib_mains[cpu_index] :
+                            (cpu_index == 0 ? vm : 0);
+
+    if (this_vm == 0)
+      continue;
+
+    vlib_node_set_state (this_vm, vhost_user_input_node.index,
+                         vec_len (vum->rx_queues_by_cpu[cpu_index]) ?
+                         VLIB_NODE_STATE_POLLING : VLIB_NODE_STATE_DISABLED);
+  }
+
+  vlib_worker_thread_barrier_release (vm);
+}
+
 static inline void vhost_user_if_disconnect(vhost_user_intf_t * vui)
 {
   vhost_user_main_t * vum = &vhost_user_main;
@@ -232,9 +289,13 @@ static inline void vhost_user_if_disconnect(vhost_user_intf_t * vui)
     vui->vrings[q].used = NULL;
     vui->vrings[q].log_guest_addr = 0;
     vui->vrings[q].log_used = 0;
+    vui->vrings[q].enabled = 0;
   }
+  /* the next guest may use fewer queues */
+  vui->num_vrings = 2;
 
   unmap_all_mem_regions(vui);
+  vhost_user_rx_thread_placement();
   DBG_SOCK("interface ifindex %d disconnected", vui->sw_if_index);
 }
 
@@ -278,6 +339,7 @@ static clib_error_t * vhost_user_socket_read (unix_file_t * uf)
   struct cmsghdr *cmsg;
   uword * p;
   u8 q;
+  int placement_changed = 0;
   unix_file_t template = {0};
   vnet_main_t * vnm = vnet_get_main();
 
@@ -335,6 +397,34 @@ static clib_error_t * vhost_user_socket_read (unix_file_t * uf)
       rv = read(uf->file_descriptor, ((char*)&msg) + n, msg.size);
   }
 
+  /* ring indices given by the guest must fit our vrings */
+  switch (msg.request) {
+    case VHOST_USER_SET_VRING_NUM:
+    case VHOST_USER_SET_VRING_ADDR:
+    case VHOST_USER_SET_VRING_BASE:
+    case VHOST_USER_GET_VRING_BASE:
+    case VHOST_USER_SET_VRING_ENABLE:
+      if (msg.state.index >= VHOST_VRING_MAX_N) {
+        DBG_SOCK("vring index %d out of range", msg.state.index);
+        goto close_socket;
+      }
+      if (msg.state.index >= vui->num_vrings)
+        vui->num_vrings = (msg.state.index | 1) + 1;
+      break;
+
+    case VHOST_USER_SET_VRING_CALL:
+    case VHOST_USER_SET_VRING_KICK:
+    case VHOST_USER_SET_VRING_ERR:
+      if ((msg.u64 & 0xFF) >= VHOST_VRING_MAX_N) {
+        DBG_SOCK("vring index %d out of range", msg.u64 & 0xFF);
+        goto close_socket;
+      }
+      break;
+
+    default:
+      break;
+  }
+
   switch (msg.request) {
     case VHOST_USER_GET_FEATURES:
       DBG_SOCK("if %d msg VHOST_USER_GET_FEATURES",
@@ -345,6 +435,7 @@ static clib_error_t * vhost_user_socket_read (unix_file_t * uf)
                 (1 << FEAT_VIRTIO_F_ANY_LAYOUT) |
                 (1 << FEAT_VHOST_F_LOG_ALL) |
                 (1 << FEAT_VIRTIO_NET_F_GUEST_ANNOUNCE) |
+                (1 << FEAT_VIRTIO_NET_F_MQ) |
                 (1 << FEAT_VHOST_USER_F_PROTOCOL_FEATURES);
       msg.u64 &= vui->feature_mask;
 
@@ -368,13 +459,14 @@ static clib_error_t * vhost_user_socket_read (unix_file_t * uf)
       vnet_hw_interface_set_flags (vnm, vui->hw_if_index,  0);
       vui->is_up = 0;
 
-      for (q = 0; q < 2; q++) {
+      for (q = 0; q < vui->num_vrings; q++) {
         vui->vrings[q].desc = 0;
         vui->vrings[q].avail = 0;
         vui->vrings[q].used = 0;
         vui->vrings[q].log_guest_addr = 0;
         vui->vrings[q].log_used = 0;
       }
+      placement_changed = 1;
 
       DBG_SOCK("interface %d disconnected", vui->sw_if_index);
 
@@ -470,6 +562,7 @@ static clib_error_t * vhost_user_socket_read (unix_file_t * uf)
 
       /* tell driver that we don't want interrupts */
       vui->vrings[msg.state.index].used->flags |= 1;
+      placement_changed = 1;
       break;
 
     case VHOST_USER_SET_OWNER:
@@ -620,7 +713,16 @@ static clib_error_t * vhost_user_socket_read (unix_file_t * uf)
       DBG_SOCK("if %d msg VHOST_USER_GET_PROTOCOL_FEATURES", vui->hw_if_index);
 
       msg.flags |= 4;
-      msg.u64 = (1 << VHOST_USER_PROTOCOL_F_LOG_SHMFD);
+      msg.u64 = (1 << VHOST_USER_PROTOCOL_F_LOG_SHMFD) |
+                (1 << VHOST_USER_PROTOCOL_F_MQ);
+      msg.size = sizeof(msg.u64);
+      break;
+
+    case VHOST_USER_GET_QUEUE_NUM:
+      DBG_SOCK("if %d msg VHOST_USER_GET_QUEUE_NUM", vui->hw_if_index);
+
+      msg.flags |= 4;
+      msg.u64 = VHOST_USER_MAX_QUEUE_PAIRS;
       msg.size = sizeof(msg.u64);
       break;
 
@@ -656,6 +758,9 @@ static clib_error_t * vhost_user_socket_read (unix_file_t * uf)
 
   }
 
+  if (placement_changed)
+    vhost_user_rx_thread_placement();
+
   /* if we need to reply */
   if (msg.flags & 4)
   {
@@ -749,6 +854,9 @@ vhost_user_init (vlib_main_t * vm)
 
   vec_validate_aligned (vum->rx_buffers, tm->n_vlib_mains - 1,
                         CLIB_CACHE_LINE_BYTES);
+  vec_validate_aligned (vum->rx_copies, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+  vec_validate (vum->rx_queues_by_cpu, tm->n_vlib_mains - 1);
 
   return 0;
 }
@@ -856,14 +964,41 @@ static inline void vhost_user_send_call(vlib_main_t * vm, vhost_user_vring_t * v
     vq->int_deadline = vlib_time_now(vm) + vum->coalesce_time;
 }
 
+/*
+ * Copies run once all descriptors of the burst have been walked, with the
+ * source of the next ones prefetched. Guest memory is cold: walking the
+ * rings first and copying in a tight loop hides most of the misses.
+ */
+always_inline void
+vhost_user_input_copy (vhost_copy_t * cp, u32 n_left)
+{
+  while (n_left >= 4)
+    {
+      CLIB_PREFETCH (cp[2].src, CLIB_CACHE_LINE_BYTES, LOAD);
+      CLIB_PREFETCH (cp[3].src, CLIB_CACHE_LINE_BYTES, LOAD);
+
+      clib_memcpy (cp[0].dst, cp[0].src, cp[0].len);
+      clib_memcpy (cp[1].dst, cp[1].src, cp[1].len);
+      cp += 2;
+      n_left -= 2;
+    }
+
+  while (n_left > 0)
+    {
+      clib_memcpy (cp[0].dst, cp[0].src, cp[0].len);
+      cp += 1;
+      n_left -= 1;
+    }
+}
 
 static u32 vhost_user_if_input ( vlib_main_t * vm,
                                vhost_user_main_t * vum, 
                                vhost_user_intf_t * vui,
+                               u32 qid,
                                vlib_node_runtime_t * node)
 {
-  vhost_user_vring_t * txvq = &vui->vrings[VHOST_NET_VRING_IDX_TX];
-  vhost_user_vring_t * rxvq = &vui->vrings[VHOST_NET_VRING_IDX_RX];
+  vhost_user_vring_t * txvq = &vui->vrings[VHOST_VRING_IDX_TX(qid)];
+  vhost_user_vring_t * rxvq = &vui->vrings[VHOST_VRING_IDX_RX(qid)];
   uword n_rx_packets = 0, n_rx_bytes = 0;
   uword n_left;
   u32 n_left_to_next, * to_next;
@@ -872,6 +1007,8 @@ static u32 vhost_user_if_input ( vlib_main_t * vm,
   uword n_trace = vlib_get_trace_count (vm, node);
   u16 qsz_mask;
   u32 cpu_index, rx_len, drops, flush;
+  u32 * rx_buffers;
+  vhost_copy_t * copies;
   f64 now = vlib_time_now (vm);
 
   vec_reset_length (vui->d_trace_buffers);
@@ -923,11 +1060,10 @@ static u32 vhost_user_if_input ( vlib_main_t * vm,
     n_left = VLIB_FRAME_SIZE;
 
   /* Allocate some buffers.
-   * Note that buffers that are chained for jumbo
-   * frames are allocated separately using a slower path.
    * The idea is to be certain to have enough buffers at least
    * to cycle through the descriptors without having to check for errors.
-   * For jumbo frames, the bottleneck is memory copy anyway.
+   * Buffers chained for jumbo frames are taken from the same cache,
+   * which is topped up whenever it could not cover the remaining heads.
    */
   if (PREDICT_FALSE(!vum->rx_buffers[cpu_index])) {
     vec_alloc (vum->rx_buffers[cpu_index], VLIB_FRAME_SIZE);
@@ -964,6 +1100,10 @@ static u32 vhost_user_if_input ( vlib_main_t * vm,
   }
 
   rx_len = vec_len(vum->rx_buffers[cpu_index]); //vector might be null
+  rx_buffers = vum->rx_buffers[cpu_index];
+  copies = vum->rx_copies[cpu_index];
+  vec_reset_length (copies);
+
   while (n_left > 0) {
     vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
 
@@ -974,7 +1114,7 @@ static u32 vhost_user_if_input ( vlib_main_t * vm,
       u8 error = VHOST_USER_INPUT_FUNC_ERROR_NO_ERROR;
 
       desc_chain_head = desc_current = txvq->avail->ring[txvq->last_avail_idx & qsz_mask];
-      bi_head = bi_current = vum->rx_buffers[cpu_index][--rx_len];
+      bi_head = bi_current = rx_buffers[--rx_len];
       b_head = b_current = vlib_get_buffer (vm, bi_head);
       vlib_buffer_chain_init(b_head);
 
@@ -1000,15 +1140,47 @@ static u32 vhost_user_if_input ( vlib_main_t * vm,
           clib_memcpy(b->pre_data, buffer_addr, sizeof(virtio_net_hdr_t)); /* 12 byte hdr is not used on tx */
 #endif
 
+        /* Only record the copies, they are done for the whole burst below */
         if (txvq->desc[desc_current].len > offset) {
-          u16 len = txvq->desc[desc_current].len - offset;
-          u16 copied = vlib_buffer_chain_append_data_with_alloc(vm, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX,
-                                                   b_head, &b_current, buffer_addr + offset, len);
+          u32 len = txvq->desc[desc_current].len - offset;
+          void * src = buffer_addr + offset;
+
+          while (len > 0) {
+            vhost_copy_t * cp;
+            u32 room = VLIB_BUFFER_DATA_SIZE - b_current->current_data
+                       - b_current->current_length;
+
+            if (PREDICT_FALSE(room == 0)) {
+              /* keep one buffer for each head still to come */
+              if (PREDICT_FALSE(rx_len < n_left)) {
+                rx_len += vlib_buffer_alloc_from_free_list
+                  (vm, rx_buffers + rx_len, VLIB_FRAME_SIZE - rx_len,
+                   VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX);
+                if (rx_len < n_left) {
+                  error = VHOST_USER_INPUT_FUNC_ERROR_NO_BUFFER;
+                  break;
+                }
+              }
+              bi_current = rx_buffers[--rx_len];
+              b_current = vlib_buffer_chain_buffer (vm, b_head, b_current,
+                                                    bi_current);
+              room = VLIB_BUFFER_DATA_SIZE - b_current->current_data;
+            }
 
-          if (copied != len) {
-            error = VHOST_USER_INPUT_FUNC_ERROR_NO_BUFFER;
-            break;
+            if (room > len)
+              room = len;
+
+            vec_add2 (copies, cp, 1);
+            cp->dst = vlib_buffer_get_current (b_current) + b_current->current_length;
+            cp->src = src;
+            cp->len = room;
+            vlib_buffer_chain_increase_length (b_head, b_current, room);
+            src += room;
+            len -= room;
           }
+
+          if (PREDICT_FALSE(error))
+            break;
         }
         offset = 0;
 
@@ -1064,6 +1236,10 @@ static u32 vhost_user_if_input ( vlib_main_t * vm,
   if (PREDICT_TRUE(vum->rx_buffers[cpu_index] != 0))
     _vec_len(vum->rx_buffers[cpu_index]) = rx_len;
 
+  /* descriptors must not go back to the guest before they are copied */
+  vhost_user_input_copy (copies, vec_len (copies));
+  vum->rx_copies[cpu_index] = copies;
+
   /* give buffers back to driver */
   CLIB_MEMORY_BARRIER();
   txvq->used->idx = txvq->last_used_idx;
@@ -1071,7 +1247,7 @@ static u32 vhost_user_if_input ( vlib_main_t * vm,
 
   if (PREDICT_FALSE (vec_len (vui->d_trace_buffers) > 0))
   {
-    vhost_user_rx_trace (vm, node, vui, VHOST_NET_VRING_IDX_TX);
+    vhost_user_rx_trace (vm, node, vui, VHOST_VRING_IDX_TX(qid));
     vlib_set_trace_count (vm, node, n_trace - vec_len (vui->d_trace_buffers));
   }
 
@@ -1091,6 +1267,8 @@ static u32 vhost_user_if_input ( vlib_main_t * vm,
   }
 
   /* increase rx counters */
+  txvq->n_packets += n_rx_packets;
+  txvq->n_bytes += n_rx_bytes;
   vlib_increment_combined_counter
   (vnet_main.interface_main.combined_sw_if_counters
    + VNET_INTERFACE_COUNTER_RX,
@@ -1107,18 +1285,16 @@ vhost_user_input (vlib_main_t * vm,
 	    vlib_frame_t * f)
 {
   vhost_user_main_t * vum = &vhost_user_main;
-  dpdk_main_t * dm = &dpdk_main;
   vhost_user_intf_t * vui;
+  vhost_iface_and_queue_t * iq;
   uword n_rx_packets = 0;
   u32 cpu_index = os_get_cpu_number();
-  int i;
 
-  for(i = 0; i < vec_len(vum->vhost_user_interfaces); i++ )
+  vec_foreach (iq, vum->rx_queues_by_cpu[cpu_index])
     {
-      vui = vec_elt_at_index(vum->vhost_user_interfaces, i);
-      if (vui->is_up &&
-          (i % dm->input_cpu_count) == (cpu_index - dm->input_cpu_first_index))
-        n_rx_packets += vhost_user_if_input (vm, vum, vui, node);
+      vui = vec_elt_at_index(vum->vhost_user_interfaces, iq->vhost_iface_index);
+      if (vui->is_up)
+        n_rx_packets += vhost_user_if_input (vm, vum, vui, iq->qid, node);
     }
   return n_rx_packets;
 }
@@ -1158,22 +1334,33 @@ vhost_user_intfc_tx (vlib_main_t * vm,
   uword n_packets = 0;
   vnet_interface_output_runtime_t * rd = (void *) node->runtime_data;
   vhost_user_intf_t * vui = vec_elt_at_index (vum->vhost_user_interfaces, rd->dev_instance);
-  vhost_user_vring_t * rxvq = &vui->vrings[VHOST_NET_VRING_IDX_RX];
+  vhost_user_vring_t * rxvq = 0;
   u16 qsz_mask;
+  u32 qid;
+  uword n_bytes = 0;
+  int locked = 0;
   u8 error = VHOST_USER_TX_FUNC_ERROR_NONE;
 
   if (PREDICT_FALSE(!vui->is_up))
      goto done2;
 
+  /* one queue pair per thread, the first one if the guest didn't enable it */
+  qid = os_get_cpu_number() % (vui->num_vrings / 2);
+  rxvq = &vui->vrings[VHOST_VRING_IDX_RX(qid)];
+  if (PREDICT_FALSE(!rxvq->desc || !rxvq->enabled))
+    rxvq = &vui->vrings[VHOST_VRING_IDX_RX(0)];
+
   if (PREDICT_FALSE(!rxvq->desc || !rxvq->avail || vui->sock_errno != 0 || !rxvq->enabled)) {
      error = VHOST_USER_TX_FUNC_ERROR_NOT_READY;
      goto done2;
   }
 
-  if (PREDICT_FALSE(vui->lockp != 0))
+  /* threads may outnumber the queues */
+  if (PREDICT_FALSE(vlib_get_thread_main()->n_vlib_mains > 1))
     {
-      while (__sync_lock_test_and_set (vui->lockp, 1))
+      while (__sync_lock_test_and_set (&rxvq->lock, 1))
         ;
+      locked = 1;
     }
 
   /* only bit 0 of avail.flags is used so we don't want to deal with this
@@ -1313,6 +1500,7 @@ vhost_user_intfc_tx (vlib_main_t * vm,
 
       rxvq->last_avail_idx++;
       used_index++;
+      n_bytes += vlib_buffer_length_in_chain (vm, b0);
   }
 
 done:
@@ -1320,6 +1508,9 @@ done:
   rxvq->used->idx = used_index;
   vhost_user_log_dirty_ring(vui, rxvq, idx);
 
+  rxvq->n_packets += n_packets - n_left;
+  rxvq->n_bytes += n_bytes;
+
   /* interrupt (call) handling */
   if((rxvq->callfd > 0) && !(rxvq->avail->flags & 1)) {
     rxvq->n_since_last_int += n_packets - n_left;
@@ -1330,8 +1521,11 @@ done:
 
 done2:
 
-  if (PREDICT_FALSE(vui->lockp != 0))
-      *vui->lockp = 0;
+  if (PREDICT_FALSE(locked))
+    {
+      CLIB_MEMORY_BARRIER();
+      rxvq->lock = 0;
+    }
 
   if (PREDICT_FALSE(n_left && error != VHOST_USER_TX_FUNC_ERROR_NONE)) {
     vlib_error_count(vm, node->node_index, error, n_left);
@@ -1484,6 +1678,33 @@ int vhost_user_delete_if(vnet_main_t * vnm, vlib_main_t * vm,
   return rv;
 }
 
+int vhost_user_set_rx_placement(vnet_main_t * vnm, u32 sw_if_index,
+                                u32 qid, u32 worker_index)
+{
+  vhost_user_main_t * vum = &vhost_user_main;
+  dpdk_main_t * dm = &dpdk_main;
+  vhost_user_intf_t * vui;
+  uword *p = NULL;
+
+  p = hash_get (vum->vhost_user_interface_index_by_sw_if_index,
+                sw_if_index);
+  if (p == 0)
+    return VNET_API_ERROR_INVALID_SW_IF_INDEX;
+
+  vui = vec_elt_at_index (vum->vhost_user_interfaces, p[0]);
+
+  if (qid >= VHOST_USER_MAX_QUEUE_PAIRS)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  if (worker_index != ~0 && worker_index >= dm->input_cpu_count)
+    return VNET_API_ERROR_INVALID_WORKER;
+
+  vui->vrings[VHOST_VRING_IDX_TX(qid)].pinned_worker_index = worker_index;
+  vhost_user_rx_thread_placement();
+
+  return 0;
+}
+
 // init server socket on specified sock_filename
 static int vhost_user_init_server_sock(const char * sock_filename, int *sockfd)
 {
@@ -1596,7 +1817,6 @@ static void vhost_user_vui_init(vnet_main_t * vnm,
 {
   vnet_sw_interface_t * sw;
   sw = vnet_get_hw_sw_interface (vnm, vui->hw_if_index);
-  vlib_thread_main_t * tm = vlib_get_thread_main();
   int q;
 
   vui->unix_fd = sockfd;
@@ -1611,46 +1831,33 @@ static void vhost_user_vui_init(vnet_main_t * vnm,
   vui->unix_file_index = ~0;
   vui->log_base_addr = 0;
 
-  for (q = 0; q < 2; q++) {
+  for (q = 0; q < VHOST_VRING_MAX_N; q++) {
     vui->vrings[q].enabled = 0;
+    vui->vrings[q].lock = 0;
+    vui->vrings[q].cpu_index = ~0;
+    vui->vrings[q].pinned_worker_index = ~0;
+    vui->vrings[q].n_packets = 0;
+    vui->vrings[q].n_bytes = 0;
   }
 
   vnet_hw_interface_set_flags (vnm, vui->hw_if_index,  0);
 
   if (sw_if_index)
       *sw_if_index = vui->sw_if_index;
-
-  if (tm->n_vlib_mains > 1)
-  {
-    vui->lockp = clib_mem_alloc_aligned (CLIB_CACHE_LINE_BYTES,
-                                         CLIB_CACHE_LINE_BYTES);
-    memset ((void *) vui->lockp, 0, CLIB_CACHE_LINE_BYTES);
-  }
 }
 
 // register vui and start polling on it
 static void vhost_user_vui_register(vlib_main_t * vm, vhost_user_intf_t *vui)
 {
   vhost_user_main_t * vum = &vhost_user_main;
-  dpdk_main_t * dm = &dpdk_main;
-  int cpu_index;
-  vlib_thread_main_t * tm = vlib_get_thread_main();
 
   hash_set (vum->vhost_user_interface_index_by_listener_fd, vui->unix_fd,
             vui - vum->vhost_user_interfaces);
   hash_set (vum->vhost_user_interface_index_by_sw_if_index, vui->sw_if_index,
             vui - vum->vhost_user_interfaces);
 
-  /* start polling */
-  cpu_index = dm->input_cpu_first_index +
-              (vui - vum->vhost_user_interfaces) % dm->input_cpu_count;
-
-  if (tm->n_vlib_mains == 1)
-    vlib_node_set_state (vm, vhost_user_input_node.index,
-                         VLIB_NODE_STATE_POLLING);
-  else
-    vlib_node_set_state (vlib_mains[cpu_index], vhost_user_input_node.index,
-                         VLIB_NODE_STATE_POLLING);
+  /* polling starts as the guest sets up its rings */
+  vhost_user_rx_thread_placement();
 
   /* tell process to start polling for sockets */
   vlib_process_signal_event(vm, vhost_user_process_node.index, 0, 0);
@@ -1815,6 +2022,58 @@ vhost_user_delete_command_fn (vlib_main_t * vm,
   return 0;
 }
 
+static clib_error_t *
+vhost_user_rx_placement_command_fn (vlib_main_t * vm,
+                                    unformat_input_t * input,
+                                    vlib_cli_command_t * cmd)
+{
+  vnet_main_t * vnm = vnet_get_main();
+  u32 sw_if_index = ~0, qid = 0, worker_index = ~0;
+  int rv;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT) {
+    if (unformat (input, "%U", unformat_vnet_sw_interface, vnm, &sw_if_index))
+      ;
+    else if (unformat (input, "queue %d", &qid))
+      ;
+    else if (unformat (input, "worker %d", &worker_index))
+      ;
+    else if (unformat (input, "auto"))
+      worker_index = ~0;
+    else
+      return clib_error_return (0, "unknown input `%U'",
+                                format_unformat_error, input);
+  }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "please specify an interface");
+
+  rv = vhost_user_set_rx_placement (vnm, sw_if_index, qid, worker_index);
+
+  switch (rv) {
+    case 0:
+      break;
+    case VNET_API_ERROR_INVALID_SW_IF_INDEX:
+      return clib_error_return (0, "not a vhost-user interface");
+    case VNET_API_ERROR_INVALID_VALUE:
+      return clib_error_return (0, "queue must be below %d",
+                                VHOST_USER_MAX_QUEUE_PAIRS);
+    case VNET_API_ERROR_INVALID_WORKER:
+      return clib_error_return (0, "no such worker");
+    default:
+      return clib_error_return (0, "vhost_user_set_rx_placement returned %d",
+                                rv);
+  }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (vhost_user_rx_placement_command, static) = {
+    .path = "set vhost-user rx-placement",
+    .short_help = "set vhost-user rx-placement <intfc> [queue <n>] [worker <n> | auto]",
+    .function = vhost_user_rx_placement_command_fn,
+};
+
 int vhost_user_dump_ifs(vnet_main_t * vnm, vlib_main_t * vm, vhost_user_intf_details_t **out_vuids)
 {
   int rv = 0;
@@ -1948,6 +2207,21 @@ show_vhost_user_command_fn (vlib_main_t * vm,
         vui->regions[j].mmap_offset,
         pointer_to_uword( vui->region_mmap_addr[j]) );
     }
+    vlib_cli_output (vm, " Queue pairs (total %d)\n", vui->num_vrings / 2);
+    for (q = 0; q < vui->num_vrings / 2; q++) {
+      vhost_user_vring_t * txvq = &vui->vrings[VHOST_VRING_IDX_TX(q)];
+      vhost_user_vring_t * rxvq = &vui->vrings[VHOST_VRING_IDX_RX(q)];
+
+      if (txvq->cpu_index != ~0)
+        vlib_cli_output(vm, "  %d: polled by thread %d%s", q,
+          txvq->cpu_index,
+          txvq->pinned_worker_index != ~0 ? " (pinned)" : "");
+      else
+        vlib_cli_output(vm, "  %d: not polled", q);
+      vlib_cli_output(vm, "     rx packets %lld bytes %lld tx packets %lld bytes %lld",
+        txvq->n_packets, txvq->n_bytes, rxvq->n_packets, rxvq->n_bytes);
+    }
+
     for (q = 0; q < vui->num_vrings; q++) {
       vlib_cli_output(vm, "\n Virtqueue %d\n", q);
 
@@ -23,6 +23,12 @@
 #define VHOST_NET_VRING_IDX_TX          1
 #define VHOST_NET_VRING_NUM             2
 
+/* Queue pair q uses vring 2q towards the guest, 2q+1 from the guest */
+#define VHOST_USER_MAX_QUEUE_PAIRS      8
+#define VHOST_VRING_MAX_N               (VHOST_USER_MAX_QUEUE_PAIRS * 2)
+#define VHOST_VRING_IDX_RX(qid)         (2 * (qid))
+#define VHOST_VRING_IDX_TX(qid)         (2 * (qid) + 1)
+
 #define VIRTQ_DESC_F_NEXT               1
 #define VHOST_USER_REPLY_MASK       (0x1 << 2)
 
@@ -49,6 +55,7 @@
  _ (VIRTIO_F_ANY_LAYOUT, 27)            \
  _ (VHOST_F_LOG_ALL, 26)                \
  _ (VIRTIO_NET_F_GUEST_ANNOUNCE, 21)    \
+ _ (VIRTIO_NET_F_MQ, 22)                \
  _ (VHOST_USER_F_PROTOCOL_FEATURES, 30)
 
 
@@ -67,6 +74,8 @@ int vhost_user_modify_if(vnet_main_t * vnm, vlib_main_t * vm,
     u32 sw_if_index, u64 feature_mask,
     u8 renumber, u32 custom_dev_instance);
 int vhost_user_delete_if(vnet_main_t * vnm, vlib_main_t * vm, u32 sw_if_index);
+int vhost_user_set_rx_placement(vnet_main_t * vnm, u32 sw_if_index,
+    u32 qid, u32 worker_index);
 
 typedef struct vhost_user_memory_region {
   u64 guest_phys_addr;
@@ -184,11 +193,22 @@ typedef struct {
   u32 callfd_idx;
   u32 n_since_last_int;
   f64 int_deadline;
+
+  /* Rings towards the guest, taken by whichever thread transmits */
+  volatile u32 lock;
+
+  /* Rings from the guest: polling thread, and the worker it is pinned
+     to, ~0 for round robin placement */
+  u32 cpu_index;
+  u32 pinned_worker_index;
+
+  /* Packets and bytes through the ring */
+  u64 n_packets;
+  u64 n_bytes;
 } vhost_user_vring_t;
 
 typedef struct {
   CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
-  volatile u32 * lockp;
   u32 is_up;
   u32 admin_up;
   u32 unix_fd;
@@ -208,7 +228,7 @@ typedef struct {
   vhost_user_memory_region_t regions[VHOST_MEMORY_MAX_NREGIONS];
   void * region_mmap_addr[VHOST_MEMORY_MAX_NREGIONS];
   u32 region_mmap_fd[VHOST_MEMORY_MAX_NREGIONS];
-  vhost_user_vring_t vrings[2];
+  vhost_user_vring_t vrings[VHOST_VRING_MAX_N];
   int virtio_net_hdr_sz;
   int is_any_layout;
   u32 * d_trace_buffers;
@@ -217,8 +237,23 @@ typedef struct {
   u64 log_size;
 } vhost_user_intf_t;
 
+/* Guest to vlib buffer copy, deferred until the burst has been walked */
+typedef struct {
+  void * dst;
+  void * src;
+  u32 len;
+} vhost_copy_t;
+
+typedef struct {
+  u32 vhost_iface_index;
+  u32 qid;
+} vhost_iface_and_queue_t;
+
 typedef struct {
   u32 ** rx_buffers;
+  vhost_copy_t ** rx_copies;
+  /* Queues from the guests polled by each thread */
+  vhost_iface_and_queue_t ** rx_queues_by_cpu;
   u32 mtu_bytes;
   vhost_user_intf_t * vhost_user_interfaces;
   u32 * vhost_user_inactive_interfaces_index;
@@ -42,6 +42,7 @@
 #include <vnet/ethernet/ethernet.h>
 #include <vppinfra/sparse_vec.h>
 #include <vnet/l2/l2_bvi.h>
+#include <vnet/unix/pcap_capture.h>
 
 
 #define foreach_ethernet_input_next		\
@@ -286,6 +287,11 @@ ethernet_input_inline (vlib_main_t * vm,
 				   sizeof (from[0]),
 				   sizeof (ethernet_input_trace_t));
 
+  /* Not-l2 packets were captured on their first pass. */
+  if (PREDICT_FALSE (pcap_capture_main.flags & PCAP_CAPTURE_RX)
+      && variant != ETHERNET_INPUT_VARIANT_NOT_L2)
+    pcap_capture_buffers (vm, from, n_left_from, PCAP_CAPTURE_RX);
+
   next_index = node->cached_next_index;
   stats_sw_if_index = node->runtime_data[0];
   stats_n_packets = stats_n_bytes = 0;
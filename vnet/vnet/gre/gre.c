@@ -507,7 +507,8 @@ static clib_error_t * gre_init (vlib_main_t * vm)
 
   gm->protocol_info_by_name = hash_create_string (0, sizeof (uword));
   gm->protocol_info_by_protocol = hash_create (0, sizeof (uword));
-  gm->tunnel_by_key = hash_create (0, sizeof (uword));
+  clib_bihash_init_8_8 (&gm->tunnel_by_key, "gre tunnels",
+                        GRE_HASH_NUM_BUCKETS, GRE_HASH_MEMORY_SIZE);
 
 #define _(n,s) add_protocol (gm, GRE_PROTOCOL_##s, #s);
   foreach_gre_protocol
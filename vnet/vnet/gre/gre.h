@@ -25,6 +25,7 @@
 #include <vnet/ip/ip4_packet.h>
 #include <vnet/pg/pg.h>
 #include <vnet/ip/format.h>
+#include <vppinfra/bihash_8_8.h>
 
 extern vnet_hw_interface_class_t gre_hw_interface_class;
 
@@ -57,6 +58,10 @@ typedef struct {
   u32 sw_if_index;
 } gre_tunnel_t;
 
+/* Sized for 50k+ tunnels */
+#define GRE_HASH_NUM_BUCKETS (64 * 1024)
+#define GRE_HASH_MEMORY_SIZE (32<<20)
+
 typedef struct {
   /* pool of tunnel instances */
   gre_tunnel_t *tunnels;
@@ -66,7 +71,7 @@ typedef struct {
   /* Hash tables mapping name/protocol to protocol info index. */
   uword * protocol_info_by_name, * protocol_info_by_protocol;
   /* Hash mapping src/dst addr pair to tunnel */
-  uword * tunnel_by_key;
+  clib_bihash_8_8_t tunnel_by_key;
 
   /* Free vlib hw_if_indices */
   u32 * free_gre_tunnel_hw_if_indices;
@@ -46,14 +46,15 @@ int vnet_gre_add_del_tunnel
   u32 slot;
   u32 outer_fib_index;
   uword * p;
-  u64 key;
+  clib_bihash_kv_8_8_t kv, value;
+  int found;
 
-  key = (u64)a->src.as_u32 << 32 | (u64)a->dst.as_u32;
-  p = hash_get (gm->tunnel_by_key, key);
+  kv.key = (u64)a->src.as_u32 << 32 | (u64)a->dst.as_u32;
+  found = !clib_bihash_search_8_8 (&gm->tunnel_by_key, &kv, &value);
 
   if (a->is_add) {
     /* check if same src/dst pair exists */
-    if (p)
+    if (found)
       return VNET_API_ERROR_INVALID_VALUE;
 
     p = hash_get (im->fib_index_by_table_id, a->outer_table_id);
@@ -115,7 +116,8 @@ int vnet_gre_add_del_tunnel
     clib_memcpy (&t->tunnel_src, &a->src, sizeof (t->tunnel_src));
     clib_memcpy (&t->tunnel_dst, &a->dst, sizeof (t->tunnel_dst));
 
-    hash_set (gm->tunnel_by_key, key, t - gm->tunnels);
+    kv.value = t - gm->tunnels;
+    clib_bihash_add_del_8_8 (&gm->tunnel_by_key, &kv, 1 /* is_add */);
 
     slot = vlib_node_add_named_next_with_slot
       (vnm->vlib_main, hi->tx_node_index, "ip4-lookup", GRE_OUTPUT_NEXT_LOOKUP);
@@ -124,10 +126,10 @@ int vnet_gre_add_del_tunnel
 
   } else { /* !is_add => delete */
     /* tunnel needs to exist */
-    if (! p)
+    if (! found)
       return VNET_API_ERROR_NO_SUCH_ENTRY;
 
-    t = pool_elt_at_index (gm->tunnels, p[0]);
+    t = pool_elt_at_index (gm->tunnels, value.value);
 
     sw_if_index = t->sw_if_index;
     vnet_sw_interface_set_flags (vnm, sw_if_index, 0 /* down */);
@@ -136,7 +138,7 @@ int vnet_gre_add_del_tunnel
     vec_add1 (gm->free_gre_tunnel_hw_if_indices, t->hw_if_index);
     gm->tunnel_index_by_sw_if_index[sw_if_index] = ~0;
 
-    hash_unset (gm->tunnel_by_key, key);
+    clib_bihash_add_del_8_8 (&gm->tunnel_by_key, &kv, 0 /* is_add */);
     pool_put (gm->tunnels, t);
   }
 
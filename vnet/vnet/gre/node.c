@@ -61,6 +61,28 @@ typedef struct {
   u32 * sparse_index_by_next_index;
 } gre_input_runtime_t;
 
+/*
+ * Tunnel lookup is staged across the dual loop: a packet's key is
+ * hashed and its bucket prefetched one iteration ahead, the value page
+ * is prefetched at the top of the iteration that searches it.
+ */
+typedef struct {
+  clib_bihash_kv_8_8_t kv;
+  u64 hash;
+} gre_input_key_t;
+
+always_inline void
+gre_input_key_hash (gre_main_t * gm, vlib_buffer_t * b, gre_input_key_t * k)
+{
+  /* ip4_local hands us the ip header, not the gre header */
+  ip4_header_t * ip = vlib_buffer_get_current (b);
+
+  k->kv.key = ((u64)(ip->dst_address.as_u32) << 32) |
+    (u64)(ip->src_address.as_u32);
+  k->hash = clib_bihash_hash_8_8 (&k->kv);
+  clib_bihash_prefetch_bucket_8_8 (&gm->tunnel_by_key, k->hash);
+}
+
 static uword
 gre_input (vlib_main_t * vm,
 	   vlib_node_runtime_t * node,
@@ -72,10 +94,12 @@ gre_input (vlib_main_t * vm,
   u64 cached_tunnel_key = (u64) ~0;
   u32 cached_tunnel_sw_if_index = 0, tunnel_sw_if_index;
   u32 cached_tunnel_fib_index = 0, tunnel_fib_index;
+  gre_input_key_t keys[VLIB_FRAME_SIZE], * k;
+  u32 * from0, n_hashed = 0;
 
   u32 cpu_index = os_get_cpu_number();
 
-  from = vlib_frame_vector_args (from_frame);
+  from = from0 = vlib_frame_vector_args (from_frame);
   n_left_from = from_frame->n_vectors;
 
   next_index = node->cached_next_index;
@@ -98,20 +122,41 @@ gre_input (vlib_main_t * vm,
 	  u32 i0, i1, next0, next1, protocol0, protocol1;
           ip4_header_t *ip0, *ip1;
 
+          k = &keys[from - from0];
+
 	  /* Prefetch next iteration. */
 	  {
-	    vlib_buffer_t * p2, * p3;
-
-	    p2 = vlib_get_buffer (vm, from[2]);
-	    p3 = vlib_get_buffer (vm, from[3]);
-
-	    vlib_prefetch_buffer_header (p2, LOAD);
-	    vlib_prefetch_buffer_header (p3, LOAD);
-
-	    CLIB_PREFETCH (p2->data, sizeof (h0[0]), LOAD);
-	    CLIB_PREFETCH (p3->data, sizeof (h1[0]), LOAD);
+            /* Stage 1: hash the packets of the next iteration */
+            while (n_hashed < (from - from0) + 4)
+              {
+                gre_input_key_hash (gm, vlib_get_buffer (vm, from0[n_hashed]),
+                                    &keys[n_hashed]);
+                n_hashed++;
+              }
+
+            if (n_left_from >= 6)
+              {
+                vlib_buffer_t * p4, * p5;
+
+                p4 = vlib_get_buffer (vm, from[4]);
+                p5 = vlib_get_buffer (vm, from[5]);
+
+                vlib_prefetch_buffer_header (p4, LOAD);
+                vlib_prefetch_buffer_header (p5, LOAD);
+
+                CLIB_PREFETCH (p4->data, sizeof (ip0[0]) + sizeof (h0[0]),
+                               LOAD);
+                CLIB_PREFETCH (p5->data, sizeof (ip1[0]) + sizeof (h1[0]),
+                               LOAD);
+              }
 	  }
 
+          /* Stage 2: buckets arrived last iteration, fetch the pages */
+          if (k[0].kv.key != cached_tunnel_key)
+            clib_bihash_prefetch_data_8_8 (&gm->tunnel_by_key, k[0].hash);
+          if (k[1].kv.key != cached_tunnel_key)
+            clib_bihash_prefetch_data_8_8 (&gm->tunnel_by_key, k[1].hash);
+
 	  bi0 = from[0];
 	  bi1 = from[1];
 	  to_next[0] = bi0;
@@ -167,24 +212,21 @@ gre_input (vlib_main_t * vm,
           if (PREDICT_FALSE(next0 == GRE_INPUT_NEXT_IP4_INPUT 
                             || next0 == GRE_INPUT_NEXT_IP6_INPUT))
             {
-              u64 key = ((u64)(vnet_buffer(b0)->gre.dst) << 32) |
-                         (u64)(vnet_buffer(b0)->gre.src);
-
-              if (cached_tunnel_key != key)
+              if (cached_tunnel_key != k[0].kv.key)
                 {
                   vnet_hw_interface_t * hi;
                   gre_tunnel_t * t;
-                  uword * p;
 
                   ip4_main_t * ip4m = &ip4_main;
-                  p = hash_get (gm->tunnel_by_key, key);
-                  if (!p)
+                  /* Stage 3: search with the page in cache */
+                  if (clib_bihash_search_inline_with_hash_8_8
+                      (&gm->tunnel_by_key, k[0].hash, &k[0].kv) < 0)
                     {
                       next0 = GRE_INPUT_NEXT_DROP;
                       b0->error = node->errors[GRE_ERROR_NO_SUCH_TUNNEL];
                       goto drop0;
                     }
-                  t = pool_elt_at_index (gm->tunnels, p[0]);
+                  t = pool_elt_at_index (gm->tunnels, k[0].kv.value);
                   hi = vnet_get_hw_interface (gm->vnet_main,
                             t->hw_if_index);
                   tunnel_sw_if_index = hi->sw_if_index;
@@ -193,6 +235,7 @@ gre_input (vlib_main_t * vm,
 
                   cached_tunnel_sw_if_index = tunnel_sw_if_index;
                   cached_tunnel_fib_index = tunnel_fib_index;
+                  cached_tunnel_key = k[0].kv.key;
                 }
               else
                 {
@@ -216,24 +259,21 @@ drop0:
           if (PREDICT_FALSE(next1 == GRE_INPUT_NEXT_IP4_INPUT 
                             || next1 == GRE_INPUT_NEXT_IP6_INPUT))
             {
-              u64 key = ((u64)(vnet_buffer(b1)->gre.dst) << 32) |
-                         (u64)(vnet_buffer(b1)->gre.src);
-
-              if (cached_tunnel_key != key)
+              if (cached_tunnel_key != k[1].kv.key)
                 {
                   vnet_hw_interface_t * hi;
                   gre_tunnel_t * t;
-                  uword * p;
 
                   ip4_main_t * ip4m = &ip4_main;
-                  p = hash_get (gm->tunnel_by_key, key);
-                  if (!p)
+                  /* Stage 3: search with the page in cache */
+                  if (clib_bihash_search_inline_with_hash_8_8
+                      (&gm->tunnel_by_key, k[1].hash, &k[1].kv) < 0)
                     {
                       next1 = GRE_INPUT_NEXT_DROP;
                       b1->error = node->errors[GRE_ERROR_NO_SUCH_TUNNEL];
                       goto drop1;
                     }
-                  t = pool_elt_at_index (gm->tunnels, p[0]);
+                  t = pool_elt_at_index (gm->tunnels, k[1].kv.value);
                   hi = vnet_get_hw_interface (gm->vnet_main,
                             t->hw_if_index);
                   tunnel_sw_if_index = hi->sw_if_index;
@@ -242,6 +282,7 @@ drop0:
 
                   cached_tunnel_sw_if_index = tunnel_sw_if_index;
                   cached_tunnel_fib_index = tunnel_fib_index;
+                  cached_tunnel_key = k[1].kv.key;
                 }
               else
                 {
@@ -300,6 +341,7 @@ drop1:
 	  u32 i0, next0;
 
 	  bi0 = from[0];
+          k = &keys[from - from0];
 	  to_next[0] = bi0;
 	  from += 1;
 	  to_next += 1;
@@ -307,6 +349,14 @@ drop1:
 	  n_left_to_next -= 1;
 
 	  b0 = vlib_get_buffer (vm, bi0);
+
+          /* tail of the frame may not have been hashed by the dual loop */
+          if (n_hashed <= (u32) (k - keys))
+            {
+              gre_input_key_hash (gm, b0, k);
+              n_hashed = (k - keys) + 1;
+            }
+
           ip0 = vlib_buffer_get_current (b0);
 
           vnet_buffer(b0)->gre.src = ip0->src_address.as_u32;
@@ -335,24 +385,20 @@ drop1:
           if (PREDICT_FALSE(next0 == GRE_INPUT_NEXT_IP4_INPUT 
                             || next0 == GRE_INPUT_NEXT_IP6_INPUT))
             {
-              u64 key = ((u64)(vnet_buffer(b0)->gre.dst) << 32) |
-                         (u64)(vnet_buffer(b0)->gre.src);
-
-              if (cached_tunnel_key != key)
+              if (cached_tunnel_key != k->kv.key)
                 {
                   vnet_hw_interface_t * hi;
                   gre_tunnel_t * t;
-                  uword * p;
 
                   ip4_main_t * ip4m = &ip4_main;
-                  p = hash_get (gm->tunnel_by_key, key);
-                  if (!p)
+                  if (clib_bihash_search_inline_with_hash_8_8
+                      (&gm->tunnel_by_key, k->hash, &k->kv) < 0)
                     {
                       next0 = GRE_INPUT_NEXT_DROP;
                       b0->error = node->errors[GRE_ERROR_NO_SUCH_TUNNEL];
                       goto drop;
                     }
-                  t = pool_elt_at_index (gm->tunnels, p[0]);
+                  t = pool_elt_at_index (gm->tunnels, k->kv.value);
                   hi = vnet_get_hw_interface (gm->vnet_main,
                             t->hw_if_index);
                   tunnel_sw_if_index = hi->sw_if_index;
@@ -361,6 +407,7 @@ drop1:
 
                   cached_tunnel_sw_if_index = tunnel_sw_if_index;
                   cached_tunnel_fib_index = tunnel_fib_index;
+                  cached_tunnel_key = k->kv.key;
                 }
               else
                 {
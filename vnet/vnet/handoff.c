@@ -499,6 +499,10 @@ VLIB_REGISTER_NODE (handoff_dispatch_node) = {
         [HANDOFF_DISPATCH_NEXT_IP4_INPUT] = "ip4-input-no-checksum",
         [HANDOFF_DISPATCH_NEXT_IP6_INPUT] = "ip6-input",
         [HANDOFF_DISPATCH_NEXT_MPLS_INPUT] = "mpls-gre-input",
+        [HANDOFF_DISPATCH_NEXT_IP4_REASS] = "ip4-reassembly",
+        [HANDOFF_DISPATCH_NEXT_IP6_REASS] = "ip6-reassembly",
+        [HANDOFF_DISPATCH_NEXT_IP4_REASS_FEATURE] = "ip4-reassembly-feature",
+        [HANDOFF_DISPATCH_NEXT_IP6_REASS_FEATURE] = "ip6-reassembly-feature",
   },
 };
 
@@ -27,6 +27,10 @@ typedef enum {
   HANDOFF_DISPATCH_NEXT_IP6_INPUT,
   HANDOFF_DISPATCH_NEXT_MPLS_INPUT,
   HANDOFF_DISPATCH_NEXT_ETHERNET_INPUT,
+  HANDOFF_DISPATCH_NEXT_IP4_REASS,
+  HANDOFF_DISPATCH_NEXT_IP6_REASS,
+  HANDOFF_DISPATCH_NEXT_IP4_REASS_FEATURE,
+  HANDOFF_DISPATCH_NEXT_IP6_REASS_FEATURE,
   HANDOFF_DISPATCH_NEXT_DROP,
   HANDOFF_DISPATCH_N_NEXT,
 } handoff_dispatch_next_t;
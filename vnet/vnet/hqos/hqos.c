@@ -0,0 +1,589 @@
+/*
+ * hqos.c: hierarchical egress shaping and scheduling, configuration
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdint.h>
+#include <vnet/hqos/hqos.h>
+#include <vnet/ethernet/ethernet.h>
+#include <vnet/policer/policer.h>
+
+hqos_main_t hqos_main;
+
+/* Smallest burst: a couple of full size frames */
+#define HQOS_MIN_BURST (2 * 1518)
+
+static void
+hqos_tb_init (hqos_token_bucket_t * tb, f64 rate, f64 burst, f64 now)
+{
+  tb->rate = rate;
+  /* Default to 10ms worth of traffic */
+  if (burst == 0)
+    burst = rate * 10e-3;
+  tb->burst = clib_max (burst, HQOS_MIN_BURST);
+  tb->tokens = tb->burst;
+  tb->last_update = now;
+}
+
+/* Network control and EF first, then AF4x, then AF2x/AF3x, then the rest */
+static u8
+hqos_default_tc_for_dscp (u32 dscp)
+{
+  if (dscp == VNET_DSCP_EF || dscp >= VNET_DSCP_CS6)
+    return 0;
+  if (dscp >= VNET_DSCP_CS4)
+    return 1;
+  if (dscp >= VNET_DSCP_CS2)
+    return 2;
+  return HQOS_N_TC - 1;
+}
+
+/* Grow the active ring to hold every subscriber, keeping its order */
+static void
+hqos_port_validate_active (hqos_port_t * p)
+{
+  u32 * active = 0;
+  u32 n_active = p->active_tail - p->active_head;
+  u32 mask = vec_len (p->active) - 1;
+  u32 i;
+
+  if (vec_len (p->active) >= vec_len (p->subscribers))
+    return;
+
+  vec_validate (active, max_pow2 (vec_len (p->subscribers)) - 1);
+  for (i = 0; i < n_active; i++)
+    active[i] = p->active[(p->active_head + i) & mask];
+
+  vec_free (p->active);
+  p->active = active;
+  p->active_head = 0;
+  p->active_tail = n_active;
+}
+
+static void
+hqos_subscriber_init (hqos_port_t * p, hqos_subscriber_t * s)
+{
+  u32 tc;
+
+  hqos_port_validate_active (p);
+
+  memset (s, 0, sizeof (s[0]));
+  for (tc = 0; tc < HQOS_N_TC; tc++)
+    vec_validate (s->queues[tc].buffers, p->queue_size - 1);
+  s->weight = 1;
+  s->is_valid = 1;
+}
+
+static void
+hqos_subscriber_free (vlib_main_t * vm, hqos_port_t * p,
+                      hqos_subscriber_t * s)
+{
+  u32 mask = p->queue_size - 1;
+  hqos_queue_t * q;
+  u32 tc;
+
+  for (tc = 0; tc < HQOS_N_TC; tc++)
+    {
+      q = &s->queues[tc];
+      while (hqos_queue_elts (q))
+        {
+          vlib_buffer_free_one (vm, q->buffers[q->head & mask]);
+          q->head++;
+        }
+      vec_free (q->buffers);
+    }
+  memset (s, 0, sizeof (s[0]));
+}
+
+static void
+hqos_port_rings_free (vlib_main_t * vm, hqos_port_t * p)
+{
+  hqos_enqueue_ring_t * r;
+
+  vec_foreach (r, p->rings)
+    {
+      while (r->head != r->tail)
+        {
+          vlib_buffer_free_one
+            (vm, r->buffers[r->head & (HQOS_ENQUEUE_RING_SIZE - 1)]);
+          r->head++;
+        }
+      vec_free (r->buffers);
+      vec_free (r->queue_ids);
+    }
+  vec_free (p->rings);
+}
+
+int
+hqos_port_enable_disable (u32 sw_if_index, f64 rate, f64 burst,
+                          u32 queue_size, int is_enable)
+{
+  hqos_main_t * hm = &hqos_main;
+  vlib_main_t * vm = hm->vlib_main;
+  vnet_main_t * vnm = hm->vnet_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  vnet_sw_interface_t * sw;
+  vnet_hw_interface_t * hw;
+  hqos_subscriber_t * s;
+  hqos_enqueue_ring_t * r;
+  hqos_port_t * p;
+  u32 port_index, i;
+  f64 now = vlib_time_now (vm);
+
+  if (pool_is_free_index (vnm->interface_main.sw_interfaces, sw_if_index))
+    return VNET_API_ERROR_INVALID_SW_IF_INDEX;
+
+  sw = vnet_get_sw_interface (vnm, sw_if_index);
+  if (sw->type != VNET_SW_INTERFACE_TYPE_HARDWARE)
+    return VNET_API_ERROR_INVALID_SW_IF_INDEX;
+
+  hw = vnet_get_hw_interface (vnm, sw->hw_if_index);
+  if (hw->hw_class_index != ethernet_hw_interface_class.index)
+    return VNET_API_ERROR_INVALID_INTERFACE;
+
+  vec_validate_init_empty (hm->port_index_by_sw_if_index, sw_if_index, ~0);
+  port_index = hm->port_index_by_sw_if_index[sw_if_index];
+
+  if (is_enable)
+    {
+      if (queue_size == 0)
+        queue_size = HQOS_DEFAULT_QUEUE_SIZE;
+      if (!is_pow2 (queue_size))
+        return VNET_API_ERROR_INVALID_VALUE;
+
+      /* Already enabled: only the port shaper can change */
+      if (port_index != ~0)
+        {
+          p = pool_elt_at_index (hm->ports, port_index);
+          if (queue_size != p->queue_size)
+            return VNET_API_ERROR_INVALID_VALUE;
+          vlib_worker_thread_barrier_sync (vm);
+          hqos_tb_init (&p->tb, rate, burst, now);
+          vlib_worker_thread_barrier_release (vm);
+          return 0;
+        }
+
+      vlib_worker_thread_barrier_sync (vm);
+
+      pool_get_aligned (hm->ports, p, CLIB_CACHE_LINE_BYTES);
+      memset (p, 0, sizeof (p[0]));
+      p->sw_if_index = sw_if_index;
+      p->output_node_index = hw->output_node_index;
+      p->queue_size = queue_size;
+      hqos_tb_init (&p->tb, rate, burst, now);
+      for (i = 0; i < ARRAY_LEN (p->tc_by_dscp); i++)
+        p->tc_by_dscp[i] = hqos_default_tc_for_dscp (i);
+
+      /* The default subscriber is limited by the port shaper only */
+      vec_validate (p->subscribers, HQOS_DEFAULT_SUBSCRIBER);
+      hqos_subscriber_init (p, &p->subscribers[HQOS_DEFAULT_SUBSCRIBER]);
+
+      vec_validate_aligned (p->rings, tm->n_vlib_mains - 1,
+                            CLIB_CACHE_LINE_BYTES);
+      vec_foreach (r, p->rings)
+        {
+          vec_validate (r->buffers, HQOS_ENQUEUE_RING_SIZE - 1);
+          vec_validate (r->queue_ids, HQOS_ENQUEUE_RING_SIZE - 1);
+        }
+
+      hm->port_index_by_sw_if_index[sw_if_index] = p - hm->ports;
+
+      vnet_interface_add_del_feature (vnm, vm, sw_if_index,
+                                      INTF_OUTPUT_FEAT_HQOS, 1 /* is_add */);
+
+      if (hm->n_ports++ == 0)
+        vlib_node_set_state (vm, hqos_scheduler_node.index,
+                             VLIB_NODE_STATE_POLLING);
+
+      vlib_worker_thread_barrier_release (vm);
+      return 0;
+    }
+
+  if (port_index == ~0)
+    return VNET_API_ERROR_NO_SUCH_ENTRY;
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  p = pool_elt_at_index (hm->ports, port_index);
+
+  vnet_interface_add_del_feature (vnm, vm, sw_if_index,
+                                  INTF_OUTPUT_FEAT_HQOS, 0 /* is_add */);
+
+  /* Forget the port's subscribers */
+  vec_foreach_index (i, hm->subscriber_by_sw_if_index)
+    {
+      if (hm->subscriber_by_sw_if_index[i] == ~0)
+        continue;
+      if (vnet_get_sup_hw_interface (vnm, i)->sw_if_index == sw_if_index)
+        hm->subscriber_by_sw_if_index[i] = ~0;
+    }
+
+  vec_foreach (s, p->subscribers)
+    hqos_subscriber_free (vm, p, s);
+  vec_free (p->subscribers);
+  vec_free (p->active);
+  hqos_port_rings_free (vm, p);
+
+  hm->port_index_by_sw_if_index[sw_if_index] = ~0;
+  pool_put (hm->ports, p);
+
+  if (--hm->n_ports == 0)
+    vlib_node_set_state (vm, hqos_scheduler_node.index,
+                         VLIB_NODE_STATE_DISABLED);
+
+  vlib_worker_thread_barrier_release (vm);
+  return 0;
+}
+
+/*
+ * Configure the subscriber for a sub-interface, creating it if needed.
+ * The port's own interface configures the default subscriber.
+ * tc_rates, if given, holds HQOS_N_TC class rates, 0 for unlimited.
+ */
+int
+hqos_subscriber_config (u32 sw_if_index, f64 rate, f64 burst,
+                        u32 weight, f64 * tc_rates)
+{
+  hqos_main_t * hm = &hqos_main;
+  vlib_main_t * vm = hm->vlib_main;
+  vnet_main_t * vnm = hm->vnet_main;
+  vnet_hw_interface_t * hw;
+  hqos_subscriber_t * s;
+  hqos_port_t * p;
+  u32 port_index, id, tc;
+  f64 now = vlib_time_now (vm);
+
+  if (pool_is_free_index (vnm->interface_main.sw_interfaces, sw_if_index))
+    return VNET_API_ERROR_INVALID_SW_IF_INDEX;
+
+  hw = vnet_get_sup_hw_interface (vnm, sw_if_index);
+  if (hw->sw_if_index >= vec_len (hm->port_index_by_sw_if_index)
+      || hm->port_index_by_sw_if_index[hw->sw_if_index] == ~0)
+    return VNET_API_ERROR_FEATURE_DISABLED;
+
+  port_index = hm->port_index_by_sw_if_index[hw->sw_if_index];
+
+  vlib_worker_thread_barrier_sync (vm);
+
+  p = pool_elt_at_index (hm->ports, port_index);
+
+  vec_validate_init_empty (hm->subscriber_by_sw_if_index, sw_if_index, ~0);
+
+  if (sw_if_index == hw->sw_if_index)
+    id = HQOS_DEFAULT_SUBSCRIBER;
+  else if (hm->subscriber_by_sw_if_index[sw_if_index] != ~0)
+    id = hm->subscriber_by_sw_if_index[sw_if_index];
+  else
+    {
+      id = vec_len (p->subscribers);
+      vec_validate (p->subscribers, id);
+      hqos_subscriber_init (p, &p->subscribers[id]);
+      hm->subscriber_by_sw_if_index[sw_if_index] = id;
+    }
+
+  s = vec_elt_at_index (p->subscribers, id);
+  hqos_tb_init (&s->tb, rate, burst, now);
+  if (weight)
+    s->weight = weight;
+  if (tc_rates)
+    for (tc = 0; tc < HQOS_N_TC; tc++)
+      hqos_tb_init (&s->tc_tb[tc], tc_rates[tc], 0, now);
+
+  vlib_worker_thread_barrier_release (vm);
+  return 0;
+}
+
+static u8 *
+format_hqos_rate (u8 * s, va_list * args)
+{
+  hqos_token_bucket_t * tb = va_arg (*args, hqos_token_bucket_t *);
+
+  if (tb->rate == 0)
+    return format (s, "unlimited");
+  return format (s, "%.0f bps burst %.0f bytes", tb->rate * 8, tb->burst);
+}
+
+u8 *
+format_hqos_port (u8 * s, va_list * args)
+{
+  hqos_port_t * p = va_arg (*args, hqos_port_t *);
+  int verbose = va_arg (*args, int);
+  hqos_main_t * hm = &hqos_main;
+  vnet_main_t * vnm = hm->vnet_main;
+  hqos_subscriber_t * sub;
+  hqos_enqueue_ring_t * r;
+  u32 id, tc, sw_if_index, n_ring_drops = 0;
+
+  vec_foreach (r, p->rings)
+    n_ring_drops += r->n_drops;
+
+  s = format (s, "%U: rate %U, queue size %d, %d subscribers, %d queued, "
+              "%d enqueue ring drops\n",
+              format_vnet_sw_if_index_name, vnm, p->sw_if_index,
+              format_hqos_rate, &p->tb, p->queue_size,
+              vec_len (p->subscribers), p->n_queued, n_ring_drops);
+
+  if (!verbose)
+    return s;
+
+  vec_foreach_index (id, p->subscribers)
+    {
+      sub = vec_elt_at_index (p->subscribers, id);
+      if (!sub->is_valid)
+        continue;
+
+      if (id == HQOS_DEFAULT_SUBSCRIBER)
+        s = format (s, "  subscriber %d (default)", id);
+      else
+        {
+          vec_foreach_index (sw_if_index, hm->subscriber_by_sw_if_index)
+            if (hm->subscriber_by_sw_if_index[sw_if_index] == id
+                && vnet_get_sup_hw_interface (vnm, sw_if_index)->sw_if_index
+                == p->sw_if_index)
+              break;
+          s = format (s, "  subscriber %d (%U)", id,
+                      format_vnet_sw_if_index_name, vnm, sw_if_index);
+        }
+      s = format (s, ": rate %U, weight %d, %d queued\n",
+                  format_hqos_rate, &sub->tb, sub->weight, sub->n_queued);
+
+      for (tc = 0; tc < HQOS_N_TC; tc++)
+        s = format (s, "    tc %d: rate %U, %d queued, %d drops\n", tc,
+                    format_hqos_rate, &sub->tc_tb[tc],
+                    hqos_queue_elts (&sub->queues[tc]),
+                    sub->queues[tc].n_drops);
+    }
+
+  return s;
+}
+
+static clib_error_t *
+hqos_rv_to_error (int rv)
+{
+  switch (rv)
+    {
+    case 0:
+      return 0;
+    case VNET_API_ERROR_INVALID_INTERFACE:
+      return clib_error_return (0, "not an ethernet interface");
+    case VNET_API_ERROR_INVALID_SW_IF_INDEX:
+      return clib_error_return (0, "not a hardware interface");
+    case VNET_API_ERROR_INVALID_VALUE:
+      return clib_error_return
+        (0, "queue size must be a power of 2, and can't change while enabled");
+    case VNET_API_ERROR_NO_SUCH_ENTRY:
+      return clib_error_return (0, "hqos not enabled on the interface");
+    case VNET_API_ERROR_FEATURE_DISABLED:
+      return clib_error_return (0, "hqos not enabled on the parent interface");
+    default:
+      return clib_error_return (0, "failed, error %d", rv);
+    }
+}
+
+static clib_error_t *
+set_hqos_interface_command_fn (vlib_main_t * vm,
+                               unformat_input_t * input,
+                               vlib_cli_command_t * cmd)
+{
+  vnet_main_t * vnm = vnet_get_main ();
+  u32 sw_if_index = ~0, queue_size = 0;
+  f64 rate = 0, burst = 0;
+  int is_enable = 1;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface, vnm,
+                    &sw_if_index))
+        ;
+      else if (unformat (input, "rate %f", &rate))
+        ;
+      else if (unformat (input, "burst %f", &burst))
+        ;
+      else if (unformat (input, "queue-size %d", &queue_size))
+        ;
+      else if (unformat (input, "disable"))
+        is_enable = 0;
+      else
+        return clib_error_return (0, "unknown input `%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "interface required");
+
+  return hqos_rv_to_error (hqos_port_enable_disable (sw_if_index, rate / 8,
+                                                     burst, queue_size,
+                                                     is_enable));
+}
+
+VLIB_CLI_COMMAND (set_hqos_interface_command, static) = {
+  .path = "set hqos interface",
+  .short_help = "set hqos interface <interface> [rate <bits-per-sec>] "
+                "[burst <bytes>] [queue-size <n>] [disable]",
+  .function = set_hqos_interface_command_fn,
+};
+
+static clib_error_t *
+set_hqos_subscriber_command_fn (vlib_main_t * vm,
+                                unformat_input_t * input,
+                                vlib_cli_command_t * cmd)
+{
+  vnet_main_t * vnm = vnet_get_main ();
+  u32 sw_if_index = ~0, weight = 0, tc;
+  f64 rate = 0, burst = 0, tc_rate, tc_rates[HQOS_N_TC];
+  int have_tc_rates = 0;
+
+  memset (tc_rates, 0, sizeof (tc_rates));
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface, vnm,
+                    &sw_if_index))
+        ;
+      else if (unformat (input, "tc %d rate %f", &tc, &tc_rate))
+        {
+          if (tc >= HQOS_N_TC)
+            return clib_error_return (0, "tc must be below %d", HQOS_N_TC);
+          tc_rates[tc] = tc_rate / 8;
+          have_tc_rates = 1;
+        }
+      else if (unformat (input, "rate %f", &rate))
+        ;
+      else if (unformat (input, "burst %f", &burst))
+        ;
+      else if (unformat (input, "weight %d", &weight))
+        ;
+      else
+        return clib_error_return (0, "unknown input `%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "interface required");
+
+  return hqos_rv_to_error
+    (hqos_subscriber_config (sw_if_index, rate / 8, burst, weight,
+                             have_tc_rates ? tc_rates : 0));
+}
+
+VLIB_CLI_COMMAND (set_hqos_subscriber_command, static) = {
+  .path = "set hqos subscriber",
+  .short_help = "set hqos subscriber <interface> [rate <bits-per-sec>] "
+                "[burst <bytes>] [weight <n>] [tc <n> rate <bits-per-sec>]...",
+  .function = set_hqos_subscriber_command_fn,
+};
+
+static clib_error_t *
+set_hqos_dscp_map_command_fn (vlib_main_t * vm,
+                              unformat_input_t * input,
+                              vlib_cli_command_t * cmd)
+{
+  hqos_main_t * hm = &hqos_main;
+  vnet_main_t * vnm = vnet_get_main ();
+  u32 sw_if_index = ~0, dscp = ~0, tc = ~0;
+  hqos_port_t * p;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface, vnm,
+                    &sw_if_index))
+        ;
+      else if (unformat (input, "dscp %d", &dscp))
+        ;
+      else if (unformat (input, "tc %d", &tc))
+        ;
+      else
+        return clib_error_return (0, "unknown input `%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "interface required");
+  if (dscp >= 64 || tc >= HQOS_N_TC)
+    return clib_error_return (0, "dscp 0-63 and tc 0-%d required",
+                              HQOS_N_TC - 1);
+  if (sw_if_index >= vec_len (hm->port_index_by_sw_if_index)
+      || hm->port_index_by_sw_if_index[sw_if_index] == ~0)
+    return hqos_rv_to_error (VNET_API_ERROR_NO_SUCH_ENTRY);
+
+  p = pool_elt_at_index (hm->ports,
+                         hm->port_index_by_sw_if_index[sw_if_index]);
+  p->tc_by_dscp[dscp] = tc;
+  return 0;
+}
+
+VLIB_CLI_COMMAND (set_hqos_dscp_map_command, static) = {
+  .path = "set hqos dscp-map",
+  .short_help = "set hqos dscp-map <interface> dscp <0-63> tc <n>",
+  .function = set_hqos_dscp_map_command_fn,
+};
+
+static clib_error_t *
+show_hqos_command_fn (vlib_main_t * vm,
+                      unformat_input_t * input,
+                      vlib_cli_command_t * cmd)
+{
+  hqos_main_t * hm = &hqos_main;
+  vnet_main_t * vnm = vnet_get_main ();
+  u32 sw_if_index = ~0;
+  int verbose = 0;
+  hqos_port_t * p;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface, vnm,
+                    &sw_if_index))
+        ;
+      else if (unformat (input, "verbose"))
+        verbose = 1;
+      else
+        return clib_error_return (0, "unknown input `%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (hm->n_ports == 0)
+    {
+      vlib_cli_output (vm, "hqos not enabled on any interface");
+      return 0;
+    }
+
+  /* *INDENT-OFF* */
+  pool_foreach (p, hm->ports,
+  ({
+    if (sw_if_index == ~0 || sw_if_index == p->sw_if_index)
+      vlib_cli_output (vm, "%U", format_hqos_port, p, verbose);
+  }));
+  /* *INDENT-ON* */
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (show_hqos_command, static) = {
+  .path = "show hqos",
+  .short_help = "show hqos [<interface>] [verbose]",
+  .function = show_hqos_command_fn,
+};
+
+static clib_error_t *
+hqos_init (vlib_main_t * vm)
+{
+  hqos_main_t * hm = &hqos_main;
+
+  hm->vlib_main = vm;
+  hm->vnet_main = vnet_get_main ();
+
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (hqos_init);
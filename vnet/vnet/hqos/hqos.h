@@ -0,0 +1,193 @@
+/*
+ * hqos.h: hierarchical egress shaping and scheduling
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __included_hqos_h__
+#define __included_hqos_h__
+
+#include <vlib/vlib.h>
+#include <vnet/vnet.h>
+#include <vppinfra/fifo.h>
+
+/*
+ * Three level hierarchy, all levels shaped by token buckets:
+ *
+ *   port (hardware interface)
+ *     -> subscriber (a sub-interface, or the port's default subscriber)
+ *       -> traffic class (a queue per class, picked by DSCP)
+ *
+ * Traffic classes of a subscriber are served in strict priority, class 0
+ * first. Subscribers of a port with backlog are served weighted round
+ * robin, up to weight packets per turn.
+ *
+ * Queues and shapers belong to hqos-scheduler on the main thread. The
+ * output feature on each thread classifies packets and hands them over
+ * through its own enqueue ring per port, without taking a lock.
+ */
+
+#define HQOS_N_TC 4
+
+/* The default subscriber carries traffic of unconfigured sub-interfaces */
+#define HQOS_DEFAULT_SUBSCRIBER 0
+
+#define HQOS_DEFAULT_QUEUE_SIZE 64
+
+/* Per thread, per port; a power of 2 */
+#define HQOS_ENQUEUE_RING_SIZE (4 * VLIB_FRAME_SIZE)
+
+typedef struct {
+  f64 rate;                     /* bytes per second, 0 is unlimited */
+  f64 burst;                    /* bytes */
+  f64 tokens;
+  f64 last_update;
+} hqos_token_bucket_t;
+
+typedef struct {
+  u32 * buffers;                /* ring of queue_size buffer indices */
+  u32 head;                     /* free running */
+  u32 tail;
+  u32 n_drops;
+} hqos_queue_t;
+
+typedef struct {
+  hqos_token_bucket_t tb;
+  hqos_token_bucket_t tc_tb[HQOS_N_TC];
+  hqos_queue_t queues[HQOS_N_TC];
+
+  /* Packets per turn in the round robin */
+  u32 weight;
+
+  u32 n_queued;
+
+  /* On the port's active ring */
+  u8 is_active;
+
+  /* Configured; free slots in the subscriber vector are not */
+  u8 is_valid;
+} hqos_subscriber_t;
+
+/* Single producer, single consumer */
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  /* Written by the enqueuing thread only */
+  volatile u32 tail;                /* free running */
+  u32 n_drops;
+
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+
+  /* Written by hqos-scheduler only */
+  volatile u32 head;
+
+  u32 * buffers;
+  /* subscriber id * HQOS_N_TC + traffic class, parallel to buffers */
+  u32 * queue_ids;
+} hqos_enqueue_ring_t;
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  u32 sw_if_index;
+  u32 output_node_index;
+
+  hqos_token_bucket_t tb;
+
+  /* Indexed by subscriber id */
+  hqos_subscriber_t * subscribers;
+
+  /* Ring of subscriber ids with backlog, each on it at most once, so
+     sized to hold all subscribers; a power of 2 */
+  u32 * active;
+  u32 active_head, active_tail; /* free running */
+
+  u32 queue_size;               /* power of 2 */
+  u32 n_queued;
+
+  u8 tc_by_dscp[64];
+
+  /* Indexed by cpu index */
+  hqos_enqueue_ring_t * rings;
+} hqos_port_t;
+
+typedef struct {
+  hqos_port_t * ports;
+
+  /* ~0 if none; indexed by the port's sw_if_index */
+  u32 * port_index_by_sw_if_index;
+
+  /* Subscriber id of a sub-interface, ~0 for the default subscriber */
+  u32 * subscriber_by_sw_if_index;
+
+  /* Number of ports with hqos enabled */
+  u32 n_ports;
+
+  /* hqos-scheduler scratch */
+  u32 * drop_buffers;
+
+  /* convenience */
+  vlib_main_t * vlib_main;
+  vnet_main_t * vnet_main;
+} hqos_main_t;
+
+extern hqos_main_t hqos_main;
+
+extern vlib_node_registration_t hqos_output_node;
+extern vlib_node_registration_t hqos_scheduler_node;
+
+always_inline void
+hqos_tb_update (hqos_token_bucket_t * tb, f64 now)
+{
+  if (tb->rate == 0)
+    return;
+
+  tb->tokens += (now - tb->last_update) * tb->rate;
+  if (tb->tokens > tb->burst)
+    tb->tokens = tb->burst;
+  tb->last_update = now;
+}
+
+/* A bucket may go negative by one packet; it then waits to refill */
+always_inline int
+hqos_tb_conforms (hqos_token_bucket_t * tb)
+{
+  return tb->rate == 0 || tb->tokens > 0;
+}
+
+always_inline void
+hqos_tb_consume (hqos_token_bucket_t * tb, u32 n_bytes)
+{
+  if (tb->rate != 0)
+    tb->tokens -= n_bytes;
+}
+
+always_inline u32
+hqos_queue_elts (hqos_queue_t * q)
+{
+  return q->tail - q->head;
+}
+
+u32 hqos_port_dequeue (vlib_main_t * vm, hqos_port_t * p, f64 now,
+                       u32 * buffers, u32 n_max);
+void hqos_port_send (vlib_main_t * vm, hqos_port_t * p,
+                     u32 * buffers, u32 n_buffers);
+
+int hqos_port_enable_disable (u32 sw_if_index, f64 rate, f64 burst,
+                              u32 queue_size, int is_enable);
+int hqos_subscriber_config (u32 sw_if_index, f64 rate, f64 burst,
+                            u32 weight, f64 * tc_rates);
+
+format_function_t format_hqos_port;
+
+#endif /* __included_hqos_h__ */
@@ -0,0 +1,447 @@
+/*
+ * node.c: hierarchical egress shaping and scheduling, data path
+ *
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <vnet/hqos/hqos.h>
+#include <vnet/ethernet/ethernet.h>
+#include <vnet/ip/ip.h>
+
+/*
+ * hqos-output is an interface output feature. On whichever thread it
+ * runs, it classifies the packets of the frame it is given and puts them
+ * on that thread's enqueue ring of the port.
+ *
+ * hqos-scheduler, an input node polling on the main thread while any
+ * port has hqos enabled, moves packets from the rings to the subscriber
+ * queues, then dequeues whatever the shapers allow and hands it to the
+ * interface output node.
+ */
+
+#define foreach_hqos_error                              \
+_(ENQUEUED, "packets queued")                           \
+_(SENT, "packets sent")                                 \
+_(RING_FULL, "enqueue ring full drops")                 \
+_(QUEUE_FULL, "queue full drops")
+
+typedef enum {
+#define _(sym,str) HQOS_ERROR_##sym,
+  foreach_hqos_error
+#undef _
+  HQOS_N_ERROR,
+} hqos_error_t;
+
+static char * hqos_error_strings[] = {
+#define _(sym,string) string,
+  foreach_hqos_error
+#undef _
+};
+
+typedef enum {
+  HQOS_OUTPUT_NEXT_DROP,
+  HQOS_OUTPUT_N_NEXT,
+} hqos_output_next_t;
+
+typedef struct {
+  u32 sw_if_index;
+  u32 subscriber;
+  u32 tc;
+  u32 ring_depth;
+} hqos_output_trace_t;
+
+static u8 * format_hqos_output_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  hqos_output_trace_t * t = va_arg (*args, hqos_output_trace_t *);
+
+  s = format (s, "HQOS: sw_if_index %d subscriber %d tc %d ring depth %d",
+              t->sw_if_index, t->subscriber, t->tc, t->ring_depth);
+  return s;
+}
+
+/* Traffic class from the DSCP of an IP packet; non-IP goes last */
+always_inline u32
+hqos_classify (hqos_port_t * p, vlib_buffer_t * b0)
+{
+  ethernet_header_t * e0 = vlib_buffer_get_current (b0);
+  u8 * l3 = (u8 *) (e0 + 1);
+  u16 type0 = clib_net_to_host_u16 (e0->type);
+  u8 dscp0;
+  int i;
+
+  for (i = 0; i < 2; i++)
+    {
+      if (type0 != ETHERNET_TYPE_VLAN && type0 != ETHERNET_TYPE_DOT1AD)
+        break;
+      type0 = clib_net_to_host_u16 (((ethernet_vlan_header_t *) l3)->type);
+      l3 += sizeof (ethernet_vlan_header_t);
+    }
+
+  if (type0 == ETHERNET_TYPE_IP4)
+    dscp0 = ((ip4_header_t *) l3)->tos >> 2;
+  else if (type0 == ETHERNET_TYPE_IP6)
+    dscp0 = (clib_net_to_host_u32
+             (((ip6_header_t *) l3)->ip_version_traffic_class_and_flow_label)
+             >> 22) & 0x3f;
+  else
+    return HQOS_N_TC - 1;
+
+  return p->tc_by_dscp[dscp0];
+}
+
+always_inline u32
+hqos_subscriber_for_sw_if_index (hqos_main_t * hm, u32 sw_if_index)
+{
+  if (sw_if_index < vec_len (hm->subscriber_by_sw_if_index)
+      && hm->subscriber_by_sw_if_index[sw_if_index] != ~0)
+    return hm->subscriber_by_sw_if_index[sw_if_index];
+  return HQOS_DEFAULT_SUBSCRIBER;
+}
+
+/*
+ * Move what the output feature has put on the port's enqueue rings to
+ * the subscriber queues. Packets that don't fit are left on drops.
+ */
+static void
+hqos_port_drain_rings (hqos_port_t * p, u32 ** drops)
+{
+  u32 mask = p->queue_size - 1;
+  hqos_enqueue_ring_t * r;
+
+  vec_foreach (r, p->rings)
+    {
+      u32 head = r->head, tail = r->tail;
+
+      if (head == tail)
+        continue;
+
+      /* Read the entries only after seeing the tail */
+      CLIB_MEMORY_BARRIER ();
+
+      while (head != tail)
+        {
+          u32 bi0, id0, si0, tc0;
+          hqos_subscriber_t * s0;
+          hqos_queue_t * q0;
+
+          bi0 = r->buffers[head & (HQOS_ENQUEUE_RING_SIZE - 1)];
+          id0 = r->queue_ids[head & (HQOS_ENQUEUE_RING_SIZE - 1)];
+          head++;
+
+          si0 = id0 / HQOS_N_TC;
+          tc0 = id0 % HQOS_N_TC;
+          s0 = vec_elt_at_index (p->subscribers, si0);
+          q0 = &s0->queues[tc0];
+
+          if (PREDICT_FALSE (hqos_queue_elts (q0) >= p->queue_size))
+            {
+              q0->n_drops++;
+              vec_add1 (*drops, bi0);
+              continue;
+            }
+
+          q0->buffers[q0->tail & mask] = bi0;
+          q0->tail++;
+          s0->n_queued++;
+          p->n_queued++;
+
+          if (!s0->is_active)
+            {
+              p->active[p->active_tail++ & (vec_len (p->active) - 1)] = si0;
+              s0->is_active = 1;
+            }
+        }
+
+      /* Done with the entries before handing them back */
+      CLIB_MEMORY_BARRIER ();
+      r->head = head;
+    }
+}
+
+/*
+ * Serve the port: subscribers with backlog in weighted round robin,
+ * their classes in strict priority, until the port shaper runs dry,
+ * every subscriber left is held back by its own shapers, or n_max
+ * packets have been dequeued. Called by hqos-scheduler only.
+ */
+u32
+hqos_port_dequeue (vlib_main_t * vm, hqos_port_t * p, f64 now,
+                   u32 * buffers, u32 n_max)
+{
+  u32 mask = p->queue_size - 1;
+  u32 n = 0, n_blocked = 0;
+
+  hqos_tb_update (&p->tb, now);
+
+  while (n < n_max && hqos_tb_conforms (&p->tb)
+         && n_blocked < p->active_tail - p->active_head)
+    {
+      hqos_subscriber_t * s;
+      u32 si, n_sent = 0;
+
+      si = p->active[p->active_head++ & (vec_len (p->active) - 1)];
+      s = vec_elt_at_index (p->subscribers, si);
+
+      hqos_tb_update (&s->tb, now);
+
+      while (n_sent < s->weight && n < n_max
+             && hqos_tb_conforms (&s->tb) && hqos_tb_conforms (&p->tb))
+        {
+          hqos_queue_t * q = 0;
+          vlib_buffer_t * b0;
+          u32 tc, bi0, n_bytes0;
+
+          for (tc = 0; tc < HQOS_N_TC; tc++)
+            {
+              if (hqos_queue_elts (&s->queues[tc]) == 0)
+                continue;
+              hqos_tb_update (&s->tc_tb[tc], now);
+              if (hqos_tb_conforms (&s->tc_tb[tc]))
+                {
+                  q = &s->queues[tc];
+                  break;
+                }
+            }
+
+          if (q == 0)
+            break;
+
+          bi0 = q->buffers[q->head & mask];
+          q->head++;
+
+          b0 = vlib_get_buffer (vm, bi0);
+          n_bytes0 = vlib_buffer_length_in_chain (vm, b0);
+
+          hqos_tb_consume (&s->tc_tb[tc], n_bytes0);
+          hqos_tb_consume (&s->tb, n_bytes0);
+          hqos_tb_consume (&p->tb, n_bytes0);
+
+          buffers[n++] = bi0;
+          n_sent++;
+        }
+
+      s->n_queued -= n_sent;
+      p->n_queued -= n_sent;
+
+      if (s->n_queued)
+        {
+          p->active[p->active_tail++ & (vec_len (p->active) - 1)] = si;
+          n_blocked = n_sent ? 0 : n_blocked + 1;
+        }
+      else
+        s->is_active = 0;
+    }
+
+  return n;
+}
+
+/* Hand dequeued packets back to the interface output node */
+void
+hqos_port_send (vlib_main_t * vm, hqos_port_t * p,
+                u32 * buffers, u32 n_buffers)
+{
+  while (n_buffers > 0)
+    {
+      vlib_frame_t * f;
+      u32 * to_next, n_this_frame;
+
+      n_this_frame = clib_min (n_buffers, VLIB_FRAME_SIZE);
+
+      f = vlib_get_frame_to_node (vm, p->output_node_index);
+      to_next = vlib_frame_vector_args (f);
+      clib_memcpy (to_next, buffers, n_this_frame * sizeof (u32));
+      f->n_vectors = n_this_frame;
+      vlib_put_frame_to_node (vm, p->output_node_index, f);
+
+      buffers += n_this_frame;
+      n_buffers -= n_this_frame;
+    }
+}
+
+static uword
+hqos_output_node_fn (vlib_main_t * vm,
+                     vlib_node_runtime_t * node,
+                     vlib_frame_t * frame)
+{
+  hqos_main_t * hm = &hqos_main;
+  vnet_main_t * vnm = hm->vnet_main;
+  u32 n_left_from, * from;
+  u32 drops[VLIB_FRAME_SIZE], n_drops = 0;
+  u32 last_sw_if_index = ~0, last_subscriber = HQOS_DEFAULT_SUBSCRIBER;
+  u32 cpu_index = os_get_cpu_number ();
+  vnet_hw_interface_t * hw;
+  hqos_enqueue_ring_t * r;
+  hqos_port_t * p;
+  u32 port_index, tail;
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+
+  /* The frame came from one interface output node: one port */
+  hw = vnet_get_sup_hw_interface
+    (vnm, vnet_buffer (vlib_get_buffer (vm, from[0]))->sw_if_index[VLIB_TX]);
+  port_index = hw->sw_if_index < vec_len (hm->port_index_by_sw_if_index) ?
+    hm->port_index_by_sw_if_index[hw->sw_if_index] : ~0;
+
+  if (PREDICT_FALSE (port_index == ~0))
+    {
+      /* hqos was turned off while the frame was in flight */
+      vlib_frame_t * f = vlib_get_frame_to_node (vm, hw->output_node_index);
+      clib_memcpy (vlib_frame_vector_args (f), from, n_left_from * sizeof (u32));
+      f->n_vectors = n_left_from;
+      vlib_put_frame_to_node (vm, hw->output_node_index, f);
+      return frame->n_vectors;
+    }
+
+  p = pool_elt_at_index (hm->ports, port_index);
+  ASSERT (p->queue_size);
+
+  r = vec_elt_at_index (p->rings, cpu_index);
+  tail = r->tail;
+
+  while (n_left_from > 0)
+    {
+      u32 bi0, sw_if_index0, tc0;
+      vlib_buffer_t * b0;
+
+      if (n_left_from > 1)
+        vlib_prefetch_buffer_with_index (vm, from[1], LOAD);
+
+      bi0 = from[0];
+      from += 1;
+      n_left_from -= 1;
+
+      b0 = vlib_get_buffer (vm, bi0);
+
+      /* HQOS is the last output feature */
+      ASSERT ((vnet_buffer(b0)->output_features.bitmap &
+               ~(1 << INTF_OUTPUT_FEAT_DONE)) == 0);
+
+      if (PREDICT_FALSE (tail - r->head >= HQOS_ENQUEUE_RING_SIZE))
+        {
+          r->n_drops++;
+          drops[n_drops++] = bi0;
+          continue;
+        }
+
+      sw_if_index0 = vnet_buffer(b0)->sw_if_index[VLIB_TX];
+      if (PREDICT_FALSE (sw_if_index0 != last_sw_if_index))
+        {
+          last_subscriber = hqos_subscriber_for_sw_if_index (hm, sw_if_index0);
+          last_sw_if_index = sw_if_index0;
+        }
+
+      tc0 = hqos_classify (p, b0);
+
+      r->buffers[tail & (HQOS_ENQUEUE_RING_SIZE - 1)] = bi0;
+      r->queue_ids[tail & (HQOS_ENQUEUE_RING_SIZE - 1)] =
+        last_subscriber * HQOS_N_TC + tc0;
+      tail++;
+
+      if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
+        {
+          hqos_output_trace_t * t = vlib_add_trace (vm, node, b0, sizeof (*t));
+          t->sw_if_index = sw_if_index0;
+          t->subscriber = last_subscriber;
+          t->tc = tc0;
+          t->ring_depth = tail - r->head;
+        }
+    }
+
+  /* Entries must be visible before the new tail */
+  CLIB_MEMORY_BARRIER ();
+  r->tail = tail;
+
+  vlib_node_increment_counter (vm, node->node_index, HQOS_ERROR_ENQUEUED,
+                               frame->n_vectors - n_drops);
+
+  if (PREDICT_FALSE (n_drops))
+    vlib_error_drop_buffers (vm, node, drops,
+                             /* buffer stride */ 1,
+                             n_drops,
+                             HQOS_OUTPUT_NEXT_DROP,
+                             node->node_index,
+                             HQOS_ERROR_RING_FULL);
+
+  return frame->n_vectors;
+}
+
+VLIB_REGISTER_NODE (hqos_output_node) = {
+  .function = hqos_output_node_fn,
+  .name = "hqos-output",
+  .vector_size = sizeof (u32),
+  .format_trace = format_hqos_output_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = ARRAY_LEN(hqos_error_strings),
+  .error_strings = hqos_error_strings,
+
+  .n_next_nodes = HQOS_OUTPUT_N_NEXT,
+  .next_nodes = {
+    [HQOS_OUTPUT_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (hqos_output_node, hqos_output_node_fn)
+
+/* Queue what the output feature enqueued, send what the shapers release */
+static uword
+hqos_scheduler_node_fn (vlib_main_t * vm,
+                        vlib_node_runtime_t * node,
+                        vlib_frame_t * frame)
+{
+  hqos_main_t * hm = &hqos_main;
+  u32 to_send[VLIB_FRAME_SIZE], n_send, n_sent = 0;
+  f64 now = vlib_time_now (vm);
+  hqos_port_t * p;
+
+  /* *INDENT-OFF* */
+  pool_foreach (p, hm->ports,
+  ({
+    hqos_port_drain_rings (p, &hm->drop_buffers);
+
+    while (p->n_queued)
+      {
+        n_send = hqos_port_dequeue (vm, p, now, to_send, VLIB_FRAME_SIZE);
+        hqos_port_send (vm, p, to_send, n_send);
+        n_sent += n_send;
+        if (n_send < VLIB_FRAME_SIZE)
+          break;
+      }
+  }));
+  /* *INDENT-ON* */
+
+  if (n_sent)
+    vlib_node_increment_counter (vm, hqos_output_node.index,
+                                 HQOS_ERROR_SENT, n_sent);
+
+  if (PREDICT_FALSE (vec_len (hm->drop_buffers)))
+    {
+      vlib_node_increment_counter (vm, hqos_output_node.index,
+                                   HQOS_ERROR_QUEUE_FULL,
+                                   vec_len (hm->drop_buffers));
+      vlib_buffer_free (vm, hm->drop_buffers, vec_len (hm->drop_buffers));
+      _vec_len (hm->drop_buffers) = 0;
+    }
+
+  return n_sent;
+}
+
+VLIB_REGISTER_NODE (hqos_scheduler_node) = {
+  .function = hqos_scheduler_node_fn,
+  .name = "hqos-scheduler",
+  .type = VLIB_NODE_TYPE_INPUT,
+  .state = VLIB_NODE_STATE_DISABLED,
+};
@@ -293,6 +293,9 @@ typedef struct vnet_hw_interface_t {
 #define VNET_HW_INTERFACE_FLAG_L2OUTPUT_SHIFT	9
 #define VNET_HW_INTERFACE_FLAG_L2OUTPUT_MAPPED	(1 << 9)
 
+  /* tx can't send buffer chains */
+#define VNET_HW_INTERFACE_FLAG_NO_MULTI_SEG	(1 << 10)
+
   /* Hardware address as vector.  Zero (e.g. zero-length vector) if no
      address for this class (e.g. PPP). */
   u8 * hw_address;
@@ -519,7 +522,8 @@ int vnet_interface_name_renumber (u32 sw_if_index, u32 new_show_dev_instance);
  */
 
 #define foreach_intf_output_feat \
- _(IPSEC, "ipsec-output")
+ _(IPSEC, "ipsec-output")            \
+ _(HQOS, "hqos-output")
 
 // Feature bitmap positions
 typedef enum {
@@ -38,6 +38,7 @@
  */
 
 #include <vnet/vnet.h>
+#include <vnet/unix/pcap_capture.h>
 
 typedef struct {
   u32 sw_if_index;
@@ -259,6 +260,9 @@ vnet_interface_output_node (vlib_main_t * vm,
                                    VNET_INTERFACE_OUTPUT_ERROR_INTERFACE_DOWN);
     }
 
+  if (PREDICT_FALSE (pcap_capture_main.flags & PCAP_CAPTURE_TX))
+    pcap_capture_buffers (vm, from, n_buffers, PCAP_CAPTURE_TX);
+
   from_end = from + n_buffers;
 
   /* Total byte count of all buffers. */
@@ -450,6 +454,9 @@ vnet_interface_output_node_no_flatten_inline  (vlib_main_t * vm,
                                       VNET_INTERFACE_OUTPUT_ERROR_INTERFACE_DOWN);
     }
 
+  if (PREDICT_FALSE (pcap_capture_main.flags & PCAP_CAPTURE_TX))
+    pcap_capture_buffers (vm, from, n_buffers, PCAP_CAPTURE_TX);
+
   from_end = from + n_buffers;
 
   /* Total byte count of all buffers. */
@@ -1144,6 +1151,10 @@ process_drop (vlib_main_t * vm,
   if (PREDICT_FALSE (im->drop_pcap_enable))
     pcap_drop_trace (vm, im, frame);
 
+  if (PREDICT_FALSE (pcap_capture_main.flags & PCAP_CAPTURE_DROP))
+    pcap_capture_buffers (vm, vlib_frame_args (frame), frame->n_vectors,
+			  PCAP_CAPTURE_DROP);
+
   return process_drop_punt (vm, node, frame, VNET_ERROR_DISPOSITION_DROP);
 }
 
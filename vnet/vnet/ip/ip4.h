@@ -134,6 +134,7 @@ typedef struct ip4_main_t {
   vnet_ip_feature_registration_t * next_mc_feature;
 
   /* Built-in unicast feature path indices, see ip_feature_init_cast(...)  */
+  u32 ip4_unicast_rx_feature_reassembly;
   u32 ip4_unicast_rx_feature_check_access;
   u32 ip4_unicast_rx_feature_source_reachable_via_rx;
   u32 ip4_unicast_rx_feature_source_reachable_via_any;
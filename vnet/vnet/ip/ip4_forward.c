@@ -1362,6 +1362,12 @@ ip4_sw_interface_admin_up_down (vnet_main_t * vnm,
 VNET_SW_INTERFACE_ADMIN_UP_DOWN_FUNCTION (ip4_sw_interface_admin_up_down);
 
 /* Built-in ip4 unicast rx feature path definition */
+VNET_IP4_UNICAST_FEATURE_INIT (ip4_reass, static) = {
+  .node_name = "ip4-reassembly-feature",
+  .runs_before = {"ip4-inacl", 0},
+  .feature_index = &ip4_main.ip4_unicast_rx_feature_reassembly,
+};
+
 VNET_IP4_UNICAST_FEATURE_INIT (ip4_inacl, static) = {
   .node_name = "ip4-inacl", 
   .runs_before = {"ip4-source-check-via-rx", 0}, 
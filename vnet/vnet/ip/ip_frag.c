@@ -44,11 +44,156 @@ static u8 * format_ip_frag_trace (u8 * s, va_list * args)
 
 static u32 running_fragment_id;
 
+/*
+ * Payload read position in the packet being fragmented.
+ * Bytes held by the first buffer are copied, except for the first fragment
+ * which keeps them in place. Chained buffers are moved to the fragments as
+ * they are, only the smaller side of a buffer split by a fragment boundary
+ * is copied.
+ */
+typedef struct {
+  u32 bi;       //Buffer holding the next payload byte
+  u32 next_bi;  //Buffer chained behind it, ~0 if none
+  u16 offset;   //Next payload byte, from the buffer current data
+  u16 end;      //End of payload, from the buffer current data
+  u8 in_head;   //Buffer is the first one, its bytes are copied
+} ip_frag_cursor_t;
+
+static void
+ip_frag_cursor_init(ip_frag_cursor_t *c, u32 pi, vlib_buffer_t *p, u16 headers_len)
+{
+  c->bi = pi;
+  c->next_bi = (p->flags & VLIB_BUFFER_NEXT_PRESENT) ? p->next_buffer : ~0;
+  c->offset = headers_len;
+  c->end = p->current_length;
+  c->in_head = 1;
+
+  //The first buffer now only holds the headers of the first fragment
+  p->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+  p->current_length = headers_len;
+}
+
+//Frees the payload that was not given to a fragment
+static void
+ip_frag_cursor_free(vlib_main_t *vm, ip_frag_cursor_t *c)
+{
+  u32 bi = c->in_head ? c->next_bi : c->bi;
+
+  if (bi != ~0) {
+    vlib_buffer_chain_validate(vm, vlib_get_buffer(vm, bi));
+    vlib_buffer_free(vm, &bi, 1);
+  }
+}
+
+//Appends len payload bytes to the fragment starting with the headers in b
+static int
+ip_frag_add_payload(vlib_main_t *vm, ip_frag_cursor_t *c, u32 bi, vlib_buffer_t *b, u16 len)
+{
+  vlib_buffer_t *last = b, *s, *t;
+  u32 si, ti;
+  u16 n, off;
+
+  while (len) {
+    if (c->offset == c->end) {
+      if (c->next_bi == ~0)
+        return -1;
+      c->bi = c->next_bi;
+      s = vlib_get_buffer(vm, c->bi);
+      c->next_bi = (s->flags & VLIB_BUFFER_NEXT_PRESENT) ? s->next_buffer : ~0;
+      c->offset = 0;
+      c->end = s->current_length;
+      c->in_head = 0;
+      continue;
+    }
+
+    si = c->bi;
+    s = vlib_get_buffer(vm, si);
+    off = c->offset;
+    n = c->end - off;
+
+    if (c->in_head || (n > len && len <= n - len)) {
+      //Copy, or extend the first fragment in place
+      n = clib_min(n, len);
+      if (si == bi)
+        last->current_length += n;
+      else if (vlib_buffer_chain_append_data_with_alloc(vm, VLIB_BUFFER_DEFAULT_FREE_LIST_INDEX, b, &last,
+                                                        vlib_buffer_get_current(s) + off, n) != n)
+        return -1;
+      c->offset += n;
+      len -= n;
+      continue;
+    }
+
+    if (n > len) {
+      //Move the tail to a new buffer, which the next fragment starts with
+      if (vlib_buffer_alloc_from_free_list(vm, &ti, 1, s->free_list_index) != 1)
+        return -1;
+      t = vlib_get_buffer(vm, ti);
+      clib_memcpy(vlib_buffer_get_current(t), vlib_buffer_get_current(s) + off + len, n - len);
+      t->current_length = n - len;
+      t->flags &= ~VLIB_BUFFER_NEXT_PRESENT;
+      if (c->next_bi != ~0) {
+        t->next_buffer = c->next_bi;
+        t->flags |= VLIB_BUFFER_NEXT_PRESENT;
+      }
+      c->bi = ti;
+      c->offset = 0;
+      c->end = n - len;
+      n = len;
+    } else {
+      c->offset = c->end;
+    }
+
+    //Link the buffer as it is
+    vlib_buffer_advance(s, off);
+    s->current_length = n;
+    s->flags &= ~(VLIB_BUFFER_NEXT_PRESENT | VLIB_BUFFER_TOTAL_LENGTH_VALID);
+    last->next_buffer = si;
+    last->flags |= VLIB_BUFFER_NEXT_PRESENT;
+    last = s;
+    len -= n;
+  }
+  return 0;
+}
+
+//Fragments are cut out of the packet's own buffers. A packet sharing
+//some of them with clones is given a private copy to cut instead.
+static int
+ip_frag_unshare(vlib_main_t *vm, u32 *pi)
+{
+  vlib_buffer_t *b = vlib_get_buffer(vm, *pi);
+  u32 ci;
+
+  while (!vlib_buffer_is_shared(b)) {
+    if (!(b->flags & VLIB_BUFFER_NEXT_PRESENT))
+      return 0;
+    b = vlib_get_buffer(vm, b->next_buffer);
+  }
+
+  ci = vlib_buffer_copy(vm, vlib_get_buffer(vm, *pi));
+  if (ci == ~0)
+    return -1;
+  vlib_buffer_free_one(vm, *pi);
+  *pi = ci;
+  return 0;
+}
+
+//Fixes the fragment chain length, and the rte_mbuf chain with DPDK
+static void
+ip_frag_chain_done(vlib_main_t *vm, vlib_buffer_t *b)
+{
+  b->flags &= ~VLIB_BUFFER_TOTAL_LENGTH_VALID;
+  b->total_length_not_including_first_buffer = 0;
+  vlib_buffer_length_in_chain(vm, b);
+  vlib_buffer_chain_validate(vm, b);
+}
+
 static void
 ip4_frag_do_fragment(vlib_main_t *vm, u32 pi, u32 **buffer, ip_frag_error_t *error)
 {
   vlib_buffer_t *p;
   ip4_header_t *ip4;
+  ip_frag_cursor_t c;
   u16 mtu, ptr, len, max, rem,
     offset, ip_frag_id, ip_frag_offset;
   u8 *packet, more;
@@ -60,11 +205,16 @@ ip4_frag_do_fragment(vlib_main_t *vm, u32 pi, u32 **buffer, ip_frag_error_t *err
   packet = (u8 *)vlib_buffer_get_current(p);
   ip4 = (ip4_header_t *)(packet + offset);
 
+  if (p->current_length < offset + sizeof(*ip4)) {
+    *error = IP_FRAG_ERROR_MALFORMED;
+    return;
+  }
+
   rem = clib_net_to_host_u16(ip4->length) - sizeof(*ip4);
   ptr = 0;
   max = (mtu - sizeof(*ip4) - vnet_buffer(p)->ip_frag.header_offset) & ~0x7;
 
-  if (rem < (p->current_length - offset - sizeof(*ip4))) {
+  if (rem != (vlib_buffer_length_in_chain(vm, p) - offset - sizeof(*ip4))) {
     *error = IP_FRAG_ERROR_MALFORMED;
     return;
   }
@@ -90,6 +240,8 @@ ip4_frag_do_fragment(vlib_main_t *vm, u32 pi, u32 **buffer, ip_frag_error_t *err
     more = 0;
   }
 
+  ip_frag_cursor_init(&c, pi, p, offset + sizeof(*ip4));
+
   //Do the actual fragmentation
   while (rem) {
     u32 bi;
@@ -105,6 +257,7 @@ ip4_frag_do_fragment(vlib_main_t *vm, u32 pi, u32 **buffer, ip_frag_error_t *err
     } else {
       if (!vlib_buffer_alloc(vm, &bi, 1)) {
         *error = IP_FRAG_ERROR_MEMORY;
+        ip_frag_cursor_free(vm, &c);
         return;
       }
       vec_add1(*buffer, bi);
@@ -115,11 +268,17 @@ ip4_frag_do_fragment(vlib_main_t *vm, u32 pi, u32 **buffer, ip_frag_error_t *err
 
       //Copy offset and ip4 header
       clib_memcpy(b->data, packet, offset + sizeof(*ip4));
-      //Copy data
-      clib_memcpy(((u8*)(fip4)) + sizeof(*fip4),
-             packet + offset + sizeof(*fip4) + ptr, len);
+      b->current_length = offset + sizeof(*ip4);
+    }
+
+    //Copy or link data
+    if (ip_frag_add_payload(vm, &c, bi, b, len)) {
+      *error = IP_FRAG_ERROR_MEMORY;
+      ip_frag_chain_done(vm, b);
+      ip_frag_cursor_free(vm, &c);
+      return;
     }
-    b->current_length = offset + len + sizeof(*fip4);
+    ip_frag_chain_done(vm, b);
 
     fip4->fragment_id = ip_frag_id;
     fip4->flags_and_fragment_offset = clib_host_to_net_u16((ptr >> 3) + ip_frag_offset);
@@ -132,12 +291,12 @@ ip4_frag_do_fragment(vlib_main_t *vm, u32 pi, u32 **buffer, ip_frag_error_t *err
     if(vnet_buffer(p)->ip_frag.flags & IP_FRAG_FLAG_IP4_HEADER) {
       //Encapsulating ipv4 header
       ip4_header_t *encap_header4 = (ip4_header_t *)vlib_buffer_get_current(b);
-      encap_header4->length = clib_host_to_net_u16(b->current_length);
+      encap_header4->length = clib_host_to_net_u16(offset + sizeof(*fip4) + len);
       encap_header4->checksum = ip4_header_checksum(encap_header4);
     } else if (vnet_buffer(p)->ip_frag.flags & IP_FRAG_FLAG_IP6_HEADER) {
       //Encapsulating ipv6 header
       ip6_header_t *encap_header6 = (ip6_header_t *)vlib_buffer_get_current(b);
-      encap_header6->payload_length = clib_host_to_net_u16(b->current_length - sizeof(*encap_header6));
+      encap_header6->payload_length = clib_host_to_net_u16(offset + sizeof(*fip4) + len - sizeof(*encap_header6));
     }
 
     rem -= len;
@@ -184,8 +343,12 @@ ip4_frag (vlib_main_t *vm,
       n_left_from -= 1;
       error0 = IP_FRAG_ERROR_NONE;
 
+      if (PREDICT_FALSE(ip_frag_unshare(vm, &pi0))) {
+        error0 = IP_FRAG_ERROR_MEMORY;
+        vec_add1(buffer, pi0);
+      } else
+        ip4_frag_do_fragment(vm, pi0, &buffer, &error0);
       p0 = vlib_get_buffer(vm, pi0);
-      ip4_frag_do_fragment(vm, pi0, &buffer, &error0);
 
       if (PREDICT_FALSE(p0->flags & VLIB_BUFFER_IS_TRACED)) {
         ip_frag_trace_t *tr = vlib_add_trace(vm, node, p0, sizeof (*tr));
@@ -251,6 +414,7 @@ ip6_frag_do_fragment(vlib_main_t *vm, u32 pi, u32 **buffer, ip_frag_error_t *err
   vlib_buffer_t *p;
   ip6_header_t *ip6_hdr;
   ip6_frag_hdr_t *frag_hdr;
+  ip_frag_cursor_t c;
   u8 *payload, *next_header;
 
   p = vlib_get_buffer(vm, pi);
@@ -306,7 +470,7 @@ ip6_frag_do_fragment(vlib_main_t *vm, u32 pi, u32 **buffer, ip_frag_error_t *err
 
   u16 headers_len = payload - (u8 *)vlib_buffer_get_current(p);
   u16 max_payload = vnet_buffer(p)->ip_frag.mtu - headers_len;
-  u16 rem = p->current_length - headers_len;
+  u16 rem = vlib_buffer_length_in_chain(vm, p) - headers_len;
   u16 ptr = 0;
 
   if(max_payload < 8) {
@@ -314,6 +478,8 @@ ip6_frag_do_fragment(vlib_main_t *vm, u32 pi, u32 **buffer, ip_frag_error_t *err
     return;
   }
 
+  ip_frag_cursor_init(&c, pi, p, headers_len);
+
   while (rem) {
     u32 bi;
     vlib_buffer_t *b;
@@ -323,13 +489,14 @@ ip6_frag_do_fragment(vlib_main_t *vm, u32 pi, u32 **buffer, ip_frag_error_t *err
     if (ptr != 0) {
       if (!vlib_buffer_alloc(vm, &bi, 1)) {
         *error = IP_FRAG_ERROR_MEMORY;
+        ip_frag_cursor_free(vm, &c);
         return;
       }
       b = vlib_get_buffer(vm, bi);
       vnet_buffer(b)->sw_if_index[VLIB_RX] = vnet_buffer(p)->sw_if_index[VLIB_RX];
       vnet_buffer(b)->sw_if_index[VLIB_TX] = vnet_buffer(p)->sw_if_index[VLIB_TX];
       clib_memcpy(vlib_buffer_get_current(b), vlib_buffer_get_current(p), headers_len);
-      clib_memcpy(vlib_buffer_get_current(b) + headers_len, payload + ptr, len);
+      b->current_length = headers_len;
       frag_hdr = vlib_buffer_get_current(b) + headers_len - sizeof(*frag_hdr);
     } else {
       bi = pi;
@@ -337,24 +504,32 @@ ip6_frag_do_fragment(vlib_main_t *vm, u32 pi, u32 **buffer, ip_frag_error_t *err
       //frag_hdr already set here
     }
 
+    vec_add1(*buffer, bi);
+
+    //Copy or link data
+    if (ip_frag_add_payload(vm, &c, bi, b, len)) {
+      *error = IP_FRAG_ERROR_MEMORY;
+      ip_frag_chain_done(vm, b);
+      ip_frag_cursor_free(vm, &c);
+      return;
+    }
+    ip_frag_chain_done(vm, b);
+
     ip6_hdr = vlib_buffer_get_current(b) +  vnet_buffer(p)->ip_frag.header_offset;
     frag_hdr->fragment_offset_and_more = ip6_frag_hdr_offset_and_more(initial_offset + (ptr >> 3), (rem || has_more));
-    b->current_length = headers_len + len;
-    ip6_hdr->payload_length = clib_host_to_net_u16(b->current_length - vnet_buffer(p)->ip_frag.header_offset - sizeof(*ip6_hdr));
+    ip6_hdr->payload_length = clib_host_to_net_u16(headers_len + len - vnet_buffer(p)->ip_frag.header_offset - sizeof(*ip6_hdr));
 
     if(vnet_buffer(p)->ip_frag.flags & IP_FRAG_FLAG_IP4_HEADER) {
       //Encapsulating ipv4 header
       ip4_header_t *encap_header4 = (ip4_header_t *)vlib_buffer_get_current(b);
-      encap_header4->length = clib_host_to_net_u16(b->current_length);
+      encap_header4->length = clib_host_to_net_u16(headers_len + len);
       encap_header4->checksum = ip4_header_checksum(encap_header4);
     } else if (vnet_buffer(p)->ip_frag.flags & IP_FRAG_FLAG_IP6_HEADER) {
       //Encapsulating ipv6 header
       ip6_header_t *encap_header6 = (ip6_header_t *)vlib_buffer_get_current(b);
-      encap_header6->payload_length = clib_host_to_net_u16(b->current_length - sizeof(*encap_header6));
+      encap_header6->payload_length = clib_host_to_net_u16(headers_len + len - sizeof(*encap_header6));
     }
 
-    vec_add1(*buffer, bi);
-
     ptr += len;
   }
 }
@@ -386,8 +561,12 @@ ip6_frag (vlib_main_t * vm,
       n_left_from -= 1;
       error0 = IP_FRAG_ERROR_NONE;
 
+      if (PREDICT_FALSE(ip_frag_unshare(vm, &pi0))) {
+        error0 = IP_FRAG_ERROR_MEMORY;
+        vec_add1(buffer, pi0);
+      } else
+        ip6_frag_do_fragment(vm, pi0, &buffer, &error0);
       p0 = vlib_get_buffer(vm, pi0);
-      ip6_frag_do_fragment(vm, pi0, &buffer, &error0);
 
       if (PREDICT_FALSE(p0->flags & VLIB_BUFFER_IS_TRACED)) {
         ip_frag_trace_t *tr = vlib_add_trace(vm, node, p0, sizeof (*tr));
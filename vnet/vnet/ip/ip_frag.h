@@ -30,6 +30,11 @@
  *     One of ip_frag_next_t, indicating to which exit node the fragments
  *     should be sent to.
  *
+ * Chained packets are fragmented without copying their chained buffers:
+ * fragments are made of a header buffer followed by the original buffers,
+ * and only the bytes of a buffer crossing a fragment boundary may be copied.
+ * The payload held by the first buffer is still copied, so unchained packets
+ * give unchained fragments.
  */
 
 #ifndef IP_FRAG_H
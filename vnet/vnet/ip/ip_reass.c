@@ -0,0 +1,1034 @@
+/*---------------------------------------------------------------------------
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *---------------------------------------------------------------------------
+ */
+/*
+ * IPv4 and IPv6 Reassembly Nodes
+ */
+
+#include <vnet/ip/ip.h>
+#include <vnet/handoff.h>
+#include <vnet/ip/ip_reass.h>
+
+/* bihash_48_8 instance; the bihash_24_8 one lives in ip6_forward.c */
+#include <vppinfra/bihash_template.c>
+
+ip_reass_main_t ip_reass_main;
+
+typedef struct {
+  u32 reass_index;
+  u32 thread_index;
+  u16 range_first;
+  u16 range_last;
+  u8 is_ip6;
+  u8 handoff;
+} ip_reass_trace_t;
+
+static u8 * format_ip_reass_trace (u8 * s, va_list * args)
+{
+  CLIB_UNUSED (vlib_main_t * vm) = va_arg (*args, vlib_main_t *);
+  CLIB_UNUSED (vlib_node_t * node) = va_arg (*args, vlib_node_t *);
+  ip_reass_trace_t * t = va_arg (*args, ip_reass_trace_t *);
+
+  s = format (s, "IPv%s fragment [%u, %u) ", t->is_ip6 ? "6" : "4",
+              t->range_first, t->range_last);
+  if (t->handoff)
+    s = format (s, "handoff to thread %u", t->thread_index);
+  else if (t->reass_index != ~0)
+    s = format (s, "reassembly %u thread %u", t->reass_index,
+                t->thread_index);
+  else
+    s = format (s, "dropped");
+  return s;
+}
+
+static char * ip_reass_error_strings[] = {
+#define _(sym,string) string,
+  foreach_ip_reass_error
+#undef _
+};
+
+always_inline void
+ip_reass_add_trace (vlib_main_t * vm, vlib_node_runtime_t * node,
+                    vlib_buffer_t * b, int is_ip6, u32 first, u32 last,
+                    u32 thread_index, u32 reass_index, int handoff)
+{
+  ip_reass_trace_t * tr = vlib_add_trace (vm, node, b, sizeof (*tr));
+
+  tr->is_ip6 = is_ip6;
+  tr->range_first = first;
+  tr->range_last = last;
+  tr->thread_index = thread_index;
+  tr->reass_index = reass_index;
+  tr->handoff = handoff;
+}
+
+void
+ip_reass_set_vnet_buffer (vlib_buffer_t * b, u8 next_index)
+{
+  vnet_buffer (b)->ip_reass.next_index = next_index;
+}
+
+always_inline int
+ip6_reass_is_fragment (vlib_buffer_t * b, ip6_header_t * ip)
+{
+  ip6_frag_hdr_t * frag = (ip6_frag_hdr_t *) (ip + 1);
+
+  if (ip->protocol != IP_PROTOCOL_IPV6_FRAGMENTATION)
+    return 0;
+
+  /* too short, ip6_reass_parse will drop it */
+  if (b->current_length < sizeof (*ip) + sizeof (*frag))
+    return 1;
+
+  /* atomic fragments (RFC 6946) are passed on as they are */
+  return (frag->fragment_offset_and_more
+          & clib_host_to_net_u16 (0xfff9)) != 0;
+}
+
+/* Trims link padding; the payload must be exactly the ip length */
+always_inline int
+ip_reass_check_length (vlib_main_t * vm, vlib_buffer_t * b, u32 ip_len)
+{
+  u32 len = vlib_buffer_length_in_chain (vm, b);
+
+  if (PREDICT_TRUE (len == ip_len))
+    return 1;
+  if (len < ip_len || (b->flags & VLIB_BUFFER_NEXT_PRESENT))
+    return 0;
+  b->current_length = ip_len;
+  return 1;
+}
+
+always_inline ip_reass_error_t
+ip4_reass_parse (vlib_main_t * vm, vlib_buffer_t * b,
+                 clib_bihash_kv_24_8_t * kv, u32 * first, u32 * last,
+                 int * more)
+{
+  ip4_header_t * ip = vlib_buffer_get_current (b);
+  u32 hdr_len = ip4_header_bytes (ip);
+  u32 ip_len = clib_net_to_host_u16 (ip->length);
+  u32 fib_index;
+
+  *first = ip4_get_fragment_offset_bytes (ip);
+  *more = ip4_get_fragment_more (ip) != 0;
+
+  if (ip_len <= hdr_len || (*more && ((ip_len - hdr_len) & 7))
+      || *first + ip_len > 0xffff
+      || ! ip_reass_check_length (vm, b, ip_len))
+    return IP_REASS_ERROR_MALFORMED;
+
+  *last = *first + ip_len - hdr_len;
+  vnet_buffer (b)->ip_reass.data_offset = hdr_len;
+
+  fib_index = vec_elt (ip4_main.fib_index_by_sw_if_index,
+                       vnet_buffer (b)->sw_if_index[VLIB_RX]);
+  kv->key[0] = ((u64) ip->src_address.as_u32 << 32)
+    | ip->dst_address.as_u32;
+  kv->key[1] = ((u64) fib_index << 32)
+    | ((u64) ip->fragment_id << 8) | ip->protocol;
+  kv->key[2] = 0;
+  return IP_REASS_ERROR_NONE;
+}
+
+always_inline ip_reass_error_t
+ip6_reass_parse (vlib_main_t * vm, vlib_buffer_t * b,
+                 clib_bihash_kv_48_8_t * kv, u32 * first, u32 * last,
+                 int * more)
+{
+  ip6_header_t * ip = vlib_buffer_get_current (b);
+  ip6_frag_hdr_t * frag = (ip6_frag_hdr_t *) (ip + 1);
+  u32 hdr_len = sizeof (*ip) + sizeof (*frag);
+  u32 ip_len = clib_net_to_host_u16 (ip->payload_length) + sizeof (*ip);
+  u32 fib_index;
+
+  if (b->current_length < hdr_len)
+    return IP_REASS_ERROR_MALFORMED;
+
+  *first = ip6_frag_hdr_offset (frag) << 3;
+  *more = ip6_frag_hdr_more (frag);
+
+  if (ip_len <= hdr_len || (*more && ((ip_len - hdr_len) & 7))
+      || *first + ip_len - hdr_len > 0xffff
+      || ! ip_reass_check_length (vm, b, ip_len))
+    return IP_REASS_ERROR_MALFORMED;
+
+  *last = *first + ip_len - hdr_len;
+  vnet_buffer (b)->ip_reass.data_offset = hdr_len;
+
+  fib_index = vec_elt (ip6_main.fib_index_by_sw_if_index,
+                       vnet_buffer (b)->sw_if_index[VLIB_RX]);
+  kv->key[0] = ip->src_address.as_u64[0];
+  kv->key[1] = ip->src_address.as_u64[1];
+  kv->key[2] = ip->dst_address.as_u64[0];
+  kv->key[3] = ip->dst_address.as_u64[1];
+  kv->key[4] = ((u64) fib_index << 32) | frag->identification;
+  kv->key[5] = 0;
+  return IP_REASS_ERROR_NONE;
+}
+
+/* Frees every fragment held by the reassembly, returns how many */
+static u32
+ip_reass_drop_fragments (vlib_main_t * vm, ip_reass_t * r)
+{
+  u32 bi = r->first_bi, next, n = 0;
+
+  while (bi != ~0)
+    {
+      next = vnet_buffer (vlib_get_buffer (vm, bi))->ip_reass.next_range_bi;
+      vlib_buffer_free_one (vm, bi);
+      bi = next;
+      n++;
+    }
+  r->first_bi = ~0;
+  return n;
+}
+
+static void
+ip_reass_free (ip_reass_per_thread_t * rt, ip_reass_t * r)
+{
+  if (r->is_ip6)
+    {
+      clib_bihash_kv_48_8_t kv;
+      clib_memcpy (kv.key, r->key, sizeof (kv.key));
+      clib_bihash_add_del_48_8 (&rt->ip6_hash, &kv, 0 /* is_add */);
+    }
+  else
+    {
+      clib_bihash_kv_24_8_t kv;
+      clib_memcpy (kv.key, r->key, sizeof (kv.key));
+      clib_bihash_add_del_24_8 (&rt->ip4_hash, &kv, 0 /* is_add */);
+    }
+
+  rt->n_reass[r->is_ip6]--;
+  pool_put (rt->pool, r);
+}
+
+/*
+ * Drops the reassemblies whose timer fired. Wheel entries are never
+ * deleted, so an entry may belong to an earlier user of the pool index;
+ * those are told apart by the expire time.
+ */
+static void
+ip_reass_expire (vlib_main_t * vm, ip_reass_per_thread_t * rt, u64 now)
+{
+  u64 next_expire, slack = 1ULL << rt->wheel.log2_clocks_per_bin;
+  u32 * e, n_dropped[2] = { 0, 0 };
+  ip_reass_t * r;
+
+  rt->expired = timing_wheel_advance (&rt->wheel, now, rt->expired,
+                                      &next_expire);
+  rt->last_expire_time = now;
+
+  vec_foreach (e, rt->expired)
+    {
+      if (pool_is_free_index (rt->pool, e[0]))
+        continue;
+      r = pool_elt_at_index (rt->pool, e[0]);
+      if (r->expire_time > now + slack)
+        continue;
+      n_dropped[r->is_ip6] += ip_reass_drop_fragments (vm, r);
+      ip_reass_free (rt, r);
+    }
+  _vec_len (rt->expired) = 0;
+
+  if (n_dropped[0])
+    vlib_node_increment_counter (vm, ip4_reass_node.index,
+                                 IP_REASS_ERROR_TIMEOUT, n_dropped[0]);
+  if (n_dropped[1])
+    vlib_node_increment_counter (vm, ip6_reass_node.index,
+                                 IP_REASS_ERROR_TIMEOUT, n_dropped[1]);
+}
+
+/*
+ * Links the fragment into the offset ordered list. Exact duplicates
+ * are refused alone; any other overlap (RFC 5722) or inconsistency
+ * fails the whole reassembly.
+ */
+static ip_reass_error_t
+ip_reass_insert (vlib_main_t * vm, ip_reass_main_t * rm, ip_reass_t * r,
+                 u32 bi0, u32 first0, u32 last0, int more0)
+{
+  u32 * prevp = &r->first_bi, prev_last = 0, bi;
+  vlib_buffer_t * b;
+
+  if (r->last_octet != ~0
+      && (last0 > r->last_octet || (! more0 && last0 != r->last_octet)))
+    return IP_REASS_ERROR_MALFORMED;
+
+  while ((bi = *prevp) != ~0)
+    {
+      b = vlib_get_buffer (vm, bi);
+      if (vnet_buffer (b)->ip_reass.range_first >= first0)
+        {
+          if (vnet_buffer (b)->ip_reass.range_first == first0
+              && vnet_buffer (b)->ip_reass.range_last == last0)
+            return IP_REASS_ERROR_DUPLICATE;
+          if (vnet_buffer (b)->ip_reass.range_first < last0)
+            return IP_REASS_ERROR_OVERLAP;
+          break;
+        }
+      prev_last = vnet_buffer (b)->ip_reass.range_last;
+      prevp = &vnet_buffer (b)->ip_reass.next_range_bi;
+    }
+
+  if (prev_last > first0)
+    return IP_REASS_ERROR_OVERLAP;
+
+  if (r->n_fragments >= rm->max_fragments)
+    return IP_REASS_ERROR_TOO_MANY_FRAGMENTS;
+
+  b = vlib_get_buffer (vm, bi0);
+  vnet_buffer (b)->ip_reass.range_first = first0;
+  vnet_buffer (b)->ip_reass.range_last = last0;
+  vnet_buffer (b)->ip_reass.next_range_bi = bi;
+  *prevp = bi0;
+
+  r->data_len += last0 - first0;
+  r->n_fragments++;
+  if (! more0)
+    r->last_octet = last0;
+
+  return IP_REASS_ERROR_NONE;
+}
+
+/*
+ * Chains the fragments behind the first one and rewrites its header.
+ * Returns the buffer index of the reassembled packet.
+ */
+static u32
+ip_reass_finalize (vlib_main_t * vm, ip_reass_t * r)
+{
+  vlib_buffer_t * first, * tail = 0, * b;
+  u32 bi, next;
+
+  first = vlib_get_buffer (vm, r->first_bi);
+
+  for (bi = r->first_bi; bi != ~0; bi = next)
+    {
+      b = vlib_get_buffer (vm, bi);
+      next = vnet_buffer (b)->ip_reass.next_range_bi;
+
+      if (b != first)
+        {
+          vlib_buffer_advance (b, vnet_buffer (b)->ip_reass.data_offset);
+          tail->next_buffer = bi;
+          tail->flags |= VLIB_BUFFER_NEXT_PRESENT;
+        }
+
+      for (tail = b; tail->flags & VLIB_BUFFER_NEXT_PRESENT; )
+        tail = vlib_get_buffer (vm, tail->next_buffer);
+    }
+
+  if (r->is_ip6)
+    {
+      ip6_header_t * ip = vlib_buffer_get_current (first);
+      ip6_frag_hdr_t * frag = (ip6_frag_hdr_t *) (ip + 1);
+
+      /* Drop the fragment header by sliding the fixed header over it */
+      ip->protocol = frag->next_hdr;
+      ip->payload_length = clib_host_to_net_u16 (r->last_octet);
+      memmove ((u8 *) ip + sizeof (*frag), ip, sizeof (*ip));
+      vlib_buffer_advance (first, sizeof (*frag));
+    }
+  else
+    {
+      ip4_header_t * ip = vlib_buffer_get_current (first);
+
+      ip->length = clib_host_to_net_u16 (ip4_header_bytes (ip)
+                                         + r->last_octet);
+      ip->flags_and_fragment_offset &=
+        clib_host_to_net_u16 (IP4_HEADER_FLAG_DONT_FRAGMENT);
+      ip->checksum = ip4_header_checksum (ip);
+    }
+
+  first->flags &= ~VLIB_BUFFER_TOTAL_LENGTH_VALID;
+  vlib_buffer_length_in_chain (vm, first);
+  vlib_buffer_chain_validate (vm, first);
+
+  return r->first_bi;
+}
+
+/* Returns 0, without waiting, when the owner's frame queue is full */
+always_inline int
+ip_reass_handoff (ip_reass_per_thread_t * rt, u32 thread_index, u32 bi)
+{
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  vlib_frame_queue_elt_t * hf;
+
+  if (rt->handoff_elts[thread_index] == 0
+      && is_vlib_handoff_queue_congested (thread_index,
+                                          tm->efd.queue_hi_thresh,
+                                          rt->handoff_congested))
+    return 0;
+
+  hf = dpdk_get_handoff_queue_elt (thread_index, rt->handoff_elts);
+  hf->buffer_index[hf->n_vectors++] = bi;
+
+  if (hf->n_vectors == VLIB_FRAME_SIZE)
+    {
+      vlib_put_handoff_queue_elt (hf);
+      rt->handoff_elts[thread_index] = 0;
+    }
+  return 1;
+}
+
+always_inline u32
+ip_reass_next (ip_config_main_t * cm, vlib_buffer_t * b, int is_feature)
+{
+  u32 next;
+
+  if (! is_feature)
+    return vnet_buffer (b)->ip_reass.next_index;
+
+  vnet_get_config_data (&cm->config_main, &b->current_config_index,
+                        &next, /* # bytes of config data */ 0);
+  return next;
+}
+
+always_inline uword
+ip_reass_inline (vlib_main_t * vm, vlib_node_runtime_t * node,
+                 vlib_frame_t * frame, int is_ip6, int is_feature)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+  u32 cpu_index = os_get_cpu_number ();
+  ip_reass_per_thread_t * rt = vec_elt_at_index (rm->per_thread, cpu_index);
+  ip_lookup_main_t * lm = is_ip6 ?
+    &ip6_main.lookup_main : &ip4_main.lookup_main;
+  ip_config_main_t * cm = &lm->rx_config_mains[VNET_UNICAST];
+  u32 n_left_from, * from, * to_next, n_left_to_next, next_index;
+  u32 n_reassembled = 0, n_handoff = 0, handoff_next, i;
+  u64 now = clib_cpu_time_now ();
+
+  if (is_ip6)
+    handoff_next = is_feature ? HANDOFF_DISPATCH_NEXT_IP6_REASS_FEATURE
+      : HANDOFF_DISPATCH_NEXT_IP6_REASS;
+  else
+    handoff_next = is_feature ? HANDOFF_DISPATCH_NEXT_IP4_REASS_FEATURE
+      : HANDOFF_DISPATCH_NEXT_IP4_REASS;
+
+  ip_reass_expire (vm, rt, now);
+
+  from = vlib_frame_vector_args (frame);
+  n_left_from = frame->n_vectors;
+  next_index = node->cached_next_index;
+
+  while (n_left_from > 0)
+    {
+      vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+
+      while (n_left_from > 0 && n_left_to_next > 0)
+        {
+          u32 bi0, in_bi0, next0, owner0, ri0 = ~0;
+          u32 first0 = 0, last0 = 0;
+          int more0, is_frag0;
+          vlib_buffer_t * b0;
+          ip_reass_t * r0;
+          ip_reass_error_t error0;
+          clib_bihash_kv_24_8_t kv4;
+          clib_bihash_kv_48_8_t kv6;
+          u64 hash0;
+
+          if (n_left_from > 1)
+            {
+              vlib_buffer_t * p1 = vlib_get_buffer (vm, from[1]);
+              vlib_prefetch_buffer_header (p1, LOAD);
+              CLIB_PREFETCH (p1->data, CLIB_CACHE_LINE_BYTES, LOAD);
+            }
+
+          bi0 = in_bi0 = from[0];
+          from += 1;
+          n_left_from -= 1;
+          b0 = vlib_get_buffer (vm, bi0);
+          owner0 = cpu_index;
+
+          if (is_ip6)
+            is_frag0 = ip6_reass_is_fragment (b0,
+                                              vlib_buffer_get_current (b0));
+          else
+            is_frag0 = ip4_is_fragment (vlib_buffer_get_current (b0));
+
+          if (PREDICT_TRUE (! is_frag0))
+            {
+              error0 = IP_REASS_ERROR_NONE;
+              next0 = ip_reass_next (cm, b0, is_feature);
+              goto enqueue0;
+            }
+
+          if (is_ip6)
+            error0 = ip6_reass_parse (vm, b0, &kv6, &first0, &last0, &more0);
+          else
+            error0 = ip4_reass_parse (vm, b0, &kv4, &first0, &last0, &more0);
+
+          if (PREDICT_FALSE (error0 != IP_REASS_ERROR_NONE))
+            goto drop0;
+
+          hash0 = is_ip6 ? clib_bihash_hash_48_8 (&kv6)
+            : clib_bihash_hash_24_8 (&kv4);
+
+          if (rm->num_workers)
+            owner0 = rm->first_worker_index + (hash0 >> 16) % rm->num_workers;
+
+          if (PREDICT_FALSE (owner0 != cpu_index))
+            {
+              /* trace first, the owner may pick the buffer up at once */
+              if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
+                ip_reass_add_trace (vm, node, b0, is_ip6, first0, last0,
+                                    owner0, ~0, 1 /* handoff */);
+              vnet_buffer (b0)->handoff.next_index = handoff_next;
+              if (PREDICT_FALSE (! ip_reass_handoff (rt, owner0, bi0)))
+                {
+                  error0 = IP_REASS_ERROR_HANDOFF_CONGESTED;
+                  goto drop0;
+                }
+              n_handoff++;
+              continue;
+            }
+
+          if (is_ip6)
+            {
+              if (clib_bihash_search_inline_with_hash_48_8
+                  (&rt->ip6_hash, hash0, &kv6) == 0)
+                ri0 = kv6.value;
+            }
+          else
+            {
+              if (clib_bihash_search_inline_with_hash_24_8
+                  (&rt->ip4_hash, hash0, &kv4) == 0)
+                ri0 = kv4.value;
+            }
+
+          if (ri0 == ~0)
+            {
+              if (rt->n_reass[is_ip6] >= rm->max_reassemblies)
+                {
+                  error0 = IP_REASS_ERROR_LIMIT;
+                  goto drop0;
+                }
+
+              pool_get (rt->pool, r0);
+              ri0 = r0 - rt->pool;
+              r0->first_bi = ~0;
+              r0->data_len = 0;
+              r0->last_octet = ~0;
+              r0->n_fragments = 0;
+              r0->is_ip6 = is_ip6;
+              r0->expire_time = now + rm->timeout_clocks;
+              rt->n_reass[is_ip6]++;
+
+              if (is_ip6)
+                {
+                  clib_memcpy (r0->key, kv6.key, sizeof (kv6.key));
+                  kv6.value = ri0;
+                  clib_bihash_add_del_48_8 (&rt->ip6_hash, &kv6,
+                                            1 /* is_add */);
+                }
+              else
+                {
+                  memset (r0->key, 0, sizeof (r0->key));
+                  clib_memcpy (r0->key, kv4.key, sizeof (kv4.key));
+                  kv4.value = ri0;
+                  clib_bihash_add_del_24_8 (&rt->ip4_hash, &kv4,
+                                            1 /* is_add */);
+                }
+              timing_wheel_insert (&rt->wheel, r0->expire_time, ri0);
+            }
+
+          r0 = pool_elt_at_index (rt->pool, ri0);
+          error0 = ip_reass_insert (vm, rm, r0, bi0, first0, last0, more0);
+
+          if (PREDICT_FALSE (error0 != IP_REASS_ERROR_NONE))
+            {
+              if (error0 != IP_REASS_ERROR_DUPLICATE)
+                {
+                  vlib_node_increment_counter
+                    (vm, node->node_index, error0,
+                     ip_reass_drop_fragments (vm, r0));
+                  ip_reass_free (rt, r0);
+                }
+              ri0 = ~0;
+              goto drop0;
+            }
+
+          if (r0->last_octet != r0->data_len)
+            goto trace0;
+
+          /* All fragments are in, send the whole packet on */
+          bi0 = ip_reass_finalize (vm, r0);
+          ip_reass_free (rt, r0);
+          n_reassembled++;
+          b0 = vlib_get_buffer (vm, bi0);
+          next0 = ip_reass_next (cm, b0, is_feature);
+          goto enqueue0;
+
+        drop0:
+          next0 = IP_REASS_NEXT_DROP;
+
+        enqueue0:
+          b0->error = node->errors[error0];
+          to_next[0] = bi0;
+          to_next += 1;
+          n_left_to_next -= 1;
+          vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
+                                           to_next, n_left_to_next,
+                                           bi0, next0);
+          if (! is_frag0)
+            continue;
+
+        trace0:
+          b0 = vlib_get_buffer (vm, in_bi0);
+          if (PREDICT_FALSE (b0->flags & VLIB_BUFFER_IS_TRACED))
+            ip_reass_add_trace (vm, node, b0, is_ip6, first0, last0,
+                                owner0, ri0, 0 /* handoff */);
+        }
+
+      vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+    }
+
+  /* Ship the handed off fragments to their owners */
+  vec_foreach_index (i, rt->handoff_elts)
+    {
+      if (rt->handoff_elts[i])
+        {
+          vlib_put_handoff_queue_elt (rt->handoff_elts[i]);
+          rt->handoff_elts[i] = 0;
+        }
+      rt->handoff_congested[i] = (vlib_frame_queue_t *) (~0);
+    }
+
+  vlib_node_increment_counter (vm, node->node_index,
+                               IP_REASS_ERROR_REASSEMBLED, n_reassembled);
+  vlib_node_increment_counter (vm, node->node_index,
+                               IP_REASS_ERROR_HANDOFF, n_handoff);
+  return frame->n_vectors;
+}
+
+static uword
+ip4_reass (vlib_main_t * vm, vlib_node_runtime_t * node,
+           vlib_frame_t * frame)
+{
+  return ip_reass_inline (vm, node, frame, 0 /* is_ip6 */,
+                          0 /* is_feature */);
+}
+
+static uword
+ip4_reass_feature (vlib_main_t * vm, vlib_node_runtime_t * node,
+                   vlib_frame_t * frame)
+{
+  return ip_reass_inline (vm, node, frame, 0 /* is_ip6 */,
+                          1 /* is_feature */);
+}
+
+static uword
+ip6_reass (vlib_main_t * vm, vlib_node_runtime_t * node,
+           vlib_frame_t * frame)
+{
+  return ip_reass_inline (vm, node, frame, 1 /* is_ip6 */,
+                          0 /* is_feature */);
+}
+
+static uword
+ip6_reass_feature (vlib_main_t * vm, vlib_node_runtime_t * node,
+                   vlib_frame_t * frame)
+{
+  return ip_reass_inline (vm, node, frame, 1 /* is_ip6 */,
+                          1 /* is_feature */);
+}
+
+VLIB_REGISTER_NODE (ip4_reass_node) = {
+  .function = ip4_reass,
+  .name = IP4_REASS_NODE_NAME,
+  .vector_size = sizeof (u32),
+  .format_trace = format_ip_reass_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = IP_REASS_N_ERROR,
+  .error_strings = ip_reass_error_strings,
+
+  .n_next_nodes = IP_REASS_N_NEXT,
+  .next_nodes = {
+    [IP_REASS_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (ip4_reass_node, ip4_reass)
+
+VLIB_REGISTER_NODE (ip4_reass_feature_node) = {
+  .function = ip4_reass_feature,
+  .name = "ip4-reassembly-feature",
+  .vector_size = sizeof (u32),
+  .format_trace = format_ip_reass_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = IP_REASS_N_ERROR,
+  .error_strings = ip_reass_error_strings,
+
+  .n_next_nodes = IP_REASS_N_NEXT,
+  .next_nodes = {
+    [IP_REASS_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (ip4_reass_feature_node, ip4_reass_feature)
+
+VLIB_REGISTER_NODE (ip6_reass_node) = {
+  .function = ip6_reass,
+  .name = IP6_REASS_NODE_NAME,
+  .vector_size = sizeof (u32),
+  .format_trace = format_ip_reass_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = IP_REASS_N_ERROR,
+  .error_strings = ip_reass_error_strings,
+
+  .n_next_nodes = IP_REASS_N_NEXT,
+  .next_nodes = {
+    [IP_REASS_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (ip6_reass_node, ip6_reass)
+
+VLIB_REGISTER_NODE (ip6_reass_feature_node) = {
+  .function = ip6_reass_feature,
+  .name = "ip6-reassembly-feature",
+  .vector_size = sizeof (u32),
+  .format_trace = format_ip_reass_trace,
+  .type = VLIB_NODE_TYPE_INTERNAL,
+
+  .n_errors = IP_REASS_N_ERROR,
+  .error_strings = ip_reass_error_strings,
+
+  .n_next_nodes = IP_REASS_N_NEXT,
+  .next_nodes = {
+    [IP_REASS_NEXT_DROP] = "error-drop",
+  },
+};
+
+VLIB_NODE_FUNCTION_MULTIARCH (ip6_reass_feature_node, ip6_reass_feature)
+
+static vlib_node_registration_t ip_reass_expire_input_node;
+
+/*
+ * Threads only expire their reassemblies when fragments arrive. This
+ * process catches the threads which went quiet with reassemblies
+ * still pending. The main thread's are expired here; workers are asked
+ * to expire their own in ip-reassembly-expire-input, so forwarding
+ * never stops for it.
+ */
+static uword
+ip_reass_walk_expired (vlib_main_t * vm, vlib_node_runtime_t * node,
+                       vlib_frame_t * f)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+  ip_reass_per_thread_t * rt;
+  u64 now;
+  u32 i;
+
+  /* Workers are running by now; they poll for requests from here on */
+  if (vec_len (rm->per_thread) > 1)
+    {
+      vlib_worker_thread_barrier_sync (vm);
+      foreach_vlib_main (
+      ({
+        if (this_vlib_main->cpu_index)
+          vlib_node_set_state (this_vlib_main,
+                               ip_reass_expire_input_node.index,
+                               VLIB_NODE_STATE_POLLING);
+      }));
+      vlib_worker_thread_barrier_release (vm);
+    }
+
+  while (1)
+    {
+      vlib_process_suspend (vm, (f64) rm->timeout_ms * 1e-3);
+
+      now = clib_cpu_time_now ();
+      vec_foreach_index (i, rm->per_thread)
+        {
+          rt = vec_elt_at_index (rm->per_thread, i);
+          if (pool_elts (rt->pool) == 0
+              || now - rt->last_expire_time < rm->timeout_clocks)
+            continue;
+
+          if (i == 0)
+            {
+              ip_reass_expire (vm, rt, now);
+              continue;
+            }
+
+          rt->expire_requested = 1;
+        }
+    }
+  return 0;
+}
+
+VLIB_REGISTER_NODE (ip_reass_walk_expired_node, static) = {
+  .function = ip_reass_walk_expired,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "ip-reassembly-expire-walk",
+};
+
+/* Expire a quiet worker's reassemblies on the worker */
+static uword
+ip_reass_expire_input (vlib_main_t * vm, vlib_node_runtime_t * node,
+                       vlib_frame_t * f)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+  u32 cpu_index = os_get_cpu_number ();
+  ip_reass_per_thread_t * rt;
+
+  if (PREDICT_FALSE (cpu_index >= vec_len (rm->per_thread)))
+    return 0;
+
+  rt = vec_elt_at_index (rm->per_thread, cpu_index);
+  if (PREDICT_TRUE (!rt->expire_requested))
+    return 0;
+
+  ip_reass_expire (vm, rt, clib_cpu_time_now ());
+  rt->expire_requested = 0;
+  return 0;
+}
+
+VLIB_REGISTER_NODE (ip_reass_expire_input_node, static) = {
+  .function = ip_reass_expire_input,
+  .type = VLIB_NODE_TYPE_INPUT,
+  .name = "ip-reassembly-expire-input",
+  .state = VLIB_NODE_STATE_DISABLED,
+};
+
+int
+ip_reass_set_params (u32 timeout_ms, u32 max_reassemblies,
+                     u32 max_fragments)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+  vlib_main_t * vm = rm->vlib_main;
+
+  if (timeout_ms == 0 || timeout_ms > 10000 || max_reassemblies == 0
+      || max_fragments == 0 || max_fragments > 1024)
+    return VNET_API_ERROR_INVALID_VALUE;
+
+  rm->timeout_ms = timeout_ms;
+  rm->timeout_clocks = (u64) (timeout_ms * 1e-3
+                              * vm->clib_time.clocks_per_second);
+  rm->max_reassemblies = max_reassemblies;
+  rm->max_fragments = max_fragments;
+  return 0;
+}
+
+int
+ip_reass_enable_disable (u32 sw_if_index, u8 is_ip6, int is_enable)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+  vnet_main_t * vnm = rm->vnet_main;
+  ip_lookup_main_t * lm;
+  ip_config_main_t * rx_cm;
+  u32 feature_index, ci;
+
+  if (pool_is_free_index (vnm->interface_main.sw_interfaces, sw_if_index))
+    return VNET_API_ERROR_INVALID_SW_IF_INDEX;
+
+  if (is_ip6)
+    {
+      lm = &ip6_main.lookup_main;
+      feature_index = ip6_main.ip6_unicast_rx_feature_reassembly;
+    }
+  else
+    {
+      lm = &ip4_main.lookup_main;
+      feature_index = ip4_main.ip4_unicast_rx_feature_reassembly;
+    }
+
+  rx_cm = &lm->rx_config_mains[VNET_UNICAST];
+
+  ci = rx_cm->config_index_by_sw_if_index[sw_if_index];
+  ci = (is_enable
+        ? vnet_config_add_feature
+        : vnet_config_del_feature)
+    (rm->vlib_main, &rx_cm->config_main,
+     ci,
+     feature_index,
+     0 /* config struct */,
+     0 /* sizeof config struct*/);
+  rx_cm->config_index_by_sw_if_index[sw_if_index] = ci;
+
+  return 0;
+}
+
+static clib_error_t *
+set_interface_ip_reass_command_fn (vlib_main_t * vm,
+                                   unformat_input_t * input,
+                                   vlib_cli_command_t * cmd)
+{
+  vnet_main_t * vnm = vnet_get_main ();
+  u32 sw_if_index = ~0;
+  u8 is_ip6 = 0;
+  int is_enable = 1;
+  int rv;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "%U", unformat_vnet_sw_interface, vnm,
+                    &sw_if_index))
+        ;
+      else if (unformat (input, "ip4"))
+        is_ip6 = 0;
+      else if (unformat (input, "ip6"))
+        is_ip6 = 1;
+      else if (unformat (input, "del"))
+        is_enable = 0;
+      else
+        return clib_error_return (0, "unknown input `%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (sw_if_index == ~0)
+    return clib_error_return (0, "Please specify an interface...");
+
+  rv = ip_reass_enable_disable (sw_if_index, is_ip6, is_enable);
+  if (rv)
+    return clib_error_return (0, "ip_reass_enable_disable returned %d", rv);
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (set_interface_ip_reass_command, static) = {
+  .path = "set interface ip reassembly",
+  .short_help = "set interface ip reassembly <intfc> [ip4|ip6] [del]",
+  .function = set_interface_ip_reass_command_fn,
+};
+
+static clib_error_t *
+set_ip_reass_command_fn (vlib_main_t * vm,
+                         unformat_input_t * input,
+                         vlib_cli_command_t * cmd)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+  u32 timeout_ms = rm->timeout_ms;
+  u32 max_reassemblies = rm->max_reassemblies;
+  u32 max_fragments = rm->max_fragments;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "timeout %u", &timeout_ms))
+        ;
+      else if (unformat (input, "max-reassemblies %u", &max_reassemblies))
+        ;
+      else if (unformat (input, "max-fragments %u", &max_fragments))
+        ;
+      else
+        return clib_error_return (0, "unknown input `%U'",
+                                  format_unformat_error, input);
+    }
+
+  if (ip_reass_set_params (timeout_ms, max_reassemblies, max_fragments))
+    return clib_error_return (0, "invalid reassembly parameters");
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (set_ip_reass_command, static) = {
+  .path = "set ip reassembly",
+  .short_help = "set ip reassembly [timeout <msec>] "
+    "[max-reassemblies <n>] [max-fragments <n>]",
+  .function = set_ip_reass_command_fn,
+};
+
+static clib_error_t *
+show_ip_reass_command_fn (vlib_main_t * vm,
+                          unformat_input_t * input,
+                          vlib_cli_command_t * cmd)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+  ip_reass_per_thread_t * rt;
+  u32 i;
+
+  vlib_cli_output (vm, "timeout %u msec, max %u reassemblies per thread, "
+                   "max %u fragments per reassembly",
+                   rm->timeout_ms, rm->max_reassemblies, rm->max_fragments);
+
+  vec_foreach_index (i, rm->per_thread)
+    {
+      rt = vec_elt_at_index (rm->per_thread, i);
+      vlib_cli_output (vm, "thread %u: %u ip4, %u ip6 reassemblies", i,
+                       rt->n_reass[0], rt->n_reass[1]);
+    }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (show_ip_reass_command, static) = {
+  .path = "show ip reassembly",
+  .short_help = "show ip reassembly",
+  .function = show_ip_reass_command_fn,
+};
+
+static clib_error_t *
+ip_reass_init (vlib_main_t * vm)
+{
+  ip_reass_main_t * rm = &ip_reass_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  vlib_thread_registration_t * tr;
+  ip_reass_per_thread_t * rt;
+  clib_error_t * error;
+  uword * p;
+
+  if ((error = vlib_call_init_function (vm, threads_init)))
+    return error;
+
+  rm->vlib_main = vm;
+  rm->vnet_main = vnet_get_main ();
+
+  /* Only the standard vnet worker threads are supported */
+  p = hash_get_mem (tm->thread_registrations_by_name, "workers");
+  if (p)
+    {
+      tr = (vlib_thread_registration_t *) p[0];
+      if (tr && tr->count > 0)
+        {
+          rm->first_worker_index = tr->first_index;
+          rm->num_workers = tr->count;
+        }
+    }
+
+  ip_reass_set_params (IP_REASS_TIMEOUT_DEFAULT_MS,
+                       IP_REASS_MAX_REASSEMBLIES_DEFAULT,
+                       IP_REASS_MAX_FRAGMENTS_DEFAULT);
+
+  vec_validate_aligned (rm->per_thread, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+  vec_foreach (rt, rm->per_thread)
+    {
+      clib_bihash_init_24_8 (&rt->ip4_hash, "ip4 reassembly",
+                             IP_REASS_HASH_NUM_BUCKETS,
+                             IP_REASS_HASH_MEMORY_SIZE);
+      clib_bihash_init_48_8 (&rt->ip6_hash, "ip6 reassembly",
+                             IP_REASS_HASH_NUM_BUCKETS,
+                             IP_REASS_HASH_MEMORY_SIZE);
+
+      rt->wheel.min_sched_time = 1e-3;
+      rt->wheel.max_sched_time = 10.0;
+      timing_wheel_init (&rt->wheel, clib_cpu_time_now (),
+                         vm->clib_time.clocks_per_second);
+      rt->last_expire_time = clib_cpu_time_now ();
+
+      vec_validate (rt->handoff_elts, tm->n_vlib_mains - 1);
+      vec_validate_init_empty (rt->handoff_congested, tm->n_vlib_mains - 1,
+                               (vlib_frame_queue_t *) (~0));
+    }
+
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (ip_reass_init);
@@ -0,0 +1,161 @@
+/*---------------------------------------------------------------------------
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *---------------------------------------------------------------------------
+ */
+/*
+ * IPv4 and IPv6 Reassembly Nodes
+ *
+ * Fragments are collected in per-thread reassembly contexts, found
+ * through a per-thread bihash and expired by a per-thread timing wheel.
+ * With worker threads, every fragment of a datagram is handed off to the
+ * worker owning its key, so each context is only touched by one thread.
+ *
+ * Fragments are never copied: once all of them are in, their buffers are
+ * chained behind the first fragment, whose header is rewritten to
+ * describe the whole datagram. IPv6 fragments are only reassembled when
+ * the fragment header directly follows the fixed header.
+ *
+ * The "ip4-reassembly-feature" and "ip6-reassembly-feature" nodes run as
+ * unicast rx features, see ip_reass_enable_disable(). Other nodes (MAP,
+ * NAT, IPsec) can send fragments to "ip4-reassembly" or "ip6-reassembly"
+ * directly after setting:
+ * ip_reass.next_index :
+ *     Next index of the reassembly node, as returned by vlib_node_add_next,
+ *     where non-fragments and reassembled packets are sent.
+ * The rest of the buffer opaque, except sw_if_index, is not preserved.
+ */
+
+#ifndef IP_REASS_H
+#define IP_REASS_H
+
+#include <vnet/vnet.h>
+#include <vppinfra/bihash_24_8.h>
+#include <vppinfra/bihash_48_8.h>
+#include <vppinfra/timing_wheel.h>
+
+#define IP4_REASS_NODE_NAME "ip4-reassembly"
+#define IP6_REASS_NODE_NAME "ip6-reassembly"
+
+extern vlib_node_registration_t ip4_reass_node;
+extern vlib_node_registration_t ip6_reass_node;
+extern vlib_node_registration_t ip4_reass_feature_node;
+extern vlib_node_registration_t ip6_reass_feature_node;
+
+typedef enum {
+  IP_REASS_NEXT_DROP,
+  IP_REASS_N_NEXT
+} ip_reass_next_t;
+
+#define IP_REASS_TIMEOUT_DEFAULT_MS 200
+#define IP_REASS_MAX_REASSEMBLIES_DEFAULT 1024 /* per thread and family */
+#define IP_REASS_MAX_FRAGMENTS_DEFAULT 16      /* per reassembly */
+
+#define IP_REASS_HASH_NUM_BUCKETS 1024
+#define IP_REASS_HASH_MEMORY_SIZE (8<<20)
+
+#define foreach_ip_reass_error                          \
+  /* Must be first. */                                  \
+ _(NONE, "valid packets")                               \
+ _(REASSEMBLED, "packets reassembled")                  \
+ _(HANDOFF, "fragments handed off to owning thread")    \
+ _(HANDOFF_CONGESTED, "owning thread frame queue full") \
+ _(MALFORMED, "malformed fragment")                     \
+ _(DUPLICATE, "duplicate fragment")                     \
+ _(OVERLAP, "overlapping fragments")                    \
+ _(TOO_MANY_FRAGMENTS, "too many fragments")            \
+ _(LIMIT, "maximum reassemblies reached")               \
+ _(TIMEOUT, "fragments dropped on timeout")
+
+typedef enum {
+#define _(sym,str) IP_REASS_ERROR_##sym,
+   foreach_ip_reass_error
+#undef _
+   IP_REASS_N_ERROR,
+ } ip_reass_error_t;
+
+typedef struct {
+  /* Hash key, kept to delete the hash entry. */
+  u64 key[6];
+
+  /* First fragment; fragments are kept in offset order, linked through
+     vnet_buffer(b)->ip_reass.next_range_bi. */
+  u32 first_bi;
+
+  /* Payload bytes received so far. */
+  u32 data_len;
+
+  /* Payload length of the datagram, ~0 until the last fragment is in. */
+  u32 last_octet;
+
+  u16 n_fragments;
+  u8 is_ip6;
+
+  /* Cpu time after which the reassembly is dropped. */
+  u64 expire_time;
+} ip_reass_t;
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+
+  /* Pool of reassembly contexts, both families. */
+  ip_reass_t * pool;
+  u32 n_reass[2];
+
+  /* Keys to pool indices. */
+  clib_bihash_24_8_t ip4_hash;
+  clib_bihash_48_8_t ip6_hash;
+
+  /* Expiry. */
+  timing_wheel_t wheel;
+  u32 * expired;
+  u64 last_expire_time;
+
+  /* Set by the expire walk for the thread to expire its own. */
+  volatile u32 expire_requested;
+
+  /* Frame queue elements under construction, by destination thread. */
+  vlib_frame_queue_elt_t ** handoff_elts;
+
+  /* Frame queues found congested this frame, ~0 when not checked. */
+  vlib_frame_queue_t ** handoff_congested;
+} ip_reass_per_thread_t;
+
+typedef struct {
+  /* Configuration */
+  u32 timeout_ms;
+  u32 max_reassemblies;
+  u32 max_fragments;
+  u64 timeout_clocks;
+
+  ip_reass_per_thread_t * per_thread;
+
+  /* Fragments are owned by the worker at hash % num_workers */
+  u32 first_worker_index;
+  u32 num_workers;
+
+  /* convenience */
+  vlib_main_t * vlib_main;
+  vnet_main_t * vnet_main;
+} ip_reass_main_t;
+
+extern ip_reass_main_t ip_reass_main;
+
+void ip_reass_set_vnet_buffer (vlib_buffer_t * b, u8 next_index);
+
+int ip_reass_enable_disable (u32 sw_if_index, u8 is_ip6, int is_enable);
+
+int ip_reass_set_params (u32 timeout_ms, u32 max_reassemblies,
+                         u32 max_fragments);
+
+#endif /* ifndef IP_REASS_H */
@@ -334,7 +334,7 @@ static u32 ip_multipath_normalize_next_hops (ip_lookup_main_t * lm,
       nhs[1] = raw_next_hops[cmp ^ 1];
 
       /* Fast path: equal cost multipath with 2 next hops. */
-      if (nhs[0].weight == nhs[1].weight)
+      if (nhs[0].weight == nhs[1].weight && ! lm->multipath_resilient_n_adj)
 	{
 	  nhs[0].weight = nhs[1].weight = 1;
 	  _vec_len (nhs) = 2;
@@ -365,8 +365,9 @@ static u32 ip_multipath_normalize_next_hops (ip_lookup_main_t * lm,
     nhs[n_nhs + i].weight = nhs[i].weight;
 
   /* Try larger and larger power of 2 sized adjacency blocks until we
-     find one where traffic flows to within 1% of specified weights. */
-  for (n_adj = max_pow2 (n_nhs); ; n_adj *= 2)
+     find one where traffic flows to within 1% of specified weights.
+     Resilient blocks have a fixed size, whatever the error. */
+  for (n_adj = clib_max (max_pow2 (n_nhs), lm->multipath_resilient_n_adj); ; n_adj *= 2)
     {
       error = 0;
 
@@ -386,7 +387,8 @@ static u32 ip_multipath_normalize_next_hops (ip_lookup_main_t * lm,
       nhs[0].weight += n_adj_left;
 
       /* Less than 5% average error per adjacency with this size adjacency block? */
-      if (error <= lm->multipath_next_hop_error_tolerance*n_adj)
+      if (error <= lm->multipath_next_hop_error_tolerance*n_adj
+	  || lm->multipath_resilient_n_adj)
 	{
 	  /* Truncate any next hops with zero weight. */
 	  _vec_len (nhs) = i;
@@ -415,15 +417,66 @@ ip_next_hop_hash_key_get_heap_handle (uword k)
   return k / 2;
 }
 
+/* Chooses the next hop of each adjacency in a new block of n_adj adjacencies.
+   Adjacencies keep the next hop they had in the block being replaced, if any,
+   as long as that next hop is still in and has not used up its weight. */
+static u32 *
+ip_multipath_layout_next_hops (ip_multipath_next_hop_t * nhs, u32 n_adj,
+			       u32 * old_next_hop_by_adj)
+{
+  u32 * next_hop_by_adj = 0, * n_left = 0;
+  u32 i, k, n_old;
+
+  vec_validate_init_empty (next_hop_by_adj, n_adj - 1, ~0);
+  vec_validate (n_left, vec_len (nhs) - 1);
+  for (k = 0; k < vec_len (nhs); k++)
+    n_left[k] = nhs[k].weight;
+
+  /* Block sizes are powers of 2, so flow hash & (n_old - 1) is the
+     adjacency a flow used in the old block. */
+  n_old = vec_len (old_next_hop_by_adj);
+  for (i = 0; n_old > 0 && i < n_adj; i++)
+    {
+      u32 old = old_next_hop_by_adj[i & (n_old - 1)];
+
+      /* Linear search: ok since n_next_hops is small. */
+      for (k = 0; k < vec_len (nhs); k++)
+	if (nhs[k].next_hop_adj_index == old)
+	  break;
+
+      if (k < vec_len (nhs) && n_left[k] > 0)
+	{
+	  next_hop_by_adj[i] = old;
+	  n_left[k]--;
+	}
+    }
+
+  /* Hand out the rest in next hop order. */
+  for (i = k = 0; i < n_adj; i++)
+    {
+      if (next_hop_by_adj[i] != ~0)
+	continue;
+      while (n_left[k] == 0)
+	k++;
+      next_hop_by_adj[i] = nhs[k].next_hop_adj_index;
+      n_left[k]--;
+    }
+
+  vec_free (n_left);
+  return next_hop_by_adj;
+}
+
 static u32
 ip_multipath_adjacency_get (ip_lookup_main_t * lm,
 			    ip_multipath_next_hop_t * raw_next_hops,
-			    uword create_if_non_existent)
+			    uword create_if_non_existent,
+			    u32 old_madj_index)
 {
   uword * p;
-  u32 i, j, n_adj, adj_index, adj_heap_handle;
+  u32 i, n_adj, adj_index, adj_heap_handle;
+  u32 * next_hop_by_adj, * old_next_hop_by_adj = 0;
   ip_adjacency_t * adj, * copy_adj;
-  ip_multipath_next_hop_t * nh, * nhs;
+  ip_multipath_next_hop_t * nhs;
   ip_multipath_adjacency_t * madj;
 
   n_adj = ip_multipath_normalize_next_hops (lm, raw_next_hops, &lm->next_hop_hash_lookup_key_normalized);
@@ -440,32 +493,31 @@ ip_multipath_adjacency_get (ip_lookup_main_t * lm,
   if (! create_if_non_existent)
     return 0;
 
+  if (old_madj_index < vec_len (lm->multipath_adjacencies))
+    old_next_hop_by_adj
+      = lm->multipath_adjacencies[old_madj_index].next_hop_by_adj;
+  next_hop_by_adj = ip_multipath_layout_next_hops (nhs, n_adj,
+						   old_next_hop_by_adj);
+
   adj = ip_add_adjacency (lm, /* copy_adj */ 0, n_adj, &adj_index);
   adj_heap_handle = adj[0].heap_handle;
 
   /* Fill in adjacencies in block based on corresponding next hop adjacencies. */
-  i = 0;
-  vec_foreach (nh, nhs)
+  for (i = 0; i < n_adj; i++)
     {
-      copy_adj = ip_get_adjacency (lm, nh->next_hop_adj_index);
-      for (j = 0; j < nh->weight; j++)
-	{
-	  adj[i] = copy_adj[0];
-	  adj[i].heap_handle = adj_heap_handle;
-	  adj[i].n_adj = n_adj;
-	  i++;
-	}
+      copy_adj = ip_get_adjacency (lm, next_hop_by_adj[i]);
+      adj[i] = copy_adj[0];
+      adj[i].heap_handle = adj_heap_handle;
+      adj[i].n_adj = n_adj;
     }
 
-  /* All adjacencies should have been initialized. */
-  ASSERT (i == n_adj);
-
   vec_validate (lm->multipath_adjacencies, adj_heap_handle);
   madj = vec_elt_at_index (lm->multipath_adjacencies, adj_heap_handle);
 
   madj->adj_index = adj_index;
   madj->n_adj_in_block = n_adj;
   madj->reference_count = 0;	/* caller will set to one. */
+  madj->next_hop_by_adj = next_hop_by_adj;
 
   madj->normalized_next_hops.count = vec_len (nhs);
   madj->normalized_next_hops.heap_offset
@@ -585,7 +637,8 @@ ip_multipath_adjacency_add_del_next_hop (ip_lookup_main_t * lm,
   if (vec_len (hash_nhs) > 0)
     {
       u32 tmp = ip_multipath_adjacency_get (lm, hash_nhs,
-					    /* create_if_non_existent */ 1);
+					    /* create_if_non_existent */ 1,
+					    mp_old ? old_mp_adj_index : ~0);
       if (tmp != ~0)
 	mp_new = vec_elt_at_index (lm->multipath_adjacencies, tmp);
 
@@ -657,10 +710,14 @@ ip_multipath_del_adjacency (ip_lookup_main_t * lm, u32 del_adj_index)
 	  if (i + 1 < n_nhs)
 	    vec_add (hash_nhs, nhs + i + 1, n_nhs - (i + 1));
 
-	  new_madj_index = ip_multipath_adjacency_get (lm, hash_nhs, /* create_if_non_existent */ 1);
+	  new_madj_index = ip_multipath_adjacency_get (lm, hash_nhs, /* create_if_non_existent */ 1,
+						       madj_index);
 
 	  lm->next_hop_hash_lookup_key = hash_nhs;
 
+	  /* Fetch again since vector may have moved. */
+	  madj = vec_elt_at_index (lm->multipath_adjacencies, madj_index);
+
 	  if (new_madj_index == madj_index)
 	    continue;
 
@@ -681,11 +738,49 @@ ip_multipath_adjacency_free (ip_lookup_main_t * lm,
 	      ip_next_hop_hash_key_from_handle (a->normalized_next_hops.heap_handle));
   heap_dealloc (lm->next_hop_heap, a->normalized_next_hops.heap_handle);
   heap_dealloc (lm->next_hop_heap, a->unnormalized_next_hops.heap_handle);
+  vec_free (a->next_hop_by_adj);
 
   ip_del_adjacency2 (lm, a->adj_index, a->reference_count == 0);
   memset (a, 0, sizeof (a[0]));
 }
 
+/* Sums the counters of the adjacencies of a multipath block which use
+   the given next hop. Returns the first of them, ~0 if there is none. */
+u32
+ip_multipath_adjacency_next_hop_counter (ip_lookup_main_t * lm,
+					 u32 adj_index,
+					 u32 next_hop_adj_index,
+					 vlib_counter_t * c,
+					 int clear)
+{
+  ip_adjacency_t * adj = ip_get_adjacency (lm, adj_index);
+  ip_multipath_adjacency_t * madj;
+  vlib_counter_t tmp;
+  u32 i, first = ~0;
+
+  vlib_counter_zero (c);
+
+  if (adj->heap_handle >= vec_len (lm->multipath_adjacencies))
+    return ~0;
+  madj = vec_elt_at_index (lm->multipath_adjacencies, adj->heap_handle);
+
+  for (i = 0; i < vec_len (madj->next_hop_by_adj); i++)
+    {
+      if (madj->next_hop_by_adj[i] != next_hop_adj_index)
+	continue;
+      if (first == ~0)
+	first = madj->adj_index + i;
+      vlib_get_combined_counter (&lm->adjacency_counters,
+				 madj->adj_index + i, &tmp);
+      if (clear)
+	vlib_zero_combined_counter (&lm->adjacency_counters,
+				    madj->adj_index + i);
+      vlib_counter_add (c, &tmp);
+    }
+
+  return first;
+}
+
 always_inline ip_multipath_next_hop_t *
 ip_next_hop_hash_key_get_next_hops (ip_lookup_main_t * lm, uword k,
 				    uword * n_next_hops)
@@ -1783,6 +1878,43 @@ VLIB_CLI_COMMAND (ip_probe_neighbor_command, static) = {
   .is_mp_safe = 1,
 };
 
+static clib_error_t *
+set_ip_multipath_command_fn (vlib_main_t * vm,
+			     unformat_input_t * input,
+			     vlib_cli_command_t * cmd)
+{
+  u32 n_adj = ~0;
+
+  while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (input, "resilient %d", &n_adj))
+	;
+      else if (unformat (input, "off"))
+	n_adj = 0;
+      else
+	return clib_error_return (0, "unknown input `%U'",
+				  format_unformat_error, input);
+    }
+
+  if (n_adj == ~0)
+    return clib_error_return (0, "expected resilient <n> or off");
+
+  if (n_adj > (1 << 12) || (n_adj && ! is_pow2 (n_adj)))
+    return clib_error_return (0, "%d: not a power of 2 up to 4096", n_adj);
+
+  /* Applies to blocks created from now on */
+  ip4_main.lookup_main.multipath_resilient_n_adj = n_adj;
+  ip6_main.lookup_main.multipath_resilient_n_adj = n_adj;
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (set_ip_multipath_command, static) = {
+  .path = "set ip multipath",
+  .short_help = "set ip multipath [resilient <n-adjacencies>] [off]",
+  .function = set_ip_multipath_command_fn,
+};
+
 typedef CLIB_PACKED (struct {
   ip4_address_t address;
 
@@ -1949,8 +2081,9 @@ ip4_show_fib (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * c
       }
       vec_foreach (r, routes)
 	{
-	  vlib_counter_t c, sum;
-	  uword i, j, n_left, n_nhs, adj_index, * result = 0;
+	  vlib_counter_t sum;
+	  uword j, n_nhs, adj_index, * result = 0;
+	  u32 i;
 	  ip_adjacency_t * adj;
 	  ip_multipath_next_hop_t * nhs, tmp_nhs[1];
 
@@ -1977,59 +2110,54 @@ ip4_show_fib (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * c
 	      n_nhs = madj->normalized_next_hops.count;
 	    }
 
-	  n_left = nhs[0].weight;
-	  vlib_counter_zero (&sum);
-	  for (i = j = 0; i < adj->n_adj; i++)
+	  /* Per next hop counters, summed over its adjacencies in the block */
+	  for (j = 0; j < n_nhs; j++)
 	    {
-	      n_left -= 1;
-	      vlib_get_combined_counter (&lm->adjacency_counters, 
-                                         adj_index + i, &c);
-              if (clear)
-                vlib_zero_combined_counter (&lm->adjacency_counters,
-                                            adj_index + i);
-	      vlib_counter_add (&sum, &c);
-	      if (n_left == 0)
-		{
-		  u8 * msg = 0;
-		  uword indent;
-
-		  if (j == 0)
-		    msg = format (msg, "%-20U",
-				  format_ip4_address_and_length,
-				  r->address.data, r->address_length);
-		  else
-		    msg = format (msg, "%U", format_white_space, 20);
-
-		  msg = format (msg, "%16Ld%16Ld ", sum.packets, sum.bytes);
+	      u8 * msg = 0;
+	      uword indent;
 
-		  indent = vec_len (msg);
-		  msg = format (msg, "weight %d, index %d",
-				nhs[j].weight, adj_index + i);
-
-		  if (ip_adjacency_is_multipath(lm, adj_index))
-		      msg = format (msg, ", multipath");
-
-		  msg = format (msg, "\n%U%U",
-				format_white_space, indent,
-				format_ip_adjacency,
-				vnm, lm, adj_index + i);
-
-		  vlib_cli_output (vm, "%v", msg);
-		  vec_free (msg);
-
-		  if (result && lm->format_fib_result)
-		    vlib_cli_output (vm, "%20s%U", "",
-				     lm->format_fib_result, vm, lm, result,
-				     i + 1 - nhs[j].weight,
-				     nhs[j].weight);
-
-		  j++;
-		  if (j < n_nhs)
-		    {
-		      n_left = nhs[j].weight;
-		      vlib_counter_zero (&sum);
-		    }
+	      if (adj->n_adj == 1)
+		{
+		  i = adj_index;
+		  vlib_get_combined_counter (&lm->adjacency_counters, i, &sum);
+		  if (clear)
+		    vlib_zero_combined_counter (&lm->adjacency_counters, i);
 		}
+	      else
+		i = ip_multipath_adjacency_next_hop_counter
+		  (lm, adj_index, nhs[j].next_hop_adj_index, &sum, clear);
+	      if (i == ~0)
+		continue;
+
+	      if (j == 0)
+		msg = format (msg, "%-20U",
+			      format_ip4_address_and_length,
+			      r->address.data, r->address_length);
+	      else
+		msg = format (msg, "%U", format_white_space, 20);
+
+	      msg = format (msg, "%16Ld%16Ld ", sum.packets, sum.bytes);
+
+	      indent = vec_len (msg);
+	      msg = format (msg, "weight %d, index %d",
+			    nhs[j].weight, i);
+
+	      if (ip_adjacency_is_multipath(lm, adj_index))
+		  msg = format (msg, ", multipath");
+
+	      msg = format (msg, "\n%U%U",
+			    format_white_space, indent,
+			    format_ip_adjacency,
+			    vnm, lm, i);
+
+	      vlib_cli_output (vm, "%v", msg);
+	      vec_free (msg);
+
+	      if (result && lm->format_fib_result)
+		vlib_cli_output (vm, "%20s%U", "",
+				 lm->format_fib_result, vm, lm, result,
+				 i - adj_index,
+				 nhs[j].weight);
 	    }
 	}
     }
@@ -2177,8 +2305,9 @@ ip6_show_fib (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * c
 		       "Destination", "Packets", "Bytes", "Adjacency");
       vec_foreach (r, routes)
 	{
-	  vlib_counter_t c, sum;
-	  uword i, j, n_left, n_nhs, adj_index, * result = 0;
+	  vlib_counter_t sum;
+	  uword j, n_nhs, adj_index, * result = 0;
+	  u32 i;
 	  ip_adjacency_t * adj;
 	  ip_multipath_next_hop_t * nhs, tmp_nhs[1];
 
@@ -2205,53 +2334,48 @@ ip6_show_fib (vlib_main_t * vm, unformat_input_t * input, vlib_cli_command_t * c
 	      n_nhs = madj->normalized_next_hops.count;
 	    }
 
-	  n_left = nhs[0].weight;
-	  vlib_counter_zero (&sum);
-	  for (i = j = 0; i < adj->n_adj; i++)
+	  /* Per next hop counters, summed over its adjacencies in the block */
+	  for (j = 0; j < n_nhs; j++)
 	    {
-	      n_left -= 1;
-	      vlib_get_combined_counter (&lm->adjacency_counters, 
-                                         adj_index + i, &c);
-              if (clear)
-                vlib_zero_combined_counter (&lm->adjacency_counters, 
-                                            adj_index + i);
-	      vlib_counter_add (&sum, &c);
-	      if (n_left == 0)
-		{
-		  u8 * msg = 0;
-		  uword indent;
+	      u8 * msg = 0;
+	      uword indent;
 
-		  if (j == 0)
-		    msg = format (msg, "%-45U",
-				  format_ip6_address_and_length,
-				  r->address.as_u8, r->address_length);
-		  else
-		    msg = format (msg, "%U", format_white_space, 20);
-
-		  msg = format (msg, "%16Ld%16Ld ", sum.packets, sum.bytes);
-
-		  indent = vec_len (msg);
-		  msg = format (msg, "weight %d, index %d",
-				nhs[j].weight, adj_index + i);
-
-		  if (ip_adjacency_is_multipath(lm, adj_index + i))
-		      msg = format (msg, ", multipath");
-
-		  msg = format (msg, "\n%U%U",
-				format_white_space, indent,
-				format_ip_adjacency,
-				vnm, lm, adj_index + i);
-
-		  vlib_cli_output (vm, "%v", msg);
-		  vec_free (msg);
-
-		  j++;
-		  if (j < n_nhs)
-		    {
-		      n_left = nhs[j].weight;
-		      vlib_counter_zero (&sum);
-		    }
+	      if (adj->n_adj == 1)
+		{
+		  i = adj_index;
+		  vlib_get_combined_counter (&lm->adjacency_counters, i, &sum);
+		  if (clear)
+		    vlib_zero_combined_counter (&lm->adjacency_counters, i);
 		}
+	      else
+		i = ip_multipath_adjacency_next_hop_counter
+		  (lm, adj_index, nhs[j].next_hop_adj_index, &sum, clear);
+	      if (i == ~0)
+		continue;
+
+	      if (j == 0)
+		msg = format (msg, "%-45U",
+			      format_ip6_address_and_length,
+			      r->address.as_u8, r->address_length);
+	      else
+		msg = format (msg, "%U", format_white_space, 20);
+
+	      msg = format (msg, "%16Ld%16Ld ", sum.packets, sum.bytes);
+
+	      indent = vec_len (msg);
+	      msg = format (msg, "weight %d, index %d",
+			    nhs[j].weight, i);
+
+	      if (ip_adjacency_is_multipath(lm, i))
+		  msg = format (msg, ", multipath");
+
+	      msg = format (msg, "\n%U%U",
+			    format_white_space, indent,
+			    format_ip_adjacency,
+			    vnm, lm, i);
+
+	      vlib_cli_output (vm, "%v", msg);
+	      vec_free (msg);
 	    }
 
 	  if (result && lm->format_fib_result)
@@ -270,6 +270,12 @@ typedef struct {
     /* Heap handle used to for example free block when we're done with it. */
     u32 heap_handle;
   } normalized_next_hops, unnormalized_next_hops;
+
+  /* Next hop adjacency index copied into each adjacency of the block.
+     A block replacing this one keeps as many adjacencies as possible
+     on the same next hop, so that only the flows of added or removed
+     next hops move. */
+  u32 * next_hop_by_adj;
 } ip_multipath_adjacency_t;
 
 /* IP multicast adjacency. */
@@ -379,6 +385,11 @@ typedef struct ip_lookup_main_t {
      size is accepted. */
   f64 multipath_next_hop_error_tolerance;
 
+  /* Fixed multipath adjacency block size (power of 2), 0 to size blocks
+     by weight error. With a fixed size, adding or removing a next hop
+     only moves the flows hashed to that next hop's adjacencies. */
+  u32 multipath_resilient_n_adj;
+
   /* Adjacency index for routing table misses, local punts, and drops. */
   u32 miss_adj_index, drop_adj_index, local_adj_index;
 
@@ -497,6 +508,13 @@ ip_multipath_adjacency_add_del_next_hop (ip_lookup_main_t * lm,
 					 u32 next_hop_weight,
 					 u32 * new_mp_adj_index);
 
+u32
+ip_multipath_adjacency_next_hop_counter (ip_lookup_main_t * lm,
+					 u32 adj_index,
+					 u32 next_hop_adj_index,
+					 vlib_counter_t * c,
+					 int clear);
+
 clib_error_t *
 ip_interface_address_add_del (ip_lookup_main_t * lm,
 			      u32 sw_if_index,
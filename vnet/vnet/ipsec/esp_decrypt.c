@@ -22,8 +22,6 @@
 #include <vnet/ipsec/ipsec.h>
 #include <vnet/ipsec/esp.h>
 
-#define ESP_WINDOW_SIZE 64
-
 #define foreach_esp_decrypt_next                \
 _(DROP, "error-drop")                           \
 _(IP4_INPUT, "ip4-input")                       \
@@ -43,6 +41,7 @@ typedef enum {
  _(DECRYPTION_FAILED, "ESP decryption failed")      \
  _(INTEG_ERROR, "Integrity check failed")           \
  _(REPLAY, "SA replayed packet")                    \
+ _(LATE, "SA packet outside replay window")         \
  _(NOT_IP, "Not IP packet (dropped)")
 
 
@@ -107,122 +106,119 @@ esp_decrypt_aes_cbc(ipsec_crypto_alg_t alg,
   EVP_DecryptFinal_ex(ctx, out + out_len, &out_len);
 }
 
-always_inline int
-esp_replay_check (ipsec_sa_t * sa, u32 seq)
+/*
+ * Anti-replay, RFC 4303 section 3.4.3 and appendix A.
+ *
+ * The window is kept as a ring of 64-bit blocks indexed by the (64-bit,
+ * ESN-extended) sequence number, so a check or update touches a single
+ * word regardless of window size, and sliding the window only clears the
+ * blocks it moves over (RFC 6479).
+ */
+
+typedef enum {
+  ESP_REPLAY_OK = 0,
+  ESP_REPLAY_DUPLICATE,
+  ESP_REPLAY_LATE,
+} esp_replay_result_t;
+
+always_inline u64
+esp_replay_top (ipsec_sa_t * sa)
 {
-  u32 diff;
+  return ((u64) sa->last_seq_hi << 32) | sa->last_seq;
+}
 
-  if (PREDICT_TRUE(seq > sa->last_seq))
-    return 0;
+/* infer the high-order 32 bits of an ESN sequence number, RFC 4303 A.2.1 */
+always_inline u64
+esp_replay_seq (ipsec_sa_t * sa, u32 seq)
+{
+  u32 tl = sa->last_seq;
+  u32 th = sa->last_seq_hi;
+  u32 w = sa->replay_window_size;
+  u32 seq_hi;
 
-  diff = sa->last_seq - seq;
+  if (PREDICT_FALSE(!sa->use_esn))
+    return seq;
 
-  if (ESP_WINDOW_SIZE > diff)
-    return (sa->replay_window & (1ULL << diff)) ? 1 : 0;
+  if (PREDICT_TRUE(tl >= (w - 1)))
+    seq_hi = (seq >= (tl - w + 1)) ? th : th + 1;
   else
-    return 1;
+    seq_hi = (seq >= (tl - w + 1)) ? th - 1 : th;
 
-  return 0;
+  return ((u64) seq_hi << 32) | seq;
 }
 
-always_inline int
-esp_replay_check_esn (ipsec_sa_t * sa, u32 seq)
+always_inline esp_replay_result_t
+esp_replay_check (ipsec_sa_t * sa, u64 seq)
 {
-  u32 tl = sa->last_seq;
-  u32 th = sa->last_seq_hi;
-  u32 diff = tl - seq;
+  u64 top = esp_replay_top (sa);
+  u32 mask = vec_len (sa->replay_window) - 1;
 
-  if (PREDICT_TRUE(tl >= (ESP_WINDOW_SIZE - 1)))
-    {
-      if (seq >= (tl - ESP_WINDOW_SIZE + 1))
-        {
-          sa->seq_hi = th;
-          if (seq <= tl)
-            return (sa->replay_window & (1ULL << diff)) ? 1 : 0;
-          else
-            return 0;
-        }
-      else
-        {
-          sa->seq_hi = th + 1;
-          return 0;
-        }
-    }
-  else
-    {
-      if (seq >= (tl - ESP_WINDOW_SIZE + 1))
-        {
-          sa->seq_hi = th - 1;
-          return (sa->replay_window & (1ULL << diff)) ? 1 : 0;
-        }
-      else
-        {
-          sa->seq_hi = th;
-          if (seq <= tl)
-            return (sa->replay_window & (1ULL << diff)) ? 1 : 0;
-          else
-            return 0;
-        }
-    }
+  if (PREDICT_TRUE(seq > top))
+    return ESP_REPLAY_OK;
+
+  if (top - seq >= sa->replay_window_size)
+    return ESP_REPLAY_LATE;
+
+  if (sa->replay_window[(seq >> 6) & mask] & (1ULL << (seq & 63)))
+    return ESP_REPLAY_DUPLICATE;
 
-  return 0;
+  return ESP_REPLAY_OK;
 }
 
-always_inline void
-esp_replay_advance (ipsec_sa_t * sa, u32 seq)
+/*
+ * Record an authenticated sequence number. The window may have moved since
+ * esp_replay_check() ran over the frame, so the verdict is re-evaluated.
+ */
+always_inline esp_replay_result_t
+esp_replay_advance (ipsec_sa_t * sa, u64 seq)
 {
-  u32 pos;
+  u64 top = esp_replay_top (sa);
+  u32 mask = vec_len (sa->replay_window) - 1;
+  u64 * w, bit;
 
-  if (seq > sa->last_seq)
-    {
-      pos = seq - sa->last_seq;
-      if (pos < ESP_WINDOW_SIZE)
-        sa->replay_window = ((sa->replay_window) << pos) | 1;
-      else
-        sa->replay_window = 1;
-      sa->last_seq = seq;
-    }
-  else
+  if (PREDICT_TRUE(seq > top))
     {
-      pos = sa->last_seq - seq;
-      sa->replay_window |= (1ULL << pos);
+      u64 top_block = top >> 6;
+      u64 n = (seq >> 6) - top_block;
+      u64 i;
+
+      if (n > mask)
+        n = mask + 1;
+      for (i = 1; i <= n; i++)
+        sa->replay_window[(top_block + i) & mask] = 0;
+
+      sa->last_seq = (u32) seq;
+      sa->last_seq_hi = (u32) (seq >> 32);
     }
+  else if (top - seq >= sa->replay_window_size)
+    return ESP_REPLAY_LATE;
+
+  w = &sa->replay_window[(seq >> 6) & mask];
+  bit = 1ULL << (seq & 63);
+  if (PREDICT_FALSE(w[0] & bit))
+    return ESP_REPLAY_DUPLICATE;
+  w[0] |= bit;
+
+  return ESP_REPLAY_OK;
 }
 
 always_inline void
-esp_replay_advance_esn (ipsec_sa_t * sa, u32 seq)
+esp_replay_count (vlib_main_t * vm, ipsec_main_t * im, u32 cpu_index,
+                  u32 sa_index, esp_replay_result_t rv)
 {
-  int wrap = sa->seq_hi - sa->last_seq_hi;
-  u32 pos;
-
-  if (wrap == 0 && seq > sa->last_seq)
-    {
-      pos = seq - sa->last_seq;
-      if (pos < ESP_WINDOW_SIZE)
-        sa->replay_window = ((sa->replay_window) << pos) | 1;
-      else
-        sa->replay_window = 1;
-      sa->last_seq = seq;
-    }
-  else if (wrap > 0)
-    {
-      pos = ~seq + sa->last_seq + 1;
-      if (pos < ESP_WINDOW_SIZE)
-        sa->replay_window = ((sa->replay_window) << pos) | 1;
-      else
-        sa->replay_window = 1;
-      sa->last_seq = seq;
-      sa->last_seq_hi = sa->seq_hi;
-    }
-  else if (wrap < 0)
+  if (rv == ESP_REPLAY_LATE)
     {
-      pos = ~seq + sa->last_seq + 1;
-      sa->replay_window |= (1ULL << pos);
+      vlib_node_increment_counter (vm, esp_decrypt_node.index,
+                                   ESP_DECRYPT_ERROR_LATE, 1);
+      vlib_increment_simple_counter (&im->sa_late_counters, cpu_index,
+                                     sa_index, 1);
     }
   else
     {
-      pos = sa->last_seq - seq;
-      sa->replay_window |= (1ULL << pos);
+      vlib_node_increment_counter (vm, esp_decrypt_node.index,
+                                   ESP_DECRYPT_ERROR_REPLAY, 1);
+      vlib_increment_simple_counter (&im->sa_replay_counters, cpu_index,
+                                     sa_index, 1);
     }
 }
 
@@ -235,7 +231,10 @@ esp_decrypt_node_fn (vlib_main_t * vm,
   ipsec_main_t *im = &ipsec_main;
   esp_main_t *em = &esp_main;
   u32 * recycle = 0;
-  from = vlib_frame_vector_args (from_frame);
+  u64 seqs[VLIB_FRAME_SIZE];
+  u8 replay[VLIB_FRAME_SIZE];
+  u32 * from0, i;
+  from = from0 = vlib_frame_vector_args (from_frame);
   n_left_from = from_frame->n_vectors;
   u32 cpu_index = os_get_cpu_number();
 
@@ -249,6 +248,36 @@ esp_decrypt_node_fn (vlib_main_t * vm,
     goto free_buffers_and_exit;
   }
 
+  /*
+   * Screen the whole frame against the replay windows before doing any
+   * crypto work, so replayed and late packets are dropped without paying
+   * for the HMAC. The verdict is confirmed by esp_replay_advance() once
+   * the packet is authenticated.
+   */
+  for (i = 0; i < n_left_from; i++)
+    {
+      vlib_buffer_t * b;
+      esp_header_t * esp;
+      ipsec_sa_t * sa;
+
+      if (i + 1 < n_left_from)
+        {
+          b = vlib_get_buffer (vm, from[i + 1]);
+          CLIB_PREFETCH (b, CLIB_CACHE_LINE_BYTES, LOAD);
+          CLIB_PREFETCH (b->data + b->current_data, CLIB_CACHE_LINE_BYTES,
+                         LOAD);
+        }
+
+      b = vlib_get_buffer (vm, from[i]);
+      esp = vlib_buffer_get_current (b);
+      sa = pool_elt_at_index (im->sad,
+                              vnet_buffer(b)->output_features.ipsec_sad_index);
+
+      seqs[i] = esp_replay_seq (sa, clib_net_to_host_u32 (esp->seq));
+      replay[i] = sa->use_anti_replay ?
+        esp_replay_check (sa, seqs[i]) : ESP_REPLAY_OK;
+    }
+
   next_index = node->cached_next_index;
 
   while (n_left_from > 0)
@@ -265,7 +294,8 @@ esp_decrypt_node_fn (vlib_main_t * vm,
           esp_header_t * esp0;
           ipsec_sa_t * sa0;
           u32 sa_index0 = ~0;
-          u32 seq;
+          u64 seq0;
+          u8 replay0;
           ip4_header_t *ih4 = 0, *oh4 = 0;
           ip6_header_t *ih6 = 0, *oh6 = 0;
           u8 tunnel_mode = 1;
@@ -273,6 +303,8 @@ esp_decrypt_node_fn (vlib_main_t * vm,
 
 
           i_bi0 = from[0];
+          seq0 = seqs[from - from0];
+          replay0 = replay[from - from0];
           from += 1;
           n_left_from -= 1;
           n_left_to_next -= 1;
@@ -285,26 +317,12 @@ esp_decrypt_node_fn (vlib_main_t * vm,
           sa_index0 = vnet_buffer(i_b0)->output_features.ipsec_sad_index;
           sa0 = pool_elt_at_index (im->sad, sa_index0);
 
-          seq = clib_host_to_net_u32(esp0->seq);
-
           /* anti-replay check */
-          if (sa0->use_anti_replay)
+          if (PREDICT_FALSE(replay0 != ESP_REPLAY_OK))
             {
-              int rv = 0;
-
-              if (PREDICT_TRUE(sa0->use_esn))
-                rv = esp_replay_check_esn(sa0, seq);
-              else
-                rv = esp_replay_check(sa0, seq);
-
-              if (PREDICT_FALSE(rv))
-                {
-                  clib_warning("anti-replay SPI %u seq %u", sa0->spi, seq);
-                  vlib_node_increment_counter (vm, esp_decrypt_node.index,
-                                               ESP_DECRYPT_ERROR_REPLAY, 1);
-                  o_bi0 = i_bi0;
-                  goto trace;
-                }
+              esp_replay_count (vm, im, cpu_index, sa_index0, replay0);
+              o_bi0 = i_bi0;
+              goto trace;
             }
 
           if (PREDICT_TRUE(sa0->integ_alg != IPSEC_INTEG_ALG_NONE))
@@ -317,7 +335,7 @@ esp_decrypt_node_fn (vlib_main_t * vm,
 
               hmac_calc(sa0->integ_alg, sa0->integ_key, sa0->integ_key_len,
                         (u8 *) esp0, i_b0->current_length, sig, sa0->use_esn,
-                        sa0->seq_hi);
+                        (u32) (seq0 >> 32));
 
               if (PREDICT_FALSE(memcmp(icv, sig, icv_size)))
                 {
@@ -330,11 +348,14 @@ esp_decrypt_node_fn (vlib_main_t * vm,
 
           if (PREDICT_TRUE(sa0->use_anti_replay))
             {
-              if (PREDICT_TRUE(sa0->use_esn))
-                esp_replay_advance_esn(sa0, seq);
-              else
-                esp_replay_advance(sa0, seq);
-             }
+              replay0 = esp_replay_advance (sa0, seq0);
+              if (PREDICT_FALSE(replay0 != ESP_REPLAY_OK))
+                {
+                  esp_replay_count (vm, im, cpu_index, sa_index0, replay0);
+                  o_bi0 = i_bi0;
+                  goto trace;
+                }
+            }
 
           /* grab free buffer */
           uword last_empty_buffer = vec_len (empty_buffers) - 1;
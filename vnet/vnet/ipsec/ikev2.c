@@ -1122,6 +1122,7 @@ ikev2_sa_auth(ikev2_sa_t *sa)
       vec_free(sa->r_id.data);
       sa->r_id.data = vec_dup(sel_p->loc_id.data);
       sa->r_id.type = sel_p->loc_id.type;
+      sa->replay_window_size = sel_p->replay_window_size;
 
       /* generate our auth data */
       authmsg = ikev2_sa_generate_authmsg(sa, 1);
@@ -1170,6 +1171,7 @@ ikev2_create_tunnel_interface(vnet_main_t * vnm, ikev2_sa_t *sa, ikev2_child_sa_
   a.local_spi = child->i_proposals[0].spi;
   a.remote_spi = child->r_proposals[0].spi;
   a.anti_replay = 1;
+  a.replay_window_size = sa->replay_window_size;
 
   tr = ikev2_sa_get_td_for_type(child->r_proposals, IKEV2_TRANSFORM_TYPE_ESN);
   if (tr)
@@ -2084,6 +2086,29 @@ ikev2_set_profile_ts(vlib_main_t * vm, u8 * name, u8 protocol_id,
   return 0;
 }
 
+clib_error_t *
+ikev2_set_profile_replay_window(vlib_main_t * vm, u8 * name,
+                                u32 replay_window_size)
+{
+  ikev2_profile_t * p;
+  clib_error_t * r;
+
+  p = ikev2_profile_index_by_name(name);
+
+  if (!p) {
+    r = clib_error_return(0, "unknown profile %v", name);
+    return r;
+  }
+
+  if (replay_window_size > IPSEC_REPLAY_WINDOW_MAX)
+    return clib_error_return(0, "replay-window must be <= %u",
+                             IPSEC_REPLAY_WINDOW_MAX);
+
+  p->replay_window_size = replay_window_size;
+
+  return 0;
+}
+
 
 clib_error_t *
 ikev2_init (vlib_main_t * vm)
@@ -356,6 +356,8 @@ clib_error_t * ikev2_set_profile_ts(vlib_main_t * vm, u8 * name, u8 protocol_id,
                                     u16 start_port, u16 end_port,
                                     ip4_address_t start_addr,
                                     ip4_address_t end_addr, int is_local);
+clib_error_t * ikev2_set_profile_replay_window(vlib_main_t * vm, u8 * name,
+                                               u32 replay_window_size);
 /* ikev2_format.c */
 u8 * format_ikev2_auth_method (u8 * s, va_list * args);
 u8 * format_ikev2_id_type (u8 * s, va_list * args);
@@ -286,6 +286,12 @@ ikev2_profile_add_del_command_fn (vlib_main_t * vm,
                                    ip4, end_addr, /*remote*/ 0);
           goto done;
         }
+    else if (unformat (line_input, "set %U replay-window %u",
+                       unformat_token, valid_chars, &name, &tmp1))
+        {
+          r = ikev2_set_profile_replay_window(vm, name, tmp1);
+          goto done;
+        }
     else
       break;
   }
@@ -309,7 +315,8 @@ VLIB_CLI_COMMAND (ikev2_profile_add_del_command, static) = {
     "ikev2 profile set <id> id <local|remote> <type> <data>\n"
     "ikev2 profile set <id> traffic-selector <local|remote> ip-range "
     "<start-addr> - <end-addr> port-range <start-port> - <end-port> "
-    "protocol <protocol-number>",
+    "protocol <protocol-number>\n"
+    "ikev2 profile set <id> replay-window <bits>",
     .function = ikev2_profile_add_del_command_fn,
 };
 
@@ -382,6 +389,9 @@ show_ikev2_profile_command_fn (vlib_main_t * vm,
                       format_ip4_address, &p->rem_ts.end_addr,
                       p->rem_ts.start_port, p->rem_ts.end_port,
                       p->rem_ts.protocol_id);
+
+    if (p->replay_window_size)
+      vlib_cli_output(vm, "  replay-window %u", p->replay_window_size);
   }));
 
   return 0;
@@ -196,6 +196,9 @@ typedef struct {
   u8 * last_res_packet_data;
 
   ikev2_child_sa_t * childs;
+
+  /* anti-replay window of the child SAs, from the profile */
+  u32 replay_window_size;
 } ikev2_sa_t;
 
 typedef struct {
@@ -207,6 +210,9 @@ typedef struct {
   ikev2_id_t rem_id;
   ikev2_ts_t loc_ts;
   ikev2_ts_t rem_ts;
+
+  /* anti-replay window in bits, 0 for the default */
+  u32 replay_window_size;
 } ikev2_profile_t;
 
 typedef struct {
@@ -401,6 +401,38 @@ ipsec_is_sa_used(u32 sa_index)
   return 0;
 }
 
+void
+ipsec_sa_replay_init(ipsec_sa_t * sa)
+{
+  ipsec_main_t *im = &ipsec_main;
+  u32 sa_index = sa - im->sad;
+  u32 w = sa->replay_window_size;
+
+  if (w < IPSEC_REPLAY_WINDOW_DEFAULT)
+    w = IPSEC_REPLAY_WINDOW_DEFAULT;
+  if (w > IPSEC_REPLAY_WINDOW_MAX)
+    w = IPSEC_REPLAY_WINDOW_MAX;
+  sa->replay_window_size = 1 << max_log2 (w);
+
+  sa->last_seq = 0;
+  sa->last_seq_hi = 0;
+  sa->replay_window = 0;
+  vec_validate_aligned (sa->replay_window,
+                        2 * (sa->replay_window_size / BITS(u64)) - 1,
+                        CLIB_CACHE_LINE_BYTES);
+
+  vlib_validate_simple_counter (&im->sa_replay_counters, sa_index);
+  vlib_zero_simple_counter (&im->sa_replay_counters, sa_index);
+  vlib_validate_simple_counter (&im->sa_late_counters, sa_index);
+  vlib_zero_simple_counter (&im->sa_late_counters, sa_index);
+}
+
+void
+ipsec_sa_replay_free(ipsec_sa_t * sa)
+{
+  vec_free (sa->replay_window);
+}
+
 int
 ipsec_add_del_sa(vlib_main_t * vm, ipsec_sa_t * new_sa, int is_add)
 {
@@ -427,6 +459,7 @@ ipsec_add_del_sa(vlib_main_t * vm, ipsec_sa_t * new_sa, int is_add)
           return VNET_API_ERROR_SYSCALL_ERROR_1; /* sa used in policy */
         }
       hash_unset (im->sa_index_by_sa_id, sa->id);
+      ipsec_sa_replay_free (sa);
       pool_put (im->sad, sa);
     }
   else /* create new SA */
@@ -434,6 +467,7 @@ ipsec_add_del_sa(vlib_main_t * vm, ipsec_sa_t * new_sa, int is_add)
       pool_get (im->sad, sa);
       clib_memcpy (sa, new_sa, sizeof (*sa));
       sa_index = sa - im->sad;
+      ipsec_sa_replay_init (sa);
       hash_set (im->sa_index_by_sa_id, sa->id, sa_index);
     }
   return 0;
@@ -508,6 +542,9 @@ ipsec_init (vlib_main_t * vm)
 
   vec_validate_aligned(im->empty_buffers, tm->n_vlib_mains-1, CLIB_CACHE_LINE_BYTES);
 
+  im->sa_replay_counters.name = "replayed";
+  im->sa_late_counters.name = "late";
+
   node = vlib_get_node_by_name (vm, (u8 *) "error-drop");
   ASSERT(node);
   im->error_drop_node_index = node->index;
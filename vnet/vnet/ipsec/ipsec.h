@@ -58,6 +58,10 @@ typedef enum {
   IPSEC_INTEG_N_ALG,
 } ipsec_integ_alg_t;
 
+/* anti-replay window size in bits, must be a power of 2 */
+#define IPSEC_REPLAY_WINDOW_DEFAULT 64
+#define IPSEC_REPLAY_WINDOW_MAX 4096
+
 typedef enum {
 	IPSEC_PROTOCOL_AH = 0,
 	IPSEC_PROTOCOL_ESP = 1
@@ -89,7 +93,9 @@ typedef struct {
     u32 seq_hi;
     u32 last_seq;
     u32 last_seq_hi;
-    u64 replay_window;
+    u32 replay_window_size;
+    /* ring of 64-bit blocks, twice the window size, indexed by seq >> 6 */
+    u64 * replay_window;
 } ipsec_sa_t;
 
 typedef struct {
@@ -104,6 +110,7 @@ typedef struct {
   u8 is_add;
   u8 esn;
   u8 anti_replay;
+  u32 replay_window_size;
   ip4_address_t local_ip, remote_ip;
   u32 local_spi;
   u32 remote_spi;
@@ -202,6 +209,10 @@ typedef struct {
   uword * sa_index_by_sa_id;
   uword * ipsec_if_pool_index_by_key;
 
+  /* per-SA anti-replay drop counters, indexed by SA pool index */
+  vlib_simple_counter_main_t sa_replay_counters;
+  vlib_simple_counter_main_t sa_late_counters;
+
   /* node indexes */
   u32 error_drop_node_index;
   u32 ip4_lookup_node_index;
@@ -225,6 +236,8 @@ int ipsec_add_del_spd(vlib_main_t * vm, u32 spd_id, int is_add);
 int ipsec_add_del_policy(vlib_main_t * vm, ipsec_policy_t * policy, int is_add);
 int ipsec_add_del_sa(vlib_main_t * vm, ipsec_sa_t * new_sa, int is_add);
 int ipsec_set_sa_key(vlib_main_t * vm, ipsec_sa_t * sa_update);
+void ipsec_sa_replay_init(ipsec_sa_t * sa);
+void ipsec_sa_replay_free(ipsec_sa_t * sa);
 
 u8 * format_ipsec_if_output_trace (u8 * s, va_list * args);
 u8 * format_ipsec_policy_action (u8 * s, va_list * args);
@@ -106,6 +106,18 @@ ipsec_sa_add_del_command_fn (vlib_main_t * vm,
           return clib_error_return(0, "unsupported integ-alg: '%U'",
                                    format_ipsec_integ_alg, sa.integ_alg);
       }
+    else if (unformat (line_input, "esn"))
+      sa.use_esn = 1;
+    else if (unformat (line_input, "anti-replay"))
+      sa.use_anti_replay = 1;
+    else if (unformat (line_input, "replay-window %u",
+                       &sa.replay_window_size))
+      {
+        if (sa.replay_window_size > IPSEC_REPLAY_WINDOW_MAX)
+          return clib_error_return(0, "replay-window must be <= %u",
+                                   IPSEC_REPLAY_WINDOW_MAX);
+        sa.use_anti_replay = 1;
+      }
     else if (unformat (line_input, "tunnel-src %U",
                        unformat_ip4_address, &sa.tunnel_src_addr.ip4))
       sa.is_tunnel = 1;
@@ -368,6 +380,15 @@ show_ipsec_command_fn (vlib_main_t * vm,
                         format_ip4_address, &sa->tunnel_src_addr.ip4,
                         format_ip4_address, &sa->tunnel_dst_addr.ip4);
       }
+      if (sa->use_anti_replay) {
+        vlib_cli_output(vm, "  anti-replay esn %u window %U",
+                        sa->use_esn, format_ipsec_replay_window, sa);
+        vlib_cli_output(vm, "  replayed %llu late %llu",
+                        vlib_get_simple_counter (&im->sa_replay_counters,
+                                                 sa - im->sad),
+                        vlib_get_simple_counter (&im->sa_late_counters,
+                                                 sa - im->sad));
+      }
     }
   }));
 
@@ -535,7 +556,12 @@ show_ipsec_command_fn (vlib_main_t * vm,
     vlib_cli_output(vm, "   last-seq %u last-seq-hi %u esn %u anti-replay %u window %U",
                     sa->last_seq, sa->last_seq_hi, sa->use_esn,
                     sa->use_anti_replay,
-                    format_ipsec_replay_window, sa->replay_window);
+                    format_ipsec_replay_window, sa);
+    vlib_cli_output(vm, "   replayed %llu late %llu",
+                    vlib_get_simple_counter (&im->sa_replay_counters,
+                                             t->input_sa_index),
+                    vlib_get_simple_counter (&im->sa_late_counters,
+                                             t->input_sa_index));
     vlib_cli_output(vm, "   remote-spi %u remote-ip %U", sa->spi,
                     format_ip4_address, &sa->tunnel_src_addr.ip4);
     vlib_cli_output(vm, "   remote-crypto %U %U",
@@ -569,6 +595,9 @@ clear_ipsec_counters_command_fn (vlib_main_t * vm,
     }));
   }));
 
+  vlib_clear_simple_counters (&im->sa_replay_counters);
+  vlib_clear_simple_counters (&im->sa_late_counters);
+
   return 0;
 }
 
@@ -604,6 +633,15 @@ create_ipsec_tunnel_command_fn (vlib_main_t * vm,
       num_m_args++;
     else if (unformat (line_input, "remote-spi %u", &a.remote_spi))
       num_m_args++;
+    else if (unformat (line_input, "anti-replay"))
+      a.anti_replay = 1;
+    else if (unformat (line_input, "replay-window %u", &a.replay_window_size))
+      {
+        if (a.replay_window_size > IPSEC_REPLAY_WINDOW_MAX)
+          return clib_error_return(0, "replay-window must be <= %u",
+                                   IPSEC_REPLAY_WINDOW_MAX);
+        a.anti_replay = 1;
+      }
     else if (unformat (line_input, "del"))
       a.is_add = 0;
     else
@@ -635,7 +673,7 @@ create_ipsec_tunnel_command_fn (vlib_main_t * vm,
 
 VLIB_CLI_COMMAND (create_ipsec_tunnel_command, static) = {
   .path = "create ipsec tunnel",
-  .short_help = "create ipsec tunnel local-ip <addr> local-spi <spi> remote-ip <addr> remote-spi <spi>",
+  .short_help = "create ipsec tunnel local-ip <addr> local-spi <spi> remote-ip <addr> remote-spi <spi> [anti-replay] [replay-window <bits>]",
   .function = create_ipsec_tunnel_command_fn,
 };
 
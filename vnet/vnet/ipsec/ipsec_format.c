@@ -121,12 +121,23 @@ unformat_ipsec_integ_alg (unformat_input_t * input, va_list * args)
 u8 *
 format_ipsec_replay_window(u8 * s, va_list * args)
 {
-  u64 w = va_arg (*args, u64);
-  u8 i;
+  ipsec_sa_t * sa = va_arg (*args, ipsec_sa_t *);
+  u64 top = ((u64) sa->last_seq_hi << 32) | sa->last_seq;
+  u32 mask = vec_len (sa->replay_window) - 1;
+  u64 seq;
+  u32 i;
 
-  for (i = 0; i < 64; i++)
+  s = format (s, "size %u ", sa->replay_window_size);
+
+  if (sa->replay_window == 0)
+    return s;
+
+  /* most recent 64 sequence numbers, newest first */
+  for (i = 0; i < 64 && i <= top; i++)
     {
-      s = format (s, "%u", w & (1ULL<<i) ? 1 : 0);
+      seq = top - i;
+      s = format (s, "%u", (sa->replay_window[(seq >> 6) & mask] &
+                            (1ULL << (seq & 63))) ? 1 : 0);
     }
 
   return s;
@@ -101,6 +101,8 @@ ipsec_add_del_tunnel_if_internal (vnet_main_t * vnm, ipsec_add_del_tunnel_args_t
       sa->is_tunnel = 1;
       sa->use_esn = args->esn;
       sa->use_anti_replay = args->anti_replay;
+      sa->replay_window_size = args->replay_window_size;
+      ipsec_sa_replay_init (sa);
       sa->integ_alg = args->integ_alg;
       if (args->remote_integ_key_len <= sizeof(args->remote_integ_key))
         {
@@ -176,8 +178,10 @@ ipsec_add_del_tunnel_if_internal (vnet_main_t * vnm, ipsec_add_del_tunnel_args_t
 
       /* delete input and output SA */
       sa = pool_elt_at_index(im->sad, t->input_sa_index);
+      ipsec_sa_replay_free (sa);
       pool_put (im->sad, sa);
       sa = pool_elt_at_index(im->sad, t->output_sa_index);
+      ipsec_sa_replay_free (sa);
       pool_put (im->sad, sa);
 
       hash_unset (im->ipsec_if_pool_index_by_key, key);
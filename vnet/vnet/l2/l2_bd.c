@@ -24,6 +24,7 @@
 #include <vnet/l2/feat_bitmap.h>
 #include <vnet/l2/l2_bd.h>
 #include <vnet/l2/l2_fib.h>
+#include <vnet/l2/l2_learn.h>
 #include <vnet/l2/l2_vtr.h>
 #include <vnet/ip/ip4_packet.h>
 #include <vnet/ip/ip6_packet.h>
@@ -94,6 +95,8 @@ int bd_delete_bd_index (bd_main_t * bdm, u32 bd_id)
 
   l2input_main.bd_configs[bd_index].bd_id = ~0;
   l2input_main.bd_configs[bd_index].feature_bitmap = 0;
+  l2input_main.bd_configs[bd_index].mac_age = 0;
+  l2learn_limit_bd_delete (bd_index);
 
   return 0;
 }
@@ -199,6 +202,24 @@ bd_set_flags (vlib_main_t * vm,
   return 0;
 }
 
+// Set the mac age for the bridge domain, in minutes. 0 disables aging.
+void
+bd_set_mac_age (vlib_main_t * vm,
+                u32 bd_index,
+                u8 age) {
+
+  l2_bridge_domain_t * bd_config;
+
+  vec_validate (l2input_main.bd_configs, bd_index);
+  bd_config = vec_elt_at_index(l2input_main.bd_configs, bd_index);
+
+  bd_config->mac_age = age;
+
+  // Let the aging scanner know it has work to do
+  if (age)
+    l2fib_start_ager_scan (vm);
+}
+
 // set bridge-domain learn enable/disable
 // The CLI format is:
 //    set bridge-domain learn <bd_id> [disable]
@@ -248,6 +269,60 @@ VLIB_CLI_COMMAND (bd_learn_cli, static) = {
   .function = bd_learn,
 };
 
+// set bridge-domain mac age
+// The CLI format is:
+//    set bridge-domain mac-age <bd_id> <minutes>
+static clib_error_t *
+bd_mac_age (vlib_main_t * vm,
+            unformat_input_t * input,
+            vlib_cli_command_t * cmd)
+{
+  bd_main_t * bdm = &bd_main;
+  clib_error_t * error = 0;
+  u32 bd_index, bd_id;
+  u32 age;
+  uword * p;
+
+  if (! unformat (input, "%d", &bd_id))
+    {
+      error = clib_error_return (0, "expecting bridge-domain id but got `%U'",
+                                 format_unformat_error, input);
+      goto done;
+    }
+
+  p = hash_get (bdm->bd_index_by_bd_id, bd_id);
+
+  if (p == 0)
+    return clib_error_return (0, "No such bridge domain %d", bd_id);
+
+  bd_index = p[0];
+
+  if (! unformat (input, "%u", &age))
+    {
+      error = clib_error_return (0, "expecting ageing time in minutes but got `%U'",
+                                 format_unformat_error, input);
+      goto done;
+    }
+
+  // the entry timestamps count minutes modulo 256
+  if (age > 255)
+    {
+      error = clib_error_return (0, "mac age must be less than 256 minutes");
+      goto done;
+    }
+
+  bd_set_mac_age (vm, bd_index, (u8) age);
+
+ done:
+  return error;
+}
+
+VLIB_CLI_COMMAND (bd_mac_age_cli, static) = {
+  .path = "set bridge-domain mac-age",
+  .short_help = "set bridge-domain mac-age <bridge-domain-id> <mins>",
+  .function = bd_mac_age,
+};
+
 // set bridge-domain forward enable/disable
 // The CLI format is:
 //    set bridge-domain forward <bd_index> [disable]
@@ -575,6 +650,15 @@ u8* format_vtr(u8 * s, va_list *args)
     }
 }
 
+static u8 * format_bd_mac_age (u8 * s, va_list * args)
+{
+  u32 age = va_arg (*args, u32);
+
+  if (age == 0)
+    return format (s, "off");
+  return format (s, "%dm", age);
+}
+
 // show bridge-domain state
 // The CLI format is:
 //    show bridge-domain [<bd_index>]
@@ -628,7 +712,7 @@ bd_show (vlib_main_t * vm,
     if (bd_is_valid(bd_config)) {
       if (!printed) {
         printed = 1;
-        vlib_cli_output (vm, "%=5s %=7s %=10s %=10s %=10s %=10s %=10s %=14s", 
+        vlib_cli_output (vm, "%=5s %=7s %=10s %=10s %=10s %=10s %=10s %=8s %=14s", 
                          "ID",
                          "Index",
                          "Learning",
@@ -636,17 +720,19 @@ bd_show (vlib_main_t * vm,
                          "UU-Flood",
                          "Flooding",
 			 "ARP-Term",
+                         "Age",
                          "BVI-Intf");
       }
 
       vlib_cli_output (
-	  vm, "%=5d %=7d %=10s %=10s %=10s %=10s %=10s %=14U", 
+	  vm, "%=5d %=7d %=10s %=10s %=10s %=10s %=10s %=8U %=14U", 
 	  bd_config->bd_id, bd_index,
 	  bd_config->feature_bitmap & L2INPUT_FEAT_LEARN ?    "on" : "off",
 	  bd_config->feature_bitmap & L2INPUT_FEAT_FWD ?      "on" : "off",
 	  bd_config->feature_bitmap & L2INPUT_FEAT_UU_FLOOD ? "on" : "off",
 	  bd_config->feature_bitmap & L2INPUT_FEAT_FLOOD ?    "on" : "off",
 	  bd_config->feature_bitmap & L2INPUT_FEAT_ARP_TERM ? "on" : "off",
+	  format_bd_mac_age, bd_config->mac_age,
 	  format_vnet_sw_if_index_name_with_NA, vnm, bd_config->bvi_sw_if_index);
 
       if (detail || intf) {
@@ -62,6 +62,9 @@ typedef struct {
   // bridge domain id, not to be confused with bd_index
   u32 bd_id;
 
+  // mac aging time in minutes, 0 disables aging
+  u8 mac_age;
+
   // Vector of members in the replication group
   l2_flood_member_t * members;
 
@@ -104,6 +107,11 @@ bd_set_flags (vlib_main_t * vm,
               u32 flags,
               u32 enable);
 
+void
+bd_set_mac_age (vlib_main_t * vm,
+                u32 bd_index,
+                u8 age);
+
 /**
  * \brief Get or create a bridge domain.
  *
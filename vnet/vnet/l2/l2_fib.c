@@ -21,6 +21,7 @@
 #include <vnet/pg/pg.h>
 #include <vnet/ethernet/ethernet.h>
 #include <vlib/cli.h>
+#include <vnet/l2/l2_input.h>
 
 #include <vppinfra/error.h>
 #include <vppinfra/hash.h>
@@ -35,6 +36,12 @@ typedef struct {
   /* hash table */
   BVT(clib_bihash) mac_table;
 
+  /* entries aged out by the current scan */
+  BVT(clib_bihash_kv) * aged;
+
+  /* number of entries aged out */
+  u64 n_aged;
+
   /* convenience variables */
   vlib_main_t * vlib_main;
   vnet_main_t * vnet_main;
@@ -189,6 +196,9 @@ show_l2fib  (vlib_main_t * vm,
   else
     vlib_cli_output (vm, "%lld l2fib entries", total_entries);
 
+  if (msm->n_aged)
+    vlib_cli_output (vm, "%lld l2fib entries aged out", msm->n_aged);
+
   if (raw)
     vlib_cli_output (vm, "Raw Hash Table:\n%U\n",
                      BV(format_bihash), h, 1 /* verbose */);
@@ -217,7 +227,7 @@ void l2fib_clear_table (uint keep_static)
                           L2FIB_NUM_BUCKETS, L2FIB_MEMORY_SIZE);
   }
 
-  l2learn_main.global_learn_count = 0;
+  l2learn_count_reset ();
 }
 
 // Clear all entries in L2FIB
@@ -255,6 +265,16 @@ void l2fib_add_entry (u64   mac,
   // set up key
   key.raw = l2fib_make_key ((u8 *)&mac, bd_index);
 
+  // dynamic entries count against the learn limits, however added
+  kv.key = key.raw;
+  if (BV(clib_bihash_search) (&mp->mac_table, &kv, &kv) == 0) {
+    result.raw = kv.value;
+    if (!result.fields.static_mac)
+      l2learn_count_del (bd_index, result.fields.sw_if_index);
+  }
+  if (!static_mac)
+    l2learn_count_add (bd_index, sw_if_index);
+
   // set up result
   result.raw = 0; // clear all fields
   result.fields.sw_if_index = sw_if_index;
@@ -267,10 +287,6 @@ void l2fib_add_entry (u64   mac,
 
   BV(clib_bihash_add_del) (&mp->mac_table, &kv, 1 /* is_add */);
 
-  // increment counter if dynamically learned mac
-  if (result.fields.static_mac) {
-     l2learn_main.global_learn_count++;
-  }
 }
 
 // Add an entry to the L2FIB
@@ -471,15 +487,13 @@ u32 l2fib_del_entry (u64   mac,
 
   result.raw = kv.value;
 
-  // decrement counter if dynamically learned mac
-  if (result.fields.static_mac) {
-    if (l2learn_main.global_learn_count > 0) {
-      l2learn_main.global_learn_count--;
-    }
-  }
+  // decrement counters if dynamically learned mac
+  if (!result.fields.static_mac)
+    l2learn_count_del (bd_index, result.fields.sw_if_index);
 
   // Remove entry from hash table
   BV(clib_bihash_add_del) (&mp->mac_table, &kv, 0 /* is_add */);
+  l2learn_forget (kv.key);
   return 0;
 }
 
@@ -535,6 +549,149 @@ VLIB_CLI_COMMAND (l2fib_del_cli, static) = {
 };
 
 
+/*
+ * MAC aging.
+ *
+ * l2-learn stamps entries with l2fib_timestamp() when it learns or sees
+ * them. The scanner below walks the mac table a slice of buckets at a
+ * time, and removes the learned entries which have not been seen for
+ * the mac-age of their bridge domain. It goes back to sleep after a
+ * full pass over a table with no aging bridge domain.
+ */
+
+// Buckets scanned per wakeup, and the time between wakeups.
+// A full pass over the table takes about 6.5 seconds.
+#define L2FIB_AGE_SCAN_BUCKETS 1024
+#define L2FIB_AGE_SCAN_INTERVAL 0.1
+
+#define L2FIB_AGE_SCAN_EVENT_START 1
+
+static vlib_node_registration_t l2fib_mac_age_scanner_process_node;
+
+static int
+l2fib_any_bd_aging (void)
+{
+  l2_bridge_domain_t * bd_config;
+
+  vec_foreach (bd_config, l2input_main.bd_configs)
+    if (bd_is_valid (bd_config) && bd_config->mac_age)
+      return 1;
+
+  return 0;
+}
+
+// Age out the stale entries of buckets [first, first + count)
+static void
+l2fib_age_scan (vlib_main_t * vm, u32 first, u32 count)
+{
+  l2fib_main_t * mp = &l2fib_main;
+  BVT(clib_bihash) * h = &mp->mac_table;
+  clib_bihash_bucket_t * b;
+  BVT(clib_bihash_value) * v;
+  BVT(clib_bihash_kv) kv;
+  l2fib_entry_key_t key;
+  l2fib_entry_result_t result;
+  l2_bridge_domain_t * bd_config;
+  u8 timestamp = l2fib_timestamp (vm);
+  u32 i, j, k;
+  BVT(clib_bihash_kv) * kvp;
+
+  for (i = first; i < first + count && i < h->nbuckets; i++)
+    {
+      b = &h->buckets[i];
+      if (b->offset == 0)
+        continue;
+      v = BV(clib_bihash_get_value) (h, b->offset);
+      for (j = 0; j < (1<<b->log2_pages); j++)
+        {
+          for (k = 0; k < BIHASH_KVP_PER_PAGE; k++)
+            {
+              if (BV(clib_bihash_is_free)(&v->kvp[k]))
+                continue;
+
+              key.raw = v->kvp[k].key;
+              result.raw = v->kvp[k].value;
+
+              if (result.fields.static_mac)
+                continue;
+
+              if (key.fields.bd_index >= vec_len (l2input_main.bd_configs))
+                continue;
+              bd_config = vec_elt_at_index (l2input_main.bd_configs,
+                                            key.fields.bd_index);
+              if (bd_config->mac_age == 0)
+                continue;
+
+              if ((u8) (timestamp - result.fields.timestamp)
+                  < bd_config->mac_age)
+                continue;
+
+              vec_add1 (mp->aged, v->kvp[k]);
+            }
+          v++;
+        }
+    }
+
+  // Deleting may rearrange a bucket, so delete after the walk
+  vec_foreach (kvp, mp->aged)
+    {
+      key.raw = kvp->key;
+      result.raw = kvp->value;
+      kv.key = kvp->key;
+      BV(clib_bihash_add_del) (h, &kv, 0 /* is_add */);
+      l2learn_count_del (key.fields.bd_index, result.fields.sw_if_index);
+      l2learn_forget (key.raw);
+    }
+  mp->n_aged += vec_len (mp->aged);
+  vec_reset_length (mp->aged);
+}
+
+static uword
+l2fib_mac_age_scanner_process (vlib_main_t * vm,
+                               vlib_node_runtime_t * rt,
+                               vlib_frame_t * f)
+{
+  l2fib_main_t * mp = &l2fib_main;
+  uword * event_data = 0;
+  u32 bucket = 0;
+
+  while (1)
+    {
+      if (bucket == 0 && !l2fib_any_bd_aging ())
+        {
+          // Nothing to age, wait for a bridge domain to set a mac-age
+          vlib_process_wait_for_event (vm);
+          vlib_process_get_events (vm, &event_data);
+          vec_reset_length (event_data);
+          continue;
+        }
+
+      vlib_process_suspend (vm, L2FIB_AGE_SCAN_INTERVAL);
+
+      l2fib_age_scan (vm, bucket, L2FIB_AGE_SCAN_BUCKETS);
+
+      bucket += L2FIB_AGE_SCAN_BUCKETS;
+      if (bucket >= mp->mac_table.nbuckets)
+        bucket = 0;
+    }
+
+  return 0;
+}
+
+VLIB_REGISTER_NODE (l2fib_mac_age_scanner_process_node, static) = {
+  .function = l2fib_mac_age_scanner_process,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "l2fib-mac-age-scanner-process",
+};
+
+// Wake up the scanner after a bridge domain mac-age change
+void l2fib_start_ager_scan (vlib_main_t * vm)
+{
+  vlib_process_signal_event (vm, l2fib_mac_age_scanner_process_node.index,
+                             L2FIB_AGE_SCAN_EVENT_START, 0);
+}
+
+
 BVT(clib_bihash) *get_mac_table(void) {
   l2fib_main_t * mp = &l2fib_main;
   return &mp->mac_table;
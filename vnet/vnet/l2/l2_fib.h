@@ -57,7 +57,7 @@ typedef struct {
       u8  filter:1;      // drop packets to/from this mac
       u8  refresh:1;     // refresh flag for aging
       u8  unused1:4;
-      u8  timestamp;     // timestamp for aging
+      u8  timestamp;     // l2fib_timestamp() when last learned or refreshed
       u16 unused2;
     } fields;
     u64 raw;
@@ -65,6 +65,15 @@ typedef struct {
 } l2fib_entry_result_t;
 
 
+// Coarse clock for mac aging, in minutes.
+// It wraps, so entry ages are computed modulo 256 minutes.
+always_inline u8
+l2fib_timestamp (vlib_main_t * vm)
+{
+  return (u8) (vlib_time_now (vm) / 60.0);
+}
+
+
 // Compute the hash for the given key and return the corresponding bucket index
 always_inline 
 u32 l2fib_compute_hash_bucket (l2fib_entry_key_t *key) {
@@ -207,6 +216,46 @@ l2fib_lookup_2 (BVT(clib_bihash) * mac_table,
 }
 
 
+// Staged mac table lookup, for quad loops over large mac tables.
+// l2fib_lookup_hash() computes the key and hash and prefetches the
+// bucket, one iteration before the search. l2fib_lookup_prefetch()
+// prefetches the value page once the bucket has arrived, and
+// l2fib_lookup_search() searches with the precomputed hash.
+
+typedef struct {
+  BVT(clib_bihash_kv) kv;
+  u64 hash;
+} l2fib_lookup_key_t;
+
+static_always_inline void
+l2fib_lookup_hash (BVT(clib_bihash) * mac_table,
+                   u8 * mac0,
+                   u16 bd_index0,
+                   l2fib_lookup_key_t * k0)
+{
+  k0->kv.key = l2fib_make_key (mac0, bd_index0);
+  k0->hash = BV(clib_bihash_hash) (&k0->kv);
+  BV(clib_bihash_prefetch_bucket) (mac_table, k0->hash);
+}
+
+static_always_inline void
+l2fib_lookup_prefetch (BVT(clib_bihash) * mac_table,
+                       l2fib_lookup_key_t * k0)
+{
+  BV(clib_bihash_prefetch_data) (mac_table, k0->hash);
+}
+
+// Returns the raw entry, ~0 if the entry was not found
+static_always_inline u64
+l2fib_lookup_search (BVT(clib_bihash) * mac_table,
+                     l2fib_lookup_key_t * k0)
+{
+  k0->kv.value = ~0ULL;
+  BV(clib_bihash_search_inline_with_hash) (mac_table, k0->hash, &k0->kv);
+  return k0->kv.value;
+}
+
+
 BVT(clib_bihash) *get_mac_table(void);
 void l2fib_clear_table (uint keep_static);
 void l2fib_add_entry (u64   mac,
@@ -223,4 +272,6 @@ void l2fib_table_dump (u32 bd_index, l2fib_entry_key_t **l2fe_key,
 
 u8 * format_vnet_sw_if_index_name_with_NA (u8 * s, va_list * args);
 
+void l2fib_start_ager_scan (vlib_main_t * vm);
+
 #endif
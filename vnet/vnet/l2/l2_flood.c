@@ -23,7 +23,6 @@
 #include <vnet/l2/l2_input.h>
 #include <vnet/l2/feat_bitmap.h>
 #include <vnet/l2/l2_bvi.h>
-#include <vnet/replication.h>
 #include <vnet/l2/l2_fib.h>
 
 #include <vppinfra/error.h>
@@ -31,17 +30,22 @@
 
 
 /*
- * Flooding uses the packet replication infrastructure to send a copy of the
- * packet to each member interface. Logically the replication infrastructure
- * expects two graph nodes: a prep node that initiates replication and sends the
- * packet to the first destination, and a recycle node that is passed the packet
- * after it has been transmitted.
+ * Flooding sends a copy of the packet to each member interface of the
+ * bridge domain. The copies are made with vlib_buffer_clone(): each
+ * member gets a private header buffer holding the first
+ * L2FLOOD_CLONE_HEAD_SIZE bytes of the packet, chained in front of the
+ * shared remainder, and all copies are enqueued in a single pass. The
+ * shared part is freed when the last copy has been transmitted.
  *
- * To decrease the amount of code, l2 flooding implements both functions in
- * the same graph node. This node can tell if is it being called as the "prep"
- * or "recycle" using replication_is_recycled().
+ * Output features may rewrite the L2/L3 headers of their copy, which
+ * stay within the private header buffer. Members that can't take a
+ * clone get a full copy instead: the BVI, whose L3 processing may
+ * rewrite any part of the packet, and interfaces that can't send
+ * buffer chains.
  */
 
+/* Bytes of the packet each flooded copy owns */
+#define L2FLOOD_CLONE_HEAD_SIZE 256
 
 typedef struct {
 
@@ -51,6 +55,11 @@ typedef struct {
   // next node index for the L3 input node of each ethertype
   next_by_ethertype_t l3_next;
 
+  // Per-thread scratch: indices of the members a packet goes to,
+  // and the buffer indices of its copies
+  u32 ** members_by_cpu;
+  u32 ** clones_by_cpu;
+
   /* convenience variables */
   vlib_main_t * vlib_main;
   vnet_main_t * vnet_main;
@@ -110,153 +119,106 @@ typedef enum {
 } l2flood_next_t;
 
 /*
- * Perform flooding on one packet
+ * Collect the members a packet is flooded to
  *
- * Due to the way BVI processing can modify the packet, the BVI interface
- * (if present) must be processed last in the replication. The member vector
- * is arranged so that the BVI interface is always the first element. 
- * Flooding walks the vector in reverse.
+ * The member vector keeps the BVI interface (if present) as its first
+ * element; it is walked in reverse so the BVI ends up last in the
+ * result, where the flood loop sends its copy down the packet's own
+ * path to L3.
  *
- * BVI processing causes the packet to go to L3 processing. This strips the
- * L2 header, which is fine because the replication infrastructure restores
- * it. However L3 processing can trigger larger changes to the packet. For
- * example, an ARP request could be turned into an ARP reply, an ICMP request
- * could be turned into an ICMP reply. If BVI processing is not performed 
- * last, the modified packet would be replicated to the remaining members. 
+ * The order does not protect the other members' copies: those are all
+ * enqueued before the BVI copy is processed and share the packet's
+ * data with it. BVI processing may turn the packet into something else
+ * entirely (an ARP request into an ARP reply, an ICMP request into an
+ * ICMP reply), so the BVI always gets a full copy, see l2flood_unshare.
  */
+static_always_inline u32 *
+l2flood_get_members (l2_flood_member_t * members,
+                     u32 sw_if_index0,
+                     u8 in_shg,
+                     u32 * result)
+{
+  i32 i;  // signed
+
+  vec_reset_length (result);
+  for (i = vec_len(members) - 1; i >= 0; i--) {
+    // Skip the reflection and split-horizon members
+    if ((members[i].sw_if_index == sw_if_index0) ||
+        (in_shg && members[i].shg == in_shg))
+      continue;
+    vec_add1 (result, i);
+  }
+  return result;
+}
 
-static_always_inline void
-l2flood_process (vlib_main_t * vm,
-                 vlib_node_runtime_t * node,
+/*
+ * Replace a copy that shares data with the other copies by a full copy
+ * when its member can't take a clone. Returns ~0, having freed the
+ * clone, if buffers ran out.
+ */
+static_always_inline u32
+l2flood_unshare (vlib_main_t * vm,
                  l2flood_main_t * msm,
-                 u64 * counter_base,
-                 vlib_buffer_t * b0,
-                 u32 * sw_if_index0,
-                 l2fib_entry_key_t * key0,
-		 u32 * bucket0,
-                 l2fib_entry_result_t * result0,
-                 u32 * next0)
+                 u32 bi0,
+                 l2_flood_member_t * member)
 {
-  u16 bd_index0;
-  l2_bridge_domain_t *bd_config;
-  l2_flood_member_t * members;
-  i32 current_member;  // signed
-  replication_context_t * ctx;
-  u8 in_shg = vnet_buffer(b0)->l2.shg;
-
-  if (!replication_is_recycled(b0)) {
-
-    // Do flood "prep node" processing
-
-    // Get config for the bridge domain interface
-    bd_index0 = vnet_buffer(b0)->l2.bd_index;
-    bd_config = vec_elt_at_index(l2input_main.bd_configs, bd_index0);
-    members = bd_config->members;
-
-    // Find first member that passes the reflection and SHG checks
-    current_member = vec_len(members) - 1;
-    while ((current_member >= 0) && 
-           ((members[current_member].sw_if_index == *sw_if_index0) ||
-	    (in_shg && members[current_member].shg == in_shg))) {
-      current_member--;
-    }
-
-    if (current_member < 0) {
-      // No members to flood to
-      *next0 = L2FLOOD_NEXT_DROP;
-      b0->error = node->errors[L2FLOOD_ERROR_NO_MEMBERS];
-      return;
-    }
-
-    if ((current_member > 0) &&
-        ((current_member > 1) || 
-	 ((members[0].sw_if_index != *sw_if_index0) &&
-	  (!in_shg || members[0].shg != in_shg)))) {
-      // If more than one member then initiate replication
-      ctx = replication_prep (vm, b0, l2flood_node.index, 1 /* l2_packet */);
-      ctx->feature_replicas = (uword) members;
-      ctx->feature_counter = current_member;
-    }
-
-  } else {
-    vnet_buffer_opaque_t *vnet_buff_op;
-
-    // Do flood "recycle node" processing
-
-    if (PREDICT_FALSE(b0->flags & VLIB_BUFFER_REPL_FAIL))
-      {
-	(void)replication_recycle (vm, b0, 1 /* is_last */);
-	*next0 = L2FLOOD_NEXT_DROP;
-	b0->error = node->errors[L2FLOOD_ERROR_REPL_FAIL];
-	return;
-      }
-
-    ctx = replication_get_ctx (b0);
-    replication_clear_recycled (b0);
-
-    members = (l2_flood_member_t *)(intptr_t) ctx->feature_replicas;
-    current_member = (i32)ctx->feature_counter - 1;
-
-    // Need to update input index from saved packet context
-    vnet_buff_op = (vnet_buffer_opaque_t *)ctx->vnet_buffer;
-    *sw_if_index0 = vnet_buff_op->sw_if_index[VLIB_RX];
-
-    // Find next member that passes the reflection and SHG check
-    while ((current_member >= 0) &&
-           ((members[current_member].sw_if_index == *sw_if_index0) ||
-	    (in_shg && members[current_member].shg == in_shg))) {
-      current_member--;
-    }
-
-    if (current_member < 0) {
-      // No more members to flood to.
-      // Terminate replication and drop packet.
+  vlib_buffer_t * b0 = vlib_get_buffer (vm, bi0);
+  vnet_hw_interface_t * hw0;
+  u32 copy0;
+
+  if (PREDICT_TRUE (!(b0->flags & VLIB_BUFFER_NEXT_PRESENT)
+                    || !vlib_buffer_is_shared
+                    (vlib_get_buffer (vm, b0->next_buffer))))
+    return bi0;
+
+  if (PREDICT_TRUE (member->flags == L2_FLOOD_MEMBER_NORMAL)) {
+    hw0 = vnet_get_sup_hw_interface (msm->vnet_main, member->sw_if_index);
+    if (PREDICT_TRUE (!(hw0->flags & VNET_HW_INTERFACE_FLAG_NO_MULTI_SEG)))
+      return bi0;
+  }
 
-      replication_recycle (vm, b0, 1 /* is_last */);
+  copy0 = vlib_buffer_copy (vm, b0);
+  vlib_buffer_free_one (vm, bi0);
+  return copy0;
+}
 
-      *next0 = L2FLOOD_NEXT_DROP;
-      // Ideally we woudn't bump a counter here, just silently complete
-      b0->error = node->errors[L2FLOOD_ERROR_NO_MEMBERS];
-      return;
-    }
+/*
+ * Forward one copy of the packet to a member
+ */
+static_always_inline u32
+l2flood_forward (vlib_main_t * vm,
+                 vlib_node_runtime_t * node,
+                 l2flood_main_t * msm,
+                 vlib_buffer_t * b0,
+                 l2_flood_member_t * member)
+{
+  u32 next0;
+  u32 rc;
 
-    // Restore packet and context and continue replication
-    ctx->feature_counter = current_member;
-    replication_recycle (vm, b0,
-       ((current_member == 0) || /*is_last */ 
-        ((current_member == 1) && 
-	 ((members[0].sw_if_index == *sw_if_index0) ||
-	  (in_shg && members[0].shg == in_shg)))));
+  if (PREDICT_TRUE(member->flags == L2_FLOOD_MEMBER_NORMAL)) {
+    // Do normal L2 forwarding
+    vnet_buffer(b0)->sw_if_index[VLIB_TX] = member->sw_if_index;
+    return L2FLOOD_NEXT_L2_OUTPUT;
   }
 
-  // Forward packet to the current member
-
-  if (PREDICT_TRUE(members[current_member].flags == L2_FLOOD_MEMBER_NORMAL)) {
-    // Do normal L2 forwarding
-    vnet_buffer(b0)->sw_if_index[VLIB_TX] = members[current_member].sw_if_index;
-    *next0 = L2FLOOD_NEXT_L2_OUTPUT;
-
-  } else {
-    // Do BVI processing
-    u32 rc;
-    rc = l2_to_bvi (vm,
-                    msm->vnet_main,
-                    b0, 
-                    members[current_member].sw_if_index,
-                    &msm->l3_next,
-                    next0);
-
-    if (PREDICT_FALSE(rc)) {
-      if (rc == TO_BVI_ERR_BAD_MAC) {
-        b0->error = node->errors[L2FLOOD_ERROR_BVI_BAD_MAC];
-        *next0 = L2FLOOD_NEXT_DROP;
-      } else if (rc == TO_BVI_ERR_ETHERTYPE) {
-        b0->error = node->errors[L2FLOOD_ERROR_BVI_ETHERTYPE];
-        *next0 = L2FLOOD_NEXT_DROP;
-      }
+  // Do BVI processing
+  rc = l2_to_bvi (vm,
+                  msm->vnet_main,
+                  b0, 
+                  member->sw_if_index,
+                  &msm->l3_next,
+                  &next0);
+
+  if (PREDICT_FALSE(rc)) {
+    if (rc == TO_BVI_ERR_BAD_MAC) {
+      b0->error = node->errors[L2FLOOD_ERROR_BVI_BAD_MAC];
+      next0 = L2FLOOD_NEXT_DROP;
+    } else if (rc == TO_BVI_ERR_ETHERTYPE) {
+      b0->error = node->errors[L2FLOOD_ERROR_BVI_ETHERTYPE];
+      next0 = L2FLOOD_NEXT_DROP;
     }
   }
-
+  return next0;
 }
 
 
@@ -268,9 +230,10 @@ l2flood_node_fn (vlib_main_t * vm,
   u32 n_left_from, * from, * to_next;
   l2flood_next_t next_index;
   l2flood_main_t * msm = &l2flood_main;
-  vlib_node_t *n = vlib_get_node (vm, l2flood_node.index);
-  u32 node_counter_base_index = n->error_heap_index;
-  vlib_error_main_t * em = &vm->error_main;
+  u32 cpu_index = vm->cpu_index;
+  u32 * member_indices = msm->members_by_cpu[cpu_index];
+  u32 * clones = msm->clones_by_cpu[cpu_index];
+  u32 n_repl_fail = 0;
 
   from = vlib_frame_vector_args (frame);
   n_left_from = frame->n_vectors; /* number of packets to process */
@@ -284,120 +247,28 @@ l2flood_node_fn (vlib_main_t * vm,
       vlib_get_next_frame (vm, node, next_index,
 			   to_next, n_left_to_next);
 
-      while (n_left_from >= 6 && n_left_to_next >= 2)
-	{
-          u32 bi0, bi1;
-	  vlib_buffer_t * b0, * b1;
-          u32 next0, next1;
-          u32 sw_if_index0, sw_if_index1;
-          l2fib_entry_key_t key0, key1;
-          l2fib_entry_result_t result0, result1;
-          u32 bucket0, bucket1;
-          
-	  /* Prefetch next iteration. */
-	  {
-	    vlib_buffer_t * p2, * p3, * p4, * p5;
-            
-	    p2 = vlib_get_buffer (vm, from[2]);
-	    p3 = vlib_get_buffer (vm, from[3]);
-	    p4 = vlib_get_buffer (vm, from[4]);
-	    p5 = vlib_get_buffer (vm, from[5]);
-            
-	    // Prefetch the buffer header for the N+2 loop iteration
-	    vlib_prefetch_buffer_header (p4, LOAD);
-	    vlib_prefetch_buffer_header (p5, LOAD);
-
- 	    // Prefetch the replication context for the N+1 loop iteration
-            // This depends on the buffer header above
-            replication_prefetch_ctx (p2);
-            replication_prefetch_ctx (p3);
-
- 	    // Prefetch the packet for the N+1 loop iteration
-	    CLIB_PREFETCH (p2->data, CLIB_CACHE_LINE_BYTES, STORE);
-	    CLIB_PREFETCH (p3->data, CLIB_CACHE_LINE_BYTES, STORE);
-	  }
-
-          /* speculatively enqueue b0 and b1 to the current next frame */
-          /* bi is "buffer index", b is pointer to the buffer */
-	  to_next[0] = bi0 = from[0];
-	  to_next[1] = bi1 = from[1];
-	  from += 2;
-	  to_next += 2;
-	  n_left_from -= 2;
-	  n_left_to_next -= 2;
-
-	  b0 = vlib_get_buffer (vm, bi0);
-	  b1 = vlib_get_buffer (vm, bi1);
- 
-          /* RX interface handles */
-          sw_if_index0 = vnet_buffer(b0)->sw_if_index[VLIB_RX];
-          sw_if_index1 = vnet_buffer(b1)->sw_if_index[VLIB_RX];
-
-            /* process 2 pkts */
-            em->counters[node_counter_base_index + L2FLOOD_ERROR_L2FLOOD] += 2;
-
-            l2flood_process (vm, node, msm, &em->counters[node_counter_base_index],
-                             b0, &sw_if_index0, &key0, &bucket0, &result0, &next0);
-
-            l2flood_process (vm, node, msm, &em->counters[node_counter_base_index],
-                             b1, &sw_if_index1, &key1, &bucket1, &result1, &next1);
-
-          if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE)))
-            {          
-              if (PREDICT_FALSE(b0->flags & VLIB_BUFFER_IS_TRACED)) 
-                {
-                  l2flood_trace_t *t = vlib_add_trace (vm, node, b0, sizeof (*t));
-		  ethernet_header_t * h0 = vlib_buffer_get_current (b0); 
-                  t->sw_if_index = sw_if_index0;
-                  t->bd_index = vnet_buffer(b0)->l2.bd_index;
-                  clib_memcpy(t->src, h0->src_address, 6);
-                  clib_memcpy(t->dst, h0->dst_address, 6);
-                }
-              if (PREDICT_FALSE(b1->flags & VLIB_BUFFER_IS_TRACED))
-                {
-                  l2flood_trace_t *t = vlib_add_trace (vm, node, b1, sizeof (*t));
-		  ethernet_header_t * h1 = vlib_buffer_get_current (b1); 
-                  t->sw_if_index = sw_if_index1;
-                  t->bd_index = vnet_buffer(b1)->l2.bd_index;
-                  clib_memcpy(t->src, h1->src_address, 6);
-                  clib_memcpy(t->dst, h1->dst_address, 6);
-                }
-            }
-
-            /* verify speculative enqueues, maybe switch current next frame */
-            /* if next0==next1==next_index then nothing special needs to be done */
-            vlib_validate_buffer_enqueue_x2 (vm, node, next_index,
-                                             to_next, n_left_to_next,
-                                             bi0, bi1, next0, next1);
-        }
-      
       while (n_left_from > 0 && n_left_to_next > 0)
 	{
           u32 bi0;
 	  vlib_buffer_t * b0;
           u32 next0;
           u32 sw_if_index0;
-          l2fib_entry_key_t key0;
-          l2fib_entry_result_t result0;
-          u32 bucket0;
+          l2_bridge_domain_t * bd_config;
+          l2_flood_member_t * members;
+          u32 n_members, n_clones, i;
 
-          /* speculatively enqueue b0 to the current next frame */
 	  bi0 = from[0];
-	  to_next[0] = bi0;
 	  from += 1;
-	  to_next += 1;
 	  n_left_from -= 1;
-	  n_left_to_next -= 1;
+
+          // Prefetch the buffer header for the next iteration
+          if (n_left_from > 0)
+            vlib_prefetch_buffer_with_index (vm, from[0], LOAD);
 
 	  b0 = vlib_get_buffer (vm, bi0);
 
+          /* RX interface handle */
           sw_if_index0 = vnet_buffer(b0)->sw_if_index[VLIB_RX];
- 
-          /* process 1 pkt */
-          em->counters[node_counter_base_index + L2FLOOD_ERROR_L2FLOOD] += 1;
-
-          l2flood_process (vm, node, msm, &em->counters[node_counter_base_index],
-                           b0, &sw_if_index0, &key0, &bucket0, &result0, &next0);
 
           if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE) &&
                             (b0->flags & VLIB_BUFFER_IS_TRACED)))
@@ -410,6 +281,87 @@ l2flood_node_fn (vlib_main_t * vm,
               clib_memcpy(t->dst, h0->dst_address, 6);
             }
 
+          // Get config for the bridge domain interface
+          bd_config = vec_elt_at_index(l2input_main.bd_configs,
+                                       vnet_buffer(b0)->l2.bd_index);
+          members = bd_config->members;
+
+          member_indices = l2flood_get_members (members, sw_if_index0,
+                                                vnet_buffer(b0)->l2.shg,
+                                                member_indices);
+          n_members = vec_len (member_indices);
+
+          if (PREDICT_FALSE(n_members == 0)) {
+            // No members to flood to
+            next0 = L2FLOOD_NEXT_DROP;
+            b0->error = node->errors[L2FLOOD_ERROR_NO_MEMBERS];
+            goto enqueue;
+          }
+
+          if (n_members > 1) {
+            vec_validate (clones, n_members - 1);
+            n_clones = vlib_buffer_clone (vm, bi0, clones, n_members,
+                                          L2FLOOD_CLONE_HEAD_SIZE);
+            n_repl_fail += n_members - n_clones;
+
+            // All copies but the last go straight to l2-output
+            if (n_clones > 1 && next_index != L2FLOOD_NEXT_L2_OUTPUT) {
+              vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+              next_index = L2FLOOD_NEXT_L2_OUTPUT;
+              vlib_get_next_frame (vm, node, next_index,
+                                   to_next, n_left_to_next);
+            }
+
+            for (i = 0; i < n_clones - 1; i++) {
+              vlib_buffer_t * c0;
+              l2_flood_member_t * m0 = vec_elt_at_index (members,
+                                                         member_indices[i]);
+              u32 ci0;
+
+              // Only the last member can be the BVI
+              ASSERT (m0->flags == L2_FLOOD_MEMBER_NORMAL);
+
+              ci0 = l2flood_unshare (vm, msm, clones[i], m0);
+              if (PREDICT_FALSE(ci0 == ~0)) {
+                n_repl_fail++;
+                continue;
+              }
+
+              c0 = vlib_get_buffer (vm, ci0);
+              vnet_buffer(c0)->sw_if_index[VLIB_TX] = m0->sw_if_index;
+
+              to_next[0] = ci0;
+              to_next += 1;
+              n_left_to_next -= 1;
+
+              if (PREDICT_FALSE(n_left_to_next == 0)) {
+                vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+                vlib_get_next_frame (vm, node, next_index,
+                                     to_next, n_left_to_next);
+              }
+            }
+
+            // The last copy takes the packet's own path below
+            bi0 = l2flood_unshare (vm, msm, clones[n_clones - 1],
+                                   vec_elt_at_index (members,
+                                                     member_indices[n_members - 1]));
+            if (PREDICT_FALSE(bi0 == ~0)) {
+              n_repl_fail++;
+              continue;
+            }
+            b0 = vlib_get_buffer (vm, bi0);
+          }
+
+          next0 = l2flood_forward (vm, node, msm, b0,
+                                   vec_elt_at_index (members,
+                                                     member_indices[n_members - 1]));
+
+        enqueue:
+          /* speculatively enqueue b0 to the current next frame */
+	  to_next[0] = bi0;
+	  to_next += 1;
+	  n_left_to_next -= 1;
+
           /* verify speculative enqueue, maybe switch current next frame */
 	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
 					   to_next, n_left_to_next,
@@ -419,6 +371,16 @@ l2flood_node_fn (vlib_main_t * vm,
       vlib_put_next_frame (vm, node, next_index, n_left_to_next);
     }
 
+  // The scratch vectors may have grown
+  msm->members_by_cpu[cpu_index] = member_indices;
+  msm->clones_by_cpu[cpu_index] = clones;
+
+  vlib_node_increment_counter (vm, node->node_index,
+                               L2FLOOD_ERROR_L2FLOOD, frame->n_vectors);
+  if (PREDICT_FALSE(n_repl_fail))
+    vlib_node_increment_counter (vm, node->node_index,
+                                 L2FLOOD_ERROR_REPL_FAIL, n_repl_fail);
+
   return frame->n_vectors;
 }
 
@@ -447,10 +409,14 @@ VLIB_NODE_FUNCTION_MULTIARCH (l2flood_node, l2flood_node_fn)
 clib_error_t *l2flood_init (vlib_main_t *vm)
 {
   l2flood_main_t * mp = &l2flood_main;
-    
+  vlib_thread_main_t * tm = vlib_get_thread_main();
+
   mp->vlib_main = vm;
   mp->vnet_main = vnet_get_main();
 
+  vec_validate (mp->members_by_cpu, tm->n_vlib_mains - 1);
+  vec_validate (mp->clones_by_cpu, tm->n_vlib_mains - 1);
+
   // Initialize the feature next-node indexes
   feat_bitmap_init_next_nodes(vm,
                               l2flood_node.index,
@@ -168,6 +168,65 @@ l2fwd_process (vlib_main_t * vm,
 }
 
 
+// The destination lookup is staged so the quad loop can hide the mac
+// table misses: a packet is hashed (and its bucket prefetched) one
+// iteration ahead, and its value page is prefetched at the top of the
+// iteration that searches. Packets l2-learn already looked up skip all
+// three stages.
+
+static_always_inline void
+l2fwd_key_hash (l2fwd_main_t * msm,
+                vlib_buffer_t * b0,
+                l2fib_lookup_key_t * k0)
+{
+  ethernet_header_t * h0 = vlib_buffer_get_current (b0);
+
+  if (vnet_buffer(b0)->l2.dst_result_valid)
+    return;
+
+  l2fib_lookup_hash (msm->mac_table, h0->dst_address,
+                     vnet_buffer(b0)->l2.bd_index, k0);
+}
+
+static_always_inline void
+l2fwd_key_prefetch (l2fwd_main_t * msm,
+                    vlib_buffer_t * b0,
+                    l2fib_lookup_key_t * k0)
+{
+  if (vnet_buffer(b0)->l2.dst_result_valid)
+    return;
+
+  l2fib_lookup_prefetch (msm->mac_table, k0);
+}
+
+static_always_inline void
+l2fwd_key_search (l2fwd_main_t * msm,
+                  vlib_buffer_t * b0,
+                  l2fib_lookup_key_t * k0,
+                  l2fib_entry_result_t * result0)
+{
+  if (vnet_buffer(b0)->l2.dst_result_valid)
+    result0->raw = vnet_buffer(b0)->l2.dst_result;
+  else
+    result0->raw = l2fib_lookup_search (msm->mac_table, k0);
+}
+
+static_always_inline void
+l2fwd_trace (vlib_main_t * vm,
+             vlib_node_runtime_t * node,
+             vlib_buffer_t * b0,
+             u32 sw_if_index0)
+{
+  ethernet_header_t * h0 = vlib_buffer_get_current (b0);
+  l2fwd_trace_t *t = vlib_add_trace (vm, node, b0, sizeof (*t));
+
+  t->sw_if_index = sw_if_index0;
+  t->bd_index = vnet_buffer(b0)->l2.bd_index;
+  clib_memcpy(t->src, h0->src_address, 6);
+  clib_memcpy(t->dst, h0->dst_address, 6);
+}
+
+
 static uword
 l2fwd_node_fn (vlib_main_t * vm,
 	       vlib_node_runtime_t * node,
@@ -179,14 +238,10 @@ l2fwd_node_fn (vlib_main_t * vm,
   vlib_node_t *n = vlib_get_node (vm, l2fwd_node.index);
   CLIB_UNUSED(u32 node_counter_base_index) = n->error_heap_index;
   vlib_error_main_t * em = &vm->error_main;
-  l2fib_entry_key_t cached_key;
-  l2fib_entry_result_t cached_result;
-
-  // Clear the one-entry cache in case mac table was updated
-  cached_key.raw = ~0; 
-  cached_result.raw = ~0;
+  l2fib_lookup_key_t keys[VLIB_FRAME_SIZE], * k;
+  u32 * from0, n_hashed = 0;
 
-  from = vlib_frame_vector_args (frame);
+  from = from0 = vlib_frame_vector_args (frame);
   n_left_from = frame->n_vectors; /* number of packets to process */
   next_index = node->cached_next_index;
 
@@ -198,95 +253,108 @@ l2fwd_node_fn (vlib_main_t * vm,
       vlib_get_next_frame (vm, node, next_index,
 			   to_next, n_left_to_next);
 
-      while (n_left_from >= 4 && n_left_to_next >= 2)
+      while (n_left_from >= 8 && n_left_to_next >= 4)
 	{
-          u32 bi0, bi1;
-	  vlib_buffer_t * b0, * b1;
-          u32 next0, next1;
-          u32 sw_if_index0, sw_if_index1;
-          ethernet_header_t * h0, * h1;
-          l2fib_entry_key_t key0, key1;
-          l2fib_entry_result_t result0, result1;
-          u32 bucket0, bucket1;
-          
+          u32 bi0, bi1, bi2, bi3;
+	  vlib_buffer_t * b0, * b1, * b2, * b3;
+          u32 next0, next1, next2, next3;
+          u32 sw_if_index0, sw_if_index1, sw_if_index2, sw_if_index3;
+          l2fib_entry_result_t result0, result1, result2, result3;
+
+          k = &keys[from - from0];
+
 	  /* Prefetch next iteration. */
 	  {
-	    vlib_buffer_t * p2, * p3;
-            
-	    p2 = vlib_get_buffer (vm, from[2]);
-	    p3 = vlib_get_buffer (vm, from[3]);
-            
-	    vlib_prefetch_buffer_header (p2, LOAD);
-	    vlib_prefetch_buffer_header (p3, LOAD);
-
-	    CLIB_PREFETCH (p2->data, CLIB_CACHE_LINE_BYTES, STORE);
-	    CLIB_PREFETCH (p3->data, CLIB_CACHE_LINE_BYTES, STORE);
+            // Stage 1: hash the packets of the next iteration
+            while (n_hashed < (from - from0) + 8)
+              {
+                l2fwd_key_hash (msm, vlib_get_buffer (vm, from0[n_hashed]),
+                                &keys[n_hashed]);
+                n_hashed++;
+              }
+
+            if (n_left_from >= 12)
+              {
+                vlib_buffer_t * p8, * p9, * p10, * p11;
+
+                p8 = vlib_get_buffer (vm, from[8]);
+                p9 = vlib_get_buffer (vm, from[9]);
+                p10 = vlib_get_buffer (vm, from[10]);
+                p11 = vlib_get_buffer (vm, from[11]);
+
+                vlib_prefetch_buffer_header (p8, LOAD);
+                vlib_prefetch_buffer_header (p9, LOAD);
+                vlib_prefetch_buffer_header (p10, LOAD);
+                vlib_prefetch_buffer_header (p11, LOAD);
+
+                CLIB_PREFETCH (p8->data, CLIB_CACHE_LINE_BYTES, STORE);
+                CLIB_PREFETCH (p9->data, CLIB_CACHE_LINE_BYTES, STORE);
+                CLIB_PREFETCH (p10->data, CLIB_CACHE_LINE_BYTES, STORE);
+                CLIB_PREFETCH (p11->data, CLIB_CACHE_LINE_BYTES, STORE);
+              }
 	  }
 
-          /* speculatively enqueue b0 and b1 to the current next frame */
+          /* speculatively enqueue b0..b3 to the current next frame */
           /* bi is "buffer index", b is pointer to the buffer */
 	  to_next[0] = bi0 = from[0];
 	  to_next[1] = bi1 = from[1];
-	  from += 2;
-	  to_next += 2;
-	  n_left_from -= 2;
-	  n_left_to_next -= 2;
+	  to_next[2] = bi2 = from[2];
+	  to_next[3] = bi3 = from[3];
+	  from += 4;
+	  to_next += 4;
+	  n_left_from -= 4;
+	  n_left_to_next -= 4;
 
 	  b0 = vlib_get_buffer (vm, bi0);
 	  b1 = vlib_get_buffer (vm, bi1);
+	  b2 = vlib_get_buffer (vm, bi2);
+	  b3 = vlib_get_buffer (vm, bi3);
+
+          // Stage 2: buckets arrived last iteration, fetch the pages
+          l2fwd_key_prefetch (msm, b0, &k[0]);
+          l2fwd_key_prefetch (msm, b1, &k[1]);
+          l2fwd_key_prefetch (msm, b2, &k[2]);
+          l2fwd_key_prefetch (msm, b3, &k[3]);
  
           /* RX interface handles */
           sw_if_index0 = vnet_buffer(b0)->sw_if_index[VLIB_RX];
           sw_if_index1 = vnet_buffer(b1)->sw_if_index[VLIB_RX];
-  
-          h0 = vlib_buffer_get_current (b0);
-          h1 = vlib_buffer_get_current (b1);
+          sw_if_index2 = vnet_buffer(b2)->sw_if_index[VLIB_RX];
+          sw_if_index3 = vnet_buffer(b3)->sw_if_index[VLIB_RX];
 
           if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE)))
             {
               if (b0->flags & VLIB_BUFFER_IS_TRACED) 
-                {
-                    l2fwd_trace_t *t = 
-                      vlib_add_trace (vm, node, b0, sizeof (*t));
-                    t->sw_if_index = sw_if_index0;
-                    t->bd_index = vnet_buffer(b0)->l2.bd_index;
-                    clib_memcpy(t->src, h0->src_address, 6);
-                    clib_memcpy(t->dst, h0->dst_address, 6);
-                  }
-                if (b1->flags & VLIB_BUFFER_IS_TRACED) 
-                  {
-                    l2fwd_trace_t *t = 
-                      vlib_add_trace (vm, node, b1, sizeof (*t));
-                    t->sw_if_index = sw_if_index1;
-                    t->bd_index = vnet_buffer(b1)->l2.bd_index;
-                    clib_memcpy(t->src, h1->src_address, 6);
-                    clib_memcpy(t->dst, h1->dst_address, 6);
-                  }
-              }
-
-            /* process 2 pkts */
+                l2fwd_trace (vm, node, b0, sw_if_index0);
+              if (b1->flags & VLIB_BUFFER_IS_TRACED) 
+                l2fwd_trace (vm, node, b1, sw_if_index1);
+              if (b2->flags & VLIB_BUFFER_IS_TRACED) 
+                l2fwd_trace (vm, node, b2, sw_if_index2);
+              if (b3->flags & VLIB_BUFFER_IS_TRACED) 
+                l2fwd_trace (vm, node, b3, sw_if_index3);
+            }
+
+          /* process 4 pkts */
 #ifdef COUNTERS
-            em->counters[node_counter_base_index + L2FWD_ERROR_L2FWD] += 2;
+          em->counters[node_counter_base_index + L2FWD_ERROR_L2FWD] += 4;
 #endif
-            l2fib_lookup_2 (msm->mac_table, &cached_key, &cached_result, 
-                            h0->dst_address, 
-                            h1->dst_address, 
-                            vnet_buffer(b0)->l2.bd_index, 
-                            vnet_buffer(b1)->l2.bd_index,
-                            &key0,    // not used
-                            &key1,    // not used
-                            &bucket0, // not used
-                            &bucket1, // not used
-                            &result0, 
-                            &result1);
-            l2fwd_process (vm, node, msm, em, b0, sw_if_index0, &result0, &next0);
-            l2fwd_process (vm, node, msm, em, b1, sw_if_index1, &result1, &next1);
-
-            /* verify speculative enqueues, maybe switch current next frame */
-            /* if next0==next1==next_index then nothing special needs to be done */
-            vlib_validate_buffer_enqueue_x2 (vm, node, next_index,
-                                             to_next, n_left_to_next,
-                                             bi0, bi1, next0, next1);
+          // Stage 3: search with the precomputed hashes
+          l2fwd_key_search (msm, b0, &k[0], &result0);
+          l2fwd_key_search (msm, b1, &k[1], &result1);
+          l2fwd_key_search (msm, b2, &k[2], &result2);
+          l2fwd_key_search (msm, b3, &k[3], &result3);
+
+          l2fwd_process (vm, node, msm, em, b0, sw_if_index0, &result0, &next0);
+          l2fwd_process (vm, node, msm, em, b1, sw_if_index1, &result1, &next1);
+          l2fwd_process (vm, node, msm, em, b2, sw_if_index2, &result2, &next2);
+          l2fwd_process (vm, node, msm, em, b3, sw_if_index3, &result3, &next3);
+
+          /* verify speculative enqueues, maybe switch current next frame */
+          /* if next0..next3 == next_index then nothing special needs to be done */
+          vlib_validate_buffer_enqueue_x4 (vm, node, next_index,
+                                           to_next, n_left_to_next,
+                                           bi0, bi1, bi2, bi3,
+                                           next0, next1, next2, next3);
         }
       
       while (n_left_from > 0 && n_left_to_next > 0)
@@ -295,10 +363,9 @@ l2fwd_node_fn (vlib_main_t * vm,
 	  vlib_buffer_t * b0;
           u32 next0;
           u32 sw_if_index0;
-          ethernet_header_t * h0;
-          l2fib_entry_key_t key0;
           l2fib_entry_result_t result0;
-          u32 bucket0;
+
+          k = &keys[from - from0];
 
           /* speculatively enqueue b0 to the current next frame */
 	  bi0 = from[0];
@@ -310,29 +377,24 @@ l2fwd_node_fn (vlib_main_t * vm,
 
 	  b0 = vlib_get_buffer (vm, bi0);
 
+          // Packets past the quad loop may not be hashed yet
+          if (k - keys >= n_hashed)
+            {
+              l2fwd_key_hash (msm, b0, k);
+              n_hashed++;
+            }
+
           sw_if_index0 = vnet_buffer(b0)->sw_if_index[VLIB_RX];
  
-          h0 = vlib_buffer_get_current (b0);
-
           if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE) 
-                            && (b0->flags & VLIB_BUFFER_IS_TRACED))) {
-            l2fwd_trace_t *t = 
-               vlib_add_trace (vm, node, b0, sizeof (*t));
-            t->sw_if_index = sw_if_index0;
-            t->bd_index = vnet_buffer(b0)->l2.bd_index;
-            clib_memcpy(t->src, h0->src_address, 6);
-            clib_memcpy(t->dst, h0->dst_address, 6);
-          }
+                            && (b0->flags & VLIB_BUFFER_IS_TRACED)))
+            l2fwd_trace (vm, node, b0, sw_if_index0);
 
           /* process 1 pkt */
 #ifdef COUNTERS
           em->counters[node_counter_base_index + L2FWD_ERROR_L2FWD] += 1;
 #endif
-          l2fib_lookup_1 (msm->mac_table, &cached_key, &cached_result, 
-                          h0->dst_address, vnet_buffer(b0)->l2.bd_index, 
-                          &key0,    // not used
-                          &bucket0, // not used
-                          &result0);
+          l2fwd_key_search (msm, b0, k, &result0);
           l2fwd_process (vm, node, msm, em, b0, sw_if_index0, &result0, &next0);
 
           /* verify speculative enqueue, maybe switch current next frame */
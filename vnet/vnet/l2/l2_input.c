@@ -201,6 +201,9 @@ classify_and_dispatch (vlib_main_t * vm,
   // Save split horizon group
   vnet_buffer(b0)->l2.shg = config->shg;
 
+  // No destination lookup has been done yet
+  vnet_buffer(b0)->l2.dst_result_valid = 0;
+
   if (config->xconnect) {
     // Set the output interface
     vnet_buffer(b0)->sw_if_index[VLIB_TX] = config->output_sw_if_index;
@@ -25,6 +25,8 @@
 #include <vnet/l2/feat_bitmap.h>
 #include <vnet/l2/l2_fib.h>
 #include <vnet/l2/l2_learn.h>
+#include <vnet/l2/l2_bd.h>
+#include <vlib/threads.h>
 
 #include <vppinfra/error.h>
 #include <vppinfra/hash.h>
@@ -69,6 +71,7 @@ static u8 * format_l2learn_trace (u8 * s, va_list * args)
 }
 
 static vlib_node_registration_t l2learn_node;
+static vlib_node_registration_t l2learn_process_node;
 
 #define foreach_l2learn_error				\
 _(L2LEARN,           "L2 learn packets")		\
@@ -77,7 +80,8 @@ _(MAC_MOVE,          "L2 mac moves")			\
 _(MAC_MOVE_VIOLATE,  "L2 mac move violations")		\
 _(LIMIT,             "L2 not learned due to limit")	\
 _(HIT,               "L2 learn hits")			\
-_(FILTER_DROP,       "L2 filter mac drops")     
+_(FILTER_DROP,       "L2 filter mac drops")		\
+_(QUEUE_FULL,        "L2 learn queue full")
 
 typedef enum {
 #define _(sym,str) L2LEARN_ERROR_##sym,
@@ -99,19 +103,22 @@ typedef enum {
 } l2learn_next_t;
 
 
-// Perform learning on one packet based on the mac table lookup result
+// Perform learning on one packet based on the mac table lookup result.
+// The mac table is not written here: new macs, moves and refreshes are
+// posted to the thread's ring for the l2-learn-process, so a mac storm
+// does not have every thread contending for the mac table writer lock.
 
 static_always_inline void
 l2learn_process (vlib_node_runtime_t * node,
                  l2learn_main_t * msm,
+                 l2learn_per_thread_t * pt,
                  u64 * counter_base,
                  vlib_buffer_t * b0,
                  u32 sw_if_index0,
                  l2fib_entry_key_t * key0,
-                 l2fib_entry_key_t * cached_key,
-		 u32 * bucket0,
                  l2fib_entry_result_t * result0,
-                 u32 * next0)
+                 u32 * next0,
+                 u8 timestamp)
 {
   u32 feature_bitmap;
 
@@ -131,38 +138,28 @@ l2learn_process (vlib_node_runtime_t * node,
 
   if (PREDICT_TRUE (result0->fields.sw_if_index == sw_if_index0)) {
     // The entry was in the table, and the sw_if_index matched, the normal case 
-
-    // TODO: for dataplane learning and aging, do this:
-    //       if refresh=0 and not a static mac, set refresh=1
     counter_base[L2LEARN_ERROR_HIT] += 1;
 
+    // Refresh the entry for aging. The timestamp only moves once a
+    // minute, so this is posted once a minute per active mac.
+    if (PREDICT_FALSE (result0->fields.timestamp != timestamp) &&
+        !result0->fields.static_mac) {
+      if (l2learn_post_event (pt, key0->raw, sw_if_index0, timestamp))
+        counter_base[L2LEARN_ERROR_QUEUE_FULL] += 1;
+    }
+
   } else if (result0->raw == ~0) {  
 
-    // The entry was not in table, so add it 
+    // The entry was not in table, ask the learner to add it.
+    // Learn limits are applied there.
 
     counter_base[L2LEARN_ERROR_MISS] += 1;
 
-    if (msm->global_learn_count == msm->global_learn_limit) {
-      // Global limit reached. Do not learn the mac but forward the packet.
-      // In the future, limits could also be per-interface or bridge-domain.
-      counter_base[L2LEARN_ERROR_LIMIT] += 1;
-      goto done;
-
-    } else {
-      BVT(clib_bihash_kv) kv;
-      // It is ok to learn
-
-      result0->raw = 0; // clear all fields
-      result0->fields.sw_if_index = sw_if_index0;
-      // TODO: set timestamp in entry to clock for dataplane aging
-      kv.key = key0->raw;
-      kv.value = result0->raw;
-
-      BV(clib_bihash_add_del) (msm->mac_table, &kv, 1 /* is_add */);
+    if (l2learn_post_event (pt, key0->raw, sw_if_index0, timestamp))
+      counter_base[L2LEARN_ERROR_QUEUE_FULL] += 1;
 
-      cached_key->raw = ~0;  // invalidate the cache
-      msm->global_learn_count++;
-    }
+    // Not in the table, so not a filter mac either
+    goto done;
 
   } else {
 
@@ -175,20 +172,11 @@ l2learn_process (vlib_node_runtime_t * node,
       b0->error = node->errors[L2LEARN_ERROR_MAC_MOVE_VIOLATE];
       *next0 = L2LEARN_NEXT_DROP;
     } else {
-      // Update the entry
-      // TODO: may want to rate limit mac moves
-      // TODO: check global/bridge domain/interface learn limits
-      BVT(clib_bihash_kv) kv;
-
-      result0->raw = 0; // clear all fields
-      result0->fields.sw_if_index = sw_if_index0;
- 
-      kv.key = key0->raw;
-      kv.value = result0->raw;
-
-      cached_key->raw = ~0;  // invalidate the cache
-
-      BV(clib_bihash_add_del) (msm->mac_table, &kv, 1 /* is_add */);
+      // Ask the learner to update the entry.
+      // The recent event filter limits a flapping mac to one update
+      // per interface change.
+      if (l2learn_post_event (pt, key0->raw, sw_if_index0, timestamp))
+        counter_base[L2LEARN_ERROR_QUEUE_FULL] += 1;
     }
   }
 
@@ -207,6 +195,113 @@ done:
 }
 
 
+// The source lookup is staged so the quad loop can hide the mac table
+// misses: a packet is hashed (and its bucket prefetched) one iteration
+// ahead, and its value page is prefetched at the top of the iteration
+// that searches.
+//
+// When the packet goes on to l2-fwd with nothing in between that
+// rewrites the mac addresses, the destination is looked up in the same
+// stages and handed to l2-fwd in the buffer, so both lookups share one
+// trip through the pipeline.
+
+always_inline int
+l2learn_wants_dst (vlib_buffer_t * b0)
+{
+  return ((vnet_buffer(b0)->l2.feature_bitmap &
+           (L2INPUT_FEAT_FWD | L2INPUT_FEAT_RW)) == L2INPUT_FEAT_FWD);
+}
+
+static_always_inline void
+l2learn_key_hash (l2learn_main_t * msm,
+                  vlib_buffer_t * b0,
+                  l2fib_lookup_key_t * src0,
+                  l2fib_lookup_key_t * dst0)
+{
+  ethernet_header_t * h0 = vlib_buffer_get_current (b0);
+  u16 bd_index0 = vnet_buffer(b0)->l2.bd_index;
+
+  l2fib_lookup_hash (msm->mac_table, h0->src_address, bd_index0, src0);
+  if (l2learn_wants_dst (b0))
+    l2fib_lookup_hash (msm->mac_table, h0->dst_address, bd_index0, dst0);
+}
+
+static_always_inline void
+l2learn_key_prefetch (l2learn_main_t * msm,
+                      vlib_buffer_t * b0,
+                      l2fib_lookup_key_t * src0,
+                      l2fib_lookup_key_t * dst0)
+{
+  l2fib_lookup_prefetch (msm->mac_table, src0);
+  if (l2learn_wants_dst (b0))
+    l2fib_lookup_prefetch (msm->mac_table, dst0);
+}
+
+static_always_inline void
+l2learn_key_search (l2learn_main_t * msm,
+                    vlib_buffer_t * b0,
+                    l2fib_lookup_key_t * src0,
+                    l2fib_lookup_key_t * dst0,
+                    l2fib_entry_key_t * key0,
+                    l2fib_entry_result_t * result0)
+{
+  key0->raw = src0->kv.key;
+  result0->raw = l2fib_lookup_search (msm->mac_table, src0);
+
+  if (l2learn_wants_dst (b0)) {
+    vnet_buffer(b0)->l2.dst_result = l2fib_lookup_search (msm->mac_table,
+                                                          dst0);
+    vnet_buffer(b0)->l2.dst_result_valid = 1;
+  }
+}
+
+static_always_inline void
+l2learn_trace (vlib_main_t * vm,
+               vlib_node_runtime_t * node,
+               vlib_buffer_t * b0,
+               u32 sw_if_index0)
+{
+  ethernet_header_t * h0 = vlib_buffer_get_current (b0);
+  l2learn_trace_t *t = vlib_add_trace (vm, node, b0, sizeof (*t));
+
+  t->sw_if_index = sw_if_index0;
+  t->bd_index = vnet_buffer(b0)->l2.bd_index;
+  clib_memcpy(t->src, h0->src_address, 6);
+  clib_memcpy(t->dst, h0->dst_address, 6);
+}
+
+
+static void
+l2learn_wakeup_rpc_callback (void * arg)
+{
+  vlib_process_signal_event (vlib_get_main (), l2learn_process_node.index,
+                             0 /* event type */, 0 /* event data */);
+}
+
+// Wake the idle learner. Only the first thread to find it idle signals
+// it, workers through an rpc to the main thread.
+static void
+l2learn_wake_learner (vlib_main_t * vm)
+{
+  l2learn_main_t * msm = &l2learn_main;
+
+  if (!__sync_bool_compare_and_swap (&msm->learner_idle, 1, 0))
+    return;
+
+  if (os_get_cpu_number () == 0)
+    {
+      l2learn_wakeup_rpc_callback (0);
+      return;
+    }
+#if DPDK > 0
+  {
+    void vl_api_rpc_call_main_thread (void *fp, u8 * data, u32 data_length);
+
+    vl_api_rpc_call_main_thread (l2learn_wakeup_rpc_callback, 0, 0);
+  }
+#endif
+}
+
 static uword
 l2learn_node_fn (vlib_main_t * vm,
 		  vlib_node_runtime_t * node,
@@ -218,17 +313,19 @@ l2learn_node_fn (vlib_main_t * vm,
   vlib_node_t *n = vlib_get_node (vm, l2learn_node.index);
   u32 node_counter_base_index = n->error_heap_index;
   vlib_error_main_t * em = &vm->error_main;
-  l2fib_entry_key_t cached_key;
-  l2fib_entry_result_t cached_result;
-
-  from = vlib_frame_vector_args (frame);
+  u64 * counter_base = &em->counters[node_counter_base_index];
+  u8 timestamp = l2fib_timestamp (vm);
+  l2learn_per_thread_t * pt = vec_elt_at_index (msm->per_thread,
+                                                vm->cpu_index);
+  l2fib_lookup_key_t src_keys[VLIB_FRAME_SIZE];
+  l2fib_lookup_key_t dst_keys[VLIB_FRAME_SIZE];
+  l2fib_lookup_key_t * ks, * kd;
+  u32 * from0, n_hashed = 0;
+
+  from = from0 = vlib_frame_vector_args (frame);
   n_left_from = frame->n_vectors; /* number of packets to process */
   next_index = node->cached_next_index;
  
-  // Clear the one-entry cache in case mac table was updated
-  cached_key.raw = ~0; 
-  cached_result.raw = ~0;       /* warning be gone */
-
   while (n_left_from > 0)
     {
       u32 n_left_to_next;
@@ -237,102 +334,113 @@ l2learn_node_fn (vlib_main_t * vm,
       vlib_get_next_frame (vm, node, next_index,
 			   to_next, n_left_to_next);
 
-      while (n_left_from >= 4 && n_left_to_next >= 2)
+      while (n_left_from >= 8 && n_left_to_next >= 4)
 	{
-          u32 bi0, bi1;
-	  vlib_buffer_t * b0, * b1;
-          u32 next0, next1;
-          u32 sw_if_index0, sw_if_index1;
-          ethernet_header_t * h0, * h1;
-          l2fib_entry_key_t key0, key1;
-          l2fib_entry_result_t result0, result1;
-          u32 bucket0, bucket1;
-          
+          u32 bi0, bi1, bi2, bi3;
+	  vlib_buffer_t * b0, * b1, * b2, * b3;
+          u32 next0, next1, next2, next3;
+          u32 sw_if_index0, sw_if_index1, sw_if_index2, sw_if_index3;
+          l2fib_entry_key_t key0, key1, key2, key3;
+          l2fib_entry_result_t result0, result1, result2, result3;
+
+          ks = &src_keys[from - from0];
+          kd = &dst_keys[from - from0];
+
 	  /* Prefetch next iteration. */
 	  {
-	    vlib_buffer_t * p2, * p3;
-            
-	    p2 = vlib_get_buffer (vm, from[2]);
-	    p3 = vlib_get_buffer (vm, from[3]);
-            
-	    vlib_prefetch_buffer_header (p2, LOAD);
-	    vlib_prefetch_buffer_header (p3, LOAD);
-
-	    CLIB_PREFETCH (p2->data, CLIB_CACHE_LINE_BYTES, STORE);
-	    CLIB_PREFETCH (p3->data, CLIB_CACHE_LINE_BYTES, STORE);
+            // Stage 1: hash the packets of the next iteration
+            while (n_hashed < (from - from0) + 8)
+              {
+                l2learn_key_hash (msm, vlib_get_buffer (vm, from0[n_hashed]),
+                                  &src_keys[n_hashed], &dst_keys[n_hashed]);
+                n_hashed++;
+              }
+
+            if (n_left_from >= 12)
+              {
+                vlib_buffer_t * p8, * p9, * p10, * p11;
+
+                p8 = vlib_get_buffer (vm, from[8]);
+                p9 = vlib_get_buffer (vm, from[9]);
+                p10 = vlib_get_buffer (vm, from[10]);
+                p11 = vlib_get_buffer (vm, from[11]);
+
+                vlib_prefetch_buffer_header (p8, LOAD);
+                vlib_prefetch_buffer_header (p9, LOAD);
+                vlib_prefetch_buffer_header (p10, LOAD);
+                vlib_prefetch_buffer_header (p11, LOAD);
+
+                CLIB_PREFETCH (p8->data, CLIB_CACHE_LINE_BYTES, STORE);
+                CLIB_PREFETCH (p9->data, CLIB_CACHE_LINE_BYTES, STORE);
+                CLIB_PREFETCH (p10->data, CLIB_CACHE_LINE_BYTES, STORE);
+                CLIB_PREFETCH (p11->data, CLIB_CACHE_LINE_BYTES, STORE);
+              }
 	  }
 
-          /* speculatively enqueue b0 and b1 to the current next frame */
+          /* speculatively enqueue b0..b3 to the current next frame */
           /* bi is "buffer index", b is pointer to the buffer */
 	  to_next[0] = bi0 = from[0];
 	  to_next[1] = bi1 = from[1];
-	  from += 2;
-	  to_next += 2;
-	  n_left_from -= 2;
-	  n_left_to_next -= 2;
+	  to_next[2] = bi2 = from[2];
+	  to_next[3] = bi3 = from[3];
+	  from += 4;
+	  to_next += 4;
+	  n_left_from -= 4;
+	  n_left_to_next -= 4;
 
 	  b0 = vlib_get_buffer (vm, bi0);
 	  b1 = vlib_get_buffer (vm, bi1);
+	  b2 = vlib_get_buffer (vm, bi2);
+	  b3 = vlib_get_buffer (vm, bi3);
+
+          // Stage 2: buckets arrived last iteration, fetch the pages
+          l2learn_key_prefetch (msm, b0, &ks[0], &kd[0]);
+          l2learn_key_prefetch (msm, b1, &ks[1], &kd[1]);
+          l2learn_key_prefetch (msm, b2, &ks[2], &kd[2]);
+          l2learn_key_prefetch (msm, b3, &ks[3], &kd[3]);
  
           /* RX interface handles */
           sw_if_index0 = vnet_buffer(b0)->sw_if_index[VLIB_RX];
           sw_if_index1 = vnet_buffer(b1)->sw_if_index[VLIB_RX];
-
-          /* Process 2 x pkts */
-
-          h0 = vlib_buffer_get_current (b0);
-          h1 = vlib_buffer_get_current (b1);
+          sw_if_index2 = vnet_buffer(b2)->sw_if_index[VLIB_RX];
+          sw_if_index3 = vnet_buffer(b3)->sw_if_index[VLIB_RX];
 
           if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE)))
             {
               if (b0->flags & VLIB_BUFFER_IS_TRACED) 
-                {
-                  l2learn_trace_t *t = 
-                    vlib_add_trace (vm, node, b0, sizeof (*t));
-                  t->sw_if_index = sw_if_index0;
-                  t->bd_index = vnet_buffer(b0)->l2.bd_index;
-                  clib_memcpy(t->src, h0->src_address, 6);
-                  clib_memcpy(t->dst, h0->dst_address, 6);
-                }
+                l2learn_trace (vm, node, b0, sw_if_index0);
               if (b1->flags & VLIB_BUFFER_IS_TRACED) 
-                {
-                  l2learn_trace_t *t = 
-                    vlib_add_trace (vm, node, b1, sizeof (*t));
-                  t->sw_if_index = sw_if_index1;
-                  t->bd_index = vnet_buffer(b1)->l2.bd_index;
-                  clib_memcpy(t->src, h1->src_address, 6);
-                  clib_memcpy(t->dst, h1->dst_address, 6);
-                }
+                l2learn_trace (vm, node, b1, sw_if_index1);
+              if (b2->flags & VLIB_BUFFER_IS_TRACED) 
+                l2learn_trace (vm, node, b2, sw_if_index2);
+              if (b3->flags & VLIB_BUFFER_IS_TRACED) 
+                l2learn_trace (vm, node, b3, sw_if_index3);
             }
 
-            /* process 2 pkts */
-            em->counters[node_counter_base_index + L2LEARN_ERROR_L2LEARN] += 2;
-
-            l2fib_lookup_2 (msm->mac_table, &cached_key, &cached_result,
-                            h0->src_address, 
-                            h1->src_address, 
-                            vnet_buffer(b0)->l2.bd_index,
-                            vnet_buffer(b1)->l2.bd_index,
-                            &key0,
-                            &key1,
-                            &bucket0,
-                            &bucket1,
-                            &result0,
-                            &result1);
-
-            l2learn_process (node, msm, &em->counters[node_counter_base_index],
-                             b0, sw_if_index0, &key0, &cached_key,
-                             &bucket0, &result0, &next0);
-
-            l2learn_process (node, msm, &em->counters[node_counter_base_index],
-                             b1, sw_if_index1, &key1, &cached_key,
-                             &bucket1, &result1, &next1);
-
-            /* verify speculative enqueues, maybe switch current next frame */
-            /* if next0==next1==next_index then nothing special needs to be done */
-            vlib_validate_buffer_enqueue_x2 (vm, node, next_index,
-                                             to_next, n_left_to_next,
-                                             bi0, bi1, next0, next1);
+          /* process 4 pkts */
+          counter_base[L2LEARN_ERROR_L2LEARN] += 4;
+
+          // Stage 3: search with the precomputed hashes
+          l2learn_key_search (msm, b0, &ks[0], &kd[0], &key0, &result0);
+          l2learn_key_search (msm, b1, &ks[1], &kd[1], &key1, &result1);
+          l2learn_key_search (msm, b2, &ks[2], &kd[2], &key2, &result2);
+          l2learn_key_search (msm, b3, &ks[3], &kd[3], &key3, &result3);
+
+          l2learn_process (node, msm, pt, counter_base, b0, sw_if_index0,
+                           &key0, &result0, &next0, timestamp);
+          l2learn_process (node, msm, pt, counter_base, b1, sw_if_index1,
+                           &key1, &result1, &next1, timestamp);
+          l2learn_process (node, msm, pt, counter_base, b2, sw_if_index2,
+                           &key2, &result2, &next2, timestamp);
+          l2learn_process (node, msm, pt, counter_base, b3, sw_if_index3,
+                           &key3, &result3, &next3, timestamp);
+
+          /* verify speculative enqueues, maybe switch current next frame */
+          /* if next0..next3 == next_index then nothing special needs to be done */
+          vlib_validate_buffer_enqueue_x4 (vm, node, next_index,
+                                           to_next, n_left_to_next,
+                                           bi0, bi1, bi2, bi3,
+                                           next0, next1, next2, next3);
         }
       
       while (n_left_from > 0 && n_left_to_next > 0)
@@ -341,10 +449,11 @@ l2learn_node_fn (vlib_main_t * vm,
 	  vlib_buffer_t * b0;
           u32 next0;
           u32 sw_if_index0;
-          ethernet_header_t * h0;
           l2fib_entry_key_t key0;
           l2fib_entry_result_t result0;
-          u32 bucket0;
+
+          ks = &src_keys[from - from0];
+          kd = &dst_keys[from - from0];
 
           /* speculatively enqueue b0 to the current next frame */
 	  bi0 = from[0];
@@ -356,32 +465,25 @@ l2learn_node_fn (vlib_main_t * vm,
 
 	  b0 = vlib_get_buffer (vm, bi0);
 
+          // Packets past the quad loop may not be hashed yet
+          if (ks - src_keys >= n_hashed)
+            {
+              l2learn_key_hash (msm, b0, ks, kd);
+              n_hashed++;
+            }
+
           sw_if_index0 = vnet_buffer(b0)->sw_if_index[VLIB_RX];
  
-          h0 = vlib_buffer_get_current (b0);
-
           if (PREDICT_FALSE((node->flags & VLIB_NODE_FLAG_TRACE) 
-                            && (b0->flags & VLIB_BUFFER_IS_TRACED))) {
-            l2learn_trace_t *t = 
-               vlib_add_trace (vm, node, b0, sizeof (*t));
-            t->sw_if_index = sw_if_index0;
-            t->bd_index = vnet_buffer(b0)->l2.bd_index;
-            clib_memcpy(t->src, h0->src_address, 6);
-            clib_memcpy(t->dst, h0->dst_address, 6);
-            }
+                            && (b0->flags & VLIB_BUFFER_IS_TRACED)))
+            l2learn_trace (vm, node, b0, sw_if_index0);
 
           /* process 1 pkt */
-          em->counters[node_counter_base_index + L2LEARN_ERROR_L2LEARN] += 1;
-
-          l2fib_lookup_1 (msm->mac_table, &cached_key, &cached_result, 
-                          h0->src_address, vnet_buffer(b0)->l2.bd_index, 
-                          &key0,
-                          &bucket0,
-                          &result0);
+          counter_base[L2LEARN_ERROR_L2LEARN] += 1;
 
-          l2learn_process (node, msm, &em->counters[node_counter_base_index],
-                           b0, sw_if_index0, &key0, &cached_key,
-                           &bucket0, &result0, &next0);
+          l2learn_key_search (msm, b0, ks, kd, &key0, &result0);
+          l2learn_process (node, msm, pt, counter_base, b0, sw_if_index0,
+                           &key0, &result0, &next0, timestamp);
 
           /* verify speculative enqueue, maybe switch current next frame */
 	  vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
@@ -392,6 +494,10 @@ l2learn_node_fn (vlib_main_t * vm,
       vlib_put_next_frame (vm, node, next_index, n_left_to_next);
     }
 
+  // Wake the learner if these events found it asleep
+  if (PREDICT_FALSE (msm->learner_idle) && pt->tail != pt->head)
+    l2learn_wake_learner (vm);
+
   return frame->n_vectors;
 }
 
@@ -417,9 +523,221 @@ VLIB_REGISTER_NODE (l2learn_node,static) = {
 
 VLIB_NODE_FUNCTION_MULTIARCH (l2learn_node, l2learn_node_fn)
 
+static l2learn_limit_t *
+l2learn_limit_get (l2learn_limit_t ** limits, u32 index)
+{
+  l2learn_limit_t empty = { .limit = ~0, .count = 0 };
+
+  vec_validate_init_empty (*limits, index, empty);
+  return vec_elt_at_index (*limits, index);
+}
+
+static_always_inline void
+l2learn_limit_dec (l2learn_limit_t * limits, u32 index)
+{
+  if (index < vec_len (limits) && limits[index].count > 0)
+    limits[index].count--;
+}
+
+// A dynamic entry was added to the mac table by the cli or api
+void l2learn_count_add (u32 bd_index, u32 sw_if_index)
+{
+  l2learn_main_t * msm = &l2learn_main;
+
+  msm->global_learn_count++;
+  l2learn_limit_get (&msm->limit_by_bd_index, bd_index)->count++;
+  l2learn_limit_get (&msm->limit_by_sw_if_index, sw_if_index)->count++;
+}
+
+// A learned entry was removed from the mac table
+void l2learn_count_del (u32 bd_index, u32 sw_if_index)
+{
+  l2learn_main_t * msm = &l2learn_main;
+
+  if (msm->global_learn_count > 0)
+    msm->global_learn_count--;
+  l2learn_limit_dec (msm->limit_by_bd_index, bd_index);
+  l2learn_limit_dec (msm->limit_by_sw_if_index, sw_if_index);
+}
+
+// An entry left the mac table, so the next packet from it is posted
+// again rather than waiting for the recent filter's timestamp to expire.
+// Producers may race with this, costing at most a duplicate event.
+void l2learn_forget (u64 key)
+{
+  l2learn_main_t * msm = &l2learn_main;
+  l2learn_per_thread_t * pt;
+  l2learn_event_t * r;
+
+  vec_foreach (pt, msm->per_thread) {
+    r = &pt->recent[clib_xxhash (key) & (L2LEARN_RECENT_SIZE - 1)];
+    if (r->key == key)
+      r->sw_if_index = ~0;
+  }
+}
+
+// The mac table was emptied
+void l2learn_count_reset (void)
+{
+  l2learn_main_t * msm = &l2learn_main;
+  l2learn_per_thread_t * pt;
+  l2learn_limit_t * l;
+  u32 i;
+
+  vec_foreach (pt, msm->per_thread)
+    for (i = 0; i < L2LEARN_RECENT_SIZE; i++)
+      pt->recent[i].sw_if_index = ~0;
+
+  msm->global_learn_count = 0;
+  vec_foreach (l, msm->limit_by_bd_index)
+    l->count = 0;
+  vec_foreach (l, msm->limit_by_sw_if_index)
+    l->count = 0;
+}
+
+// A bridge domain was deleted, its index may be reused by a new one
+void l2learn_limit_bd_delete (u32 bd_index)
+{
+  l2learn_main_t * msm = &l2learn_main;
+
+  if (bd_index < vec_len (msm->limit_by_bd_index)) {
+    msm->limit_by_bd_index[bd_index].limit = ~0;
+    msm->limit_by_bd_index[bd_index].count = 0;
+  }
+}
+
+// Apply one learn event to the mac table. Returns 1 if a new mac was
+// not learned because of a learn limit.
+static int
+l2learn_apply_event (l2learn_main_t * msm, l2learn_event_t * e)
+{
+  BVT(clib_bihash_kv) kv;
+  l2fib_entry_key_t key;
+  l2fib_entry_result_t result;
+  l2learn_limit_t * bd_limit, * intf_limit;
+
+  key.raw = e->key;
+  kv.key = e->key;
+
+  if (BV(clib_bihash_search) (msm->mac_table, &kv, &kv) == 0) {
+    result.raw = kv.value;
+
+    // Made static since the event was posted
+    if (result.fields.static_mac)
+      return 0;
+
+    if (result.fields.sw_if_index == e->sw_if_index) {
+      // Refresh, or an event posted again by another thread
+      if (result.fields.timestamp == e->timestamp)
+        return 0;
+    } else {
+      // Mac move, the entry now counts against the new interface
+      l2learn_limit_dec (msm->limit_by_sw_if_index, result.fields.sw_if_index);
+      l2learn_limit_get (&msm->limit_by_sw_if_index, e->sw_if_index)->count++;
+    }
+  } else {
+    bd_limit = l2learn_limit_get (&msm->limit_by_bd_index, key.fields.bd_index);
+    intf_limit = l2learn_limit_get (&msm->limit_by_sw_if_index, e->sw_if_index);
+
+    if (msm->global_learn_count >= msm->global_learn_limit
+        || bd_limit->count >= bd_limit->limit
+        || intf_limit->count >= intf_limit->limit)
+      return 1;
+
+    msm->global_learn_count++;
+    bd_limit->count++;
+    intf_limit->count++;
+  }
+
+  result.raw = 0; // clear all fields
+  result.fields.sw_if_index = e->sw_if_index;
+  result.fields.timestamp = e->timestamp;
+  kv.key = key.raw;
+  kv.value = result.raw;
+
+  BV(clib_bihash_add_del) (msm->mac_table, &kv, 1 /* is_add */);
+  return 0;
+}
+
+static int
+l2learn_events_pending (l2learn_main_t * msm)
+{
+  l2learn_per_thread_t * pt;
+
+  vec_foreach (pt, msm->per_thread)
+    if (pt->head != pt->tail)
+      return 1;
+  return 0;
+}
+
+// The single writer of learned entries. Drains the learn event rings
+// of all threads into the mac table.
+static uword
+l2learn_process_fn (vlib_main_t * vm,
+                    vlib_node_runtime_t * rt,
+                    vlib_frame_t * f)
+{
+  l2learn_main_t * msm = &l2learn_main;
+  l2learn_per_thread_t * pt;
+  u32 head, tail, n_applied = 0, n_limited;
+
+  while (1) {
+    if (n_applied) {
+      // Busy, keep batching events without wakeups
+      vlib_process_suspend (vm, L2LEARN_PROCESS_INTERVAL);
+    } else {
+      // Idle, sleep until a thread posts an event. Go idle before
+      // checking the rings so an event posted meanwhile still wakes us.
+      msm->learner_idle = 1;
+      CLIB_MEMORY_BARRIER ();
+      if (!l2learn_events_pending (msm)) {
+        vlib_process_wait_for_event_or_clock (vm,
+                                              L2LEARN_PROCESS_IDLE_INTERVAL);
+        vlib_process_get_events (vm, 0);
+      }
+      msm->learner_idle = 0;
+    }
+
+    n_applied = n_limited = 0;
+
+    vec_foreach (pt, msm->per_thread) {
+      head = pt->head;
+      tail = pt->tail;
+      if (head == tail)
+        continue;
+
+      n_applied += tail - head;
+
+      // Read the events only after the tail which covers them
+      CLIB_MEMORY_BARRIER ();
+
+      for (; head != tail; head++)
+        n_limited += l2learn_apply_event
+          (msm, &pt->ring[head & (L2LEARN_RING_SIZE - 1)]);
+
+      // Done with the events before handing their slots back
+      CLIB_MEMORY_BARRIER ();
+      pt->head = head;
+    }
+
+    if (n_limited)
+      vlib_error_count (vm, l2learn_node.index, L2LEARN_ERROR_LIMIT,
+                        n_limited);
+  }
+
+  return 0;
+}
+
+VLIB_REGISTER_NODE (l2learn_process_node, static) = {
+  .function = l2learn_process_fn,
+  .type = VLIB_NODE_TYPE_PROCESS,
+  .name = "l2-learn-process",
+};
+
 clib_error_t *l2learn_init (vlib_main_t *vm)
 {
   l2learn_main_t * mp = &l2learn_main;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
     
   mp->vlib_main = vm;
   mp->vnet_main = vnet_get_main();
@@ -434,6 +752,10 @@ clib_error_t *l2learn_init (vlib_main_t *vm)
   /* init the hash table ptr */
   mp->mac_table = get_mac_table();
 
+  // One learn event ring per thread
+  vec_validate_aligned (mp->per_thread, tm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
+
   // Set the default number of dynamically learned macs to the number 
   // of buckets.
   mp->global_learn_limit = L2FIB_NUM_BUCKETS * 16;
@@ -483,6 +805,120 @@ VLIB_CLI_COMMAND (int_learn_cli, static) = {
 };
 
 
+// set the learn limit of an interface or bridge domain
+// The CLI format is:
+//    set interface l2 learn-limit <interface> <limit> | none
+//    set bridge-domain learn-limit <bd_id> <limit> | none
+static clib_error_t *
+learn_limit (vlib_main_t * vm,
+             unformat_input_t * input,
+             vlib_cli_command_t * cmd)
+{
+  l2learn_main_t * msm = &l2learn_main;
+  vnet_main_t * vnm = vnet_get_main();
+  bd_main_t * bdm = &bd_main;
+  l2learn_limit_t * l;
+  u32 index, bd_id, limit;
+  uword * p;
+
+  if (cmd->function_arg) {
+    if (! unformat (input, "%d", &bd_id))
+      return clib_error_return (0, "expecting bridge-domain id but got `%U'",
+                                format_unformat_error, input);
+    p = hash_get (bdm->bd_index_by_bd_id, bd_id);
+    if (p == 0)
+      return clib_error_return (0, "No such bridge domain %d", bd_id);
+    index = p[0];
+  } else {
+    if (! unformat_user (input, unformat_vnet_sw_interface, vnm, &index))
+      return clib_error_return (0, "unknown interface `%U'",
+                                format_unformat_error, input);
+  }
+
+  if (unformat (input, "none"))
+    limit = ~0;
+  else if (! unformat (input, "%u", &limit))
+    return clib_error_return (0, "expecting limit but got `%U'",
+                              format_unformat_error, input);
+
+  if (cmd->function_arg)
+    l = l2learn_limit_get (&msm->limit_by_bd_index, index);
+  else
+    l = l2learn_limit_get (&msm->limit_by_sw_if_index, index);
+
+  // Entries already learned beyond a lowered limit stay until they age
+  l->limit = limit;
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (int_learn_limit_cli, static) = {
+  .path = "set interface l2 learn-limit",
+  .short_help = "set interface l2 learn-limit <interface> <limit> | none",
+  .function = learn_limit,
+  .function_arg = 0,
+};
+
+VLIB_CLI_COMMAND (bd_learn_limit_cli, static) = {
+  .path = "set bridge-domain learn-limit",
+  .short_help = "set bridge-domain learn-limit <bridge-domain-id> <limit> | none",
+  .function = learn_limit,
+  .function_arg = 1,
+};
+
+static u8 * format_l2learn_limit (u8 * s, va_list * args)
+{
+  l2learn_limit_t * l = va_arg (*args, l2learn_limit_t *);
+
+  if (l->limit == ~0)
+    return format (s, "%d learned, no limit", l->count);
+  return format (s, "%d learned, limit %d", l->count, l->limit);
+}
+
+static clib_error_t *
+show_l2learn (vlib_main_t * vm,
+              unformat_input_t * input,
+              vlib_cli_command_t * cmd)
+{
+  l2learn_main_t * msm = &l2learn_main;
+  vnet_main_t * vnm = vnet_get_main();
+  l2learn_per_thread_t * pt;
+  l2learn_limit_t * l;
+  u32 i;
+
+  vlib_cli_output (vm, "%d learned, limit %d",
+                   msm->global_learn_count, msm->global_learn_limit);
+
+  vec_foreach_index (i, msm->per_thread) {
+    pt = vec_elt_at_index (msm->per_thread, i);
+    vlib_cli_output (vm, "  thread %d: %d events queued", i,
+                     pt->tail - pt->head);
+  }
+
+  vec_foreach (l, msm->limit_by_bd_index) {
+    if (l->count || l->limit != ~0)
+      vlib_cli_output (vm, "  bd_index %d: %U", l - msm->limit_by_bd_index,
+                       format_l2learn_limit, l);
+  }
+
+  vec_foreach (l, msm->limit_by_sw_if_index) {
+    if (l->count || l->limit != ~0)
+      vlib_cli_output (vm, "  %U: %U",
+                       format_vnet_sw_if_index_name, vnm,
+                       l - msm->limit_by_sw_if_index,
+                       format_l2learn_limit, l);
+  }
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (show_l2learn_cli, static) = {
+  .path = "show l2learn",
+  .short_help = "show l2learn",
+  .function = show_l2learn,
+};
+
+
 static clib_error_t *
 l2learn_config (vlib_main_t * vm, unformat_input_t * input)
 {
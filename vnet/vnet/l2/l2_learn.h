@@ -20,13 +20,66 @@
 
 #include <vlib/vlib.h>
 #include <vnet/ethernet/ethernet.h>
+#include <vppinfra/xxhash.h>
 
 
+// Learn events, posted by the threads running l2-learn and applied to
+// the mac table by the l2-learn-process on the main thread.
+// The event makes key map to sw_if_index, stamped with timestamp.
+typedef struct {
+  u64 key;
+  u32 sw_if_index;
+  u32 timestamp;
+} l2learn_event_t;
+
+// Events per thread, a power of 2
+#define L2LEARN_RING_SIZE 1024
+
+// Recently posted events, to avoid posting the same one for every
+// packet while it waits for the learner. A power of 2.
+#define L2LEARN_RECENT_SIZE 256
+
+// Seconds between learner runs while events keep arriving
+#define L2LEARN_PROCESS_INTERVAL 1e-3
+
+// Longest learner sleep while no events arrive. Threads posting to an
+// idle learner wake it, this only bounds the wait if a wakeup is lost.
+#define L2LEARN_PROCESS_IDLE_INTERVAL 1.0
+
+typedef struct {
+  // Written by the producer thread
+  CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+  volatile u32 tail;
+  l2learn_event_t recent[L2LEARN_RECENT_SIZE];
+
+  // Written by the learner
+  CLIB_CACHE_LINE_ALIGN_MARK(cacheline1);
+  volatile u32 head;
+
+  l2learn_event_t ring[L2LEARN_RING_SIZE];
+} l2learn_per_thread_t;
+
+// Learn limit and count, per bridge domain and per interface
+typedef struct {
+  u32 limit;
+  u32 count;
+} l2learn_limit_t;
+
 typedef struct {
 
   // Hash table
   BVT(clib_bihash) *mac_table;
 
+  // Per-thread event rings, indexed by cpu_index
+  l2learn_per_thread_t * per_thread;
+
+  // Set while the learner sleeps, cleared by the thread that wakes it
+  volatile u32 learner_idle;
+
+  // Learn limits, ~0 for none
+  l2learn_limit_t * limit_by_bd_index;
+  l2learn_limit_t * limit_by_sw_if_index;
+
   // number of dynamically learned mac entries
   u32 global_learn_count;
 
@@ -44,4 +97,42 @@ typedef struct {
 
 l2learn_main_t l2learn_main;
 
+// Post a learn event. Returns 0 if it was posted or was already
+// recently posted, 1 if the ring is full.
+static_always_inline int
+l2learn_post_event (l2learn_per_thread_t * pt,
+                    u64 key,
+                    u32 sw_if_index,
+                    u8 timestamp)
+{
+  l2learn_event_t * r, * e;
+  u32 tail;
+
+  r = &pt->recent[clib_xxhash (key) & (L2LEARN_RECENT_SIZE - 1)];
+  if (r->key == key && r->sw_if_index == sw_if_index
+      && r->timestamp == timestamp)
+    return 0;
+
+  tail = pt->tail;
+  if (PREDICT_FALSE (tail - pt->head >= L2LEARN_RING_SIZE))
+    return 1;
+
+  e = &pt->ring[tail & (L2LEARN_RING_SIZE - 1)];
+  e->key = key;
+  e->sw_if_index = sw_if_index;
+  e->timestamp = timestamp;
+  *r = *e;
+
+  // Make the event visible before the new tail
+  CLIB_MEMORY_BARRIER ();
+  pt->tail = tail + 1;
+  return 0;
+}
+
+void l2learn_count_add (u32 bd_index, u32 sw_if_index);
+void l2learn_count_del (u32 bd_index, u32 sw_if_index);
+void l2learn_forget (u64 key);
+void l2learn_count_reset (void);
+void l2learn_limit_bd_delete (u32 bd_index);
+
 #endif
@@ -100,19 +100,73 @@ VLIB_CLI_COMMAND (disable_streams_cli, static) = {
   .function_arg = 0,		/* is_enable */
 };
 
+static u8 * format_pg_replay (u8 * s, va_list * va)
+{
+  pg_replay_t * r = va_arg (*va, pg_replay_t *);
+  vlib_main_t * vm = vlib_get_main ();
+  pg_replay_per_thread_t * pt;
+  u64 n = 0, sum = 0, min = ~0ULL, max = 0;
+
+  s = format (s, "replay %s, %d packets, ",
+	      r->pcap.file_name, vec_len (r->pcap.packet_offsets));
+
+  if (r->n_threads > 0)
+    s = format (s, "workers %d, ", r->n_threads);
+
+  if (r->timing_speedup > 0)
+    s = format (s, "original-timing speedup %.2f, ", r->timing_speedup);
+
+  if (r->n_loops > 0)
+    s = format (s, "loop %d, ", r->n_loops);
+  else
+    s = format (s, "loop forever, ");
+
+  if (! r->is_latency)
+    return s;
+
+  vec_foreach (pt, r->per_thread)
+    {
+      n += pt->n_latency_samples;
+      sum += pt->latency_sum;
+      if (pt->n_latency_samples)
+	{
+	  min = clib_min (min, pt->latency_min);
+	  max = clib_max (max, pt->latency_max);
+	}
+    }
+
+  if (n == 0)
+    return format (s, "latency no samples, ");
+
+  return format (s, "latency min/avg/max %.2f/%.2f/%.2f us (%Ld samples), ",
+		 1e6 * min * vm->clib_time.seconds_per_clock,
+		 1e6 * ((f64) sum / n) * vm->clib_time.seconds_per_clock,
+		 1e6 * max * vm->clib_time.seconds_per_clock,
+		 n);
+}
+
 static u8 * format_pg_stream (u8 * s, va_list * va)
 {
   pg_stream_t * t = va_arg (*va, pg_stream_t *);
+  u64 n_packets_generated;
   u8 * v;
 
   if (! t)
     return format (s, "%=16s%=12s%=16s%s",
 		   "Name", "Enabled", "Count", "Parameters");
 
+  n_packets_generated = t->n_packets_generated;
+  if (t->replay)
+    {
+      pg_replay_per_thread_t * pt;
+      vec_foreach (pt, t->replay->per_thread)
+	n_packets_generated += pt->n_packets_generated;
+    }
+
   s = format (s, "%-16v%=12s%16Ld",
 	      t->name,
 	      pg_stream_is_enabled (t) ? "Yes" : "No",
-	      t->n_packets_generated);
+	      n_packets_generated);
 
   v = 0;
 
@@ -120,12 +174,18 @@ static u8 * format_pg_stream (u8 * s, va_list * va)
 
   v = format (v, "rate %.2e pps, ", t->rate_packets_per_second);
 
+  if (t->rate_bits_per_second > 0)
+    v = format (v, "rate-bps %.2e, ", t->rate_bits_per_second);
+
   v = format (v, "size %d%c%d, ",
 	      t->min_packet_bytes,
 	      t->packet_size_edit_type == PG_EDIT_RANDOM ? '+' : '-',
 	      t->max_packet_bytes);
 
-  v = format (v, "buffer-size %d, ", t->buffer_bytes);
+  if (t->replay)
+    v = format (v, "%U", format_pg_replay, t->replay);
+  else
+    v = format (v, "buffer-size %d, ", t->buffer_bytes);
 
   if (v)
     {
@@ -199,6 +259,9 @@ unformat_pg_stream_parameter (unformat_input_t * input, va_list * args)
   if (unformat (input, "limit %f", &x))
     s->n_packets_limit = x;
 
+  else if (unformat (input, "rate-bps %f", &x))
+    s->rate_bits_per_second = x;
+
   else if (unformat (input, "rate %f", &x))
     s->rate_packets_per_second = x;
 
@@ -229,9 +292,12 @@ validate_stream (pg_stream_t * s)
     return clib_error_create ("buffer-size must be positive and < 4096, given %d",
 			      s->buffer_bytes);
 
-  if (s->rate_packets_per_second < 0)
+  if (s->rate_packets_per_second < 0 || s->rate_bits_per_second < 0)
     return clib_error_create ("negative rate");
 
+  if (s->rate_bits_per_second > 0 && ! s->replay)
+    return clib_error_create ("rate-bps applies to replay streams only");
+
   return 0;
 }
 
@@ -249,6 +315,12 @@ new_stream (vlib_main_t * vm,
   pg_main_t * pg = &pg_main;
   pg_stream_t s = {0};
   char * pcap_file_name;
+  char * replay_file_name;
+  u32 n_replay_workers = 0;
+  u32 n_replay_loops = 1;
+  f64 replay_timing_speedup = 0;
+  int is_replay_latency = 0;
+  int replay_option_given = 0;
   
   s.sw_if_index[VLIB_RX] = s.sw_if_index[VLIB_TX] = ~0;
   s.node_index = ~0;
@@ -256,6 +328,7 @@ new_stream (vlib_main_t * vm,
   s.buffer_bytes = VLIB_BUFFER_DEFAULT_FREE_LIST_BYTES;
   s.if_id = 0;
   pcap_file_name = 0;
+  replay_file_name = 0;
   while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
     {
       if (unformat (input, "name %v", &tmp))
@@ -288,6 +361,28 @@ new_stream (vlib_main_t * vm,
       else if (unformat (input, "pcap %s", &pcap_file_name))
 	;
 
+      else if (unformat (input, "replay %s", &replay_file_name))
+	;
+
+      else if (unformat (input, "workers %u", &n_replay_workers))
+	replay_option_given = 1;
+
+      else if (unformat (input, "loop %u", &n_replay_loops))
+	replay_option_given = 1;
+
+      else if (unformat (input, "original-timing speedup %f",
+			 &replay_timing_speedup))
+	replay_option_given = 1;
+
+      else if (unformat (input, "original-timing"))
+	{
+	  replay_timing_speedup = 1;
+	  replay_option_given = 1;
+	}
+
+      else if (unformat (input, "latency"))
+	is_replay_latency = replay_option_given = 1;
+
       else if (! sub_input_given
 	       && unformat (input, "data %U", unformat_input, &sub_input))
 	sub_input_given++;
@@ -306,11 +401,41 @@ new_stream (vlib_main_t * vm,
 	}
     }
 
+  if (replay_file_name)
+    {
+      if (pcap_file_name || sub_input_given)
+	{
+	  error = clib_error_create ("replay excludes pcap and data");
+	  goto done;
+	}
+
+      if (replay_timing_speedup < 0)
+	{
+	  error = clib_error_create ("negative speedup");
+	  goto done;
+	}
+
+      error = pg_replay_init (&s, replay_file_name, n_replay_workers);
+      replay_file_name = 0;
+      if (error)
+	goto done;
+
+      s.replay->timing_speedup = replay_timing_speedup;
+      s.replay->n_loops = n_replay_loops;
+      s.replay->is_latency = is_replay_latency;
+    }
+  else if (replay_option_given)
+    {
+      error = clib_error_create ("workers, loop, original-timing and "
+				 "latency apply to replay streams only");
+      goto done;
+    }
+
   error = validate_stream (&s);
   if (error)
-    return error;
+    goto done;
 
-  if (! sub_input_given && ! pcap_file_name)
+  if (! sub_input_given && ! pcap_file_name && ! s.replay)
     {
       error = clib_error_create ("no packet data given");
       goto done;
@@ -318,7 +443,7 @@ new_stream (vlib_main_t * vm,
 
   if (s.node_index == ~0)
     {
-      if (pcap_file_name != 0)
+      if (pcap_file_name != 0 || s.replay)
 	{
 	  vlib_node_t * n = vlib_get_node_by_name(vm, (u8 *) "ethernet-input");
 	  s.node_index = n->index;
@@ -338,7 +463,10 @@ new_stream (vlib_main_t * vm,
     else
       n = 0;
 
-    if (pcap_file_name != 0)
+    if (s.replay)
+      ;
+
+    else if (pcap_file_name != 0)
       {
 	error = pg_pcap_read (&s, pcap_file_name);
 	if (error)
@@ -364,6 +492,7 @@ new_stream (vlib_main_t * vm,
 
  done:
   pg_stream_free (&s);
+  vec_free (replay_file_name);
   unformat_free (&sub_input);
   return error;
 }
@@ -381,7 +510,14 @@ VLIB_CLI_COMMAND (new_stream_cli, static) = {
   "interface STRING     interface for stream output \n"
   "node NODE-NAME       node for stream output\n"
   "data STRING          specifies packet data\n"
-  "pcap FILENAME        read packet data from pcap file\n",
+  "pcap FILENAME        read packet data from pcap file\n"
+  "replay FILENAME      replay pcap file mapped in memory\n"
+  "rate-bps BITS/SEC    replay rate in bits of packet data\n"
+  "original-timing [speedup X]\n"
+  "                     replay at capture timing, X times faster\n"
+  "loop N               passes over replay file, default 1, 0 for forever\n"
+  "workers N            spread replay over first N worker threads\n"
+  "latency              timestamp replayed packets, measured at pg output\n",
 };
 
 static clib_error_t *
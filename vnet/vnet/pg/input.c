@@ -1538,13 +1538,13 @@ static u8 * format_pg_input_trace (u8 * s, va_list * va)
 }
 
 static void
-pg_input_trace (pg_main_t * pg,
+pg_input_trace (vlib_main_t * vm,
+		pg_main_t * pg,
 		vlib_node_runtime_t * node,
 		pg_stream_t * s,
 		u32 * buffers,
 		u32 n_buffers)
 {
-  vlib_main_t * vm = pg->vlib_main;
   u32 * b, n_left, stream_index, next_index;
 
   n_left = n_buffers;
@@ -1654,7 +1654,7 @@ pg_generate_packets (vlib_node_runtime_t * node,
       if (n_trace > 0)
 	{
 	  u32 n = clib_min (n_trace, n_this_frame);
-	  pg_input_trace (pg, node, s, to_next, n);
+	  pg_input_trace (vm, pg, node, s, to_next, n);
 	  vlib_set_trace_count (vm, node, n_trace - n);
 	}
       n_packets_to_generate -= n_this_frame;
@@ -1717,6 +1717,275 @@ pg_input_stream (vlib_node_runtime_t * node,
   return n_packets;
 }
 
+/* Buffers needed for a replayed packet; the latency trailer
+   is never split across buffers. */
+always_inline u32
+pg_replay_n_buffers (u32 n_bytes, u32 n_trailer_bytes)
+{
+  u32 n, n_last;
+
+  if (n_bytes == 0)
+    return 1;
+
+  n = (n_bytes + VLIB_BUFFER_DATA_SIZE - 1) / VLIB_BUFFER_DATA_SIZE;
+  n_last = n_bytes - (n - 1) * VLIB_BUFFER_DATA_SIZE;
+  return n + (n_last + n_trailer_bytes > VLIB_BUFFER_DATA_SIZE);
+}
+
+always_inline vlib_buffer_t *
+pg_replay_chain (vlib_main_t * vm, vlib_buffer_t * prev, u32 bi)
+{
+  vlib_buffer_t * b = vlib_get_buffer (vm, bi);
+
+  prev->flags |= VLIB_BUFFER_NEXT_PRESENT;
+  prev->next_buffer = bi;
+  b->current_data = 0;
+  b->current_length = 0;
+  b->flags = 0;
+  return b;
+}
+
+static uword
+pg_replay_input_stream (vlib_main_t * vm,
+			vlib_node_runtime_t * node,
+			pg_main_t * pg,
+			pg_stream_t * s)
+{
+  pg_replay_t * r = s->replay;
+  u32 cpu_index = os_get_cpu_number ();
+  u32 slot = pg_replay_slot (r, cpu_index);
+  u32 n_slots = pg_replay_n_slots (r);
+  u32 n_trailer_bytes = r->is_latency ? sizeof (pg_latency_trailer_t) : 0;
+  u32 n_file_packets = vec_len (r->pcap.packet_offsets);
+  pg_replay_per_thread_t * pt;
+  pcap_packet_header_t * ph;
+  u32 i, n_loops_done, n_packets, n_buffers, n_alloc, n_left, k;
+  u32 * to_next, n_this_frame, n_trace;
+  f64 time_now, dt, byte_credit;
+  u64 n_bytes;
+  int is_done;
+
+  /* Main thread disables worker replays once every slot is done. */
+  if (cpu_index == 0 && r->n_threads > 0)
+    {
+      vec_foreach (pt, r->per_thread)
+	if (pg_replay_slot (r, pt - r->per_thread) != ~0 && ! pt->is_done)
+	  return 0;
+      pg_stream_enable_disable (pg, s, /* want_enabled */ 0);
+      return 0;
+    }
+
+  if (slot == ~0)
+    return 0;
+
+  pt = vec_elt_at_index (r->per_thread, cpu_index);
+  if (pt->is_done)
+    {
+      if (r->n_threads == 0)
+	pg_stream_enable_disable (pg, s, /* want_enabled */ 0);
+      return 0;
+    }
+
+  /* Apply rate limits, split evenly over the replaying threads. */
+  time_now = vlib_time_now (vm);
+  if (pt->time_last_generate == 0)
+    pt->time_start = pt->time_last_generate = time_now;
+
+  dt = time_now - pt->time_last_generate;
+  pt->time_last_generate = time_now;
+
+  n_packets = VLIB_FRAME_SIZE;
+  if (s->rate_packets_per_second > 0)
+    {
+      pt->packet_accumulator += dt * s->rate_packets_per_second / n_slots;
+      n_packets = clib_min (pt->packet_accumulator, VLIB_FRAME_SIZE);
+
+      /* Never allow accumulator to grow if we get behind. */
+      pt->packet_accumulator -= (u32) pt->packet_accumulator;
+    }
+
+  byte_credit = 0;
+  if (s->rate_bits_per_second > 0)
+    {
+      f64 max_credit = VLIB_FRAME_SIZE * (f64) (s->max_packet_bytes
+						+ n_trailer_bytes);
+      pt->byte_accumulator += dt * s->rate_bits_per_second / (8 * n_slots);
+      pt->byte_accumulator = clib_min (pt->byte_accumulator, max_credit);
+      byte_credit = pt->byte_accumulator;
+    }
+
+  /* Apply fixed limit, this thread's share of it. */
+  if (s->n_packets_limit > 0)
+    {
+      u64 limit = s->n_packets_limit / n_slots
+	+ (slot < s->n_packets_limit % n_slots);
+      if (pt->n_packets_generated + n_packets > limit)
+	n_packets = limit - pt->n_packets_generated;
+      if (n_packets == 0)
+	pt->is_done = 1;
+    }
+
+  /* Walk the file to see what is due, counting buffers to allocate. */
+  i = pt->next_packet;
+  n_loops_done = pt->n_loops_done;
+  n_buffers = n_bytes = 0;
+  is_done = 0;
+  for (k = 0; k < n_packets; k++)
+    {
+      u32 n0;
+
+      if (r->timing_speedup > 0
+	  && ((r->packet_times[i] + n_loops_done * r->loop_time)
+	      / r->timing_speedup) > time_now - pt->time_start)
+	break;
+
+      ph = pcap_mapped_packet (&r->pcap, i);
+      n0 = ph->n_packet_bytes_stored_in_file + n_trailer_bytes;
+      if (s->rate_bits_per_second > 0)
+	{
+	  if (n0 > byte_credit)
+	    break;
+	  byte_credit -= n0;
+	}
+
+      n_bytes += n0;
+      n_buffers += pg_replay_n_buffers (ph->n_packet_bytes_stored_in_file,
+					n_trailer_bytes);
+
+      i += n_slots;
+      if (i >= n_file_packets)
+	{
+	  i = slot;
+	  n_loops_done++;
+	  if (r->n_loops > 0 && n_loops_done >= r->n_loops)
+	    {
+	      is_done = 1;
+	      k++;
+	      break;
+	    }
+	}
+    }
+  n_packets = k;
+
+  if (n_packets == 0)
+    return 0;
+
+  vec_validate (pt->buffers, n_buffers - 1);
+  n_alloc = vlib_buffer_alloc (vm, pt->buffers, n_buffers);
+  if (n_alloc < n_buffers)
+    {
+      /* Try again next time around. */
+      if (n_alloc > 0)
+	vlib_buffer_free (vm, pt->buffers, n_alloc);
+      return 0;
+    }
+
+  /* Copy packets out of the mapped file. */
+  vec_validate (pt->heads, n_packets - 1);
+  i = pt->next_packet;
+  n_alloc = 0;
+  for (k = 0; k < n_packets; k++)
+    {
+      vlib_buffer_t * b0, * first0;
+      u32 n_left0, n0;
+      u8 * src0;
+
+      ph = pcap_mapped_packet (&r->pcap, i);
+      src0 = ph->data;
+      n_left0 = ph->n_packet_bytes_stored_in_file;
+
+      pt->heads[k] = pt->buffers[n_alloc++];
+      first0 = b0 = vlib_get_buffer (vm, pt->heads[k]);
+      first0->current_data = 0;
+      first0->flags = VLIB_BUFFER_TOTAL_LENGTH_VALID;
+      vnet_buffer (first0)->sw_if_index[VLIB_RX] = s->sw_if_index[VLIB_RX];
+      vnet_buffer (first0)->sw_if_index[VLIB_TX] = (u32)~0;
+
+      while (1)
+	{
+	  n0 = clib_min (n_left0, VLIB_BUFFER_DATA_SIZE);
+	  clib_memcpy (b0->data, src0, n0);
+	  b0->current_length = n0;
+	  src0 += n0;
+	  n_left0 -= n0;
+	  if (n_left0 == 0)
+	    break;
+	  b0 = pg_replay_chain (vm, b0, pt->buffers[n_alloc++]);
+	}
+
+      if (n_trailer_bytes)
+	{
+	  pg_latency_trailer_t t0;
+
+	  if (b0->current_length + n_trailer_bytes > VLIB_BUFFER_DATA_SIZE)
+	    b0 = pg_replay_chain (vm, b0, pt->buffers[n_alloc++]);
+
+	  t0.magic = PG_LATENCY_TRAILER_MAGIC;
+	  t0.stream_index = s - pg->streams;
+	  t0.cpu_time = clib_cpu_time_now ();
+	  clib_memcpy (b0->data + b0->current_length, &t0, sizeof (t0));
+	  b0->current_length += sizeof (t0);
+	}
+
+      first0->total_length_not_including_first_buffer
+	= ph->n_packet_bytes_stored_in_file + n_trailer_bytes
+	- first0->current_length;
+
+      i += n_slots;
+      if (i >= n_file_packets)
+	i = slot;
+    }
+  ASSERT (n_alloc == n_buffers);
+
+  pg_set_mbuf_metadata (pg, pt->heads, n_packets);
+
+  {
+    vnet_main_t * vnm = vnet_get_main();
+    vnet_interface_main_t * im = &vnm->interface_main;
+    vlib_increment_combined_counter (im->combined_sw_if_counters
+				     + VNET_INTERFACE_COUNTER_RX,
+				     cpu_index,
+				     s->sw_if_index[VLIB_RX],
+				     n_packets,
+				     n_bytes);
+  }
+
+  n_left = n_packets;
+  k = 0;
+  while (n_left > 0)
+    {
+      u32 n_left_to_next;
+
+      vlib_get_next_frame (vm, node, s->next_index, to_next, n_left_to_next);
+
+      n_this_frame = clib_min (n_left, n_left_to_next);
+      vlib_copy_buffers (to_next, pt->heads + k, n_this_frame);
+
+      n_trace = vlib_get_trace_count (vm, node);
+      if (n_trace > 0)
+	{
+	  u32 n = clib_min (n_trace, n_this_frame);
+	  pg_input_trace (vm, pg, node, s, to_next, n);
+	  vlib_set_trace_count (vm, node, n_trace - n);
+	}
+
+      k += n_this_frame;
+      n_left -= n_this_frame;
+      n_left_to_next -= n_this_frame;
+      vlib_put_next_frame (vm, node, s->next_index, n_left_to_next);
+    }
+
+  pt->next_packet = i;
+  pt->n_loops_done = n_loops_done;
+  pt->is_done |= is_done;
+  pt->n_packets_generated += n_packets;
+  pt->n_bytes_generated += n_bytes;
+  if (s->rate_bits_per_second > 0)
+    pt->byte_accumulator -= n_bytes;
+
+  return n_packets;
+}
+
 uword
 pg_input (vlib_main_t * vm,
 	  vlib_node_runtime_t * node,
@@ -1725,9 +1994,16 @@ pg_input (vlib_main_t * vm,
   uword i;
   pg_main_t * pg = &pg_main;
   uword n_packets = 0;
+  u32 cpu_index = os_get_cpu_number ();
+  pg_stream_t * s;
 
+  /* Workers only run replay streams placed on them. */
   clib_bitmap_foreach (i, pg->enabled_streams, ({
-    n_packets += pg_input_stream (node, pg, vec_elt_at_index (pg->streams, i));
+    s = vec_elt_at_index (pg->streams, i);
+    if (s->replay)
+      n_packets += pg_replay_input_stream (vm, node, pg, s);
+    else if (cpu_index == 0)
+      n_packets += pg_input_stream (node, pg, s);
   }));
 
   return n_packets;
@@ -42,6 +42,51 @@
 #include <vnet/pg/pg.h>
 #include <vnet/ethernet/ethernet.h>
 
+/* Account latency of packets replayed with a timestamp trailer. */
+static void
+pg_output_latency (vlib_main_t * vm, pg_main_t * pg,
+		   u32 * buffers, uword n_buffers)
+{
+  u32 cpu_index = os_get_cpu_number ();
+  u64 now = clib_cpu_time_now ();
+  pg_replay_per_thread_t * pt;
+  pg_latency_trailer_t t0;
+  pg_stream_t * s;
+  vlib_buffer_t * b0;
+  u64 dt;
+
+  while (n_buffers > 0)
+    {
+      b0 = vlib_get_buffer (vm, buffers[0]);
+      buffers++;
+      n_buffers--;
+
+      while (b0->flags & VLIB_BUFFER_NEXT_PRESENT)
+	b0 = vlib_get_buffer (vm, b0->next_buffer);
+
+      if (b0->current_length < sizeof (t0))
+	continue;
+
+      clib_memcpy (&t0, b0->data + b0->current_data + b0->current_length
+		   - sizeof (t0), sizeof (t0));
+      if (t0.magic != PG_LATENCY_TRAILER_MAGIC
+	  || pool_is_free_index (pg->streams, t0.stream_index))
+	continue;
+
+      s = pool_elt_at_index (pg->streams, t0.stream_index);
+      if (! s->replay || ! s->replay->is_latency
+	  || cpu_index >= vec_len (s->replay->per_thread))
+	continue;
+
+      pt = vec_elt_at_index (s->replay->per_thread, cpu_index);
+      dt = now - t0.cpu_time;
+      pt->n_latency_samples++;
+      pt->latency_sum += dt;
+      pt->latency_min = clib_min (pt->latency_min, dt);
+      pt->latency_max = clib_max (pt->latency_max, dt);
+    }
+}
+
 uword
 pg_output (vlib_main_t * vm,
 	   vlib_node_runtime_t * node,
@@ -67,6 +112,10 @@ pg_output (vlib_main_t * vm,
       pcap_write (&pif->pcap_main);
     }
 
-  vlib_buffer_free_no_next (vm, vlib_frame_args (frame), n_buffers);
+  if (pg->n_latency_streams > 0)
+    pg_output_latency (vm, pg, vlib_frame_args (frame), n_buffers);
+
+  /* Replayed packets may be chained. */
+  vlib_buffer_free (vm, vlib_frame_args (frame), n_buffers);
   return n_buffers;
 }
@@ -92,6 +92,91 @@ typedef struct {
   u32 free_list_index;
 } pg_buffer_index_t;
 
+/* Replay state of one thread.  Thread with slot k of n replays
+   packets k, k + n, k + 2n, ... of the file. */
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  /* Next packet to send and completed passes over the file. */
+  u32 next_packet;
+  u32 n_loops_done;
+  u8 is_done;
+
+  /* Time of first packet sent, for original timing. */
+  f64 time_start;
+
+  f64 time_last_generate;
+
+  /* Rate shaping credit in packets and bytes. */
+  f64 packet_accumulator;
+  f64 byte_accumulator;
+
+  u64 n_packets_generated;
+  u64 n_bytes_generated;
+
+  /* Scratch buffer index vectors. */
+  u32 * buffers;
+  u32 * heads;
+
+  /* Latency of packets received by pg output on this thread,
+     in cpu clocks. */
+  u64 n_latency_samples;
+  u64 latency_sum;
+  u64 latency_min;
+  u64 latency_max;
+} pg_replay_per_thread_t;
+
+/* Stream replaying a memory mapped pcap file. */
+typedef struct {
+  pcap_main_t pcap;
+
+  /* Capture time of each packet relative to the first, in seconds. */
+  f64 * packet_times;
+
+  /* Capture duration plus one average gap: one pass over the file. */
+  f64 loop_time;
+
+  /* Worker threads sharing the replay; zero means main thread. */
+  u32 first_cpu_index;
+  u32 n_threads;
+
+  /* Replay at capture timing sped up by this factor.
+     Zero means use stream rates instead. */
+  f64 timing_speedup;
+
+  /* Passes over the file.  Zero means loop forever. */
+  u32 n_loops;
+
+  /* Append a pg_latency_trailer_t to each packet. */
+  u8 is_latency;
+
+  /* Indexed by cpu index. */
+  pg_replay_per_thread_t * per_thread;
+} pg_replay_t;
+
+/* Appended to replayed packets, checked by pg output. */
+typedef CLIB_PACKED (struct {
+  u32 magic;
+  u32 stream_index;
+  u64 cpu_time;
+}) pg_latency_trailer_t;
+
+#define PG_LATENCY_TRAILER_MAGIC 0x70674c74
+
+/* Slot of given thread in replay, ~0 if it takes no part. */
+always_inline u32
+pg_replay_slot (pg_replay_t * r, u32 cpu_index)
+{
+  if (r->n_threads == 0)
+    return cpu_index == 0 ? 0 : ~0;
+  cpu_index -= r->first_cpu_index;
+  return cpu_index < r->n_threads ? cpu_index : ~0;
+}
+
+always_inline u32
+pg_replay_n_slots (pg_replay_t * r)
+{ return r->n_threads > 0 ? r->n_threads : 1; }
+
 typedef struct pg_stream_t {
   /* Stream name. */
   u8 * name;
@@ -157,6 +242,10 @@ typedef struct pg_stream_t {
      Zero means unlimited rate. */
   f64 rate_packets_per_second;
 
+  /* Rate in bits/second of packet data, replay streams only.
+     Zero means unlimited rate. */
+  f64 rate_bits_per_second;
+
   f64 time_last_generate;
 
   f64 packet_accumulator;
@@ -165,6 +254,9 @@ typedef struct pg_stream_t {
 
   u8 ** replay_packet_templates;
   u32 current_replay_packet_index;
+
+  /* Non-zero for streams replayed from a mapped pcap file. */
+  pg_replay_t * replay;
 } pg_stream_t;
 
 always_inline void
@@ -185,6 +277,22 @@ pg_edit_group_free (pg_edit_group_t * g)
   vec_free (g->fixed_packet_data_mask);
 }
 
+always_inline void
+pg_replay_free (pg_replay_t * r)
+{
+  pg_replay_per_thread_t * pt;
+  pcap_unmap (&r->pcap);
+  vec_free (r->pcap.file_name);
+  vec_free (r->packet_times);
+  vec_foreach (pt, r->per_thread)
+    {
+      vec_free (pt->buffers);
+      vec_free (pt->heads);
+    }
+  vec_free (r->per_thread);
+  vec_free (r);
+}
+
 always_inline void
 pg_stream_free (pg_stream_t * s)
 {
@@ -206,6 +314,10 @@ pg_stream_free (pg_stream_t * s)
       pg_buffer_index_free (bi);
     vec_free (s->buffer_indices);
   }
+
+  if (s->replay)
+    pg_replay_free (s->replay);
+  s->replay = 0;
 }
 
 always_inline int
@@ -309,6 +421,9 @@ typedef struct pg_main_t {
   /* Bitmap indicating which streams are currently enabled. */
   uword * enabled_streams;
 
+  /* Streams with latency trailers; pg output looks for them if non-zero. */
+  u32 n_latency_streams;
+
   /* Hash mapping name -> stream index. */
   uword * stream_index_by_name;
 
@@ -336,6 +451,10 @@ void pg_stream_add (pg_main_t * pg, pg_stream_t * s_init);
 /* Enable/disable stream. */
 void pg_stream_enable_disable (pg_main_t * pg, pg_stream_t * s, int is_enable);
 
+/* Map pcap file for replay by the given worker threads. */
+clib_error_t * pg_replay_init (pg_stream_t * s, char * file_name,
+			       u32 n_workers);
+
 /* Find/create free packet-generator interface index. */
 u32 pg_interface_add_or_get (pg_main_t * pg, uword stream_index);
 
@@ -41,6 +41,57 @@
 #include <vnet/pg/pg.h>
 #include <vnet/ethernet/ethernet.h>
 
+static void pg_replay_reset (pg_replay_t * r)
+{
+  pg_replay_per_thread_t * pt;
+  u32 n_packets = vec_len (r->pcap.packet_offsets);
+  u32 slot;
+
+  vec_foreach (pt, r->per_thread)
+    {
+      slot = pg_replay_slot (r, pt - r->per_thread);
+      pt->next_packet = slot;
+      pt->n_loops_done = 0;
+      pt->is_done = slot >= n_packets;
+      pt->time_start = 0;
+      pt->time_last_generate = 0;
+      pt->packet_accumulator = 0;
+      pt->byte_accumulator = 0;
+      pt->n_packets_generated = 0;
+      pt->n_bytes_generated = 0;
+      pt->n_latency_samples = 0;
+      pt->latency_sum = 0;
+      pt->latency_min = ~0ULL;
+      pt->latency_max = 0;
+    }
+}
+
+/* pg-input polls on a worker while an enabled replay stream uses it. */
+static void pg_update_worker_input_state (pg_main_t * pg)
+{
+  uword * want_polling = 0;
+  pg_stream_t * s;
+  uword i, cpu_index;
+
+  clib_bitmap_foreach (i, pg->enabled_streams, ({
+    s = pool_elt_at_index (pg->streams, i);
+    if (s->replay)
+      for (cpu_index = s->replay->first_cpu_index;
+	   cpu_index < s->replay->first_cpu_index + s->replay->n_threads;
+	   cpu_index++)
+	want_polling = clib_bitmap_set (want_polling, cpu_index, 1);
+  }));
+
+  for (cpu_index = 1; cpu_index < vec_len (vlib_mains); cpu_index++)
+    vlib_node_set_state (vlib_mains[cpu_index],
+			 pg_input_node.index,
+			 (clib_bitmap_get (want_polling, cpu_index)
+			  ? VLIB_NODE_STATE_POLLING
+			  : VLIB_NODE_STATE_DISABLED));
+
+  clib_bitmap_free (want_polling);
+}
+
 /* Mark stream active or inactive. */
 void pg_stream_enable_disable (pg_main_t * pg, pg_stream_t * s, int want_enabled)
 {
@@ -53,8 +104,15 @@ void pg_stream_enable_disable (pg_main_t * pg, pg_stream_t * s, int want_enabled
     /* No change necessary. */
     return;
       
+  /* Replay streams run on workers, which walk the enabled bitmap. */
+  vlib_worker_thread_barrier_sync (pg->vlib_main);
+
   if (want_enabled)
-    s->n_packets_generated = 0;
+    {
+      s->n_packets_generated = 0;
+      if (s->replay)
+	pg_replay_reset (s->replay);
+    }
 
   /* Toggle enabled flag. */
   s->flags ^= PG_STREAM_FLAGS_IS_ENABLED;
@@ -79,8 +137,12 @@ void pg_stream_enable_disable (pg_main_t * pg, pg_stream_t * s, int want_enabled
 			? VLIB_NODE_STATE_DISABLED
 			: VLIB_NODE_STATE_POLLING));
 
+  pg_update_worker_input_state (pg);
+
   s->packet_accumulator = 0;
   s->time_last_generate = 0;
+
+  vlib_worker_thread_barrier_release (pg->vlib_main);
 }
 
 static u8 * format_pg_interface_name (u8 * s, va_list * args)
@@ -346,6 +408,9 @@ void pg_stream_add (pg_main_t * pg, pg_stream_t * s_init)
   pg_stream_t * s;
   uword * p;
 
+  /* Workers may be walking the stream pool. */
+  vlib_worker_thread_barrier_sync (vm);
+
   if (! pg->stream_index_by_name)
     pg->stream_index_by_name
       = hash_create_vec (0, sizeof (s->name[0]), sizeof (uword));
@@ -368,6 +433,9 @@ void pg_stream_add (pg_main_t * pg, pg_stream_t * s_init)
 
   hash_set_mem (pg->stream_index_by_name, s->name, s - pg->streams);
 
+  if (s->replay && s->replay->is_latency)
+    pg->n_latency_streams++;
+
   /* Get fixed part of buffer data. */
   if (s->edit_groups)
     perform_fixed_edits (s);
@@ -384,33 +452,36 @@ void pg_stream_add (pg_main_t * pg, pg_stream_t * s_init)
     default:
       /* Get packet size from fixed edits. */
       s->packet_size_edit_type = PG_EDIT_FIXED;
-      if (! s->replay_packet_templates)
+      if (! s->replay_packet_templates && ! s->replay)
 	s->min_packet_bytes = s->max_packet_bytes = vec_len (s->fixed_packet_data);
       break;
     }
 
   s->last_increment_packet_size = s->min_packet_bytes;
 
-  {
-    pg_buffer_index_t * bi;
-    int n;
+  /* Replay copies into default buffers as it goes. */
+  if (! s->replay)
+    {
+      pg_buffer_index_t * bi;
+      int n;
 
-    if (! s->buffer_bytes)
-      s->buffer_bytes = s->max_packet_bytes;
+      if (! s->buffer_bytes)
+	s->buffer_bytes = s->max_packet_bytes;
 
-    s->buffer_bytes = vlib_buffer_round_size (s->buffer_bytes);
+      s->buffer_bytes = vlib_buffer_round_size (s->buffer_bytes);
 
-    n = s->max_packet_bytes / s->buffer_bytes;
-    n += (s->max_packet_bytes % s->buffer_bytes) != 0;
+      n = s->max_packet_bytes / s->buffer_bytes;
+      n += (s->max_packet_bytes % s->buffer_bytes) != 0;
 
-    vec_resize (s->buffer_indices, n);
+      vec_resize (s->buffer_indices, n);
 
-    vec_foreach (bi, s->buffer_indices)
-      bi->free_list_index = vlib_buffer_create_free_list (vm, s->buffer_bytes,
-							  "pg stream %d buffer #%d",
-							  s - pg->streams,
-							  1 + (bi - s->buffer_indices));
-  }
+      vec_foreach (bi, s->buffer_indices)
+	bi->free_list_index
+	  = vlib_buffer_create_free_list (vm, s->buffer_bytes,
+					  "pg stream %d buffer #%d",
+					  s - pg->streams,
+					  1 + (bi - s->buffer_indices));
+    }
 
   /* Find an interface to use. */
   s->pg_if_index = pg_interface_add_or_get (pg, s->if_id);
@@ -428,6 +499,8 @@ void pg_stream_add (pg_main_t * pg, pg_stream_t * s_init)
 
   /* Connect the graph. */
   s->next_index = vlib_node_add_next (vm, pg_input_node.index, s->node_index);
+
+  vlib_worker_thread_barrier_release (vm);
 }
 
 void pg_stream_del (pg_main_t * pg, uword index)
@@ -436,6 +509,8 @@ void pg_stream_del (pg_main_t * pg, uword index)
   pg_stream_t * s;
   pg_buffer_index_t * bi;
 
+  vlib_worker_thread_barrier_sync (vm);
+
   s = pool_elt_at_index (pg->streams, index);
 
   pg_stream_enable_disable (pg, s, /* want_enabled */ 0);
@@ -447,7 +522,73 @@ void pg_stream_del (pg_main_t * pg, uword index)
       clib_fifo_free (bi->buffer_fifo);
     }
 
+  if (s->replay && s->replay->is_latency)
+    pg->n_latency_streams--;
+
   pg_stream_free (s);
   pool_put (pg->streams, s);
+
+  vlib_worker_thread_barrier_release (vm);
+}
+
+clib_error_t *
+pg_replay_init (pg_stream_t * s, char * file_name, u32 n_workers)
+{
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  pg_replay_t * r = 0;
+  pcap_packet_header_t * ph;
+  clib_error_t * error;
+  f64 t, t0, t_last;
+  u32 i, n_packets;
+
+  /* One element vector, zeroed by vec_validate. */
+  vec_validate_aligned (r, 0, CLIB_CACHE_LINE_BYTES);
+  r->pcap.file_name = file_name;
+  s->replay = r;
+
+  if (n_workers > 0)
+    {
+      vlib_thread_registration_t * tr;
+      uword * p;
+
+      p = hash_get_mem (tm->thread_registrations_by_name, "workers");
+      tr = p ? (vlib_thread_registration_t *) p[0] : 0;
+      if (! tr || tr->count == 0)
+	return clib_error_return (0, "no worker threads");
+      if (n_workers > tr->count)
+	return clib_error_return (0, "only %d worker threads", tr->count);
+
+      r->first_cpu_index = tr->first_index;
+      r->n_threads = n_workers;
+    }
+
+  error = pcap_map (&r->pcap);
+  if (error)
+    return error;
+
+  /* Relative capture times, forced monotonic. */
+  n_packets = vec_len (r->pcap.packet_offsets);
+  vec_resize (r->packet_times, n_packets);
+  t0 = t_last = 0;
+  for (i = 0; i < n_packets; i++)
+    {
+      ph = pcap_mapped_packet (&r->pcap, i);
+      t = ph->time_in_sec + 1e-6 * ph->time_in_usec;
+      if (i == 0)
+	t0 = t_last = t;
+      t_last = clib_max (t, t_last);
+      r->packet_times[i] = t_last - t0;
+    }
+  if (n_packets > 1)
+    r->loop_time = r->packet_times[n_packets - 1] * n_packets / (n_packets - 1);
+
+  vec_validate_aligned (r->per_thread, clib_max (tm->n_vlib_mains, 1) - 1,
+			CLIB_CACHE_LINE_BYTES);
+
+  s->min_packet_bytes = r->pcap.min_packet_bytes;
+  s->max_packet_bytes = r->pcap.max_packet_bytes;
+  s->flags |= PG_STREAM_FLAGS_DISABLE_BUFFER_RECYCLE;
+
+  return 0;
 }
 
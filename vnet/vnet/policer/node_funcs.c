@@ -93,6 +93,31 @@ void vnet_policer_mark (vlib_buffer_t * b, u8 dscp)
     }
 }
 
+static_always_inline policer_result_e
+vnet_policer_police (vnet_policer_main_t * pm, u32 cpu_index, u32 pi,
+                     u32 len, u64 time)
+{
+  policer_read_response_type_st * pol = &pm->policers [pi];
+  policer_local_bucket_t * local;
+
+  if (pol->borrow_tokens)
+    {
+      local = vec_elt_at_index (pm->local_buckets_by_cpu[cpu_index], pi);
+      return vnet_police_packet_per_thread (pol, local, len,
+                                            POLICE_CONFORM /* no chaining */,
+                                            time);
+    }
+
+  if (pol->thread_shared)
+    return vnet_police_packet_locked (pol, len,
+                                      POLICE_CONFORM /* no chaining */,
+                                      time);
+
+  return vnet_police_packet (pol, len,
+                             POLICE_CONFORM /* no chaining */,
+                             time);
+}
+
 static inline
 uword vnet_policer_inline (vlib_main_t * vm,
                            vlib_node_runtime_t * node,
@@ -104,6 +129,7 @@ uword vnet_policer_inline (vlib_main_t * vm,
   vnet_policer_main_t * pm = &vnet_policer_main;
   u64 time_in_policer_periods;
   u32 transmitted = 0;
+  u32 cpu_index = os_get_cpu_number();
 
   time_in_policer_periods = 
     clib_cpu_time_now() >> POLICER_TICKS_PER_PERIOD_SHIFT;
@@ -184,16 +210,14 @@ uword vnet_policer_inline (vlib_main_t * vm,
 
           len0 = vlib_buffer_length_in_chain (vm, b0);
           pol0 = &pm->policers [pi0];
-          col0 = vnet_police_packet (pol0, len0, 
-                                     POLICE_CONFORM /* no chaining */,
-                                     time_in_policer_periods);
+          col0 = vnet_policer_police (pm, cpu_index, pi0, len0,
+                                      time_in_policer_periods);
           act0 = pol0->action[col0];
 
           len1 = vlib_buffer_length_in_chain (vm, b1);
           pol1 = &pm->policers [pi1];
-          col1 = vnet_police_packet (pol1, len1, 
-                                     POLICE_CONFORM /* no chaining */,
-                                     time_in_policer_periods);
+          col1 = vnet_policer_police (pm, cpu_index, pi1, len1,
+                                      time_in_policer_periods);
           act1 = pol1->action[col1];
 
           if (PREDICT_FALSE(act0 == SSE2_QOS_ACTION_DROP)) /* drop action */
@@ -284,9 +308,8 @@ uword vnet_policer_inline (vlib_main_t * vm,
 
           len0 = vlib_buffer_length_in_chain (vm, b0);
           pol0 = &pm->policers [pi0];
-          col0 = vnet_police_packet (pol0, len0, 
-                                     POLICE_CONFORM /* no chaining */,
-                                     time_in_policer_periods);
+          col0 = vnet_policer_police (pm, cpu_index, pi0, len0,
+                                      time_in_policer_periods);
           act0 = pol0->action[col0];
           
           if (PREDICT_FALSE(act0 == SSE2_QOS_ACTION_DROP)) /* drop action */
@@ -388,6 +411,7 @@ int test_policer_add_del (u32 rx_sw_if_index, u8 *config_name,
   policer_read_response_type_st * policer;
   vnet_hw_interface_t * rxhi;
   uword * p;
+  u32 i;
 
   rxhi = vnet_get_sup_hw_interface (pm->vnet_main, rx_sw_if_index);
 
@@ -410,10 +434,24 @@ int test_policer_add_del (u32 rx_sw_if_index, u8 *config_name,
          rxhi->hw_if_index,
          policer_by_sw_if_index_node.index);
 
+      /* Workers may be policing while the pool and buckets move */
+      vlib_worker_thread_barrier_sync (pm->vlib_main);
+
       pool_get_aligned (pm->policers, policer, CLIB_CACHE_LINE_BYTES);
 
       policer[0] = template[0];
 
+      for (i = 0; i < vec_len (pm->local_buckets_by_cpu); i++)
+        {
+          vec_validate_aligned (pm->local_buckets_by_cpu[i],
+                                policer - pm->policers, CLIB_CACHE_LINE_BYTES);
+          memset (vec_elt_at_index (pm->local_buckets_by_cpu[i],
+                                    policer - pm->policers),
+                  0, sizeof (policer_local_bucket_t));
+        }
+
+      vlib_worker_thread_barrier_release (pm->vlib_main);
+
       vec_validate (pm->policer_index_by_sw_if_index, rx_sw_if_index);
       pm->policer_index_by_sw_if_index[rx_sw_if_index] 
           = policer - pm->policers;
@@ -51,7 +51,19 @@ typedef enum {
 //
 // The 64-bit last_update_time supports a 4Ghz CPU without rollover for 100 years
 //
-// The lock field should be used for a spin-lock on the struct. 
+// The lock field should be used for a spin-lock on the struct. It is taken
+// only when thread_shared is set, a policer used by a single thread needs
+// no lock.
+//
+// Per-thread mode:
+// When borrow_tokens is non-zero the lock is not used. Each thread polices
+// against its own policer_local_bucket_t and takes tokens from the
+// buckets of the shared struct borrow_tokens at a time, with atomic
+// instructions. The shared buckets are refilled by whichever thread wins
+// a compare-and-swap on last_update_time. A thread holds at most
+// borrow_tokens plus one packet worth of tokens per bucket, and gives them
+// back once idle for POLICER_LOCAL_IDLE_PERIODS, which bounds the aggregate
+// rate error to n_threads * borrow_tokens.
 
 #define POLICER_TICKS_PER_PERIOD_SHIFT 17
 #define POLICER_TICKS_PER_PERIOD       (1 << POLICER_TICKS_PER_PERIOD_SHIFT)
@@ -80,7 +92,9 @@ typedef struct {
     uint32_t extended_bucket;            // MOD
 
     uint64_t last_update_time;           // MOD
-    uint64_t pad64;
+
+    uint32_t borrow_tokens;              // per-thread mode, 0 = off
+    uint32_t thread_shared;              // 1 = take the lock per packet
 
 } policer_read_response_type_st;
 
@@ -177,4 +191,155 @@ vnet_police_packet (policer_read_response_type_st *policer,
   return result;
 }
 
+// Locked mode, for policers shared between threads
+static inline policer_result_e
+vnet_police_packet_locked (policer_read_response_type_st *policer,
+                           uint32_t packet_length,
+                           policer_result_e packet_color,
+                           uint64_t time)
+{
+  policer_result_e result;
+
+  while (__sync_lock_test_and_set (&policer->lock, 1))
+    ;
+  result = vnet_police_packet (policer, packet_length, packet_color, time);
+  __sync_lock_release (&policer->lock);
+  return result;
+}
+
+// Periods after which a thread gives its unused tokens back
+#define POLICER_LOCAL_IDLE_PERIODS 1024
+
+// A thread's share of a per-thread mode policer, in scaled tokens
+typedef struct {
+    uint32_t current_tokens;
+    uint32_t extended_tokens;
+    uint64_t last_use_time;
+} policer_local_bucket_t;
+
+static inline void
+policer_shared_refill (policer_read_response_type_st *policer, uint64_t time)
+{
+  uint64_t last, n_periods, tokens;
+  uint32_t old, new;
+
+  last = policer->last_update_time;
+  if (time <= last)
+    return;
+
+  // The winner adds the tokens for the elapsed periods
+  if (!__sync_bool_compare_and_swap (&policer->last_update_time, last, time))
+    return;
+  n_periods = time - last;
+
+  do {
+    old = policer->current_bucket;
+    tokens = old + n_periods * policer->cir_tokens_per_period;
+    new = tokens > policer->current_limit ? policer->current_limit : tokens;
+  } while (!__sync_bool_compare_and_swap (&policer->current_bucket, old, new));
+
+  do {
+    old = policer->extended_bucket;
+    tokens = old + n_periods * (policer->single_rate ?
+                                policer->cir_tokens_per_period :
+                                policer->pir_tokens_per_period);
+    new = tokens > policer->extended_limit ? policer->extended_limit : tokens;
+  } while (!__sync_bool_compare_and_swap (&policer->extended_bucket, old, new));
+}
+
+// Take up to want tokens from a shared bucket, returns the number taken
+static inline uint32_t
+policer_shared_take (volatile uint32_t *bucket, uint32_t want)
+{
+  uint32_t old, take;
+
+  do {
+    old = *bucket;
+    take = old < want ? old : want;
+    if (take == 0)
+      return 0;
+  } while (!__sync_bool_compare_and_swap (bucket, old, old - take));
+
+  return take;
+}
+
+static inline void
+policer_shared_give (volatile uint32_t *bucket, uint32_t limit,
+                     uint32_t tokens)
+{
+  uint32_t old, new;
+
+  do {
+    old = *bucket;
+    new = (uint64_t) old + tokens > limit ? limit : old + tokens;
+  } while (!__sync_bool_compare_and_swap (bucket, old, new));
+}
+
+// Same result as vnet_police_packet, using the caller's local bucket
+static inline policer_result_e
+vnet_police_packet_per_thread (policer_read_response_type_st *policer,
+                               policer_local_bucket_t *local,
+                               uint32_t packet_length,
+                               policer_result_e packet_color,
+                               uint64_t time)
+{
+  policer_result_e result;
+
+  packet_length = packet_length << policer->scale;
+
+  if (time - local->last_use_time > POLICER_LOCAL_IDLE_PERIODS) {
+    if (local->current_tokens)
+      policer_shared_give (&policer->current_bucket, policer->current_limit,
+                           local->current_tokens);
+    if (local->extended_tokens)
+      policer_shared_give (&policer->extended_bucket,
+                           policer->extended_limit,
+                           local->extended_tokens);
+    local->current_tokens = local->extended_tokens = 0;
+  }
+  local->last_use_time = time;
+
+  // Top up whichever local bucket can't cover the packet
+  if (local->current_tokens < packet_length ||
+      local->extended_tokens < packet_length) {
+    policer_shared_refill (policer, time);
+    if (local->current_tokens < packet_length)
+      local->current_tokens +=
+        policer_shared_take (&policer->current_bucket,
+                             packet_length - local->current_tokens +
+                             policer->borrow_tokens);
+    if (local->extended_tokens < packet_length)
+      local->extended_tokens +=
+        policer_shared_take (&policer->extended_bucket,
+                             packet_length - local->extended_tokens +
+                             policer->borrow_tokens);
+  }
+
+  if (policer->single_rate) {
+    if ((!policer->color_aware || (packet_color == POLICE_CONFORM)) && (local->current_tokens >= packet_length)) {
+      local->current_tokens -= packet_length;
+      local->extended_tokens -= local->extended_tokens < packet_length ?
+        local->extended_tokens : packet_length;
+      result = POLICE_CONFORM;
+    } else if ((!policer->color_aware || (packet_color != POLICE_VIOLATE)) && (local->extended_tokens >= packet_length)) {
+      local->extended_tokens -= packet_length;
+      result = POLICE_EXCEED;
+    } else {
+      result = POLICE_VIOLATE;
+    }
+  } else {
+    if ((policer->color_aware && (packet_color == POLICE_VIOLATE)) || (local->extended_tokens < packet_length)) {
+      result = POLICE_VIOLATE;
+    } else if ((policer->color_aware && (packet_color == POLICE_EXCEED)) || (local->current_tokens < packet_length)) {
+      local->extended_tokens -= packet_length;
+      result = POLICE_EXCEED;
+    } else {
+      local->current_tokens -= packet_length;
+      local->extended_tokens -= packet_length;
+      result = POLICE_CONFORM;
+    }
+  }
+  return result;
+}
+
 #endif // __POLICE_H__
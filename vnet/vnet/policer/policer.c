@@ -41,6 +41,20 @@ policer_add_del (vlib_main_t *vm,
   /* Vet the configuration before adding it to the table */
   rv = sse2_pol_logical_2_physical (cfg, &test_policer);
 
+  if (rv == 0 && cfg->per_thread_tolerance > 100)
+    rv = -1;
+
+  /* Split the tolerated error evenly between the threads */
+  if (rv == 0 && cfg->per_thread_tolerance)
+    {
+      u64 n_threads = vec_len (pm->local_buckets_by_cpu);
+      u64 borrow = (u64) test_policer.current_limit
+        * cfg->per_thread_tolerance / (100 * n_threads);
+      test_policer.borrow_tokens = clib_max (borrow, 1);
+    }
+  else if (rv == 0)
+    test_policer.thread_shared = cfg->thread_shared != 0;
+
   if (rv == 0)
     {
       policer_read_response_type_st *pp;
@@ -82,6 +96,10 @@ u8 * format_policer_instance (u8 * s, va_list * va)
               i->extended_limit,
               i->extended_bucket);
   s = format (s, "last update %llu\n", i->last_update_time);
+  if (i->borrow_tokens)
+    s = format (s, "per-thread buckets, borrow %u tok\n", i->borrow_tokens);
+  else if (i->thread_shared)
+    s = format (s, "shared between threads, locked\n");
   return s;
 }              
 
@@ -190,6 +208,10 @@ u8 * format_policer_config (u8 * s, va_list * va)
               format_policer_action_type, &c->conform_action,
               format_policer_action_type, &c->exceed_action,
               format_policer_action_type, &c->violate_action);
+  if (c->per_thread_tolerance)
+    s = format (s, "per-thread tolerance %u%%\n", c->per_thread_tolerance);
+  else if (c->thread_shared)
+    s = format (s, "thread shared\n");
   return s;
 }
 
@@ -348,7 +370,28 @@ unformat_policer_action (unformat_input_t * input, va_list * va)
   return 0;
 }
 
+static uword
+unformat_policer_tolerance (unformat_input_t * input, va_list * va)
+{
+  sse2_qos_pol_cfg_params_st * c
+    = va_arg (*va, sse2_qos_pol_cfg_params_st *);
+  u32 pct;
+
+  if (unformat (input, "per-thread-tolerance %u", &pct) && pct <= 100)
+    {
+      c->per_thread_tolerance = pct;
+      return 1;
+    }
+  else if (unformat (input, "thread-shared"))
+    {
+      c->thread_shared = 1;
+      return 1;
+    }
+  return 0;
+}
+
 #define foreach_config_param                    \
+_(tolerance)                                    \
 _(eb)                                           \
 _(cb)                                           \
 _(eir)                                          \
@@ -453,6 +496,9 @@ clib_error_t *policer_init (vlib_main_t * vm)
   pm->vnet_main = vnet_get_main();
 
   pm->policer_config_by_name = hash_create_string (0, sizeof (uword));
+
+  vec_validate (pm->local_buckets_by_cpu,
+                vlib_get_thread_main()->n_vlib_mains - 1);
   return 0;
 }
 
@@ -35,6 +35,9 @@ typedef struct {
   /* Policer by sw_if_index vector */
   u32 * policer_index_by_sw_if_index;
 
+  /* Per-thread mode buckets, indexed by cpu then policer index */
+  policer_local_bucket_t ** local_buckets_by_cpu;
+
   /* convenience */
   vlib_main_t * vlib_main;
   vnet_main_t * vnet_main;
@@ -117,6 +117,12 @@ typedef struct sse2_qos_pol_action_params_st_ {
  * element: rnd_type
  *      Rounding type (see sse_qos_round_type_en). Needed when policer values
  *      need to be rounded. Caller can decide on type of rounding used
+ * element: per_thread_tolerance
+ *      Percent of the committed burst that threads may hold in per-thread
+ *      token buckets. 0 selects a single bucket.
+ * element: thread_shared
+ *      With a single bucket, take the bucket lock for each packet. Needed
+ *      when the policer is applied on interfaces polled by several threads.
  */
 typedef struct sse2_qos_pol_cfg_params_st_ {
     union {
@@ -142,6 +148,8 @@ typedef struct sse2_qos_pol_cfg_params_st_ {
     sse2_qos_pol_action_params_st conform_action;
     sse2_qos_pol_action_params_st exceed_action;
     sse2_qos_pol_action_params_st violate_action;
+    uint8_t  per_thread_tolerance; /* % of burst threads may hold, 0 = off */
+    uint8_t  thread_shared;        /* single bucket taken under the lock */
 } sse2_qos_pol_cfg_params_st;
 
 
@@ -39,6 +39,8 @@
 
 #include <vnet/unix/pcap.h>
 #include <sys/fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* Usage
 
@@ -215,3 +217,119 @@ clib_error_t * pcap_read (pcap_main_t * pm)
   return error;
   
 }
+
+/* Map a pcap file read-only for replay and index its packets.
+   The mapping is private, so headers of byte swapped files are
+   fixed up in place; only those pages get copied. */
+clib_error_t * pcap_map (pcap_main_t * pm)
+{
+  clib_error_t * error = 0;
+  pcap_file_header_t * fh;
+  pcap_packet_header_t * ph;
+  struct stat statb;
+  u64 offset;
+  int fd, need_swap;
+
+  fd = open (pm->file_name, O_RDONLY);
+  if (fd < 0)
+    {
+      error = clib_error_return_unix (0, "open `%s'", pm->file_name);
+      goto done;
+    }
+
+  if (fstat (fd, &statb) < 0)
+    {
+      error = clib_error_return_unix (0, "stat `%s'", pm->file_name);
+      goto done;
+    }
+
+  if (statb.st_size < sizeof (fh[0]))
+    {
+      error = clib_error_return (0, "short file `%s'", pm->file_name);
+      goto done;
+    }
+
+  pm->file_size = statb.st_size;
+  pm->file_baseva = mmap (0, pm->file_size, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE, fd, /* offset */ 0);
+  if (pm->file_baseva == MAP_FAILED)
+    {
+      pm->file_baseva = 0;
+      error = clib_error_return_unix (0, "mmap `%s'", pm->file_name);
+      goto done;
+    }
+
+  fh = (pcap_file_header_t *) pm->file_baseva;
+
+  need_swap = 0;
+  if (fh->magic == 0xd4c3b2a1)
+    {
+      need_swap = 1;
+#define _(t,f) fh->f = clib_byte_swap_##t (fh->f);
+      foreach_pcap_file_header;
+#undef _
+    }
+
+  if (fh->magic != 0xa1b2c3d4)
+    {
+      error = clib_error_return (0, "bad magic `%s'", pm->file_name);
+      goto done;
+    }
+
+  pm->packet_type = fh->packet_type;
+  pm->min_packet_bytes = 0;
+  pm->max_packet_bytes = 0;
+  vec_reset_length (pm->packet_offsets);
+
+  offset = sizeof (fh[0]);
+  while (offset + sizeof (ph[0]) <= pm->file_size)
+    {
+      ph = (pcap_packet_header_t *) (pm->file_baseva + offset);
+
+      if (need_swap)
+	{
+#define _(t,f) ph->f = clib_byte_swap_##t (ph->f);
+	  foreach_pcap_packet_header;
+#undef _
+	}
+
+      /* Capture cut short while writing the last packet. */
+      if (offset + sizeof (ph[0]) + ph->n_packet_bytes_stored_in_file
+	  > pm->file_size)
+	break;
+
+      if (vec_len (pm->packet_offsets) == 0)
+	pm->min_packet_bytes = pm->max_packet_bytes
+	  = ph->n_packet_bytes_stored_in_file;
+      else
+	{
+	  pm->min_packet_bytes = clib_min (pm->min_packet_bytes,
+					   ph->n_packet_bytes_stored_in_file);
+	  pm->max_packet_bytes = clib_max (pm->max_packet_bytes,
+					   ph->n_packet_bytes_stored_in_file);
+	}
+
+      vec_add1 (pm->packet_offsets, offset);
+      offset += sizeof (ph[0]) + ph->n_packet_bytes_stored_in_file;
+    }
+
+  if (vec_len (pm->packet_offsets) == 0)
+    error = clib_error_return (0, "no packets in `%s'", pm->file_name);
+
+ done:
+  /* The mapping outlives the descriptor. */
+  if (fd >= 0)
+    close (fd);
+  if (error)
+    pcap_unmap (pm);
+  return error;
+}
+
+void pcap_unmap (pcap_main_t * pm)
+{
+  if (pm->file_baseva)
+    munmap (pm->file_baseva, pm->file_size);
+  pm->file_baseva = 0;
+  pm->file_size = 0;
+  vec_free (pm->packet_offsets);
+}
@@ -129,6 +129,11 @@ typedef struct {
   u8 ** packets_read;
 
   u32 min_packet_bytes, max_packet_bytes;
+
+  /* Mapped file and offsets of its packet headers, see pcap_map. */
+  u8 * file_baseva;
+  u64 file_size;
+  u64 * packet_offsets;
 } pcap_main_t;
 
 /* Write out data to output file. */
@@ -136,6 +141,17 @@ clib_error_t * pcap_write (pcap_main_t * pm);
 
 clib_error_t * pcap_read (pcap_main_t * pm);
 
+/* Map file for replay instead of copying the packets out of it. */
+clib_error_t * pcap_map (pcap_main_t * pm);
+void pcap_unmap (pcap_main_t * pm);
+
+always_inline pcap_packet_header_t *
+pcap_mapped_packet (pcap_main_t * pm, u32 i)
+{
+  return (pcap_packet_header_t *)
+    (pm->file_baseva + vec_elt (pm->packet_offsets, i));
+}
+
 static inline void *
 pcap_add_packet (pcap_main_t * pm,
 		 f64 time_now,
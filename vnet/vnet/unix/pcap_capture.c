@@ -0,0 +1,678 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * pcap_capture.c: per-thread capture rings and the pcap-writer thread
+ */
+
+#include <signal.h>
+#include <sys/fcntl.h>
+#include <vnet/vnet.h>
+#include <vlib/threads.h>
+#include <vlib/unix/unix.h>
+#include <vnet/classify/vnet_classify.h>
+#include <vnet/unix/pcap_capture.h>
+
+pcap_capture_main_t pcap_capture_main;
+
+/* Options after the packet data: direction flags, end of options. */
+#define PCAPNG_EPB_OPTION_BYTES 12
+#define PCAPNG_EPB_OPTION_FLAGS 2
+
+always_inline void
+pcap_capture_ring_put (pcap_capture_ring_t * r, u64 offset,
+		       void * src, u32 n_bytes)
+{
+  u32 o = offset & (r->size - 1);
+  u32 n0 = clib_min (n_bytes, r->size - o);
+
+  clib_memcpy (r->data + o, src, n0);
+  if (n_bytes > n0)
+    clib_memcpy (r->data, src + n0, n_bytes - n0);
+}
+
+static int
+pcap_capture_classify (pcap_capture_main_t * pcm, vlib_buffer_t * b, f64 now)
+{
+  vnet_classify_main_t * cm = &vnet_classify_main;
+  vnet_classify_table_t * t;
+  u32 table_index = pcm->classify_table_index;
+  u8 * h = vlib_buffer_get_current (b);
+  u64 hash;
+
+  while (table_index != ~0)
+    {
+      if (pool_is_free_index (cm->tables, table_index))
+	return 0;
+      t = pool_elt_at_index (cm->tables, table_index);
+      hash = vnet_classify_hash_packet (t, h);
+      if (vnet_classify_find_entry (t, h, hash, now))
+	return 1;
+      table_index = t->next_table_index;
+    }
+
+  return 0;
+}
+
+void
+pcap_capture_buffers (vlib_main_t * vm, u32 * buffers, u32 n_buffers,
+		      pcap_capture_point_t point)
+{
+  pcap_capture_main_t * pcm = &pcap_capture_main;
+  pcap_capture_ring_t * r = vec_elt_at_index (pcm->rings, vm->cpu_index);
+  vlib_rx_or_tx_t rx_or_tx = point == PCAP_CAPTURE_TX ? VLIB_TX : VLIB_RX;
+  pcapng_enhanced_packet_block_t h;
+  u32 options[PCAPNG_EPB_OPTION_BYTES / sizeof (u32)];
+  u64 head, tail, timestamp;
+  f64 now = vlib_time_now (vm);
+  static u8 zero[4];
+
+  /* One timestamp per frame. */
+  timestamp = pcm->unix_time_base_nsec
+    + (clib_cpu_time_now () - pcm->cpu_time_base) * pcm->nsec_per_clock;
+
+  memset (&h, 0, sizeof (h));
+  h.block_type = PCAPNG_BLOCK_TYPE_ENHANCED_PACKET;
+  h.timestamp_high = timestamp >> 32;
+  h.timestamp_low = timestamp;
+
+  /* epb_flags: inbound 1, outbound 2; drops say nothing. */
+  options[0] = PCAPNG_EPB_OPTION_FLAGS | (sizeof (u32) << 16);
+  options[1] = point == PCAP_CAPTURE_RX ? 1 : point == PCAP_CAPTURE_TX ? 2 : 0;
+  options[2] = 0;
+
+  head = r->head;
+  tail = r->tail;
+
+  while (n_buffers > 0)
+    {
+      vlib_buffer_t * b0 = vlib_get_buffer (vm, buffers[0]);
+      u32 n_left0, n_block0, n_pad0;
+      u64 t0;
+
+      buffers++;
+      n_buffers--;
+
+      if (pcm->sw_if_index != ~0
+	  && vnet_buffer (b0)->sw_if_index[rx_or_tx] != pcm->sw_if_index)
+	continue;
+
+      if (pcm->classify_table_index != ~0
+	  && ! pcap_capture_classify (pcm, b0, now))
+	continue;
+
+      h.packet_length = vlib_buffer_length_in_chain (vm, b0);
+      h.captured_length = clib_min (h.packet_length, pcm->snaplen);
+      n_pad0 = round_pow2 (h.captured_length, 4) - h.captured_length;
+      n_block0 = sizeof (h) + h.captured_length + n_pad0
+	+ PCAPNG_EPB_OPTION_BYTES + sizeof (u32);
+      h.block_total_length = n_block0;
+
+      if (tail + n_block0 - head > r->size)
+	{
+	  /* Writer may have caught up since. */
+	  head = r->head;
+	  if (tail + n_block0 - head > r->size)
+	    {
+	      r->n_dropped++;
+	      continue;
+	    }
+	}
+
+      t0 = tail;
+      pcap_capture_ring_put (r, t0, &h, sizeof (h));
+      t0 += sizeof (h);
+
+      n_left0 = h.captured_length;
+      while (1)
+	{
+	  u32 n = clib_min (n_left0, b0->current_length);
+	  pcap_capture_ring_put (r, t0, vlib_buffer_get_current (b0), n);
+	  t0 += n;
+	  n_left0 -= n;
+	  if (n_left0 == 0 || ! (b0->flags & VLIB_BUFFER_NEXT_PRESENT))
+	    break;
+	  b0 = vlib_get_buffer (vm, b0->next_buffer);
+	}
+
+      pcap_capture_ring_put (r, t0, zero, n_pad0);
+      t0 += n_pad0;
+      pcap_capture_ring_put (r, t0, options, sizeof (options));
+      t0 += sizeof (options);
+      pcap_capture_ring_put (r, t0, &n_block0, sizeof (n_block0));
+
+      tail += n_block0;
+      r->n_captured++;
+    }
+
+  /* Publish the whole frame's blocks at once. */
+  CLIB_MEMORY_BARRIER ();
+  r->tail = tail;
+}
+
+static clib_error_t *
+pcap_capture_write_header (pcap_capture_main_t * pcm)
+{
+  /* Packed: no tail padding between the trailer and the next block. */
+  CLIB_PACKED (struct {
+    u32 block_type;
+    u32 block_total_length;
+    u32 byte_order_magic;
+    u16 major_version;
+    u16 minor_version;
+    u64 section_length;
+    u32 block_total_length_trailer;
+  }) shb;
+  struct {
+    u32 block_type;
+    u32 block_total_length;
+    u16 link_type;
+    u16 reserved;
+    u32 snaplen;
+    /* if_tsresol: nanoseconds, then end of options. */
+    u16 tsresol_code;
+    u16 tsresol_length;
+    u8 tsresol;
+    u8 pad[3];
+    u32 end_of_options;
+    u32 block_total_length_trailer;
+  } idb;
+  struct iovec iov[2];
+
+  memset (&shb, 0, sizeof (shb));
+  shb.block_type = PCAPNG_BLOCK_TYPE_SECTION_HEADER;
+  shb.block_total_length = shb.block_total_length_trailer = sizeof (shb);
+  shb.byte_order_magic = 0x1a2b3c4d;
+  shb.major_version = 1;
+  shb.minor_version = 0;
+  shb.section_length = ~0ULL;
+
+  memset (&idb, 0, sizeof (idb));
+  idb.block_type = PCAPNG_BLOCK_TYPE_INTERFACE_DESCRIPTION;
+  idb.block_total_length = idb.block_total_length_trailer = sizeof (idb);
+  idb.link_type = 1;		/* ethernet */
+  idb.snaplen = pcm->snaplen;
+  idb.tsresol_code = 9;
+  idb.tsresol_length = 1;
+  idb.tsresol = 9;
+
+  iov[0].iov_base = &shb;
+  iov[0].iov_len = sizeof (shb);
+  iov[1].iov_base = &idb;
+  iov[1].iov_len = sizeof (idb);
+
+  if (writev (pcm->file_descriptor, iov, 2) != sizeof (shb) + sizeof (idb))
+    return clib_error_return_unix (0, "write header");
+
+  pcm->file_bytes = sizeof (shb) + sizeof (idb);
+  return 0;
+}
+
+static clib_error_t *
+pcap_capture_open (pcap_capture_main_t * pcm)
+{
+  clib_error_t * error;
+  u8 * name;
+
+  if (pcm->n_files > 1)
+    name = format (0, "%s.%d%c", pcm->file_name, pcm->file_index, 0);
+  else
+    name = format (0, "%s%c", pcm->file_name, 0);
+
+  pcm->file_descriptor = open ((char *) name,
+			       O_CREAT | O_TRUNC | O_WRONLY, 0664);
+  if (pcm->file_descriptor < 0)
+    {
+      error = clib_error_return_unix (0, "open `%s'", name);
+      vec_free (name);
+      return error;
+    }
+  vec_free (name);
+
+  error = pcap_capture_write_header (pcm);
+  if (error)
+    {
+      close (pcm->file_descriptor);
+      pcm->file_descriptor = -1;
+      return error;
+    }
+
+  pcm->n_files_written++;
+  return 0;
+}
+
+static void
+pcap_capture_close (pcap_capture_main_t * pcm)
+{
+  if (pcm->file_descriptor >= 0)
+    close (pcm->file_descriptor);
+  pcm->file_descriptor = -1;
+}
+
+/* Write everything the rings hold in one writev.
+   Returns number of bytes taken from the rings. */
+static uword
+pcap_capture_flush (pcap_capture_main_t * pcm)
+{
+  pcap_capture_ring_t * r;
+  struct iovec * iov = pcm->iovecs;
+  uword n_bytes = 0;
+  int i, n_iov = 0;
+
+  vec_foreach (r, pcm->rings)
+    {
+      u64 head = r->head;
+      u64 tail = r->tail;
+      u32 h, n0;
+
+      /* Read tail before the blocks it covers. */
+      CLIB_MEMORY_BARRIER ();
+      pcm->ring_tails[r - pcm->rings] = tail;
+      if (tail == head)
+	continue;
+
+      h = head & (r->size - 1);
+      n0 = clib_min (tail - head, r->size - h);
+      iov[n_iov].iov_base = r->data + h;
+      iov[n_iov].iov_len = n0;
+      n_iov++;
+      if (tail - head > n0)
+	{
+	  iov[n_iov].iov_base = r->data;
+	  iov[n_iov].iov_len = tail - head - n0;
+	  n_iov++;
+	}
+      n_bytes += tail - head;
+    }
+
+  if (n_bytes == 0)
+    return 0;
+
+  /* Whole blocks only: a short write continues where it stopped. */
+  i = 0;
+  while (i < n_iov && pcm->file_descriptor >= 0)
+    {
+      ssize_t n = writev (pcm->file_descriptor, iov + i, n_iov - i);
+
+      if (n < 0)
+	{
+	  if (unix_error_is_fatal (errno))
+	    {
+	      pcm->n_write_errors++;
+	      pcap_capture_close (pcm);
+	    }
+	  continue;
+	}
+
+      pcm->file_bytes += n;
+      pcm->n_bytes_written += n;
+      while (i < n_iov && n >= iov[i].iov_len)
+	n -= iov[i++].iov_len;
+      if (i < n_iov)
+	{
+	  iov[i].iov_base += n;
+	  iov[i].iov_len -= n;
+	}
+    }
+
+  /* Hand the space back to the producers. */
+  CLIB_MEMORY_BARRIER ();
+  vec_foreach (r, pcm->rings)
+    r->head = pcm->ring_tails[r - pcm->rings];
+
+  /*
+   * A file that failed is left for the next one in the rotation. With
+   * a single file, or when the next one can't be opened either, there
+   * is nowhere to write: turn capture off rather than drain the rings
+   * into nothing.
+   */
+  if (pcm->file_descriptor < 0 && pcm->n_files == 1)
+    pcm->flags = 0;
+  else if (pcm->file_descriptor < 0
+	   || (pcm->max_file_bytes > 0
+	       && pcm->file_bytes >= pcm->max_file_bytes))
+    {
+      clib_error_t * error;
+
+      pcap_capture_close (pcm);
+      pcm->file_index = (pcm->file_index + 1) % pcm->n_files;
+      error = pcap_capture_open (pcm);
+      if (error)
+	{
+	  pcm->n_write_errors++;
+	  clib_error_free (error);
+	  pcm->flags = 0;
+	}
+    }
+
+  return n_bytes;
+}
+
+static void
+pcap_capture_writer_thread_fn (void * arg)
+{
+  pcap_capture_main_t * pcm = &pcap_capture_main;
+  vlib_worker_thread_t * w = (vlib_worker_thread_t *) arg;
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  struct timespec ts;
+
+  /* Writer wants no signals. */
+  {
+    sigset_t s;
+    sigfillset (&s);
+    pthread_sigmask (SIG_SETMASK, &s, 0);
+  }
+
+  if (vec_len (tm->thread_prefix))
+    vlib_set_thread_name ((char *)
+			  format (0, "%v_pcap_writer%c", tm->thread_prefix, '\0'));
+
+  clib_mem_set_heap (w->thread_mheap);
+
+  while (1)
+    {
+      if (pcm->flags || pcm->stop_requested)
+	{
+	  if (pcap_capture_flush (pcm))
+	    continue;
+
+	  if (pcm->stop_requested)
+	    {
+	      /* Producers are stopped and the rings are empty. */
+	      pcap_capture_close (pcm);
+	      CLIB_MEMORY_BARRIER ();
+	      pcm->stop_requested = 0;
+	    }
+	}
+
+      ts.tv_sec = 0;
+      ts.tv_nsec = pcm->flags ? 100 * 1000 : 10 * 1000 * 1000;
+      while (nanosleep (&ts, &ts) < 0)
+	;
+    }
+}
+
+VLIB_REGISTER_THREAD (pcap_capture_writer_thread_reg, static) = {
+  .name = "pcap-writer",
+  .function = pcap_capture_writer_thread_fn,
+  .fixed_count = 1,
+  .count = 1,
+  .no_data_structure_clone = 1,
+  .use_pthreads = 1,
+};
+
+static clib_error_t *
+pcap_capture_enable (vlib_main_t * vm, pcap_capture_main_t * pcm)
+{
+  vlib_thread_main_t * tm = vlib_get_thread_main ();
+  pcap_capture_ring_t * r;
+  clib_error_t * error;
+  u32 n_rings = clib_max (tm->n_vlib_mains, 1);
+
+  /* Rings only change while capture is off and the writer idle. */
+  if (vec_len (pcm->rings) != n_rings
+      || (n_rings > 0 && pcm->rings[0].size != pcm->ring_bytes))
+    {
+      vec_foreach (r, pcm->rings)
+	clib_mem_free (r->data);
+      vec_free (pcm->rings);
+      vec_validate_aligned (pcm->rings, n_rings - 1, CLIB_CACHE_LINE_BYTES);
+      vec_foreach (r, pcm->rings)
+	{
+	  r->size = pcm->ring_bytes;
+	  r->data = clib_mem_alloc_aligned (r->size, CLIB_CACHE_LINE_BYTES);
+	}
+      vec_validate (pcm->iovecs, 2 * n_rings - 1);
+      vec_validate (pcm->ring_tails, n_rings - 1);
+    }
+
+  vec_foreach (r, pcm->rings)
+    {
+      r->head = r->tail = 0;
+      r->n_captured = r->n_dropped = 0;
+    }
+
+  pcm->file_index = 0;
+  pcm->n_bytes_written = 0;
+  pcm->n_files_written = 0;
+  pcm->n_write_errors = 0;
+  error = pcap_capture_open (pcm);
+  if (error)
+    return error;
+
+  pcm->unix_time_base_nsec = unix_time_now_nsec ();
+  pcm->cpu_time_base = clib_cpu_time_now ();
+  pcm->nsec_per_clock = 1e9 * vm->clib_time.seconds_per_clock;
+
+  return 0;
+}
+
+static clib_error_t *
+pcap_capture_command_fn (vlib_main_t * vm,
+			 unformat_input_t * input,
+			 vlib_cli_command_t * cmd)
+{
+  pcap_capture_main_t * pcm = &pcap_capture_main;
+  vnet_main_t * vnm = vnet_get_main ();
+  unformat_input_t _line_input, * line_input = &_line_input;
+  clib_error_t * error = 0;
+  u32 flags = 0, sw_if_index = ~0, classify_table_index = ~0;
+  u32 snaplen = 128, n_files = 1, max_file_mbytes = 0, ring_kbytes = 4096;
+  u8 * file_name = 0;
+  int is_on = 0, is_off = 0;
+  f64 deadline;
+
+  if (! unformat_user (input, unformat_line_input, line_input))
+    return 0;
+
+  while (unformat_check_input (line_input) != UNFORMAT_END_OF_INPUT)
+    {
+      if (unformat (line_input, "on"))
+	is_on = 1;
+      else if (unformat (line_input, "off"))
+	is_off = 1;
+#define _(b,f,s)						\
+      else if (unformat (line_input, s))			\
+	flags |= PCAP_CAPTURE_##f;
+      foreach_pcap_capture_point
+#undef _
+      /* Before "file", which would take them as a file name. */
+      else if (unformat (line_input, "files %u", &n_files))
+	;
+      else if (unformat (line_input, "file-size %u", &max_file_mbytes))
+	;
+      else if (unformat (line_input, "file %s", &file_name))
+	;
+      else if (unformat (line_input, "snaplen %u", &snaplen))
+	;
+      else if (unformat (line_input, "ring-size %u", &ring_kbytes))
+	;
+      else if (unformat (line_input, "interface %U",
+			 unformat_vnet_sw_interface, vnm, &sw_if_index))
+	;
+      else if (unformat (line_input, "classify-table %u",
+			 &classify_table_index))
+	;
+      else
+	{
+	  error = clib_error_return (0, "unknown input `%U'",
+				     format_unformat_error, line_input);
+	  goto done;
+	}
+    }
+
+  if (is_off)
+    {
+      if (pcm->flags == 0)
+	{
+	  vlib_cli_output (vm, "pcap capture already off...");
+	  goto done;
+	}
+
+      /* No thread is inside a node once the barrier is held. */
+      vlib_worker_thread_barrier_sync (vm);
+      pcm->flags = 0;
+      vlib_worker_thread_barrier_release (vm);
+
+      pcm->stop_requested = 1;
+      deadline = vlib_time_now (vm) + 5.0;
+      while (pcm->stop_requested && vlib_time_now (vm) < deadline)
+	vlib_process_suspend (vm, 1e-3);
+
+      if (pcm->stop_requested)
+	error = clib_error_return (0, "pcap writer not responding");
+      else
+	vlib_cli_output (vm, "pcap capture off, %Ld bytes in %Ld files",
+			 pcm->n_bytes_written, pcm->n_files_written);
+      goto done;
+    }
+
+  if (! is_on)
+    {
+      error = clib_error_return (0, "expected on or off");
+      goto done;
+    }
+
+  if (pcm->flags)
+    {
+      error = clib_error_return (0, "pcap capture already on");
+      goto done;
+    }
+
+  if (pcm->stop_requested)
+    {
+      error = clib_error_return (0, "pcap writer still stopping");
+      goto done;
+    }
+
+  if (flags == 0)
+    flags = PCAP_CAPTURE_RX | PCAP_CAPTURE_TX;
+
+  if (snaplen == 0 || n_files == 0 || ring_kbytes == 0)
+    {
+      error = clib_error_return (0, "snaplen, files and ring-size "
+				 "must be positive");
+      goto done;
+    }
+
+  if (ring_kbytes > PCAP_CAPTURE_MAX_RING_KBYTES)
+    {
+      error = clib_error_return (0, "ring-size at most %u kbytes",
+				 PCAP_CAPTURE_MAX_RING_KBYTES);
+      goto done;
+    }
+
+  if (classify_table_index != ~0
+      && pool_is_free_index (vnet_classify_main.tables, classify_table_index))
+    {
+      error = clib_error_return (0, "classify table %d not found",
+				 classify_table_index);
+      goto done;
+    }
+
+  if (n_files > 1 && max_file_mbytes == 0)
+    {
+      error = clib_error_return (0, "rotating over files needs a file-size");
+      goto done;
+    }
+
+  vec_free (pcm->file_name);
+  pcm->file_name = file_name ? file_name : format (0, "/tmp/vnet.pcapng");
+  vec_add1 (pcm->file_name, 0);
+  file_name = 0;
+
+  pcm->snaplen = snaplen;
+  pcm->n_files = n_files;
+  pcm->max_file_bytes = (u64) max_file_mbytes << 20;
+  pcm->ring_bytes = max_pow2 (ring_kbytes << 10);
+  pcm->sw_if_index = sw_if_index;
+  pcm->classify_table_index = classify_table_index;
+
+  error = pcap_capture_enable (vm, pcm);
+  if (error)
+    goto done;
+
+  vlib_worker_thread_barrier_sync (vm);
+  pcm->flags = flags;
+  vlib_worker_thread_barrier_release (vm);
+
+  vlib_cli_output (vm, "pcap capture on...");
+
+ done:
+  vec_free (file_name);
+  unformat_free (line_input);
+  return error;
+}
+
+VLIB_CLI_COMMAND (pcap_capture_command, static) = {
+  .path = "pcap capture",
+  .short_help =
+  "pcap capture on [rx] [tx] [drop] [file <name>] [snaplen <n>]\n"
+  "  [files <n> file-size <MB>] [ring-size <KB>] [interface <intfc>]\n"
+  "  [classify-table <n>] | off",
+  .function = pcap_capture_command_fn,
+};
+
+static clib_error_t *
+show_pcap_capture_command_fn (vlib_main_t * vm,
+			      unformat_input_t * input,
+			      vlib_cli_command_t * cmd)
+{
+  pcap_capture_main_t * pcm = &pcap_capture_main;
+  pcap_capture_ring_t * r;
+
+  if (pcm->flags == 0 && vec_len (pcm->rings) == 0)
+    {
+      vlib_cli_output (vm, "pcap capture is off...");
+      return 0;
+    }
+
+  vlib_cli_output (vm, "pcap capture %s, file %s, snaplen %d",
+		   pcm->flags ? "on" : "off", pcm->file_name, pcm->snaplen);
+  if (pcm->n_files > 1)
+    vlib_cli_output (vm, "  rotating over %d files of %Ld MB, at file %d",
+		     pcm->n_files, pcm->max_file_bytes >> 20,
+		     pcm->file_index);
+  vlib_cli_output (vm, "  %Ld bytes written, %Ld files, %Ld write errors",
+		   pcm->n_bytes_written, pcm->n_files_written,
+		   pcm->n_write_errors);
+
+  vlib_cli_output (vm, "%=10s%=16s%=16s%=16s",
+		   "Thread", "Captured", "Dropped", "Ring used");
+  vec_foreach (r, pcm->rings)
+    vlib_cli_output (vm, "%=10d%=16Ld%=16Ld%=16Ld",
+		     r - pcm->rings, r->n_captured, r->n_dropped,
+		     r->tail - r->head);
+
+  return 0;
+}
+
+VLIB_CLI_COMMAND (show_pcap_capture_command, static) = {
+  .path = "show pcap capture",
+  .short_help = "show pcap capture",
+  .function = show_pcap_capture_command_fn,
+};
+
+static clib_error_t *
+pcap_capture_init (vlib_main_t * vm)
+{
+  pcap_capture_main_t * pcm = &pcap_capture_main;
+
+  pcm->file_descriptor = -1;
+  pcm->sw_if_index = ~0;
+  pcm->classify_table_index = ~0;
+  return 0;
+}
+
+VLIB_INIT_FUNCTION (pcap_capture_init);
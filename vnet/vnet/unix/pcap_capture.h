@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * pcap_capture.h: packet capture to disk off the forwarding path
+ *
+ * Each thread appends pcapng enhanced packet blocks for the packets it
+ * captures to its own single producer, single consumer ring.  The
+ * pcap-writer thread drains all rings with one writev and rotates the
+ * output over a set of files by size.  When a ring is full the packet
+ * is left out of the capture and counted; forwarding never waits.
+ *
+ * Rx packets are captured in ethernet-input, and in dpdk-input for
+ * those it hands straight to ip4/ip6/mpls-input.  The ixge, ssvm, tap
+ * and tuntap drivers do the same without capturing: their l3 packets
+ * are not in an rx capture.
+ */
+
+#ifndef included_vnet_pcap_capture_h
+#define included_vnet_pcap_capture_h
+
+#include <sys/uio.h>
+#include <vlib/vlib.h>
+
+#define foreach_pcap_capture_point		\
+  _ (0, RX, "rx")				\
+  _ (1, TX, "tx")				\
+  _ (2, DROP, "drop")
+
+typedef enum {
+#define _(b,f,s) PCAP_CAPTURE_##f = (1 << (b)),
+  foreach_pcap_capture_point
+#undef _
+} pcap_capture_point_t;
+
+/* pcapng block types. */
+#define PCAPNG_BLOCK_TYPE_SECTION_HEADER	0x0a0d0d0a
+#define PCAPNG_BLOCK_TYPE_INTERFACE_DESCRIPTION	0x00000001
+#define PCAPNG_BLOCK_TYPE_ENHANCED_PACKET	0x00000006
+
+typedef struct {
+  u32 block_type;
+  u32 block_total_length;
+  u32 interface_id;
+  u32 timestamp_high;
+  u32 timestamp_low;
+  u32 captured_length;
+  u32 packet_length;
+
+  /* Packet data padded to 4 bytes, options and
+     block_total_length again follow. */
+  u8 data[0];
+} pcapng_enhanced_packet_block_t;
+
+/* Largest ring, whose size in bytes still fits a u32. */
+#define PCAP_CAPTURE_MAX_RING_KBYTES	(1 << 20)
+
+typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline0);
+
+  /* Producer side, written by the capturing thread only. */
+  volatile u64 tail;
+  u64 n_captured;
+  u64 n_dropped;
+
+  CLIB_CACHE_LINE_ALIGN_MARK (cacheline1);
+
+  /* Consumer side, written by the writer thread only. */
+  volatile u64 head;
+
+  /* Power of 2 bytes of pcapng blocks. */
+  u8 * data;
+  u32 size;
+} pcap_capture_ring_t;
+
+typedef struct {
+  /* Enabled capture points, zero when capture is off. */
+  volatile u32 flags;
+
+  /* Bytes of each packet kept. */
+  u32 snaplen;
+
+  /* Capture only packets of this interface, ~0 for all. */
+  u32 sw_if_index;
+
+  /* Capture only packets matching this classifier table, ~0 for all. */
+  u32 classify_table_index;
+
+  /* Packet timestamps: unix time in nanoseconds at cpu time base. */
+  u64 unix_time_base_nsec;
+  u64 cpu_time_base;
+  f64 nsec_per_clock;
+
+  /* Indexed by cpu index. */
+  pcap_capture_ring_t * rings;
+  u32 ring_bytes;
+
+  /* Output files: file_name, or file_name.N when rotating over
+     n_files files of about max_file_bytes each. */
+  u8 * file_name;
+  u32 n_files;
+  u64 max_file_bytes;
+
+  /* Writer state. */
+  int file_descriptor;
+  u32 file_index;
+  u64 file_bytes;
+  u64 n_bytes_written;
+  u64 n_files_written;
+  u64 n_write_errors;
+  struct iovec * iovecs;
+  u64 * ring_tails;
+
+  /* Set to have the writer drain the rings and close the file. */
+  volatile u32 stop_requested;
+} pcap_capture_main_t;
+
+extern pcap_capture_main_t pcap_capture_main;
+
+/* Copy packets into this thread's ring.  Caller checks the flags. */
+void pcap_capture_buffers (vlib_main_t * vm, u32 * buffers, u32 n_buffers,
+			   pcap_capture_point_t point);
+
+#endif /* included_vnet_pcap_capture_h */
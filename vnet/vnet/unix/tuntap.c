@@ -27,6 +27,7 @@
 
 #include <linux/if_arp.h>
 #include <linux/if_tun.h>
+#include <linux/virtio_net.h>
 
 #include <vlib/vlib.h>
 #include <vlib/unix/unix.h>
@@ -66,16 +67,45 @@ typedef struct {
 } subif_address_t;
 
 typedef struct {
+  CLIB_CACHE_LINE_ALIGN_MARK(cacheline0);
+
   /* Vector of iovecs for readv/writev calls. */
   struct iovec * iovecs;
 
   /* Vector of VLIB rx buffers to use.  We allocate them in blocks
      of VLIB_FRAME_SIZE (256). */
   u32 * rx_buffers;
+} tuntap_per_thread_t;
+
+typedef struct {
+  /* /dev/net/tun file descriptor, one per IFF_MULTI_QUEUE queue */
+  int fd;
+
+  u32 unix_file_index;
+
+  /* Thread reading the queue */
+  u32 cpu_index;
+} tuntap_queue_t;
 
-  /* File descriptors for /dev/net/tun and provisioning socket. */
+typedef struct {
+  /* Indexed by cpu_index */
+  tuntap_per_thread_t * per_thread;
+
+  /* First queue's fd, and the provisioning socket. */
   int dev_net_tun_fd, dev_tap_fd;
 
+  /* All queues, the first one included */
+  tuntap_queue_t * queues;
+
+  /* Number of queues configured */
+  u32 n_queues;
+
+  /* Reads and writes carry a struct virtio_net_hdr */
+  int have_vnet_hdr;
+
+  /* Queues are polled, by the workers if any, instead of epoll driven */
+  int is_polling;
+
   /* Create a "tap" [ethernet] encaps device */
   int is_ether;
 
@@ -98,8 +128,6 @@ typedef struct {
   /* Hash for subif addresses */
   mhash_t subif_mhash;
 
-  u32 unix_file_index;
-
   /* For the "normal" interface, if configured */
   u32 hw_if_index, sw_if_index;
 
@@ -110,6 +138,8 @@ static tuntap_main_t tuntap_main = {
 
   /* Suitable defaults for an Ethernet-like tun/tap device */
   .mtu_bytes = 4096 + 256,
+
+  .n_queues = 1,
 };
 
 /*
@@ -126,6 +156,11 @@ tuntap_tx (vlib_main_t * vm,
   u32 * buffers = vlib_frame_args (frame);
   uword n_packets = frame->n_vectors;
   tuntap_main_t * tm = &tuntap_main;
+  u32 cpu_index = os_get_cpu_number();
+  tuntap_per_thread_t * pt = vec_elt_at_index (tm->per_thread, cpu_index);
+  /* A writev is one packet, threads may share a queue */
+  int fd = tm->queues[cpu_index % vec_len (tm->queues)].fd;
+  struct virtio_net_hdr vnet_hdr;
   int i;
 
   for (i = 0; i < n_packets; i++)
@@ -143,11 +178,22 @@ tuntap_tx (vlib_main_t * vm,
         }
 
       /* Re-set iovecs if present. */
-      if (tm->iovecs)
-	_vec_len (tm->iovecs) = 0;
+      if (pt->iovecs)
+	_vec_len (pt->iovecs) = 0;
+
+      /* Checksums we verified need not be verified again by the kernel */
+      if (tm->have_vnet_hdr)
+	{
+	  memset (&vnet_hdr, 0, sizeof (vnet_hdr));
+	  if (b->flags & IP_BUFFER_L4_CHECKSUM_CORRECT)
+	    vnet_hdr.flags = VIRTIO_NET_HDR_F_DATA_VALID;
+	  vec_add2 (pt->iovecs, iov, 1);
+	  iov->iov_base = &vnet_hdr;
+	  iov->iov_len = sizeof (vnet_hdr);
+	}
 
       /* VLIB buffer chain -> Unix iovec(s). */
-      vec_add2 (tm->iovecs, iov, 1);
+      vec_add2 (pt->iovecs, iov, 1);
       iov->iov_base = b->data + b->current_data;
       iov->iov_len = l = b->current_length;
 
@@ -156,7 +202,7 @@ tuntap_tx (vlib_main_t * vm,
 	  do {
 	    b = vlib_get_buffer (vm, b->next_buffer);
 
-	    vec_add2 (tm->iovecs, iov, 1);
+	    vec_add2 (pt->iovecs, iov, 1);
 
 	    iov->iov_base = b->data + b->current_data;
 	    iov->iov_len = b->current_length;
@@ -164,7 +210,10 @@ tuntap_tx (vlib_main_t * vm,
 	  } while (b->flags & VLIB_BUFFER_NEXT_PRESENT);
 	}
 
-      if (writev (tm->dev_net_tun_fd, tm->iovecs, vec_len (tm->iovecs)) < l)
+      if (tm->have_vnet_hdr)
+	l += sizeof (vnet_hdr);
+
+      if (writev (fd, pt->iovecs, vec_len (pt->iovecs)) < l)
 	clib_unix_warning ("writev");
     }
     
@@ -192,12 +241,47 @@ enum {
   TUNTAP_RX_N_NEXT,
 };
 
+/*
+ * The kernel skipped the checksum of a CHECKSUM_PARTIAL packet, since
+ * we said we'd take those (TUN_F_CSUM): finish it, it's cheaper than
+ * the full verification the kernel would have done for us otherwise.
+ */
+always_inline void
+tuntap_rx_vnet_hdr (vlib_main_t * vm, vlib_buffer_t * b,
+                    struct virtio_net_hdr * hdr)
+{
+  ip_csum_t sum;
+  u16 * csum;
+  u32 start;
+
+  /* No TSO/UFO offloads are enabled, packets come whole */
+  ASSERT (hdr->gso_type == VIRTIO_NET_HDR_GSO_NONE);
+
+  if (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)
+    {
+      start = hdr->csum_start;
+      ASSERT (start + hdr->csum_offset + sizeof (u16) <= b->current_length);
+
+      sum = ip_incremental_checksum_buffer
+        (vm, b, start, vlib_buffer_length_in_chain (vm, b) - start, 0);
+      csum = (u16 *) (b->data + start + hdr->csum_offset);
+      *csum = ~ip_csum_fold (sum);
+
+      b->flags |= IP_BUFFER_L4_CHECKSUM_COMPUTED | IP_BUFFER_L4_CHECKSUM_CORRECT;
+    }
+  else if (hdr->flags & VIRTIO_NET_HDR_F_DATA_VALID)
+    b->flags |= IP_BUFFER_L4_CHECKSUM_COMPUTED | IP_BUFFER_L4_CHECKSUM_CORRECT;
+}
+
+/* Reads up to a frame's worth of packets from one queue */
 static uword
-tuntap_rx (vlib_main_t * vm,
-	   vlib_node_runtime_t * node,
-	   vlib_frame_t * frame)
+tuntap_rx_queue (vlib_main_t * vm,
+                 vlib_node_runtime_t * node,
+                 tuntap_queue_t * q)
 {
   tuntap_main_t * tm = &tuntap_main;
+  u32 cpu_index = os_get_cpu_number();
+  tuntap_per_thread_t * pt = vec_elt_at_index (tm->per_thread, cpu_index);
   vlib_buffer_t * b;
   u32 bi;
   const uword buffer_size = VLIB_BUFFER_DATA_SIZE;
@@ -207,158 +291,223 @@ tuntap_rx (vlib_main_t * vm,
   dpdk_main_t * dm = &dpdk_main;
   u32 free_list_index = dm->vlib_buffer_free_list_index;
 #endif
+  struct virtio_net_hdr vnet_hdr;
+  u32 n_hdr_iovecs = tm->have_vnet_hdr ? 1 : 0;
+  u32 next_index = node->cached_next_index;
+  u32 n_left_to_next, * to_next;
+  uword n_trace = vlib_get_trace_count (vm, node);
+  u32 n_packets = 0, n_bytes = 0;
+  int admin_down = 0;
+
+  /* The linux kernel couldn't care less if our interface is up */
+  if (tm->have_normal_interface)
+    {
+      vnet_main_t *vnm = vnet_get_main();
+      vnet_sw_interface_t * si;
+      si = vnet_get_sw_interface (vnm, tm->sw_if_index);
+      admin_down = !(si->flags & VNET_SW_INTERFACE_FLAG_ADMIN_UP);
+    }
 
-  /* Make sure we have some RX buffers. */
-  {
-    uword n_left = vec_len (tm->rx_buffers);
-    uword n_alloc;
+  vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+
+  while (n_packets < VLIB_FRAME_SIZE)
+    {
+      u32 next0;
+      uword i_rx;
+      word i, n_read, n_bytes_left, n_bytes_in_packet;
 
-    if (n_left < VLIB_FRAME_SIZE / 2)
+      /* Make sure we have some RX buffers. */
       {
-	if (! tm->rx_buffers)
-	  vec_alloc (tm->rx_buffers, VLIB_FRAME_SIZE);
+        uword n_left = vec_len (pt->rx_buffers);
+        uword n_alloc;
+
+        if (n_left < VLIB_FRAME_SIZE / 2)
+          {
+            if (! pt->rx_buffers)
+              vec_alloc (pt->rx_buffers, VLIB_FRAME_SIZE);
 
-	n_alloc = vlib_buffer_alloc_from_free_list 
-            (vm, tm->rx_buffers + n_left, VLIB_FRAME_SIZE - n_left, 
-             free_list_index);
-	_vec_len (tm->rx_buffers) = n_left + n_alloc;
+            n_alloc = vlib_buffer_alloc_from_free_list
+                (vm, pt->rx_buffers + n_left, VLIB_FRAME_SIZE - n_left,
+                 free_list_index);
+            _vec_len (pt->rx_buffers) = n_left + n_alloc;
+          }
+
+        /* We need enough buffers left for an MTU sized packet. */
+        if (PREDICT_FALSE (vec_len (pt->rx_buffers) < tm->mtu_buffers))
+          break;
       }
-  }
 
-  /* Allocate RX buffers from end of rx_buffers.
-     Turn them into iovecs to pass to readv. */
-  {
-    uword i_rx = vec_len (tm->rx_buffers) - 1;
-    vlib_buffer_t * b;
-    word i, n_bytes_left, n_bytes_in_packet;
+      /* Allocate RX buffers from end of rx_buffers.
+         Turn them into iovecs to pass to readv. */
+      i_rx = vec_len (pt->rx_buffers) - 1;
 
-    /* We should have enough buffers left for an MTU sized packet. */
-    ASSERT (vec_len (tm->rx_buffers) >= tm->mtu_buffers);
+      vec_validate (pt->iovecs, n_hdr_iovecs + tm->mtu_buffers - 1);
+      if (n_hdr_iovecs)
+        {
+          pt->iovecs[0].iov_base = &vnet_hdr;
+          pt->iovecs[0].iov_len = sizeof (vnet_hdr);
+        }
+      for (i = 0; i < tm->mtu_buffers; i++)
+        {
+          b = vlib_get_buffer (vm, pt->rx_buffers[i_rx - i]);
+          pt->iovecs[n_hdr_iovecs + i].iov_base = b->data;
+          pt->iovecs[n_hdr_iovecs + i].iov_len = buffer_size;
+        }
 
-    vec_validate (tm->iovecs, tm->mtu_buffers - 1);
-    for (i = 0; i < tm->mtu_buffers; i++)
-      {
-	b = vlib_get_buffer (vm, tm->rx_buffers[i_rx - i]);
-	tm->iovecs[i].iov_base = b->data;
-	tm->iovecs[i].iov_len = buffer_size;
-      }
+      n_read = readv (q->fd, pt->iovecs, n_hdr_iovecs + tm->mtu_buffers);
+      if (n_read <= 0)
+        {
+          if (n_read < 0 && errno != EAGAIN)
+            clib_unix_warning ("readv %d", n_read);
+          break;
+        }
 
-    n_bytes_left = readv (tm->dev_net_tun_fd, tm->iovecs, tm->mtu_buffers);
-    n_bytes_in_packet = n_bytes_left;
-    if (n_bytes_left <= 0)
-      {
-        if (errno != EAGAIN)
-          clib_unix_warning ("readv %d", n_bytes_left);
-	return 0;
-      }
+      n_bytes_left = n_read - (n_hdr_iovecs ? sizeof (vnet_hdr) : 0);
+      n_bytes_in_packet = n_bytes_left;
+      if (PREDICT_FALSE (n_bytes_left <= 0))
+        continue;
 
-    bi = tm->rx_buffers[i_rx];
+      bi = pt->rx_buffers[i_rx];
 
-    while (1)
-      {
+      while (1)
+        {
 #if DPDK == 1
-        struct rte_mbuf * mb;
+          struct rte_mbuf * mb;
 #endif
-	b = vlib_get_buffer (vm, tm->rx_buffers[i_rx]);
+          b = vlib_get_buffer (vm, pt->rx_buffers[i_rx]);
 #if DPDK == 1
-	mb = rte_mbuf_from_vlib_buffer(b);
+          mb = rte_mbuf_from_vlib_buffer(b);
 #endif
-	b->flags = 0;
-	b->current_data = 0;
-	b->current_length = n_bytes_left < buffer_size ? n_bytes_left : buffer_size;
+          b->flags = 0;
+          b->current_data = 0;
+          b->current_length = n_bytes_left < buffer_size ? n_bytes_left : buffer_size;
 
-	n_bytes_left -= buffer_size;
+          n_bytes_left -= buffer_size;
 #if DPDK == 1
-        rte_pktmbuf_data_len (mb) = b->current_length;
+          rte_pktmbuf_data_len (mb) = b->current_length;
 #endif
 
-	if (n_bytes_left <= 0)
-          {
+          if (n_bytes_left <= 0)
+            {
 #if DPDK == 1
-            rte_pktmbuf_pkt_len (mb) = n_bytes_in_packet;
+              rte_pktmbuf_pkt_len (mb) = n_bytes_in_packet;
 #endif
-            break;
-          }
+              break;
+            }
 
-	i_rx--;
-	b->flags |= VLIB_BUFFER_NEXT_PRESENT;
-	b->next_buffer = tm->rx_buffers[i_rx];
+          i_rx--;
+          b->flags |= VLIB_BUFFER_NEXT_PRESENT;
+          b->next_buffer = pt->rx_buffers[i_rx];
 #if DPDK == 1
-        ASSERT(0);
-        // ((struct rte_pktmbuf *)(b->mb))->next = 
-        // vlib_get_buffer (vm, tm->rx_buffers[i_rx])->mb;
+          ASSERT(0);
+          // ((struct rte_pktmbuf *)(b->mb))->next =
+          // vlib_get_buffer (vm, pt->rx_buffers[i_rx])->mb;
 #endif
-      }
+        }
 
-    /* Interface counters for tuntap interface. */
-    vlib_increment_combined_counter 
-        (vnet_main.interface_main.combined_sw_if_counters
-         + VNET_INTERFACE_COUNTER_RX,
-         os_get_cpu_number(),
-         tm->sw_if_index,
-         1, n_bytes_in_packet);
-    
-    _vec_len (tm->rx_buffers) = i_rx;
-  }
+      _vec_len (pt->rx_buffers) = i_rx;
 
-  b = vlib_get_buffer (vm, bi);
+      b = vlib_get_buffer (vm, bi);
 
-  {
-    u32 next_index;
-    uword n_trace = vlib_get_trace_count (vm, node);
+      if (n_hdr_iovecs)
+        tuntap_rx_vnet_hdr (vm, b, &vnet_hdr);
 
-    vnet_buffer (b)->sw_if_index[VLIB_RX] = tm->sw_if_index;
-    vnet_buffer (b)->sw_if_index[VLIB_TX] = (u32)~0;
+      vnet_buffer (b)->sw_if_index[VLIB_RX] = tm->sw_if_index;
+      vnet_buffer (b)->sw_if_index[VLIB_TX] = (u32)~0;
 
-    /*
-     * Turn this on if you run into
-     * "bad monkey" contexts, and you want to know exactly
-     * which nodes they've visited...
-     */
-    if (VLIB_BUFFER_TRACE_TRAJECTORY)
-        b->pre_data[0] = 0;
+      /*
+       * Turn this on if you run into
+       * "bad monkey" contexts, and you want to know exactly
+       * which nodes they've visited...
+       */
+      if (VLIB_BUFFER_TRACE_TRAJECTORY)
+          b->pre_data[0] = 0;
 
-    b->error = node->errors[0];
+      b->error = node->errors[0];
 
-    if (tm->is_ether)
-      {
-	next_index = TUNTAP_RX_NEXT_ETHERNET_INPUT;
-      }
-    else
-      switch (b->data[0] & 0xf0)
+      if (tm->is_ether)
         {
-        case 0x40:
-          next_index = TUNTAP_RX_NEXT_IP4_INPUT;
-          break;
-        case 0x60:
-          next_index = TUNTAP_RX_NEXT_IP6_INPUT;
-          break;
-        default:
-          next_index = TUNTAP_RX_NEXT_DROP;
-          break;
+          next0 = TUNTAP_RX_NEXT_ETHERNET_INPUT;
         }
+      else
+        switch (b->data[0] & 0xf0)
+          {
+          case 0x40:
+            next0 = TUNTAP_RX_NEXT_IP4_INPUT;
+            break;
+          case 0x60:
+            next0 = TUNTAP_RX_NEXT_IP6_INPUT;
+            break;
+          default:
+            next0 = TUNTAP_RX_NEXT_DROP;
+            break;
+          }
 
-    /* The linux kernel couldn't care less if our interface is up */
-    if (tm->have_normal_interface)
-      {
-        vnet_main_t *vnm = vnet_get_main();
-        vnet_sw_interface_t * si;
-        si = vnet_get_sw_interface (vnm, tm->sw_if_index);
-        if (!(si->flags & VNET_SW_INTERFACE_FLAG_ADMIN_UP))
-          next_index = TUNTAP_RX_NEXT_DROP;
-      }
+      if (admin_down)
+        next0 = TUNTAP_RX_NEXT_DROP;
 
-    vlib_set_next_frame_buffer (vm, node, next_index, bi);
+      if (PREDICT_FALSE (n_trace > 0))
+        {
+          vlib_trace_buffer (vm, node, next0,
+                             b, /* follow_chain */ 1);
+          vlib_set_trace_count (vm, node, --n_trace);
+        }
+
+      n_packets++;
+      n_bytes += n_bytes_in_packet;
+
+      to_next[0] = bi;
+      to_next++;
+      n_left_to_next--;
+
+      vlib_validate_buffer_enqueue_x1 (vm, node, next_index,
+                                       to_next, n_left_to_next,
+                                       bi, next0);
+
+      if (PREDICT_FALSE (n_left_to_next == 0))
+        {
+          vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+          vlib_get_next_frame (vm, node, next_index, to_next, n_left_to_next);
+        }
+    }
+
+  vlib_put_next_frame (vm, node, next_index, n_left_to_next);
+
+  /* Interface counters for tuntap interface. */
+  if (n_packets)
+    vlib_increment_combined_counter
+        (vnet_main.interface_main.combined_sw_if_counters
+         + VNET_INTERFACE_COUNTER_RX,
+         cpu_index,
+         tm->sw_if_index,
+         n_packets, n_bytes);
+
+  return n_packets;
+}
+
+static uword
+tuntap_rx (vlib_main_t * vm,
+	   vlib_node_runtime_t * node,
+	   vlib_frame_t * frame)
+{
+  tuntap_main_t * tm = &tuntap_main;
+  u32 cpu_index = os_get_cpu_number();
+  tuntap_queue_t * q;
+  uword n_packets = 0;
+  int n_queues = 0;
 
-    if (n_trace > 0)
+  vec_foreach (q, tm->queues)
+    if (q->cpu_index == cpu_index)
       {
-        vlib_trace_buffer (vm, node, next_index,
-                           b, /* follow_chain */ 1);
-        vlib_set_trace_count (vm, node, n_trace - 1);
+        n_packets += tuntap_rx_queue (vm, node, q);
+        n_queues++;
       }
-  }
 
-  return 1;
+  /* Polling state is inherited by every thread, keep it where needed */
+  if (PREDICT_FALSE (n_queues == 0 && node->state == VLIB_NODE_STATE_POLLING))
+    vlib_node_set_state (vm, node->node_index, VLIB_NODE_STATE_DISABLED);
+
+  return n_packets;
 }
 
 static char * tuntap_rx_error_strings[] = {
@@ -383,7 +532,8 @@ VLIB_REGISTER_NODE (tuntap_rx_node,static) = {
   },
 };
 
-/* Gets called when file descriptor is ready from epoll. */
+/* Gets called when file descriptor is ready from epoll. The rx node
+   reads every queue, they all belong to the main thread in this mode. */
 static clib_error_t * tuntap_read_ready (unix_file_t * uf)
 {
   vlib_main_t * vm = vlib_get_main();
@@ -391,6 +541,21 @@ static clib_error_t * tuntap_read_ready (unix_file_t * uf)
   return 0;
 }
 
+static void
+tuntap_close_queues (tuntap_main_t * tm)
+{
+  tuntap_queue_t * q;
+
+  vec_foreach (q, tm->queues)
+    {
+      if (q->unix_file_index != ~0)
+        unix_file_del (&unix_main, unix_main.file_pool + q->unix_file_index);
+      else if (q->fd >= 0)
+        close (q->fd);
+    }
+  vec_free (tm->queues);
+}
+
 /*
  * tuntap_exit
  * Clean up the tun/tap device
@@ -427,7 +592,8 @@ tuntap_exit (vlib_main_t * vm)
   if (ioctl (tm->dev_net_tun_fd, TUNSETPERSIST, 0) < 0)
     clib_unix_warning ("TUNSETPERSIST");
   close(tm->dev_tap_fd);
-  close(tm->dev_net_tun_fd);
+  tuntap_close_queues (tm);
+  tm->dev_net_tun_fd = -1;
   close (sfd);
 
   return 0;
@@ -444,7 +610,11 @@ tuntap_config (vlib_main_t * vm, unformat_input_t * input)
   u8 * name;
   int flags = IFF_TUN | IFF_NO_PI;
   int is_enabled = 0, is_ether = 0, have_normal_interface = 0;
+  int have_vnet_hdr = 0, is_polling = 0;
   const uword buffer_size = VLIB_BUFFER_DATA_SIZE;
+  vlib_thread_main_t * vtm = vlib_get_thread_main();
+  tuntap_queue_t * q;
+  u32 i;
 
   while (unformat_check_input (input) != UNFORMAT_END_OF_INPUT)
     {
@@ -462,6 +632,12 @@ tuntap_config (vlib_main_t * vm, unformat_input_t * input)
         have_normal_interface = 1;
       else if (unformat (input, "name %s", &name))
 	tm->tun_name = (char *) name;
+      else if (unformat (input, "queues %d", &tm->n_queues))
+        ;
+      else if (unformat (input, "vnet-hdr"))
+        have_vnet_hdr = 1;
+      else if (unformat (input, "poll"))
+        is_polling = 1;
       else
 	return clib_error_return (0, "unknown input `%U'",
 				  format_unformat_error, input);
@@ -479,27 +655,80 @@ tuntap_config (vlib_main_t * vm, unformat_input_t * input)
       return 0;
     }    
 
+  if (tm->n_queues == 0)
+    return clib_error_return (0, "queues must be at least 1");
+
   tm->is_ether = is_ether;
   tm->have_normal_interface = have_normal_interface;
+  tm->have_vnet_hdr = have_vnet_hdr;
+  tm->is_polling = is_polling;
 
   if (is_ether)
     flags = IFF_TAP | IFF_NO_PI;
+  if (tm->n_queues > 1)
+    flags |= IFF_MULTI_QUEUE;
+  if (have_vnet_hdr)
+    flags |= IFF_VNET_HDR;
+
+  vec_validate_aligned (tm->per_thread, vtm->n_vlib_mains - 1,
+                        CLIB_CACHE_LINE_BYTES);
 
-  if ((tm->dev_net_tun_fd = open ("/dev/net/tun", O_RDWR)) < 0)
+  /* Each open of /dev/net/tun attaching to the same name adds a queue */
+  for (i = 0; i < tm->n_queues; i++)
     {
-      error = clib_error_return_unix (0, "open /dev/net/tun");
-      goto done;
+      vec_add2 (tm->queues, q, 1);
+      q->unix_file_index = ~0;
+      q->cpu_index = 0;
+
+      if ((q->fd = open ("/dev/net/tun", O_RDWR)) < 0)
+        {
+          error = clib_error_return_unix (0, "open /dev/net/tun");
+          goto done;
+        }
+
+      memset (&ifr, 0, sizeof (ifr));
+      strncpy(ifr.ifr_name, tm->tun_name, sizeof(ifr.ifr_name)-1);
+      ifr.ifr_flags = flags;
+      if (ioctl (q->fd, TUNSETIFF, (void *)&ifr) < 0)
+        {
+          error = clib_error_return_unix (0, "ioctl TUNSETIFF");
+          goto done;
+        }
+
+      /* non-blocking I/O on /dev/tapX */
+      {
+        int one = 1;
+        if (ioctl (q->fd, FIONBIO, &one) < 0)
+          {
+            error = clib_error_return_unix (0, "ioctl FIONBIO");
+            goto done;
+          }
+      }
     }
 
-  memset (&ifr, 0, sizeof (ifr));
-  strncpy(ifr.ifr_name, tm->tun_name, sizeof(ifr.ifr_name)-1);
-  ifr.ifr_flags = flags;
-  if (ioctl (tm->dev_net_tun_fd, TUNSETIFF, (void *)&ifr) < 0)
+  tm->dev_net_tun_fd = tm->queues[0].fd;
+
+  /*
+   * We finish CHECKSUM_PARTIAL packets ourselves. No TSO/UFO: the
+   * kernel then segments before handing us anything, and never
+   * expects us to segment what we send.
+   */
+  if (have_vnet_hdr)
     {
-      error = clib_error_return_unix (0, "ioctl TUNSETIFF");
-      goto done;
+      int hdr_size = sizeof (struct virtio_net_hdr);
+
+      if (ioctl (tm->dev_net_tun_fd, TUNSETVNETHDRSZ, &hdr_size) < 0)
+        {
+          error = clib_error_return_unix (0, "ioctl TUNSETVNETHDRSZ");
+          goto done;
+        }
+      if (ioctl (tm->dev_net_tun_fd, TUNSETOFFLOAD, TUN_F_CSUM) < 0)
+        {
+          error = clib_error_return_unix (0, "ioctl TUNSETOFFLOAD");
+          goto done;
+        }
     }
-    
+
   /* Make it persistent, at least until we split. */
   if (ioctl (tm->dev_net_tun_fd, TUNSETPERSIST, 1) < 0)
     {
@@ -541,16 +770,6 @@ tuntap_config (vlib_main_t * vm, unformat_input_t * input)
       }
   }
 
-  /* non-blocking I/O on /dev/tapX */
-  {
-    int one = 1;
-    if (ioctl (tm->dev_net_tun_fd, FIONBIO, &one) < 0)
-      {
-	error = clib_error_return_unix (0, "ioctl FIONBIO");
-	goto done;
-      }
-  }
-
   tm->mtu_buffers = (tm->mtu_bytes + (buffer_size - 1)) / buffer_size;
 
   ifr.ifr_mtu = tm->mtu_bytes;
@@ -622,18 +841,48 @@ tuntap_config (vlib_main_t * vm, unformat_input_t * input)
                                    VNET_SW_INTERFACE_FLAG_ADMIN_UP);
     }
 
-  {
-    unix_file_t template = {0};
-    template.read_function = tuntap_read_ready;
-    template.file_descriptor = tm->dev_net_tun_fd;
-    tm->unix_file_index = unix_file_add (&unix_main, &template);
-  }
+  /*
+   * Polled queues are spread over the workers, if any. Workers clone
+   * the main thread's node states, those without a queue disable the
+   * rx node on their first pass.
+   */
+  if (is_polling)
+    {
+      uword * p;
+      vlib_thread_registration_t * tr;
+      u32 first = 0, count = 1;
+
+      p = hash_get_mem (vtm->thread_registrations_by_name, "workers");
+      tr = p ? (vlib_thread_registration_t *) p[0] : 0;
+      if (tr && tr->count > 0)
+        {
+          first = tr->first_index;
+          count = tr->count;
+        }
+
+      vec_foreach (q, tm->queues)
+        q->cpu_index = first + (q - tm->queues) % count;
+
+      vlib_node_set_state (vm, tuntap_rx_node.index,
+                           VLIB_NODE_STATE_POLLING);
+    }
+  else
+    {
+      vec_foreach (q, tm->queues)
+        {
+          unix_file_t template = {0};
+          template.read_function = tuntap_read_ready;
+          template.file_descriptor = q->fd;
+          template.private_data = q - tm->queues;
+          q->unix_file_index = unix_file_add (&unix_main, &template);
+        }
+    }
 
  done:
   if (error)
     {
-      if (tm->dev_net_tun_fd >= 0)
-	close (tm->dev_net_tun_fd);
+      tuntap_close_queues (tm);
+      tm->dev_net_tun_fd = -1;
       if (tm->dev_tap_fd >= 0)
 	close (tm->dev_tap_fd);
     }
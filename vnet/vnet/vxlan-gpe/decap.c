@@ -56,6 +56,90 @@ static u8 * format_vxlan_gpe_with_length (u8 * s, va_list * args)
   return s;
 }
 
+/*
+ * Tunnel demux is staged as in vxlan-input: a packet's key is hashed
+ * and its bucket prefetched one dual loop iteration ahead, the value
+ * page is prefetched at the top of the iteration that searches it.
+ */
+typedef struct {
+  union {
+    clib_bihash_kv_24_8_t kv4;
+    clib_bihash_kv_48_8_t kv6;
+  };
+  u64 hash;
+} vxlan_gpe_decap_key_t;
+
+always_inline void
+vxlan_gpe_decap_key_hash (vxlan_gpe_main_t * ngm, vlib_buffer_t * b,
+                          vxlan_gpe_decap_key_t * k, u8 is_ip4)
+{
+  /* udp leaves current_data pointing at the vxlan-gpe header */
+  vxlan_gpe_header_t * vxlan = vlib_buffer_get_current (b);
+
+  if (is_ip4)
+    {
+      ip4_header_t * ip4 = (ip4_header_t *)
+        ((u8 *) vxlan - sizeof (udp_header_t) - sizeof (ip4_header_t));
+      vxlan4_gpe_tunnel_key_t key4;
+
+      key4.local = ip4->dst_address.as_u32;
+      key4.remote = ip4->src_address.as_u32;
+      key4.vni = vxlan->vni_res;
+      key4.pad = 0;
+      vxlan4_gpe_tunnel_kv (&k->kv4, &key4);
+      k->hash = clib_bihash_hash_24_8 (&k->kv4);
+      clib_bihash_prefetch_bucket_24_8 (&ngm->vxlan4_gpe_tunnel_by_key,
+                                        k->hash);
+    }
+  else
+    {
+      ip6_header_t * ip6 = (ip6_header_t *)
+        ((u8 *) vxlan - sizeof (udp_header_t) - sizeof (ip6_header_t));
+      vxlan6_gpe_tunnel_key_t key6;
+
+      key6.local.as_u64[0] = ip6->dst_address.as_u64[0];
+      key6.local.as_u64[1] = ip6->dst_address.as_u64[1];
+      key6.remote.as_u64[0] = ip6->src_address.as_u64[0];
+      key6.remote.as_u64[1] = ip6->src_address.as_u64[1];
+      key6.vni = vxlan->vni_res;
+      vxlan6_gpe_tunnel_kv (&k->kv6, &key6);
+      k->hash = clib_bihash_hash_48_8 (&k->kv6);
+      clib_bihash_prefetch_bucket_48_8 (&ngm->vxlan6_gpe_tunnel_by_key,
+                                        k->hash);
+    }
+}
+
+always_inline void
+vxlan_gpe_decap_key_prefetch (vxlan_gpe_main_t * ngm,
+                              vxlan_gpe_decap_key_t * k, u8 is_ip4)
+{
+  if (is_ip4)
+    clib_bihash_prefetch_data_24_8 (&ngm->vxlan4_gpe_tunnel_by_key, k->hash);
+  else
+    clib_bihash_prefetch_data_48_8 (&ngm->vxlan6_gpe_tunnel_by_key, k->hash);
+}
+
+/* returns the tunnel index, or ~0 if there is no such tunnel */
+always_inline u32
+vxlan_gpe_decap_key_search (vxlan_gpe_main_t * ngm,
+                            vxlan_gpe_decap_key_t * k, u8 is_ip4)
+{
+  if (is_ip4)
+    {
+      if (clib_bihash_search_inline_with_hash_24_8
+          (&ngm->vxlan4_gpe_tunnel_by_key, k->hash, &k->kv4) < 0)
+        return ~0;
+      return k->kv4.value;
+    }
+  else
+    {
+      if (clib_bihash_search_inline_with_hash_48_8
+          (&ngm->vxlan6_gpe_tunnel_by_key, k->hash, &k->kv6) < 0)
+        return ~0;
+      return k->kv6.value;
+    }
+}
+
 always_inline uword
 vxlan_gpe_input (vlib_main_t * vm,
                      vlib_node_runtime_t * node,
@@ -66,16 +150,13 @@ vxlan_gpe_input (vlib_main_t * vm,
   vxlan_gpe_main_t * ngm = &vxlan_gpe_main;
   vnet_main_t * vnm = ngm->vnet_main;
   vnet_interface_main_t * im = &vnm->interface_main;
-  u32 last_tunnel_index = ~0;
-  vxlan4_gpe_tunnel_key_t last_key4;
-  vxlan6_gpe_tunnel_key_t last_key6;
+  vxlan_gpe_decap_key_t keys[VLIB_FRAME_SIZE], * k;
+  u32 * from0, n_hashed = 0;
   u32 pkts_decapsulated = 0;
   u32 cpu_index = os_get_cpu_number ();
   u32 stats_sw_if_index, stats_n_packets, stats_n_bytes;
 
-  memset (&last_key4, 0xff, sizeof(last_key4));
-
-  from = vlib_frame_vector_args (from_frame);
+  from = from0 = vlib_frame_vector_args (from_frame);
   n_left_from = from_frame->n_vectors;
 
   next_index = node->cached_next_index;
@@ -95,28 +176,43 @@ vxlan_gpe_input (vlib_main_t * vm,
       u32 next0, next1;
       ip4_vxlan_gpe_header_t * iuvn4_0, *iuvn4_1;
       ip6_vxlan_gpe_header_t * iuvn6_0, *iuvn6_1;
-      uword * p0, *p1;
       u32 tunnel_index0, tunnel_index1;
       vxlan_gpe_tunnel_t * t0, *t1;
-      vxlan4_gpe_tunnel_key_t key4_0, key4_1;
-      vxlan6_gpe_tunnel_key_t key6_0, key6_1;
       u32 error0, error1;
       u32 sw_if_index0, sw_if_index1, len0, len1;
 
+      k = &keys[from - from0];
+
       /* Prefetch next iteration. */
       {
-        vlib_buffer_t * p2, *p3;
+        /* Stage 1: hash the packets of the next iteration */
+        while (n_hashed < (from - from0) + 4)
+          {
+            vxlan_gpe_decap_key_hash (ngm, vlib_get_buffer (vm,
+                                                            from0[n_hashed]),
+                                      &keys[n_hashed], is_ip4);
+            n_hashed++;
+          }
 
-        p2 = vlib_get_buffer (vm, from[2]);
-        p3 = vlib_get_buffer (vm, from[3]);
+        if (n_left_from >= 6)
+          {
+            vlib_buffer_t * p4, *p5;
+
+            p4 = vlib_get_buffer (vm, from[4]);
+            p5 = vlib_get_buffer (vm, from[5]);
 
-        vlib_prefetch_buffer_header(p2, LOAD);
-        vlib_prefetch_buffer_header(p3, LOAD);
+            vlib_prefetch_buffer_header(p4, LOAD);
+            vlib_prefetch_buffer_header(p5, LOAD);
 
-        CLIB_PREFETCH(p2->data, 2*CLIB_CACHE_LINE_BYTES, LOAD);
-        CLIB_PREFETCH(p3->data, 2*CLIB_CACHE_LINE_BYTES, LOAD);
+            CLIB_PREFETCH(p4->data, 2*CLIB_CACHE_LINE_BYTES, LOAD);
+            CLIB_PREFETCH(p5->data, 2*CLIB_CACHE_LINE_BYTES, LOAD);
+          }
       }
 
+      /* Stage 2: buckets arrived last iteration, fetch the pages */
+      vxlan_gpe_decap_key_prefetch (ngm, &k[0], is_ip4);
+      vxlan_gpe_decap_key_prefetch (ngm, &k[1], is_ip4);
+
       bi0 = from[0];
       bi1 = from[1];
       to_next[0] = bi0;
@@ -167,37 +263,6 @@ vxlan_gpe_input (vlib_main_t * vm,
                 iuvn4_0->vxlan.protocol : VXLAN_GPE_INPUT_NEXT_DROP;
         next1 = (iuvn4_1->vxlan.protocol < node->n_next_nodes) ?
                 iuvn4_1->vxlan.protocol : VXLAN_GPE_INPUT_NEXT_DROP;
-
-        key4_0.local = iuvn4_0->ip4.dst_address.as_u32;
-        key4_1.local = iuvn4_1->ip4.dst_address.as_u32;
-
-        key4_0.remote = iuvn4_0->ip4.src_address.as_u32;
-        key4_1.remote = iuvn4_1->ip4.src_address.as_u32;
-
-        key4_0.vni = iuvn4_0->vxlan.vni_res;
-        key4_1.vni = iuvn4_1->vxlan.vni_res;
-
-        key4_0.pad = 0;
-        key4_1.pad = 0;
-
-        /* Processing for key4_0 */
-        if (PREDICT_FALSE((key4_0.as_u64[0] != last_key4.as_u64[0])
-                || (key4_0.as_u64[1] != last_key4.as_u64[1])))
-        {
-          p0 = hash_get_mem(ngm->vxlan4_gpe_tunnel_by_key, &key4_0);
-
-          if (p0 == 0)
-          {
-            error0 = VXLAN_GPE_ERROR_NO_SUCH_TUNNEL;
-            goto trace0;
-          }
-
-          last_key4.as_u64[0] = key4_0.as_u64[0];
-          last_key4.as_u64[1] = key4_0.as_u64[1];
-          tunnel_index0 = last_tunnel_index = p0[0];
-        }
-        else
-          tunnel_index0 = last_tunnel_index;
       }
       else /* is_ip6 */
       {
@@ -205,36 +270,16 @@ vxlan_gpe_input (vlib_main_t * vm,
                 iuvn6_0->vxlan.protocol : VXLAN_GPE_INPUT_NEXT_DROP;
         next1 = (iuvn6_1->vxlan.protocol < node->n_next_nodes) ?
                 iuvn6_1->vxlan.protocol : VXLAN_GPE_INPUT_NEXT_DROP;
+      }
 
-        key6_0.local.as_u64[0] = iuvn6_0->ip6.dst_address.as_u64[0];
-        key6_0.local.as_u64[1] = iuvn6_0->ip6.dst_address.as_u64[1];
-        key6_1.local.as_u64[0] = iuvn6_1->ip6.dst_address.as_u64[0];
-        key6_1.local.as_u64[1] = iuvn6_1->ip6.dst_address.as_u64[1];
-
-        key6_0.remote.as_u64[0] = iuvn6_0->ip6.src_address.as_u64[0];
-        key6_0.remote.as_u64[1] = iuvn6_0->ip6.src_address.as_u64[1];
-        key6_1.remote.as_u64[0] = iuvn6_1->ip6.src_address.as_u64[0];
-        key6_1.remote.as_u64[1] = iuvn6_1->ip6.src_address.as_u64[1];
-
-        key6_0.vni = iuvn6_0->vxlan.vni_res;
-        key6_1.vni = iuvn6_1->vxlan.vni_res;
-
-        /* Processing for key6_0 */
-        if (PREDICT_FALSE(memcmp (&key6_0, &last_key6, sizeof(last_key6)) != 0))
-        {
-          p0 = hash_get_mem(ngm->vxlan6_gpe_tunnel_by_key, &key6_0);
+      /* Stage 3: both pages are on their way, search */
+      tunnel_index0 = vxlan_gpe_decap_key_search (ngm, &k[0], is_ip4);
+      tunnel_index1 = vxlan_gpe_decap_key_search (ngm, &k[1], is_ip4);
 
-          if (p0 == 0)
-          {
-            error0 = VXLAN_GPE_ERROR_NO_SUCH_TUNNEL;
-            goto trace0;
-          }
-
-          memcpy (&last_key6, &key6_0, sizeof(key6_0));
-          tunnel_index0 = last_tunnel_index = p0[0];
-        }
-        else
-          tunnel_index0 = last_tunnel_index;
+      if (PREDICT_FALSE (tunnel_index0 == ~0))
+      {
+        error0 = VXLAN_GPE_ERROR_NO_SUCH_TUNNEL;
+        goto trace0;
       }
 
       t0 = pool_elt_at_index(ngm->tunnels, tunnel_index0);
@@ -280,46 +325,10 @@ vxlan_gpe_input (vlib_main_t * vm,
       }
 
       /* Process packet 1 */
-      if (is_ip4)
-      {
-        /* Processing for key4_1 */
-        if (PREDICT_FALSE(
-            (key4_1.as_u64[0] != last_key4.as_u64[0])
-                || (key4_1.as_u64[1] != last_key4.as_u64[1])))
-        {
-          p1 = hash_get_mem(ngm->vxlan4_gpe_tunnel_by_key, &key4_1);
-
-          if (p1 == 0)
-          {
-            error1 = VXLAN_GPE_ERROR_NO_SUCH_TUNNEL;
-            goto trace1;
-          }
-
-          last_key4.as_u64[0] = key4_1.as_u64[0];
-          last_key4.as_u64[1] = key4_1.as_u64[1];
-          tunnel_index1 = last_tunnel_index = p1[0];
-        }
-        else
-          tunnel_index1 = last_tunnel_index;
-      }
-      else /* is_ip6 */
+      if (PREDICT_FALSE (tunnel_index1 == ~0))
       {
-        /* Processing for key6_1 */
-        if (PREDICT_FALSE(memcmp (&key6_1, &last_key6, sizeof(last_key6)) != 0))
-        {
-          p1 = hash_get_mem(ngm->vxlan6_gpe_tunnel_by_key, &key6_1);
-
-          if (p1 == 0)
-          {
-            error1 = VXLAN_GPE_ERROR_NO_SUCH_TUNNEL;
-            goto trace1;
-          }
-
-          memcpy (&last_key6, &key6_1, sizeof(key6_1));
-          tunnel_index1 = last_tunnel_index = p1[0];
-        }
-        else
-          tunnel_index1 = last_tunnel_index;
+        error1 = VXLAN_GPE_ERROR_NO_SUCH_TUNNEL;
+        goto trace1;
       }
 
       t1 = pool_elt_at_index(ngm->tunnels, tunnel_index1);
@@ -377,15 +386,13 @@ vxlan_gpe_input (vlib_main_t * vm,
       u32 next0;
       ip4_vxlan_gpe_header_t * iuvn4_0;
       ip6_vxlan_gpe_header_t * iuvn6_0;
-      uword * p0;
       u32 tunnel_index0;
       vxlan_gpe_tunnel_t * t0;
-      vxlan4_gpe_tunnel_key_t key4_0;
-      vxlan6_gpe_tunnel_key_t key6_0;
       u32 error0;
       u32 sw_if_index0, len0;
 
       bi0 = from[0];
+      k = &keys[from - from0];
       to_next[0] = bi0;
       from += 1;
       to_next += 1;
@@ -394,6 +401,13 @@ vxlan_gpe_input (vlib_main_t * vm,
 
       b0 = vlib_get_buffer (vm, bi0);
 
+      /* tail of the frame may not have been hashed by the dual loop */
+      if (n_hashed <= (u32) (k - keys))
+        {
+          vxlan_gpe_decap_key_hash (ngm, b0, k, is_ip4);
+          n_hashed = (k - keys) + 1;
+        }
+
       if (is_ip4)
       {
         /* udp leaves current_data pointing at the vxlan-gpe header */
@@ -425,59 +439,19 @@ vxlan_gpe_input (vlib_main_t * vm,
         next0 =
             (iuvn4_0->vxlan.protocol < node->n_next_nodes) ?
                 iuvn4_0->vxlan.protocol : VXLAN_GPE_INPUT_NEXT_DROP;
-
-        key4_0.local = iuvn4_0->ip4.dst_address.as_u32;
-        key4_0.remote = iuvn4_0->ip4.src_address.as_u32;
-        key4_0.vni = iuvn4_0->vxlan.vni_res;
-        key4_0.pad = 0;
-
-        /* Processing for key4_0 */
-        if (PREDICT_FALSE(
-            (key4_0.as_u64[0] != last_key4.as_u64[0])
-                || (key4_0.as_u64[1] != last_key4.as_u64[1])))
-        {
-          p0 = hash_get_mem(ngm->vxlan4_gpe_tunnel_by_key, &key4_0);
-
-          if (p0 == 0)
-          {
-            error0 = VXLAN_GPE_ERROR_NO_SUCH_TUNNEL;
-            goto trace00;
-          }
-
-          last_key4.as_u64[0] = key4_0.as_u64[0];
-          last_key4.as_u64[1] = key4_0.as_u64[1];
-          tunnel_index0 = last_tunnel_index = p0[0];
-        }
-        else
-          tunnel_index0 = last_tunnel_index;
       }
       else /* is_ip6 */
       {
         next0 = (iuvn6_0->vxlan.protocol < node->n_next_nodes) ?
                 iuvn6_0->vxlan.protocol : VXLAN_GPE_INPUT_NEXT_DROP;
+      }
 
-        key6_0.local.as_u64[0] = iuvn6_0->ip6.dst_address.as_u64[0];
-        key6_0.local.as_u64[1] = iuvn6_0->ip6.dst_address.as_u64[1];
-        key6_0.remote.as_u64[0] = iuvn6_0->ip6.src_address.as_u64[0];
-        key6_0.remote.as_u64[1] = iuvn6_0->ip6.src_address.as_u64[1];
-        key6_0.vni = iuvn6_0->vxlan.vni_res;
-
-        /* Processing for key6_0 */
-        if (PREDICT_FALSE(memcmp (&key6_0, &last_key6, sizeof(last_key6)) != 0))
-        {
-          p0 = hash_get_mem(ngm->vxlan6_gpe_tunnel_by_key, &key6_0);
-
-          if (p0 == 0)
-          {
-            error0 = VXLAN_GPE_ERROR_NO_SUCH_TUNNEL;
-            goto trace00;
-          }
+      tunnel_index0 = vxlan_gpe_decap_key_search (ngm, k, is_ip4);
 
-          memcpy (&last_key6, &key6_0, sizeof(key6_0));
-          tunnel_index0 = last_tunnel_index = p0[0];
-        }
-        else
-          tunnel_index0 = last_tunnel_index;
+      if (PREDICT_FALSE (tunnel_index0 == ~0))
+      {
+        error0 = VXLAN_GPE_ERROR_NO_SUCH_TUNNEL;
+        goto trace00;
       }
 
       t0 = pool_elt_at_index(ngm->tunnels, tunnel_index0);
@@ -214,13 +214,14 @@ int vnet_vxlan_gpe_add_del_tunnel
   vxlan_gpe_tunnel_t *t = 0;
   vnet_main_t * vnm = gm->vnet_main;
   vnet_hw_interface_t * hi;
-  uword * p;
   u32 hw_if_index = ~0;
   u32 sw_if_index = ~0;
-  int rv;
-  vxlan4_gpe_tunnel_key_t key4, *key4_copy;
-  vxlan6_gpe_tunnel_key_t key6, *key6_copy;
-  hash_pair_t *hp;
+  int rv, found;
+  vxlan4_gpe_tunnel_key_t key4;
+  vxlan6_gpe_tunnel_key_t key6;
+  clib_bihash_kv_24_8_t kv4, value4;
+  clib_bihash_kv_48_8_t kv6, value6;
+  u32 tunnel_index = ~0;
 
   if (!a->is_ip6)
   {
@@ -229,7 +230,11 @@ int vnet_vxlan_gpe_add_del_tunnel
     key4.vni = clib_host_to_net_u32 (a->vni << 8);
     key4.pad = 0;
 
-    p = hash_get_mem(gm->vxlan4_gpe_tunnel_by_key, &key4);
+    vxlan4_gpe_tunnel_kv (&kv4, &key4);
+    found = !clib_bihash_search_24_8 (&gm->vxlan4_gpe_tunnel_by_key,
+                                      &kv4, &value4);
+    if (found)
+      tunnel_index = value4.value;
   }
   else
   {
@@ -239,13 +244,17 @@ int vnet_vxlan_gpe_add_del_tunnel
     key6.remote.as_u64[1] = a->remote.ip6.as_u64[1];
     key6.vni = clib_host_to_net_u32 (a->vni << 8);
 
-    p = hash_get_mem(gm->vxlan6_gpe_tunnel_by_key, &key6);
+    vxlan6_gpe_tunnel_kv (&kv6, &key6);
+    found = !clib_bihash_search_48_8 (&gm->vxlan6_gpe_tunnel_by_key,
+                                      &kv6, &value6);
+    if (found)
+      tunnel_index = value6.value;
   }
 
   if (a->is_add)
     {
       /* adding a tunnel: tunnel must not already exist */
-      if (p)
+      if (found)
         return VNET_API_ERROR_INVALID_VALUE;
 
       pool_get_aligned (gm->tunnels, t, CLIB_CACHE_LINE_BYTES);
@@ -273,19 +282,17 @@ int vnet_vxlan_gpe_add_del_tunnel
       }
 
       if (!a->is_ip6)
-      {
-        key4_copy = clib_mem_alloc (sizeof (*key4_copy));
-        clib_memcpy (key4_copy, &key4, sizeof (*key4_copy));
-        hash_set_mem (gm->vxlan4_gpe_tunnel_by_key, key4_copy,
-                      t - gm->tunnels);
-      }
+        {
+          kv4.value = t - gm->tunnels;
+          clib_bihash_add_del_24_8 (&gm->vxlan4_gpe_tunnel_by_key, &kv4,
+                                    1 /* is_add */);
+        }
       else
-      {
-          key6_copy = clib_mem_alloc (sizeof (*key6_copy));
-          clib_memcpy (key6_copy, &key6, sizeof (*key6_copy));
-          hash_set_mem (gm->vxlan6_gpe_tunnel_by_key, key6_copy,
-                        t - gm->tunnels);
-      }
+        {
+          kv6.value = t - gm->tunnels;
+          clib_bihash_add_del_48_8 (&gm->vxlan6_gpe_tunnel_by_key, &kv6,
+                                    1 /* is_add */);
+        }
 
       if (vec_len (gm->free_vxlan_gpe_tunnel_hw_if_indices) > 0)
         {
@@ -317,10 +324,10 @@ int vnet_vxlan_gpe_add_del_tunnel
   else
     {
       /* deleting a tunnel: tunnel must exist */
-      if (!p)
+      if (!found)
         return VNET_API_ERROR_NO_SUCH_ENTRY;
 
-      t = pool_elt_at_index (gm->tunnels, p[0]);
+      t = pool_elt_at_index (gm->tunnels, tunnel_index);
 
       vnet_sw_interface_set_flags (vnm, t->sw_if_index, 0 /* down */);
       vec_add1 (gm->free_vxlan_gpe_tunnel_hw_if_indices, t->hw_if_index);
@@ -328,19 +335,11 @@ int vnet_vxlan_gpe_add_del_tunnel
       gm->tunnel_index_by_sw_if_index[t->sw_if_index] = ~0;
 
       if (!a->is_ip6)
-      {
-        hp = hash_get_pair (gm->vxlan4_gpe_tunnel_by_key, &key4);
-        key4_copy = (void *)(hp->key);
-        hash_unset_mem (gm->vxlan4_gpe_tunnel_by_key, &key4);
-        clib_mem_free (key4_copy);
-      }
+        clib_bihash_add_del_24_8 (&gm->vxlan4_gpe_tunnel_by_key, &kv4,
+                                  0 /* is_add */);
       else
-      {
-        hp = hash_get_pair (gm->vxlan6_gpe_tunnel_by_key, &key6);
-        key6_copy = (void *)(hp->key);
-        hash_unset_mem (gm->vxlan4_gpe_tunnel_by_key, &key6);
-        clib_mem_free (key6_copy);
-      }
+        clib_bihash_add_del_48_8 (&gm->vxlan6_gpe_tunnel_by_key, &kv6,
+                                  0 /* is_add */);
 
       vec_free (t->rewrite);
       pool_put (gm->tunnels, t);
@@ -559,11 +558,12 @@ clib_error_t *vxlan_gpe_init (vlib_main_t *vm)
   gm->vnet_main = vnet_get_main();
   gm->vlib_main = vm;
 
-  gm->vxlan4_gpe_tunnel_by_key
-    = hash_create_mem (0, sizeof(vxlan4_gpe_tunnel_key_t), sizeof (uword));
-
-  gm->vxlan6_gpe_tunnel_by_key
-    = hash_create_mem (0, sizeof(vxlan6_gpe_tunnel_key_t), sizeof (uword));
+  clib_bihash_init_24_8 (&gm->vxlan4_gpe_tunnel_by_key, "vxlan4-gpe tunnels",
+                         VXLAN_GPE_HASH_NUM_BUCKETS,
+                         VXLAN_GPE_HASH_MEMORY_SIZE);
+  clib_bihash_init_48_8 (&gm->vxlan6_gpe_tunnel_by_key, "vxlan6-gpe tunnels",
+                         VXLAN_GPE_HASH_NUM_BUCKETS,
+                         VXLAN_GPE_HASH_MEMORY_SIZE);
 
 
   udp_register_dst_port (vm, UDP_DST_PORT_vxlan_gpe,
@@ -17,6 +17,8 @@
 
 #include <vppinfra/error.h>
 #include <vppinfra/hash.h>
+#include <vppinfra/bihash_24_8.h>
+#include <vppinfra/bihash_48_8.h>
 #include <vnet/vnet.h>
 #include <vnet/ip/ip.h>
 #include <vnet/l2/l2_input.h>
@@ -114,13 +116,16 @@ typedef enum {
   VXLAN_GPE_N_ERROR,
 } vxlan_gpe_input_error_t;
 
+#define VXLAN_GPE_HASH_NUM_BUCKETS (64 * 1024)
+#define VXLAN_GPE_HASH_MEMORY_SIZE (32<<20)
+
 typedef struct {
   /* vector of encap tunnel instances */
   vxlan_gpe_tunnel_t *tunnels;
 
-  /* lookup tunnel by key */
-  uword * vxlan4_gpe_tunnel_by_key;
-  uword * vxlan6_gpe_tunnel_by_key;
+  /* lookup tunnel by key, value is the tunnel index */
+  clib_bihash_24_8_t vxlan4_gpe_tunnel_by_key;
+  clib_bihash_48_8_t vxlan6_gpe_tunnel_by_key;
 
   /* Free vlib hw_if_indices */
   u32 * free_vxlan_gpe_tunnel_hw_if_indices;
@@ -155,6 +160,28 @@ typedef struct {
 int vnet_vxlan_gpe_add_del_tunnel
 (vnet_vxlan_gpe_add_del_tunnel_args_t *a, u32 * sw_if_indexp);
 
+always_inline void
+vxlan4_gpe_tunnel_kv (clib_bihash_kv_24_8_t * kv,
+                      vxlan4_gpe_tunnel_key_t * key)
+{
+  kv->key[0] = key->as_u64[0];
+  kv->key[1] = key->as_u64[1];
+  kv->key[2] = 0;
+}
+
+/* The whole 36 byte ip6 key, zero padded to 48 bytes */
+always_inline void
+vxlan6_gpe_tunnel_kv (clib_bihash_kv_48_8_t * kv,
+                      vxlan6_gpe_tunnel_key_t * key)
+{
+  kv->key[0] = key->local.as_u64[0];
+  kv->key[1] = key->local.as_u64[1];
+  kv->key[2] = key->remote.as_u64[0];
+  kv->key[3] = key->remote.as_u64[1];
+  kv->key[4] = key->vni;
+  kv->key[5] = 0;
+}
+
 
 
 
@@ -47,6 +47,89 @@ static u8 * format_vxlan_rx_trace (u8 * s, va_list * args)
   return s;
 }
 
+/*
+ * Tunnel demux is split into stages so the dual loop can hide the
+ * bihash bucket and value page misses: the key and hash of a packet are
+ * computed (and its bucket prefetched) one iteration ahead, the value
+ * page is prefetched at the top of the iteration that consumes it, and
+ * the search reuses the precomputed hash.
+ */
+typedef struct {
+  union {
+    clib_bihash_kv_8_8_t kv4;
+    clib_bihash_kv_24_8_t kv6;
+  };
+  u64 hash;
+} vxlan_decap_key_t;
+
+always_inline void
+vxlan_decap_key_hash (vxlan_main_t * vxm, vlib_buffer_t * b,
+                      vxlan_decap_key_t * k, char is_ip4)
+{
+  /* udp leaves current_data pointing at the vxlan header */
+  vxlan_header_t * vxlan = vlib_buffer_get_current (b);
+
+  if (is_ip4)
+    {
+      ip4_header_t * ip4 = (ip4_header_t *)
+        ((u8 *) vxlan - sizeof (udp_header_t) - sizeof (ip4_header_t));
+      vxlan4_tunnel_key_t key4;
+
+      key4.src = ip4->src_address.as_u32;
+      key4.vni = vxlan->vni_reserved;
+      k->kv4.key = key4.as_u64;
+      k->hash = clib_bihash_hash_8_8 (&k->kv4);
+      clib_bihash_prefetch_bucket_8_8 (&vxm->vxlan4_tunnel_by_key, k->hash);
+    }
+  else
+    {
+      ip6_header_t * ip6 = (ip6_header_t *)
+        ((u8 *) vxlan - sizeof (udp_header_t) - sizeof (ip6_header_t));
+      vxlan6_tunnel_key_t key6;
+
+      key6.src.as_u64[0] = ip6->src_address.as_u64[0];
+      key6.src.as_u64[1] = ip6->src_address.as_u64[1];
+      key6.vni = vxlan->vni_reserved;
+      key6.pad = 0;
+      k->kv6.key[0] = key6.as_u64[0];
+      k->kv6.key[1] = key6.as_u64[1];
+      k->kv6.key[2] = key6.as_u64[2];
+      k->hash = clib_bihash_hash_24_8 (&k->kv6);
+      clib_bihash_prefetch_bucket_24_8 (&vxm->vxlan6_tunnel_by_key, k->hash);
+    }
+}
+
+always_inline void
+vxlan_decap_key_prefetch (vxlan_main_t * vxm, vxlan_decap_key_t * k,
+                          char is_ip4)
+{
+  if (is_ip4)
+    clib_bihash_prefetch_data_8_8 (&vxm->vxlan4_tunnel_by_key, k->hash);
+  else
+    clib_bihash_prefetch_data_24_8 (&vxm->vxlan6_tunnel_by_key, k->hash);
+}
+
+/* returns the tunnel index, or ~0 if there is no such tunnel */
+always_inline u32
+vxlan_decap_key_search (vxlan_main_t * vxm, vxlan_decap_key_t * k,
+                        char is_ip4)
+{
+  if (is_ip4)
+    {
+      if (clib_bihash_search_inline_with_hash_8_8
+          (&vxm->vxlan4_tunnel_by_key, k->hash, &k->kv4) < 0)
+        return ~0;
+      return k->kv4.value;
+    }
+  else
+    {
+      if (clib_bihash_search_inline_with_hash_24_8
+          (&vxm->vxlan6_tunnel_by_key, k->hash, &k->kv6) < 0)
+        return ~0;
+      return k->kv6.value;
+    }
+}
+
 always_inline uword
 vxlan_input (vlib_main_t * vm,
              vlib_node_runtime_t * node,
@@ -57,16 +140,13 @@ vxlan_input (vlib_main_t * vm,
   vxlan_main_t * vxm = &vxlan_main;
   vnet_main_t * vnm = vxm->vnet_main;
   vnet_interface_main_t * im = &vnm->interface_main;
-  u32 last_tunnel_index = ~0;
-  vxlan4_tunnel_key_t last_key4;
-  vxlan6_tunnel_key_t last_key6;
+  vxlan_decap_key_t keys[VLIB_FRAME_SIZE], * k;
+  u32 * from0, n_hashed = 0;
   u32 pkts_decapsulated = 0;
   u32 cpu_index = os_get_cpu_number();
   u32 stats_sw_if_index, stats_n_packets, stats_n_bytes;
 
-  last_key4.as_u64 = ~0;
-
-  from = vlib_frame_vector_args (from_frame);
+  from = from0 = vlib_frame_vector_args (from_frame);
   n_left_from = from_frame->n_vectors;
 
   next_index = node->cached_next_index;
@@ -87,28 +167,43 @@ vxlan_input (vlib_main_t * vm,
           ip4_header_t * ip4_0, * ip4_1;
           ip6_header_t * ip6_0, * ip6_1;
           vxlan_header_t * vxlan0, * vxlan1;
-	  uword * p0, * p1;
           u32 tunnel_index0, tunnel_index1;
           vxlan_tunnel_t * t0, * t1;
-          vxlan4_tunnel_key_t key4_0, key4_1;
-          vxlan6_tunnel_key_t key6_0, key6_1;
           u32 error0, error1;
 	  u32 sw_if_index0, sw_if_index1, len0, len1;
 
+          k = &keys[from - from0];
+
 	  /* Prefetch next iteration. */
 	  {
-	    vlib_buffer_t * p2, * p3;
+            /* Stage 1: hash the packets of the next iteration */
+            while (n_hashed < (from - from0) + 4)
+              {
+                vxlan_decap_key_hash (vxm, vlib_get_buffer (vm,
+                                                            from0[n_hashed]),
+                                      &keys[n_hashed], is_ip4);
+                n_hashed++;
+              }
 
-	    p2 = vlib_get_buffer (vm, from[2]);
-	    p3 = vlib_get_buffer (vm, from[3]);
+            if (n_left_from >= 6)
+              {
+                vlib_buffer_t * p4, * p5;
+
+                p4 = vlib_get_buffer (vm, from[4]);
+                p5 = vlib_get_buffer (vm, from[5]);
 
-	    vlib_prefetch_buffer_header (p2, LOAD);
-	    vlib_prefetch_buffer_header (p3, LOAD);
+                vlib_prefetch_buffer_header (p4, LOAD);
+                vlib_prefetch_buffer_header (p5, LOAD);
 
-	    CLIB_PREFETCH (p2->data, 2*CLIB_CACHE_LINE_BYTES, LOAD);
-	    CLIB_PREFETCH (p3->data, 2*CLIB_CACHE_LINE_BYTES, LOAD);
+                CLIB_PREFETCH (p4->data, 2*CLIB_CACHE_LINE_BYTES, LOAD);
+                CLIB_PREFETCH (p5->data, 2*CLIB_CACHE_LINE_BYTES, LOAD);
+              }
 	  }
 
+          /* Stage 2: buckets arrived last iteration, fetch the pages */
+          vxlan_decap_key_prefetch (vxm, &k[0], is_ip4);
+          vxlan_decap_key_prefetch (vxm, &k[1], is_ip4);
+
 	  bi0 = from[0];
 	  bi1 = from[1];
 	  to_next[0] = bi0;
@@ -154,54 +249,19 @@ vxlan_input (vlib_main_t * vm,
               (b1, sizeof(*ip6_1)+sizeof(udp_header_t)+sizeof(*vxlan1));
           }
 
-          tunnel_index0 = ~0;
           error0 = 0;
-
-          tunnel_index1 = ~0;
           error1 = 0;
 
-          if (is_ip4) {
-            key4_0.src = ip4_0->src_address.as_u32;
-            key4_0.vni = vxlan0->vni_reserved;
-
-            if (PREDICT_FALSE (key4_0.as_u64 != last_key4.as_u64))
-              {
-                p0 = hash_get (vxm->vxlan4_tunnel_by_key, key4_0.as_u64);
-
-                if (p0 == 0)
-                  {
-                    error0 = VXLAN_ERROR_NO_SUCH_TUNNEL;
-                    next0 = VXLAN_INPUT_NEXT_DROP;
-                    goto trace0;
-                  }
+          /* Stage 3: search with the precomputed hash */
+          tunnel_index0 = vxlan_decap_key_search (vxm, &k[0], is_ip4);
+          tunnel_index1 = vxlan_decap_key_search (vxm, &k[1], is_ip4);
 
-                last_key4.as_u64 = key4_0.as_u64;
-                tunnel_index0 = last_tunnel_index = p0[0];
-              }
-            else
-              tunnel_index0 = last_tunnel_index;
-          } else /* !is_ip4 */ {
-            key6_0.src.as_u64[0] = ip6_0->src_address.as_u64[0];
-            key6_0.src.as_u64[1] = ip6_0->src_address.as_u64[1];
-            key6_0.vni = vxlan0->vni_reserved;
-
-            if (PREDICT_FALSE (memcmp(&key6_0, &last_key6, sizeof(last_key6)) != 0))
-              {
-                p0 = hash_get_mem (vxm->vxlan6_tunnel_by_key, &key6_0);
-
-                if (p0 == 0)
-                  {
-                    error0 = VXLAN_ERROR_NO_SUCH_TUNNEL;
-                    next0 = VXLAN_INPUT_NEXT_DROP;
-                    goto trace0;
-                  }
-
-                clib_memcpy (&last_key6, &key6_0, sizeof(key6_0));
-                tunnel_index0 = last_tunnel_index = p0[0];
-              }
-            else
-              tunnel_index0 = last_tunnel_index;
-          }
+          if (PREDICT_FALSE (tunnel_index0 == ~0))
+            {
+              error0 = VXLAN_ERROR_NO_SUCH_TUNNEL;
+              next0 = VXLAN_INPUT_NEXT_DROP;
+              goto trace0;
+            }
 
           t0 = pool_elt_at_index (vxm->tunnels, tunnel_index0);
 
@@ -249,49 +309,12 @@ vxlan_input (vlib_main_t * vm,
               tr->vni = vnet_get_vni (vxlan0);
             }
 
-
-          if (is_ip4) {
-            key4_1.src = ip4_1->src_address.as_u32;
-            key4_1.vni = vxlan1->vni_reserved;
-
-            if (PREDICT_FALSE (key4_1.as_u64 != last_key4.as_u64))
-              {
-                p1 = hash_get (vxm->vxlan4_tunnel_by_key, key4_1.as_u64);
-
-                if (p1 == 0)
-                  {
-                    error1 = VXLAN_ERROR_NO_SUCH_TUNNEL;
-                    next1 = VXLAN_INPUT_NEXT_DROP;
-                    goto trace1;
-                  }
-
-                last_key4.as_u64 = key4_1.as_u64;
-                tunnel_index1 = last_tunnel_index = p1[0];
-              }
-            else
-              tunnel_index1 = last_tunnel_index;
-          } else /* !is_ip4 */ {
-            key6_1.src.as_u64[0] = ip6_1->src_address.as_u64[0];
-            key6_1.src.as_u64[1] = ip6_1->src_address.as_u64[1];
-            key6_1.vni = vxlan1->vni_reserved;
-
-            if (PREDICT_FALSE (memcmp(&key6_1, &last_key6, sizeof(last_key6)) != 0))
-              {
-                p1 = hash_get_mem (vxm->vxlan6_tunnel_by_key, &key6_1);
-
-                if (p1 == 0)
-                  {
-                    error1 = VXLAN_ERROR_NO_SUCH_TUNNEL;
-                    next1 = VXLAN_INPUT_NEXT_DROP;
-                    goto trace1;
-                  }
-
-                clib_memcpy (&last_key6, &key6_1, sizeof(key6_1));
-                tunnel_index1 = last_tunnel_index = p1[0];
-              }
-            else
-              tunnel_index1 = last_tunnel_index;
-          }
+          if (PREDICT_FALSE (tunnel_index1 == ~0))
+            {
+              error1 = VXLAN_ERROR_NO_SUCH_TUNNEL;
+              next1 = VXLAN_INPUT_NEXT_DROP;
+              goto trace1;
+            }
 
           t1 = pool_elt_at_index (vxm->tunnels, tunnel_index1);
 
@@ -352,15 +375,13 @@ vxlan_input (vlib_main_t * vm,
           ip4_header_t * ip4_0;
           ip6_header_t * ip6_0;
           vxlan_header_t * vxlan0;
-	  uword * p0;
           u32 tunnel_index0;
           vxlan_tunnel_t * t0;
-          vxlan4_tunnel_key_t key4_0;
-          vxlan6_tunnel_key_t key6_0;
           u32 error0;
 	  u32 sw_if_index0, len0;
 
 	  bi0 = from[0];
+          k = &keys[from - from0];
 	  to_next[0] = bi0;
 	  from += 1;
 	  to_next += 1;
@@ -369,6 +390,13 @@ vxlan_input (vlib_main_t * vm,
 
 	  b0 = vlib_get_buffer (vm, bi0);
 
+          /* tail of the frame may not have been hashed by the dual loop */
+          if (n_hashed <= (u32) (k - keys))
+            {
+              vxlan_decap_key_hash (vxm, b0, k, is_ip4);
+              n_hashed = (k - keys) + 1;
+            }
+
           /* udp leaves current_data pointing at the vxlan header */
           vxlan0 = vlib_buffer_get_current (b0);
 
@@ -391,51 +419,16 @@ vxlan_input (vlib_main_t * vm,
               (b0, sizeof(*ip6_0)+sizeof(udp_header_t)+sizeof(*vxlan0));
           }
 
-          tunnel_index0 = ~0;
           error0 = 0;
 
-          if (is_ip4) {
-            key4_0.src = ip4_0->src_address.as_u32;
-            key4_0.vni = vxlan0->vni_reserved;
-
-            if (PREDICT_FALSE (key4_0.as_u64 != last_key4.as_u64))
-              {
-                p0 = hash_get (vxm->vxlan4_tunnel_by_key, key4_0.as_u64);
-
-                if (p0 == 0)
-                  {
-                    error0 = VXLAN_ERROR_NO_SUCH_TUNNEL;
-                    next0 = VXLAN_INPUT_NEXT_DROP;
-                    goto trace00;
-                  }
-
-                last_key4.as_u64 = key4_0.as_u64;
-                tunnel_index0 = last_tunnel_index = p0[0];
-              }
-            else
-              tunnel_index0 = last_tunnel_index;
-          } else /* !is_ip4 */ {
-            key6_0.src.as_u64[0] = ip6_0->src_address.as_u64[0];
-            key6_0.src.as_u64[1] = ip6_0->src_address.as_u64[1];
-            key6_0.vni = vxlan0->vni_reserved;
-
-            if (PREDICT_FALSE (memcmp(&key6_0, &last_key6, sizeof(last_key6)) != 0))
-              {
-                p0 = hash_get_mem (vxm->vxlan6_tunnel_by_key, &key6_0);
-
-                if (p0 == 0)
-                  {
-                    error0 = VXLAN_ERROR_NO_SUCH_TUNNEL;
-                    next0 = VXLAN_INPUT_NEXT_DROP;
-                    goto trace00;
-                  }
+          tunnel_index0 = vxlan_decap_key_search (vxm, k, is_ip4);
 
-                clib_memcpy (&last_key6, &key6_0, sizeof(key6_0));
-                tunnel_index0 = last_tunnel_index = p0[0];
-              }
-            else
-              tunnel_index0 = last_tunnel_index;
-          }
+          if (PREDICT_FALSE (tunnel_index0 == ~0))
+            {
+              error0 = VXLAN_ERROR_NO_SUCH_TUNNEL;
+              next0 = VXLAN_INPUT_NEXT_DROP;
+              goto trace00;
+            }
 
           t0 = pool_elt_at_index (vxm->tunnels, tunnel_index0);
 
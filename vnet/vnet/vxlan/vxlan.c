@@ -201,31 +201,42 @@ int vnet_vxlan_add_del_tunnel
   ip4_main_t * im4 = &ip4_main;
   ip6_main_t * im6 = &ip6_main;
   vnet_hw_interface_t * hi;
-  uword * p;
   u32 hw_if_index = ~0;
   u32 sw_if_index = ~0;
-  int rv;
+  int rv, found;
   vxlan4_tunnel_key_t key4;
   vxlan6_tunnel_key_t key6;
+  clib_bihash_kv_8_8_t kv4;
+  clib_bihash_kv_24_8_t kv6;
+  u32 tunnel_index = ~0;
   l2output_main_t * l2om = &l2output_main;
 
   if (!a->is_ip6) {
     key4.src = a->dst.ip4.as_u32; /* decap src in key is encap dst in config */
     key4.vni = clib_host_to_net_u32 (a->vni << 8);
-  
-    p = hash_get (vxm->vxlan4_tunnel_by_key, key4.as_u64);
+
+    kv4.key = key4.as_u64;
+    found = !clib_bihash_search_8_8 (&vxm->vxlan4_tunnel_by_key, &kv4, &kv4);
+    if (found)
+      tunnel_index = kv4.value;
   } else {
     key6.src.as_u64[0] = a->dst.ip6.as_u64[0];
     key6.src.as_u64[1] = a->dst.ip6.as_u64[1];
     key6.vni = clib_host_to_net_u32 (a->vni << 8);
-
-    p = hash_get_mem (vxm->vxlan6_tunnel_by_key, &key6);
+    key6.pad = 0;
+
+    kv6.key[0] = key6.as_u64[0];
+    kv6.key[1] = key6.as_u64[1];
+    kv6.key[2] = key6.as_u64[2];
+    found = !clib_bihash_search_24_8 (&vxm->vxlan6_tunnel_by_key, &kv6, &kv6);
+    if (found)
+      tunnel_index = kv6.value;
   }
   
   if (a->is_add)
     {
       /* adding a tunnel: tunnel must not already exist */
-      if (p)
+      if (found)
         return VNET_API_ERROR_TUNNEL_EXIST;
 
       if (a->decap_next_index == ~0)
@@ -244,17 +255,6 @@ int vnet_vxlan_add_del_tunnel
       else            foreach_copy_ipv6
 #undef _
       
-      /* copy the key */
-      if (a->is_ip6)
-        {
-          t->key6 = clib_mem_alloc (sizeof(vxlan6_tunnel_key_t));
-          clib_memcpy (t->key6, &key6, sizeof(key6));
-        }
-      else
-        {
-          t->key4 = 0; /* not yet used */
-        }
-
       if (!a->is_ip6) t->flags |= VXLAN_TUNNEL_IS_IPV4;
 
       if (!a->is_ip6) {
@@ -270,9 +270,18 @@ int vnet_vxlan_add_del_tunnel
         }
 
       if (!a->is_ip6)
-        hash_set (vxm->vxlan4_tunnel_by_key, key4.as_u64, t - vxm->tunnels);
+        {
+          kv4.key = key4.as_u64;
+          kv4.value = t - vxm->tunnels;
+          clib_bihash_add_del_8_8 (&vxm->vxlan4_tunnel_by_key, &kv4,
+                                   1 /* is_add */);
+        }
       else
-        hash_set_mem (vxm->vxlan6_tunnel_by_key, t->key6, t - vxm->tunnels);
+        {
+          kv6.value = t - vxm->tunnels;
+          clib_bihash_add_del_24_8 (&vxm->vxlan6_tunnel_by_key, &kv6,
+                                    1 /* is_add */);
+        }
       
       if (vec_len (vxm->free_vxlan_tunnel_hw_if_indices) > 0)
         {
@@ -341,10 +350,10 @@ int vnet_vxlan_add_del_tunnel
   else
     {
       /* deleting a tunnel: tunnel must exist */
-      if (!p) 
+      if (!found)
         return VNET_API_ERROR_NO_SUCH_ENTRY;
 
-      t = pool_elt_at_index (vxm->tunnels, p[0]);
+      t = pool_elt_at_index (vxm->tunnels, tunnel_index);
 
       vnet_sw_interface_set_flags (vnm, t->sw_if_index, 0 /* down */);
       /* make sure tunnel is removed from l2 bd or xconnect */
@@ -358,9 +367,11 @@ int vnet_vxlan_add_del_tunnel
         = L2OUTPUT_NEXT_DEL_TUNNEL;
 
       if (!a->is_ip6)
-        hash_unset (vxm->vxlan4_tunnel_by_key, key4.as_u64);
+        clib_bihash_add_del_8_8 (&vxm->vxlan4_tunnel_by_key, &kv4,
+                                 0 /* is_add */);
       else
-        hash_unset_mem (vxm->vxlan6_tunnel_by_key, t->key6);
+        clib_bihash_add_del_24_8 (&vxm->vxlan6_tunnel_by_key, &kv6,
+                                  0 /* is_add */);
 
       vec_free (t->rewrite);
       pool_put (vxm->tunnels, t);
@@ -585,10 +596,10 @@ clib_error_t *vxlan_init (vlib_main_t *vm)
   vxm->vnet_main = vnet_get_main();
   vxm->vlib_main = vm;
 
-  /* initialize the ip6 hash */
-  vxm->vxlan6_tunnel_by_key = hash_create_mem(0,
-        sizeof(vxlan6_tunnel_key_t),
-        sizeof(uword));
+  clib_bihash_init_8_8 (&vxm->vxlan4_tunnel_by_key, "vxlan4 tunnels",
+                        VXLAN_HASH_NUM_BUCKETS, VXLAN_HASH_MEMORY_SIZE);
+  clib_bihash_init_24_8 (&vxm->vxlan6_tunnel_by_key, "vxlan6 tunnels",
+                         VXLAN_HASH_NUM_BUCKETS, VXLAN_HASH_MEMORY_SIZE);
 
   udp_register_dst_port (vm, UDP_DST_PORT_vxlan, 
                          vxlan4_input_node.index, /* is_ip4 */ 1);
@@ -17,6 +17,8 @@
 
 #include <vppinfra/error.h>
 #include <vppinfra/hash.h>
+#include <vppinfra/bihash_8_8.h>
+#include <vppinfra/bihash_24_8.h>
 #include <vnet/vnet.h>
 #include <vnet/ip/ip.h>
 #include <vnet/l2/l2_input.h>
@@ -59,8 +61,14 @@ typedef CLIB_PACKED(struct {
    * Key fields: ip src and vxlan vni on incoming VXLAN packet
    * all fields in NET byte order
    */
-  ip6_address_t src;
-  u32 vni;                 /* shifted left 8 bits */
+  union {
+    struct {
+      ip6_address_t src;
+      u32 vni;                 /* shifted left 8 bits */
+      u32 pad;                 /* always zero */
+    };
+    u64 as_u64[3];
+  };
 }) vxlan6_tunnel_key_t;
 
 typedef struct {
@@ -84,11 +92,6 @@ typedef struct {
   u16 hw_if_index;
   u32 sw_if_index;
 
-  union { /* storage for the hash key */
-    vxlan4_tunnel_key_t *key4;
-    vxlan6_tunnel_key_t *key6;
-  };
-
   /* flags */
   u32 flags;
 } vxlan_tunnel_t;
@@ -116,13 +119,16 @@ typedef enum {
   VXLAN_N_ERROR,
 } vxlan_input_error_t;
 
+#define VXLAN_HASH_NUM_BUCKETS (64 * 1024)
+#define VXLAN_HASH_MEMORY_SIZE (32<<20)
+
 typedef struct {
   /* vector of encap tunnel instances */
   vxlan_tunnel_t *tunnels;
 
-  /* lookup tunnel by key */
-  uword * vxlan4_tunnel_by_key; /* keyed on ipv4.dst + vni */
-  uword * vxlan6_tunnel_by_key; /* keyed on ipv6.dst + vni */
+  /* lookup tunnel by key, value is the tunnel index */
+  clib_bihash_8_8_t vxlan4_tunnel_by_key;  /* keyed on ipv4.src + vni */
+  clib_bihash_24_8_t vxlan6_tunnel_by_key; /* keyed on ipv6.src + vni */
 
   /* Free vlib hw_if_indices */
   u32 * free_vxlan_tunnel_hw_if_indices;
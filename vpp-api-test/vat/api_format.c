@@ -9378,6 +9378,8 @@ api_ipsec_sad_add_del_entry (vat_main_t * vam)
 
     u8 protocol = IPSEC_PROTOCOL_AH;
     u8 is_tunnel = 0, is_tunnel_ipv6 = 0;
+    u8 use_esn = 0, use_anti_replay = 0;
+    u32 replay_window_size = 0;
     u32 crypto_alg = 0, integ_alg = 0;
     ip4_address_t tun_src4;
     ip4_address_t tun_dst4;
@@ -9429,6 +9431,12 @@ api_ipsec_sad_add_del_entry (vat_main_t * vam)
         }
         else if (unformat (i, "integ_key %U", unformat_hex_string, &ik))
             ;
+        else if (unformat (i, "esn"))
+            use_esn = 1;
+        else if (unformat (i, "anti_replay"))
+            use_anti_replay = 1;
+        else if (unformat (i, "replay_window %d", &replay_window_size))
+            use_anti_replay = 1;
         else {
             clib_warning ("parse error '%U'", format_unformat_error, i);
             return -99;
@@ -9444,6 +9452,9 @@ api_ipsec_sad_add_del_entry (vat_main_t * vam)
     mp->spi = ntohl(spi);
     mp->is_tunnel = is_tunnel;
     mp->is_tunnel_ipv6 = is_tunnel_ipv6;
+    mp->use_extended_sequence_number = use_esn;
+    mp->use_anti_replay = use_anti_replay;
+    mp->replay_window_size = ntohl(replay_window_size);
     mp->crypto_algorithm = crypto_alg;
     mp->integrity_algorithm = integ_alg;
     mp->crypto_key_length = vec_len(ck);
@@ -12556,7 +12567,8 @@ _(ipsec_interface_add_del_spd, "(<intfc> | sw_if_index <id>)\n"         \
   "  spid_id <n> ")                                                     \
 _(ipsec_sad_add_del_entry, "sad_id <n> spi <n> crypto_alg <alg>\n"      \
   "  crypto_key <hex> tunnel_src <ip4|ip6> tunnel_dst <ip4|ip6>\n"      \
-  "  integ_alg <alg> integ_key <hex>")                                  \
+  "  integ_alg <alg> integ_key <hex> [esn] [anti_replay]\n"             \
+  "  [replay_window <bits>]")                                           \
 _(ipsec_spd_add_del_entry, "spd_id <n> priority <n> action <action>\n"  \
   "  (inbound|outbound) [sa_id <n>] laddr_start <ip4|ip6>\n"            \
   "  laddr_stop <ip4|ip6> raddr_start <ip4|ip6> raddr_stop <ip4|ip6>\n" \
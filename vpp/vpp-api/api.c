@@ -77,6 +77,9 @@
 #include <vnet/cop/cop.h>
 #include <vnet/ip/ip6_hop_by_hop.h>
 #include <vnet/devices/af_packet/af_packet.h>
+#if AF_XDP > 0
+#include <vnet/devices/af_xdp/af_xdp.h>
+#endif
 #include <vnet/policer/policer.h>
 #include <vnet/devices/netmap/netmap.h>
 #include <vnet/flow/flow_report.h>
@@ -288,6 +291,7 @@ _(L2_INTERFACE_VLAN_TAG_REWRITE, l2_interface_vlan_tag_rewrite)         \
 _(CREATE_VHOST_USER_IF, create_vhost_user_if)                           \
 _(MODIFY_VHOST_USER_IF, modify_vhost_user_if)                           \
 _(DELETE_VHOST_USER_IF, delete_vhost_user_if)                           \
+_(VHOST_USER_RX_PLACEMENT, vhost_user_rx_placement)                     \
 _(SW_INTERFACE_VHOST_USER_DUMP, sw_interface_vhost_user_dump)           \
 _(IP_ADDRESS_DUMP, ip_address_dump)                                     \
 _(IP_DUMP, ip_dump)                                                     \
@@ -350,6 +354,8 @@ _(LISP_GET_MAP_REQUEST_ITR_RLOCS, lisp_get_map_request_itr_rlocs)       \
 _(SR_MULTICAST_MAP_ADD_DEL, sr_multicast_map_add_del)                   \
 _(AF_PACKET_CREATE, af_packet_create)                                   \
 _(AF_PACKET_DELETE, af_packet_delete)                                   \
+_(AF_XDP_CREATE, af_xdp_create)                                         \
+_(AF_XDP_DELETE, af_xdp_delete)                                         \
 _(POLICER_ADD_DEL, policer_add_del)                                     \
 _(POLICER_DUMP, policer_dump)                                           \
 _(NETMAP_CREATE, netmap_create)                                         \
@@ -3851,6 +3857,26 @@ vl_api_delete_vhost_user_if_t_handler (vl_api_delete_vhost_user_if_t *mp)
 #endif
 }
 
+static void
+vl_api_vhost_user_rx_placement_t_handler (vl_api_vhost_user_rx_placement_t *mp)
+{
+#if DPDK > 0
+    int rv = 0;
+    vl_api_vhost_user_rx_placement_reply_t * rmp;
+    vnet_main_t * vnm = vnet_get_main();
+    dpdk_main_t * dm = &dpdk_main;
+
+    if (!dm->conf->use_virtio_vhost)
+      rv = VNET_API_ERROR_UNIMPLEMENTED;
+    else
+      rv = vhost_user_set_rx_placement (vnm, ntohl(mp->sw_if_index),
+                                        ntohl(mp->queue_id),
+                                        ntohl(mp->worker_index));
+
+    REPLY_MACRO(VL_API_VHOST_USER_RX_PLACEMENT_REPLY);
+#endif
+}
+
 static void vl_api_sw_interface_vhost_user_details_t_handler (
     vl_api_sw_interface_vhost_user_details_t * mp)
 {
@@ -5804,6 +5830,12 @@ static void vl_api_ipsec_sad_add_del_entry_t_handler
     sa.integ_key_len = mp->integrity_key_length;
     clib_memcpy(&sa.integ_key, mp->integrity_key, sizeof(sa.integ_key));
     sa.use_esn = mp->use_extended_sequence_number;
+    sa.use_anti_replay = mp->use_anti_replay;
+    sa.replay_window_size = ntohl(mp->replay_window_size);
+    if (sa.replay_window_size > IPSEC_REPLAY_WINDOW_MAX) {
+        rv = VNET_API_ERROR_INVALID_VALUE;
+        goto out;
+    }
     sa.is_tunnel = mp->is_tunnel;
     sa.is_tunnel_ip6 = mp->is_tunnel_ipv6;
     if (sa.is_tunnel_ip6) {
@@ -6280,7 +6312,8 @@ vl_api_af_packet_create_t_handler
     vec_add1 (host_if_name, 0);
 
     rv = af_packet_create_if(vm, host_if_name,
-                             mp->use_random_hw_addr ? 0 : mp->hw_addr, &sw_if_index);
+                             mp->use_random_hw_addr ? 0 : mp->hw_addr,
+                             1 /* n_queues */, &sw_if_index);
 
     vec_free(host_if_name);
 
@@ -6307,6 +6340,58 @@ vl_api_af_packet_delete_t_handler
     REPLY_MACRO(VL_API_AF_PACKET_DELETE_REPLY);
 }
 
+static void
+vl_api_af_xdp_create_t_handler
+(vl_api_af_xdp_create_t *mp)
+{
+    vl_api_af_xdp_create_reply_t *rmp;
+    int rv = 0;
+    u32 sw_if_index = ~0;
+
+#if AF_XDP > 0
+    vlib_main_t *vm = vlib_get_main();
+    u8 *host_if_name = NULL;
+
+    host_if_name = format(0, "%s", mp->host_if_name);
+    vec_add1 (host_if_name, 0);
+
+    rv = af_xdp_create_if(vm, host_if_name,
+                          mp->use_random_hw_addr ? 0 : mp->hw_addr,
+                          ntohl(mp->n_queues), mp->is_copy, &sw_if_index);
+
+    vec_free(host_if_name);
+#else
+    rv = VNET_API_ERROR_UNIMPLEMENTED;
+#endif
+
+    REPLY_MACRO2(VL_API_AF_XDP_CREATE_REPLY,
+		 rmp->sw_if_index = clib_host_to_net_u32(sw_if_index));
+}
+
+static void
+vl_api_af_xdp_delete_t_handler
+(vl_api_af_xdp_delete_t *mp)
+{
+    vl_api_af_xdp_delete_reply_t *rmp;
+    int rv = 0;
+
+#if AF_XDP > 0
+    vlib_main_t * vm = vlib_get_main();
+    u8 *host_if_name = NULL;
+
+    host_if_name = format(0, "%s", mp->host_if_name);
+    vec_add1 (host_if_name, 0);
+
+    rv = af_xdp_delete_if(vm, host_if_name);
+
+    vec_free(host_if_name);
+#else
+    rv = VNET_API_ERROR_UNIMPLEMENTED;
+#endif
+
+    REPLY_MACRO(VL_API_AF_XDP_DELETE_REPLY);
+}
+
 static void
 vl_api_policer_add_del_t_handler
 (vl_api_policer_add_del_t *mp)
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2016 Cisco and/or its affiliates.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#undef BIHASH_TYPE
+
+#define BIHASH_TYPE _48_8
+#define BIHASH_KVP_PER_PAGE 4
+
+#ifndef __included_bihash_48_8_h__
+#define __included_bihash_48_8_h__
+
+#include <vppinfra/heap.h>
+#include <vppinfra/format.h>
+#include <vppinfra/pool.h>
+#include <vppinfra/xxhash.h>
+
+typedef struct {
+  u64 key[6];
+  u64 value;
+} clib_bihash_kv_48_8_t;
+
+static inline int clib_bihash_is_free_48_8 (clib_bihash_kv_48_8_t *v)
+{
+  /* Free values are memset to 0xff, check a bit... */
+  if (v->key[0] == ~0ULL && v->value == ~0ULL)
+    return 1;
+  return 0;
+}
+
+#if __SSE4_2__ && defined (__x86_64__)
+static inline u64
+crc_u64_48_8 (u64 data, u64 value)
+{
+  __asm__ volatile( "crc32q %[data], %[value];"
+                    : [value] "+r" (value)
+                    : [data] "rm" (data));
+  return value;
+}
+
+static inline u64 clib_bihash_hash_48_8  (clib_bihash_kv_48_8_t *v)
+{
+  u64 value = 0;
+
+  value = crc_u64_48_8 (v->key[0], value);
+  value = crc_u64_48_8 (v->key[1], value);
+  value = crc_u64_48_8 (v->key[2], value);
+  value = crc_u64_48_8 (v->key[3], value);
+  value = crc_u64_48_8 (v->key[4], value);
+  value = crc_u64_48_8 (v->key[5], value);
+
+  return value;
+}
+#else
+static inline u64 clib_bihash_hash_48_8  (clib_bihash_kv_48_8_t *v)
+{
+  /* Chained, so keys with swapped words (src / dst) don't collide */
+  u64 tmp = v->key[0];
+  int i;
+
+  for (i = 1; i < ARRAY_LEN (v->key); i++)
+    tmp = clib_xxhash (tmp) ^ v->key[i];
+  return clib_xxhash (tmp);
+}
+#endif
+
+static inline u8 * format_bihash_kvp_48_8 (u8 * s, va_list * args)
+{
+  clib_bihash_kv_48_8_t * v = va_arg (*args, clib_bihash_kv_48_8_t *);
+
+  s = format (s, "key %llu %llu %llu %llu %llu %llu value %llu",
+              v->key[0], v->key[1], v->key[2],
+              v->key[3], v->key[4], v->key[5], v->value);
+  return s;
+}
+
+static inline int clib_bihash_key_compare_48_8 (u64 * a, u64 * b)
+{
+  return ((a[0]^b[0]) | (a[1]^b[1]) | (a[2]^b[2]) |
+          (a[3]^b[3]) | (a[4]^b[4]) | (a[5]^b[5])) == 0;
+}
+#undef __included_bihash_template_h__
+#include <vppinfra/bihash_template.h>
+
+#endif /* __included_bihash_48_8_h__ */
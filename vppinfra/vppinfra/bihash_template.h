@@ -121,17 +121,50 @@ format_function_t BV(format_bihash);
 format_function_t BV(format_bihash_kvp);
 
 
-static inline int BV(clib_bihash_search_inline) 
-    (BVT(clib_bihash) * h, BVT(clib_bihash_kv) * kvp)
+/*
+ * Split lookup: compute BV(clib_bihash_hash) early, prefetch the bucket, then
+ * (once the bucket has arrived) prefetch the value page, and finally
+ * search. Lets dual / quad loops hide bucket and page cache misses.
+ */
+static inline void BV(clib_bihash_prefetch_bucket)
+    (BVT(clib_bihash) * h, u64 hash)
+{
+  u32 bucket_index = hash & (h->nbuckets-1);
+
+  CLIB_PREFETCH (&h->buckets[bucket_index], CLIB_CACHE_LINE_BYTES, LOAD);
+}
+
+static inline void BV(clib_bihash_prefetch_data)
+    (BVT(clib_bihash) * h, u64 hash)
 {
-  u64 hash;
   u32 bucket_index;
   uword value_index;
   BVT(clib_bihash_value) * v;
   clib_bihash_bucket_t * b;
-  int i;
 
-  hash = BV(clib_bihash_hash) (kvp);
+  bucket_index = hash & (h->nbuckets-1);
+  b = &h->buckets[bucket_index];
+
+  if (b->offset == 0)
+    return;
+
+  hash >>= h->log2_nbuckets;
+
+  v = BV(clib_bihash_get_value) (h, b->offset);
+  value_index = hash & ((1<<b->log2_pages)-1);
+  v += value_index;
+
+  CLIB_PREFETCH (v, sizeof (v[0]), LOAD);
+}
+
+static inline int BV(clib_bihash_search_inline_with_hash)
+    (BVT(clib_bihash) * h, u64 hash, BVT(clib_bihash_kv) * kvp)
+{
+  u32 bucket_index;
+  uword value_index;
+  BVT(clib_bihash_value) * v;
+  clib_bihash_bucket_t * b;
+  int i;
 
   bucket_index = hash & (h->nbuckets-1);
   b = &h->buckets[bucket_index];
@@ -156,6 +189,13 @@ static inline int BV(clib_bihash_search_inline)
   return -1;
 }
 
+static inline int BV(clib_bihash_search_inline) 
+    (BVT(clib_bihash) * h, BVT(clib_bihash_kv) * kvp)
+{
+  return BV(clib_bihash_search_inline_with_hash)
+    (h, BV(clib_bihash_hash) (kvp), kvp);
+}
+
 static inline int BV(clib_bihash_search_inline_2) 
      (BVT(clib_bihash) * h, 
       BVT(clib_bihash_kv) *search_key,
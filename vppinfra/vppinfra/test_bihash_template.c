@@ -16,7 +16,12 @@
 #include <vppinfra/cache.h>
 #include <vppinfra/error.h>
 
+/* Built once per key width, see Makefile.am */
+#ifdef BIHASH_TEST_48_8
+#include <vppinfra/bihash_48_8.h>
+#else
 #include <vppinfra/bihash_8_8.h>
+#endif
 #include <vppinfra/bihash_template.h>
 
 #include <vppinfra/bihash_template.c>
@@ -45,6 +50,99 @@ uword vl (void * v)
     return vec_len (v);
 }
 
+/* Wide keys carry the test key in the last word, so that search has to
+   compare all of them */
+static inline void
+test_bihash_set_key (BVT(clib_bihash_kv) * kv, u64 key)
+{
+#ifdef BIHASH_TEST_48_8
+  int i;
+
+  for (i = 0; i < ARRAY_LEN (kv->key) - 1; i++)
+    kv->key[i] = 0x0123456789abcdefULL + i;
+  kv->key[i] = key;
+#else
+  kv->key = key;
+#endif
+}
+
+/*
+ * Search with the split lookup API, staged the way the graph nodes use
+ * it: hash and prefetch the bucket two keys ahead, prefetch the value
+ * page one key ahead, then search with the saved hash.
+ */
+static clib_error_t * test_bihash_split_search (test_main_t * tm)
+{
+  BVT(clib_bihash) * h = &tm->hash;
+  BVT(clib_bihash_kv) kv, * kvs = 0;
+  u64 * hashes = 0;
+  uword total_searches;
+  f64 before, delta;
+  int i, j;
+
+  fformat (stdout, "Split search for items %d times...\n", tm->search_iter);
+
+  vec_validate (kvs, tm->nitems - 1);
+  vec_validate (hashes, tm->nitems - 1);
+
+  before = clib_time_now (&tm->clib_time);
+
+  for (j = 0; j < tm->search_iter; j++)
+    {
+      for (i = 0; i < tm->nitems + 2; i++)
+        {
+          if (i < tm->nitems)
+            {
+              test_bihash_set_key (&kvs[i], tm->keys[i]);
+              hashes[i] = BV(clib_bihash_hash) (&kvs[i]);
+              BV(clib_bihash_prefetch_bucket) (h, hashes[i]);
+            }
+          if (i >= 1 && i - 1 < tm->nitems)
+            BV(clib_bihash_prefetch_data) (h, hashes[i - 1]);
+          if (i < 2)
+            continue;
+
+          kv = kvs[i - 2];
+          if (BV(clib_bihash_search_inline_with_hash)
+              (h, hashes[i - 2], &kv) < 0)
+            return clib_error_return (0, "split search for key %lld failed",
+                                      tm->keys[i - 2]);
+          if (kv.value != (u64)(i - 1))
+            return clib_error_return (0, "split search for key %lld "
+                                      "returned %lld, not %lld",
+                                      tm->keys[i - 2], kv.value,
+                                      (u64)(i - 1));
+        }
+    }
+
+  delta = clib_time_now (&tm->clib_time) - before;
+  total_searches = (uword)tm->search_iter * (uword) tm->nitems;
+
+  if (delta > 0)
+    fformat (stdout, "%.f searches per second\n",
+             ((f64)total_searches) / delta);
+
+  fformat (stdout, "%lld searches in %.6f seconds\n", total_searches, delta);
+
+  /* Keys that were never added must miss, and agree with the plain search */
+  for (i = 0; i < tm->nitems; i++)
+    {
+      u64 absent = tm->keys[i] ^ 1;
+
+      if (hash_get (tm->key_hash, absent))
+        continue;
+      test_bihash_set_key (&kv, absent);
+      if (BV(clib_bihash_search_inline_with_hash)
+          (h, BV(clib_bihash_hash) (&kv), &kv) >= 0)
+        return clib_error_return (0, "split search for absent key %lld "
+                                  "succeeded", absent);
+    }
+
+  vec_free (kvs);
+  vec_free (hashes);
+  return 0;
+}
+
 static clib_error_t * test_bihash (test_main_t * tm)
 {
   int i, j;
@@ -53,6 +151,7 @@ static clib_error_t * test_bihash (test_main_t * tm)
   f64 before, delta;
   BVT(clib_bihash) * h;
   BVT(clib_bihash_kv) kv;
+  clib_error_t * error;
 
   h = &tm->hash;
 
@@ -85,7 +184,7 @@ static clib_error_t * test_bihash (test_main_t * tm)
   fformat (stdout, "Add items...\n");
   for (i = 0; i < tm->nitems; i++)
     {
-      kv.key = tm->keys[i];
+      test_bihash_set_key (&kv, tm->keys[i]);
       kv.value = i+1;
 
       BV(clib_bihash_add_del) (h, &kv, 1 /* is_add */);
@@ -131,7 +230,7 @@ static clib_error_t * test_bihash (test_main_t * tm)
               hash1 = hash2;
             }
 
-          kv.key = tm->keys[i];
+          test_bihash_set_key (&kv, tm->keys[i]);
           if (BV(clib_bihash_search) (h, &kv, &kv) < 0)
             clib_warning ("search for key %lld failed unexpectedly\n", 
                           tm->keys[i]);
@@ -150,6 +249,10 @@ static clib_error_t * test_bihash (test_main_t * tm)
 
   fformat (stdout, "%lld searches in %.6f seconds\n", total_searches, delta);
 
+  error = test_bihash_split_search (tm);
+  if (error)
+    return error;
+
   fformat (stdout, "Standard E-hash search for items %d times...\n", 
            tm->search_iter);
 
@@ -181,7 +284,7 @@ static clib_error_t * test_bihash (test_main_t * tm)
       int j;
       int rv;
 
-      kv.key = tm->keys[i];
+      test_bihash_set_key (&kv, tm->keys[i]);
       kv.value = (u64)(i+1);
       rv = BV(clib_bihash_add_del) (h, &kv,  0 /* is_add */);
 
@@ -193,7 +296,7 @@ static clib_error_t * test_bihash (test_main_t * tm)
         {
           for (j = 0; j < tm->nitems; j++)
             {
-              kv.key = tm->keys[j];
+              test_bihash_set_key (&kv, tm->keys[j]);
               rv = BV(clib_bihash_search) (h, &kv, &kv);
               if (j <= i && rv >= 0)
                 {